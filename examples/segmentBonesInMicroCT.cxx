@@ -6,8 +6,7 @@
 #include "itkImageFileWriter.h"
 #include "itkMedianImageFilter.h"
 #include "itkBinaryThresholdImageFilter.h"
-#include "itkConnectedComponentImageFilter.h"
-#include "itkRelabelComponentImageFilter.h"
+#include "itkParallelConnectedComponentImageFilter.h"
 #include "itkSignedMaurerDistanceMapImageFilter.h"
 #include "itkNotImageFilter.h"
 #include "itkSmoothingRecursiveGaussianImageFilter.h"
@@ -17,10 +16,12 @@
 #include "itkNeighborhoodConnectedImageFilter.h"
 #include "itkConstantPadImageFilter.h"
 #include "itkBinaryFillholeImageFilter.h"
+#include "itkStageProfile.h"
 
 
-auto     startTime = std::chrono::steady_clock::now();
-unsigned runDebugLevel = 0;
+auto                      startTime = std::chrono::steady_clock::now();
+unsigned                  runDebugLevel = 0;
+itk::StageProfile::Pointer profile; // wall time, processor time and memory of the stages, printed at the end
 
 template <typename TImage>
 void
@@ -63,24 +64,17 @@ connectedComponentAnalysis(itk::SmartPointer<TImage> labelImage,
                            itk::IdentifierType &     numLabels,
                            unsigned                  debugLevel)
 {
-  using ManyLabelImageType = itk::Image<itk::SizeValueType, TImage::ImageDimension>;
-  using LabelerType = itk::ConnectedComponentImageFilter<TImage, ManyLabelImageType>;
+  using LabelerType = itk::ParallelConnectedComponentImageFilter<TImage, TImage>;
   typename LabelerType::Pointer labeler = LabelerType::New();
   labeler->SetInput(labelImage);
+  labeler->SetMinimumObjectSize(1000);
   static unsigned invocationCount = 0;
   UpdateAndWrite(
-    labeler->GetOutput(), outFilename + std::to_string(invocationCount) + "-cc-label.nrrd", true, debugLevel + 1);
-
-  using RelabelType = itk::RelabelComponentImageFilter<ManyLabelImageType, TImage>;
-  typename RelabelType::Pointer relabeler = RelabelType::New();
-  relabeler->SetInput(labeler->GetOutput());
-  relabeler->SetMinimumObjectSize(1000);
-  UpdateAndWrite(
-    relabeler->GetOutput(), outFilename + std::to_string(invocationCount) + "-ccR-label.nrrd", true, debugLevel);
+    labeler->GetOutput(), outFilename + std::to_string(invocationCount) + "-ccR-label.nrrd", true, debugLevel);
   ++invocationCount;
 
-  numLabels = relabeler->GetNumberOfObjects();
-  return relabeler->GetOutput();
+  numLabels = labeler->GetObjectCount();
+  return labeler->GetOutput();
 }
 
 // signed distance field
@@ -194,6 +188,7 @@ mainProcessing(typename ImageType::ConstPointer inImage,
 
   typename LabelImageType::Pointer gaussLabel;
   {
+    itk::StageProfile::Scope stage(profile, "gauss");
     using GaussType = itk::SmoothingRecursiveGaussianImageFilter<ImageType>;
     typename GaussType::Pointer gaussF = GaussType::New();
     gaussF->SetInput(inImage);
@@ -209,6 +204,7 @@ mainProcessing(typename ImageType::ConstPointer inImage,
 
   typename LabelImageType::Pointer descoLabel;
   {
+    itk::StageProfile::Scope stage(profile, "hessian");
     using MultiScaleHessianFilterType = itk::MultiScaleHessianEnhancementImageFilter<ImageType, RealImageType>;
     using EigenValueImageType = typename MultiScaleHessianFilterType::EigenValueImageType;
     using DescoteauxEigenToScalarImageFilterType =
@@ -234,39 +230,45 @@ mainProcessing(typename ImageType::ConstPointer inImage,
     descoLabel = descoTh->GetOutput();
   }
 
-
-  typename BinaryThresholdType::Pointer binTh = BinaryThresholdType::New();
-  binTh->SetInput(inImage);
-  binTh->SetLowerThreshold(5000); // start from a high threshold, so bones are well separated
-  UpdateAndWrite(binTh->GetOutput(), outFilename + "-bin1-label.nrrd", true, 2);
-  typename LabelImageType::Pointer thLabel = binTh->GetOutput();
+  typename LabelImageType::Pointer thLabel;
+  {
+    itk::StageProfile::Scope stage(profile, "threshold");
+    typename BinaryThresholdType::Pointer binTh = BinaryThresholdType::New();
+    binTh->SetInput(inImage);
+    binTh->SetLowerThreshold(5000); // start from a high threshold, so bones are well separated
+    UpdateAndWrite(binTh->GetOutput(), outFilename + "-bin1-label.nrrd", true, 2);
+    thLabel = binTh->GetOutput();
+  }
 
   // create cortexLabel with information from descoLabel, gaussLabel and thLabel
   typename LabelImageType::Pointer cortexLabel = LabelImageType::New();
-  cortexLabel->CopyInformation(inImage);
-  cortexLabel->SetRegions(paddedWholeImage);
-  cortexLabel->Allocate(true);
-  mt->ParallelizeImageRegion<Dimension>(
-    wholeImage,
-    [descoLabel, gaussLabel, thLabel, cortexLabel](const RegionType region) {
-      itk::ImageRegionConstIterator<LabelImageType> gIt(gaussLabel, region);
-      itk::ImageRegionConstIterator<LabelImageType> tIt(thLabel, region);
-      itk::ImageRegionConstIterator<LabelImageType> dIt(descoLabel, region);
-      itk::ImageRegionIterator<LabelImageType>      cIt(cortexLabel, region);
-      for (; !cIt.IsAtEnd(); ++gIt, ++tIt, ++dIt, ++cIt)
-      {
-        unsigned char p = dIt.Get() || gIt.Get();
-        p = p && tIt.Get();
-        if (p)
+  typename LabelImageType::Pointer cortexEroded;
+  {
+    itk::StageProfile::Scope stage(profile, "cortex");
+    cortexLabel->CopyInformation(inImage);
+    cortexLabel->SetRegions(paddedWholeImage);
+    cortexLabel->Allocate(true);
+    mt->ParallelizeImageRegion<Dimension>(
+      wholeImage,
+      [descoLabel, gaussLabel, thLabel, cortexLabel](const RegionType region) {
+        itk::ImageRegionConstIterator<LabelImageType> gIt(gaussLabel, region);
+        itk::ImageRegionConstIterator<LabelImageType> tIt(thLabel, region);
+        itk::ImageRegionConstIterator<LabelImageType> dIt(descoLabel, region);
+        itk::ImageRegionIterator<LabelImageType>      cIt(cortexLabel, region);
+        for (; !cIt.IsAtEnd(); ++gIt, ++tIt, ++dIt, ++cIt)
         {
-          cIt.Set(p);
+          unsigned char p = dIt.Get() || gIt.Get();
+          p = p && tIt.Get();
+          if (p)
+          {
+            cIt.Set(p);
+          }
         }
-      }
-    },
-    nullptr);
-  UpdateAndWrite(cortexLabel, outFilename + "-cortex-label.nrrd", true, 2);
-  typename LabelImageType::Pointer cortexEroded =
-    sdfErode(cortexLabel, 0.5 * corticalBoneThickness, outFilename + "-cortex-eroded", 2);
+      },
+      nullptr);
+    UpdateAndWrite(cortexLabel, outFilename + "-cortex-label.nrrd", true, 2);
+    cortexEroded = sdfErode(cortexLabel, 0.5 * corticalBoneThickness, outFilename + "-cortex-eroded", 2);
+  }
   descoLabel = nullptr; // deallocate it
   gaussLabel = nullptr; // deallocate it
 
@@ -283,14 +285,23 @@ mainProcessing(typename ImageType::ConstPointer inImage,
   // do morphological processing per bone, to avoid merging bones which are close to each other
   itk::IdentifierType numBones = 0;
 
-  typename LabelImageType::Pointer bones = connectedComponentAnalysis(thLabel, outFilename, numBones, 3);
-  // we might not even get to this point if there are more than 255 bones
-  // we need 3 labels per bone, one each for cortical, trabecular and marrow
-  itkAssertOrThrowMacro(numBones <= 85, "There are too many bones to fit into uchar");
-  UpdateAndWrite(bones, outFilename + "-bones-label.nrrd", true, 1);
+  typename LabelImageType::Pointer bones;
+  {
+    itk::StageProfile::Scope stage(profile, "CCL");
+    bones = connectedComponentAnalysis(thLabel, outFilename, numBones, 3);
+    // we might not even get to this point if there are more bones than labels
+    // we need 3 labels per bone, one each for cortical, trabecular and marrow
+    itkAssertOrThrowMacro(numBones * 3 <= itk::NumericTraits<typename LabelImageType::PixelType>::max(),
+                          "There are too many bones to fit into the label pixel type");
+    UpdateAndWrite(bones, outFilename + "-bones-label.nrrd", true, 1);
+  }
 
-  bones = zeroPad(bones, opSize, outFilename + "-bonesPad-label.nrrd", 3);
-  typename RealImageType::Pointer boneDist = sdf(bones, outFilename + "-bones-dist.nrrd", 3);
+  typename RealImageType::Pointer boneDist;
+  {
+    itk::StageProfile::Scope stage(profile, "boneDist");
+    bones = zeroPad(bones, opSize, outFilename + "-bonesPad-label.nrrd", 3);
+    boneDist = sdf(bones, outFilename + "-bones-dist.nrrd", 3);
+  }
 
   // calculate bounding box for each bone
   std::vector<IndexType> minIndices(numBones + 1, IndexType::Filled(itk::NumericTraits<itk::IndexValueType>::max()));
@@ -298,6 +309,7 @@ mainProcessing(typename ImageType::ConstPointer inImage,
                                     IndexType::Filled(itk::NumericTraits<itk::IndexValueType>::NonpositiveMin()));
   std::vector<unsigned char> replacedBy(numBones + 1, 0);
   {
+    itk::StageProfile::Scope stage(profile, "boundingBoxes");
     itk::ImageRegionConstIteratorWithIndex<LabelImageType> bIt(bones, wholeImage);
     itk::ImageRegionConstIterator<LabelImageType>          cIt(cortexEroded, wholeImage);
     for (; !bIt.IsAtEnd(); ++bIt, ++cIt)
@@ -332,7 +344,8 @@ mainProcessing(typename ImageType::ConstPointer inImage,
       continue; // next bone
     }
 
-    std::string boneFilename = outFilename + "-bone" + std::to_string(bone);
+    itk::StageProfile::Scope boneStage(profile, "bone", bone);
+    std::string              boneFilename = outFilename + "-bone" + std::to_string(bone);
 
     // calculate expanded bounding box, so the subsequent operations don't need to process the whole image
     RegionType boneRegion;         // tight bounding box
@@ -349,136 +362,148 @@ mainProcessing(typename ImageType::ConstPointer inImage,
     RegionType safeBoneRegion = expandedBoneRegion;
     safeBoneRegion.Crop(wholeImage); // restrict to image size
 
-    typename LabelImageType::Pointer thisBone = LabelImageType::New();
-    thisBone->CopyInformation(inImage);
-    thisBone->SetRegions(expandedBoneRegion);
-    thisBone->Allocate(true);
-    mt->ParallelizeImageRegion<Dimension>(
-      boneRegion,
-      [thisBone, bones, bone](const RegionType region) {
-        itk::ImageRegionConstIterator<LabelImageType> bIt(bones, region);
-        itk::ImageRegionIterator<LabelImageType>      oIt(thisBone, region);
-        for (; !oIt.IsAtEnd(); ++bIt, ++oIt)
-        {
-          if (bIt.Get() == bone)
+    typename RealImageType::Pointer thisDist;
+    {
+      itk::StageProfile::Scope stage(profile, "sdf", bone);
+      typename LabelImageType::Pointer thisBone = LabelImageType::New();
+      thisBone->CopyInformation(inImage);
+      thisBone->SetRegions(expandedBoneRegion);
+      thisBone->Allocate(true);
+      mt->ParallelizeImageRegion<Dimension>(
+        boneRegion,
+        [thisBone, bones, bone](const RegionType region) {
+          itk::ImageRegionConstIterator<LabelImageType> bIt(bones, region);
+          itk::ImageRegionIterator<LabelImageType>      oIt(thisBone, region);
+          for (; !oIt.IsAtEnd(); ++bIt, ++oIt)
           {
-            oIt.Set(bone);
+            if (bIt.Get() == bone)
+            {
+              oIt.Set(bone);
+            }
           }
-        }
-      },
-      nullptr);
-    typename RealImageType::Pointer thisDist = sdf(thisBone, boneFilename + "-dist.nrrd", 2);
-    thisBone = nullptr; // deallocate it
+        },
+        nullptr);
+      thisDist = sdf(thisBone, boneFilename + "-dist.nrrd", 2);
+    }
 
     typename LabelImageType::Pointer boneBasin = LabelImageType::New();
-    boneBasin->CopyInformation(inImage);
-    boneBasin->SetRegions(safeBoneRegion);
-    boneBasin->Allocate(true);
-    mt->ParallelizeImageRegion<Dimension>(
-      boneRegion,
-      [boneBasin, thisDist, boneDist, epsDist](const RegionType region) {
-        itk::ImageRegionConstIterator<RealImageType> tIt(thisDist, region);
-        itk::ImageRegionConstIterator<RealImageType> gIt(boneDist, region);
-        itk::ImageRegionIterator<LabelImageType>     oIt(boneBasin, region);
-        for (; !oIt.IsAtEnd(); ++tIt, ++gIt, ++oIt)
-        {
-          if (std::abs(tIt.Get() - gIt.Get()) < epsDist)
+    {
+      itk::StageProfile::Scope stage(profile, "fill", bone);
+      boneBasin->CopyInformation(inImage);
+      boneBasin->SetRegions(safeBoneRegion);
+      boneBasin->Allocate(true);
+      mt->ParallelizeImageRegion<Dimension>(
+        boneRegion,
+        [boneBasin, thisDist, boneDist, epsDist](const RegionType region) {
+          itk::ImageRegionConstIterator<RealImageType> tIt(thisDist, region);
+          itk::ImageRegionConstIterator<RealImageType> gIt(boneDist, region);
+          itk::ImageRegionIterator<LabelImageType>     oIt(boneBasin, region);
+          for (; !oIt.IsAtEnd(); ++tIt, ++gIt, ++oIt)
           {
-            oIt.Set(1);
+            if (std::abs(tIt.Get() - gIt.Get()) < epsDist)
+            {
+              oIt.Set(1);
+            }
           }
-        }
-      },
-      nullptr);
-    thisDist = nullptr; // deallocate it
-
-    using FillHolesType = itk::BinaryFillholeImageFilter<LabelImageType>;
-    typename FillHolesType::Pointer fillHoles = FillHolesType::New();
-    fillHoles->SetInput(boneBasin);
-    fillHoles->SetForegroundValue(1);
-    UpdateAndWrite(fillHoles->GetOutput(), boneFilename + "-basin-label.nrrd", true, 2);
-    boneBasin = fillHoles->GetOutput();
-    boneBasin->DisconnectPipeline();
+        },
+        nullptr);
+      thisDist = nullptr; // deallocate it
+
+      using FillHolesType = itk::BinaryFillholeImageFilter<LabelImageType>;
+      typename FillHolesType::Pointer fillHoles = FillHolesType::New();
+      fillHoles->SetInput(boneBasin);
+      fillHoles->SetForegroundValue(1);
+      UpdateAndWrite(fillHoles->GetOutput(), boneFilename + "-basin-label.nrrd", true, 2);
+      boneBasin = fillHoles->GetOutput();
+      boneBasin->DisconnectPipeline();
+    }
 
     constexpr typename ImageType::PixelType background = -4096;
 
-    typename ImageType::Pointer partialInput = ImageType::New();
-    partialInput->CopyInformation(inImage);
-    partialInput->SetRegions(safeBoneRegion);
-    partialInput->Allocate(false);
-    partialInput->FillBuffer(background);
-    mt->ParallelizeImageRegion<Dimension>(
-      boneRegion,
-      [partialInput, inImage, boneBasin](const RegionType region) {
-        itk::ImageRegionConstIterator<LabelImageType> tIt(boneBasin, region);
-        itk::ImageRegionConstIterator<ImageType>      iIt(inImage, region);
-        itk::ImageRegionIterator<ImageType>           oIt(partialInput, region);
-        for (; !oIt.IsAtEnd(); ++iIt, ++tIt, ++oIt)
-        {
-          if (tIt.Get())
+    typename LabelImageType::Pointer thBone;
+    {
+      itk::StageProfile::Scope    stage(profile, "grow", bone);
+      typename ImageType::Pointer partialInput = ImageType::New();
+      partialInput->CopyInformation(inImage);
+      partialInput->SetRegions(safeBoneRegion);
+      partialInput->Allocate(false);
+      partialInput->FillBuffer(background);
+      mt->ParallelizeImageRegion<Dimension>(
+        boneRegion,
+        [partialInput, inImage, boneBasin](const RegionType region) {
+          itk::ImageRegionConstIterator<LabelImageType> tIt(boneBasin, region);
+          itk::ImageRegionConstIterator<ImageType>      iIt(inImage, region);
+          itk::ImageRegionIterator<ImageType>           oIt(partialInput, region);
+          for (; !oIt.IsAtEnd(); ++iIt, ++tIt, ++oIt)
           {
-            oIt.Set(iIt.Get());
+            if (tIt.Get())
+            {
+              oIt.Set(iIt.Get());
+            }
           }
-        }
-      },
-      nullptr);
-    UpdateAndWrite(partialInput, boneFilename + ".nrrd", true, 1);
-
-    using ConnectedFilterType = itk::NeighborhoodConnectedImageFilter<ImageType, LabelImageType>;
-    typename ConnectedFilterType::Pointer neighborhoodConnected = ConnectedFilterType::New();
-    neighborhoodConnected->SetInput(partialInput);
-    neighborhoodConnected->SetLower(1500); // use a lower threshold here, so we capture more of trabecular bone
-    itk::ImageRegionConstIteratorWithIndex<LabelImageType> bIt(bones, boneRegion);
-    itk::ImageRegionConstIterator<LabelImageType>          bbIt(boneBasin, boneRegion);
-    for (; !bIt.IsAtEnd(); ++bIt, ++bbIt)
-    {
-      unsigned char b = bIt.Get();
-      if (b > 0)
+        },
+        nullptr);
+      UpdateAndWrite(partialInput, boneFilename + ".nrrd", true, 1);
+
+      using ConnectedFilterType = itk::NeighborhoodConnectedImageFilter<ImageType, LabelImageType>;
+      typename ConnectedFilterType::Pointer neighborhoodConnected = ConnectedFilterType::New();
+      neighborhoodConnected->SetInput(partialInput);
+      neighborhoodConnected->SetLower(1500); // use a lower threshold here, so we capture more of trabecular bone
+      itk::ImageRegionConstIteratorWithIndex<LabelImageType> bIt(bones, boneRegion);
+      itk::ImageRegionConstIterator<LabelImageType>          bbIt(boneBasin, boneRegion);
+      for (; !bIt.IsAtEnd(); ++bIt, ++bbIt)
       {
-        if (b == bone)
+        unsigned char b = bIt.Get();
+        if (b > 0)
         {
-          neighborhoodConnected->AddSeed(bIt.GetIndex());
-        }
-        else // b != bone
-        {
-          if (bbIt.Get()) // this was a hole inside this bone basin
+          if (b == bone)
+          {
+            neighborhoodConnected->AddSeed(bIt.GetIndex());
+          }
+          else // b != bone
           {
-            replacedBy[b] = bone; // mark it for skipping
+            if (bbIt.Get()) // this was a hole inside this bone basin
+            {
+              replacedBy[b] = bone; // mark it for skipping
+            }
           }
         }
       }
+      UpdateAndWrite(neighborhoodConnected->GetOutput(), boneFilename + "-trabecularSmall-label.nrrd", true, 3);
+      thBone = neighborhoodConnected->GetOutput();
+    }
+
+    typename LabelImageType::Pointer dilatedBone;
+    typename LabelImageType::Pointer erodedMarrow;
+    {
+      itk::StageProfile::Scope stage(profile, "morphology", bone);
+      thBone = zeroPad(thBone, opSize, boneFilename + "-trabecularPadded-label.nrrd", 2);
+      dilatedBone = sdfDilate(thBone, 3.0 * corticalBoneThickness, boneFilename + "-trabecular1", 2);
+      typename LabelImageType::Pointer erodedBone =
+        sdfErode(dilatedBone, 4.0 * corticalBoneThickness, boneFilename + "-trabecular2", 3);
+      dilatedBone = sdfDilate(erodedBone, 1.0 * corticalBoneThickness, boneFilename + "-trabecular3", 3);
+
+      // now do the same for marrow, seeding from cortical and trabecular bone
+      mt->ParallelizeImageRegion<Dimension>(
+        boneRegion,
+        [thBone, erodedBone](const RegionType region) {
+          itk::ImageRegionConstIterator<LabelImageType> bIt(erodedBone, region);
+          itk::ImageRegionIterator<LabelImageType>      oIt(thBone, region);
+          for (; !oIt.IsAtEnd(); ++bIt, ++oIt)
+          {
+            oIt.Set(bIt.Get() || oIt.Get());
+          }
+        },
+        nullptr);
+      erodedBone = nullptr; // deallocate it
+      typename LabelImageType::Pointer dilatedMarrow =
+        sdfDilate(thBone, 5.0 * corticalBoneThickness, boneFilename + "-marrow", 3);
+      thBone = nullptr; // deallocate it
+      erodedMarrow = sdfErode(dilatedMarrow, 6.0 * corticalBoneThickness, boneFilename + "-marrow", 3);
     }
-    UpdateAndWrite(neighborhoodConnected->GetOutput(), boneFilename + "-trabecularSmall-label.nrrd", true, 3);
-    typename LabelImageType::Pointer thBone = neighborhoodConnected->GetOutput();
-    partialInput = nullptr; // deallocate it
-
-    thBone = zeroPad(thBone, opSize, boneFilename + "-trabecularPadded-label.nrrd", 2);
-    typename LabelImageType::Pointer dilatedBone =
-      sdfDilate(thBone, 3.0 * corticalBoneThickness, boneFilename + "-trabecular1", 2);
-    typename LabelImageType::Pointer erodedBone =
-      sdfErode(dilatedBone, 4.0 * corticalBoneThickness, boneFilename + "-trabecular2", 3);
-    dilatedBone = sdfDilate(erodedBone, 1.0 * corticalBoneThickness, boneFilename + "-trabecular3", 3);
-
-    // now do the same for marrow, seeding from cortical and trabecular bone
-    mt->ParallelizeImageRegion<Dimension>(
-      boneRegion,
-      [thBone, erodedBone](const RegionType region) {
-        itk::ImageRegionConstIterator<LabelImageType> bIt(erodedBone, region);
-        itk::ImageRegionIterator<LabelImageType>      oIt(thBone, region);
-        for (; !oIt.IsAtEnd(); ++bIt, ++oIt)
-        {
-          oIt.Set(bIt.Get() || oIt.Get());
-        }
-      },
-      nullptr);
-    erodedBone = nullptr; // deallocate it
-    typename LabelImageType::Pointer dilatedMarrow =
-      sdfDilate(thBone, 5.0 * corticalBoneThickness, boneFilename + "-marrow", 3);
-    thBone = nullptr; // deallocate it
-    typename LabelImageType::Pointer erodedMarrow =
-      sdfErode(dilatedMarrow, 6.0 * corticalBoneThickness, boneFilename + "-marrow", 3);
-    dilatedMarrow = nullptr; // deallocate it
 
     // now combine them, clipping them to the boneBasin
+    itk::StageProfile::Scope compositeStage(profile, "composite", bone);
     mt->ParallelizeImageRegion<Dimension>(
       safeBoneRegion,
       [splitBones, finalBones, erodedMarrow, dilatedBone, cortexLabel, boneBasin, bone, background](
@@ -565,16 +590,29 @@ main(int argc, char * argv[])
     using InputPixelType = short;
     using InputImageType = itk::Image<InputPixelType, ImageDimension>;
 
-    typename InputImageType::Pointer image = itk::ReadImage<InputImageType>(inputFileName);
+    profile = itk::StageProfile::New();
+    profile->Start();
+    typename InputImageType::Pointer image;
+    {
+      itk::StageProfile::Scope stage(profile, "read");
+      image = itk::ReadImage<InputImageType>(inputFileName);
+    }
 
     using MedianType = itk::MedianImageFilter<InputImageType, InputImageType>;
     MedianType::Pointer median = MedianType::New();
     median->SetInput(image);
-    UpdateAndWrite(median->GetOutput(), outputFileName + "-median.nrrd", false, 2);
+    {
+      itk::StageProfile::Scope stage(profile, "median");
+      UpdateAndWrite(median->GetOutput(), outputFileName + "-median.nrrd", false, 2);
+    }
     image = median->GetOutput();
     image->DisconnectPipeline();
 
     mainProcessing<InputImageType>(image, outputFileName, corticalBoneThickness, boneCount);
+
+    profile->Stop();
+    std::cout << std::endl << "Stage profile:" << std::endl;
+    profile->WriteJSON(std::cout);
     return EXIT_SUCCESS;
   }
   catch (itk::ExceptionObject & exc)
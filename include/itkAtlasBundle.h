@@ -0,0 +1,210 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkAtlasBundle_h
+#define itkAtlasBundle_h
+
+#include "itkBSplineAtlasRefinement.h"
+#include "itkImage.h"
+#include "itkImportImageContainer.h"
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace itk
+{
+namespace AtlasBundleDetail
+{
+// a read-only file, mapped where the platform allows, read into memory otherwise
+class MappedFile;
+
+// pixel buffer which keeps the view it points into alive
+template <typename TElement>
+class MappedImageContainer : public ImportImageContainer<SizeValueType, TElement>
+{
+public:
+  ITK_DISALLOW_COPY_AND_MOVE(MappedImageContainer);
+
+  using Self = MappedImageContainer;
+  using Superclass = ImportImageContainer<SizeValueType, TElement>;
+  using Pointer = SmartPointer<Self>;
+  using ConstPointer = SmartPointer<const Self>;
+
+  itkOverrideGetNameOfClassMacro(MappedImageContainer);
+  itkNewMacro(Self);
+
+  void
+  SetView(std::shared_ptr<char> view, SizeValueType numberOfElements)
+  {
+    m_View = std::move(view);
+    this->SetImportPointer(reinterpret_cast<TElement *>(m_View.get()), numberOfElements, false);
+  }
+
+protected:
+  MappedImageContainer() = default;
+  ~MappedImageContainer() override = default;
+
+private:
+  std::shared_ptr<char> m_View;
+};
+} // namespace AtlasBundleDetail
+
+/** \class AtlasBundle
+ *
+ * \brief Memory-mapped atlas, prepared once by AtlasBundleBuilder for each of its bones.
+ *
+ * For each bone, the bundle holds the atlas image and labels cropped to the bone's
+ * region, the Gaussian pyramid of the cropped image which BSplineAtlasRefinement
+ * registers with, the bone's landmarks and optionally the signed distance map of
+ * the bone's label. Each image is a view mapped from the file: its voxels are not read
+ * until they are accessed, and writing to them changes only a private copy of the
+ * touched pages, neither the file nor other images. Images remain valid after the
+ * bundle is destroyed or reads another file.
+ *
+ * The file starts with a preamble: 8 magic bytes, a byte order mark, the dimension,
+ * the number of pyramid levels, the number of bones and the offset of the table.
+ * The table follows the voxel data, and describes each bone's label, landmarks and
+ * images. Each image has its pixel type, buffered region, geometry, and the offset and
+ * size of its voxels, which start at a multiple of 64 bytes. Files of another
+ * dimension, byte order or pixel type are refused.
+ *
+ * \ingroup HASI
+ */
+template <typename TImage, typename TLabelImage>
+class AtlasBundle : public Object
+{
+public:
+  ITK_DISALLOW_COPY_AND_MOVE(AtlasBundle);
+
+  /** Standard class typedefs. */
+  using Self = AtlasBundle;
+  using Superclass = Object;
+  using Pointer = SmartPointer<Self>;
+  using ConstPointer = SmartPointer<const Self>;
+
+  /** Run-time type information. */
+  itkOverrideGetNameOfClassMacro(AtlasBundle);
+
+  /** Standard New macro. */
+  itkNewMacro(Self);
+
+  static constexpr unsigned int ImageDimension = TImage::ImageDimension;
+  using ImageType = TImage;
+  using LabelImageType = TLabelImage;
+  using LabelType = typename TLabelImage::PixelType;
+  using RegionType = typename TImage::RegionType;
+  using PointType = typename TLabelImage::PointType;
+  using LandmarksType = std::vector<PointType>;
+  using PyramidType = typename BSplineAtlasRefinement<TImage>::PyramidType;
+  using DistanceImageType = Image<float, ImageDimension>;
+
+  /** Map the bundle in fileName, replacing any previous one. Throws if it is missing or malformed. */
+  void
+  Read(const std::string & fileName);
+
+  /** The file which was read. */
+  itkGetStringMacro(FileName);
+
+  /** The number of pyramid levels, BSplineAtlasRefinement's NumberOfResolutions when the bundle was built. */
+  itkGetConstMacro(NumberOfPyramidLevels, unsigned int);
+
+  /** The bones in the bundle, in the order they were added to the builder. */
+  std::vector<LabelType>
+  GetBones() const;
+
+  /** Whether the bundle has bone. */
+  bool
+  HasBone(LabelType bone) const;
+
+  /** The landmarks of bone. The getters throw if the bundle does not have bone. */
+  const LandmarksType &
+  GetLandmarks(LabelType bone) const;
+
+  /** The atlas image, cropped to the region of bone. */
+  typename TImage::Pointer
+  GetImage(LabelType bone) const;
+
+  /** The atlas labels, cropped to the region of bone. */
+  typename TLabelImage::Pointer
+  GetLabels(LabelType bone) const;
+
+  /** The pyramid of the cropped image, coarsest level first. */
+  PyramidType
+  GetPyramid(LabelType bone) const;
+
+  /** The signed distance to the surface of bone, negative inside, in physical units,
+   * on the grid of the cropped labels. Null if the bundle was built without distance maps. */
+  typename DistanceImageType::Pointer
+  GetDistanceMap(LabelType bone) const;
+
+protected:
+  AtlasBundle() = default;
+  ~AtlasBundle() override = default;
+
+  void
+  PrintSelf(std::ostream & os, Indent indent) const override;
+
+  // where an image's voxels are in the file, and its grid
+  struct EntryType
+  {
+    std::uint32_t                  pixelType = 0;
+    RegionType                     region;
+    typename TImage::SpacingType   spacing;
+    typename TImage::PointType     origin;
+    typename TImage::DirectionType direction;
+    std::uint64_t                  offset = 0;
+    std::uint64_t                  numberOfBytes = 0;
+  };
+
+  struct BoneType
+  {
+    LabelType              label = 0;
+    LandmarksType          landmarks;
+    EntryType              image;
+    EntryType              labels;
+    std::vector<EntryType> pyramid;
+    bool                   hasDistanceMap = false;
+    EntryType              distanceMap;
+  };
+
+  // the entry of bone, throws if there is none
+  const BoneType &
+  GetBone(LabelType bone) const;
+
+  // an image whose buffer is the entry's voxels in the mapping
+  template <typename TEntryImage>
+  typename TEntryImage::Pointer
+  MakeImage(const EntryType & entry) const;
+
+private:
+  std::string                                    m_FileName;
+  unsigned int                                   m_NumberOfPyramidLevels = 0;
+  std::vector<BoneType>                          m_Bones;
+  std::shared_ptr<AtlasBundleDetail::MappedFile> m_Mapping;
+};
+} // namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#  include "itkAtlasBundle.hxx"
+#endif
+
+#endif // itkAtlasBundle_h
@@ -0,0 +1,426 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkAtlasBundle_hxx
+#define itkAtlasBundle_hxx
+
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+#if defined(_WIN32)
+#  include <fstream>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+namespace itk
+{
+namespace AtlasBundleDetail
+{
+constexpr char          Magic[8] = { 'H', 'A', 'S', 'I', 'A', 'T', 'B', '1' };
+constexpr std::uint32_t ByteOrderMark = 0x01020304;
+constexpr std::uint64_t Alignment = 64;
+constexpr std::uint64_t PreambleSize = 32;
+
+// size, floating point and sign of a pixel type
+template <typename TPixel>
+std::uint32_t
+PixelTypeId()
+{
+  return static_cast<std::uint32_t>(sizeof(TPixel)) | (std::is_floating_point<TPixel>::value ? 1u << 8 : 0u) |
+         (std::is_signed<TPixel>::value ? 1u << 9 : 0u);
+}
+
+template <typename T>
+void
+WriteValue(std::ostream & out, const T & value)
+{
+  out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+// reads values from a buffer, which becomes invalid instead of reading past its end
+class BufferReader
+{
+public:
+  BufferReader(const char * data, std::uint64_t size, std::uint64_t position)
+    : m_Data(data)
+    , m_Size(size)
+    , m_Position(position)
+    , m_Valid(position <= size)
+  {}
+
+  void
+  ReadBytes(void * destination, std::uint64_t numberOfBytes)
+  {
+    m_Valid = m_Valid && numberOfBytes <= m_Size - m_Position;
+    if (m_Valid)
+    {
+      std::memcpy(destination, m_Data + m_Position, numberOfBytes);
+      m_Position += numberOfBytes;
+    }
+  }
+
+  template <typename T>
+  T
+  Read()
+  {
+    T value{};
+    this->ReadBytes(&value, sizeof(T));
+    return value;
+  }
+
+  void
+  Invalidate()
+  {
+    m_Valid = false;
+  }
+
+  bool
+  IsValid() const
+  {
+    return m_Valid;
+  }
+
+private:
+  const char *  m_Data;
+  std::uint64_t m_Size;
+  std::uint64_t m_Position;
+  bool          m_Valid;
+};
+
+class MappedFile
+{
+public:
+  ITK_DISALLOW_COPY_AND_MOVE(MappedFile);
+
+  explicit MappedFile(const std::string & fileName)
+  {
+#if defined(_WIN32)
+    std::ifstream in(fileName, std::ios::binary | std::ios::ate);
+    if (!in)
+    {
+      itkGenericExceptionMacro(<< "Could not open " << fileName);
+    }
+    m_Size = static_cast<std::uint64_t>(in.tellg());
+    m_Buffer.reset(new char[m_Size]);
+    in.seekg(0);
+    in.read(m_Buffer.get(), m_Size);
+    if (!in)
+    {
+      itkGenericExceptionMacro(<< "Could not read " << fileName);
+    }
+    m_Data = m_Buffer.get();
+#else
+    m_Descriptor = open(fileName.c_str(), O_RDONLY);
+    if (m_Descriptor < 0)
+    {
+      itkGenericExceptionMacro(<< "Could not open " << fileName);
+    }
+    struct stat status;
+    if (fstat(m_Descriptor, &status) != 0 || status.st_size <= 0)
+    {
+      close(m_Descriptor);
+      itkGenericExceptionMacro(<< "Could not map empty file " << fileName);
+    }
+    m_Size = static_cast<std::uint64_t>(status.st_size);
+
+    void * data = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, m_Descriptor, 0);
+    if (data == MAP_FAILED)
+    {
+      close(m_Descriptor);
+      itkGenericExceptionMacro(<< "Could not map " << fileName);
+    }
+    m_Data = static_cast<char *>(data);
+#endif
+  }
+
+  ~MappedFile()
+  {
+#if !defined(_WIN32)
+    munmap(const_cast<char *>(m_Data), m_Size);
+    close(m_Descriptor);
+#endif
+  }
+
+  const char *
+  GetData() const
+  {
+    return m_Data;
+  }
+
+  std::uint64_t
+  GetSize() const
+  {
+    return m_Size;
+  }
+
+  // numberOfBytes at offset, mapped privately so that writing to them changes neither the file nor other views
+  std::shared_ptr<char>
+  MapView(std::uint64_t offset, std::uint64_t numberOfBytes) const
+  {
+    if (numberOfBytes == 0)
+    {
+      return nullptr;
+    }
+#if defined(_WIN32)
+    std::shared_ptr<char> view(new char[numberOfBytes], std::default_delete<char[]>());
+    std::memcpy(view.get(), m_Data + offset, numberOfBytes);
+    return view;
+#else
+    const auto          pageSize = static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+    const std::uint64_t start = offset - offset % pageSize;
+    const std::uint64_t length = numberOfBytes + (offset - start);
+    void *              pages = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, m_Descriptor, start);
+    if (pages == MAP_FAILED)
+    {
+      itkGenericExceptionMacro(<< "Could not map " << numberOfBytes << " bytes at " << offset);
+    }
+    return std::shared_ptr<char>(static_cast<char *>(pages) + (offset - start),
+                                 [pages, length](char *) { munmap(pages, length); });
+#endif
+  }
+
+private:
+  const char *  m_Data = nullptr;
+  std::uint64_t m_Size = 0;
+#if defined(_WIN32)
+  std::unique_ptr<char[]> m_Buffer;
+#else
+  int m_Descriptor = -1;
+#endif
+};
+} // namespace AtlasBundleDetail
+
+template <typename TImage, typename TLabelImage>
+void
+AtlasBundle<TImage, TLabelImage>::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "FileName: " << m_FileName << std::endl;
+  os << indent << "NumberOfPyramidLevels: " << m_NumberOfPyramidLevels << std::endl;
+  os << indent << "Bones:";
+  for (const BoneType & bone : m_Bones)
+  {
+    os << " " << static_cast<typename NumericTraits<LabelType>::PrintType>(bone.label);
+  }
+  os << std::endl;
+}
+
+template <typename TImage, typename TLabelImage>
+void
+AtlasBundle<TImage, TLabelImage>::Read(const std::string & fileName)
+{
+  auto mapping = std::make_shared<AtlasBundleDetail::MappedFile>(fileName);
+
+  AtlasBundleDetail::BufferReader preamble(mapping->GetData(), mapping->GetSize(), 0);
+  char                            magic[sizeof(AtlasBundleDetail::Magic)];
+  preamble.ReadBytes(magic, sizeof(magic));
+  const auto byteOrderMark = preamble.Read<std::uint32_t>();
+  const auto dimension = preamble.Read<std::uint32_t>();
+  const auto numberOfPyramidLevels = preamble.Read<std::uint32_t>();
+  const auto numberOfBones = preamble.Read<std::uint32_t>();
+  const auto tableOffset = preamble.Read<std::uint64_t>();
+  if (!preamble.IsValid() || std::memcmp(magic, AtlasBundleDetail::Magic, sizeof(magic)) != 0 ||
+      byteOrderMark != AtlasBundleDetail::ByteOrderMark || dimension != ImageDimension)
+  {
+    itkExceptionMacro(<< fileName << " is not an atlas bundle of dimension " << ImageDimension
+                      << " in this machine's byte order");
+  }
+  if (tableOffset < AtlasBundleDetail::PreambleSize || numberOfBones > mapping->GetSize() ||
+      numberOfPyramidLevels > mapping->GetSize())
+  {
+    itkExceptionMacro(<< "The preamble of atlas bundle " << fileName << " is corrupt");
+  }
+
+  AtlasBundleDetail::BufferReader table(mapping->GetData(), mapping->GetSize(), tableOffset);
+  auto                            readEntry = [&table, &mapping]() {
+    EntryType entry;
+    entry.pixelType = table.Read<std::uint32_t>();
+    for (unsigned d = 0; d < ImageDimension; d++)
+    {
+      entry.region.SetIndex(d, table.Read<std::int64_t>());
+      entry.region.SetSize(d, table.Read<std::uint64_t>());
+      entry.spacing[d] = table.Read<double>();
+      entry.origin[d] = table.Read<double>();
+      for (unsigned e = 0; e < ImageDimension; e++)
+      {
+        entry.direction(d, e) = table.Read<double>();
+      }
+    }
+    entry.offset = table.Read<std::uint64_t>();
+    entry.numberOfBytes = table.Read<std::uint64_t>();
+    const bool inside = entry.offset % AtlasBundleDetail::Alignment == 0 && entry.offset <= mapping->GetSize() &&
+                        entry.numberOfBytes <= mapping->GetSize() - entry.offset;
+    if (!inside)
+    {
+      table.Invalidate();
+    }
+    return entry;
+  };
+
+  std::vector<BoneType> bones(numberOfBones);
+  for (BoneType & bone : bones)
+  {
+    bone.label = static_cast<LabelType>(table.Read<std::int64_t>());
+    const auto numberOfLandmarks = table.Read<std::uint32_t>();
+    if (!table.IsValid() || numberOfLandmarks > mapping->GetSize())
+    {
+      table.Invalidate();
+      break;
+    }
+    bone.landmarks.resize(numberOfLandmarks);
+    for (PointType & landmark : bone.landmarks)
+    {
+      for (unsigned d = 0; d < ImageDimension; d++)
+      {
+        landmark[d] = table.Read<double>();
+      }
+    }
+    bone.image = readEntry();
+    bone.labels = readEntry();
+    bone.pyramid.resize(numberOfPyramidLevels);
+    for (EntryType & level : bone.pyramid)
+    {
+      level = readEntry();
+    }
+    bone.hasDistanceMap = table.Read<std::uint32_t>() != 0;
+    if (bone.hasDistanceMap)
+    {
+      bone.distanceMap = readEntry();
+    }
+  }
+  if (!table.IsValid())
+  {
+    itkExceptionMacro(<< "The table of atlas bundle " << fileName << " is truncated or corrupt");
+  }
+
+  m_FileName = fileName;
+  m_NumberOfPyramidLevels = numberOfPyramidLevels;
+  m_Bones = std::move(bones);
+  m_Mapping = std::move(mapping);
+  this->Modified();
+}
+
+template <typename TImage, typename TLabelImage>
+auto
+AtlasBundle<TImage, TLabelImage>::GetBones() const -> std::vector<LabelType>
+{
+  std::vector<LabelType> labels;
+  for (const BoneType & bone : m_Bones)
+  {
+    labels.push_back(bone.label);
+  }
+  return labels;
+}
+
+template <typename TImage, typename TLabelImage>
+bool
+AtlasBundle<TImage, TLabelImage>::HasBone(LabelType bone) const
+{
+  return std::any_of(m_Bones.begin(), m_Bones.end(), [bone](const BoneType & b) { return b.label == bone; });
+}
+
+template <typename TImage, typename TLabelImage>
+auto
+AtlasBundle<TImage, TLabelImage>::GetBone(LabelType bone) const -> const BoneType &
+{
+  for (const BoneType & b : m_Bones)
+  {
+    if (b.label == bone)
+    {
+      return b;
+    }
+  }
+  itkExceptionMacro(<< "Atlas bundle " << m_FileName << " does not have bone "
+                    << static_cast<typename NumericTraits<LabelType>::PrintType>(bone));
+}
+
+template <typename TImage, typename TLabelImage>
+template <typename TEntryImage>
+typename TEntryImage::Pointer
+AtlasBundle<TImage, TLabelImage>::MakeImage(const EntryType & entry) const
+{
+  using PixelType = typename TEntryImage::PixelType;
+  const SizeValueType numberOfPixels = entry.region.GetNumberOfPixels();
+  if (entry.pixelType != AtlasBundleDetail::PixelTypeId<PixelType>() ||
+      entry.numberOfBytes != numberOfPixels * sizeof(PixelType))
+  {
+    itkExceptionMacro(<< "An image in atlas bundle " << m_FileName << " does not have the requested pixel type");
+  }
+
+  typename TEntryImage::Pointer image = TEntryImage::New();
+  image->SetRegions(entry.region);
+  image->SetSpacing(entry.spacing);
+  image->SetOrigin(entry.origin);
+  image->SetDirection(entry.direction);
+
+  using ContainerType = AtlasBundleDetail::MappedImageContainer<PixelType>;
+  typename ContainerType::Pointer container = ContainerType::New();
+  container->SetView(m_Mapping->MapView(entry.offset, entry.numberOfBytes), numberOfPixels);
+  image->SetPixelContainer(container);
+  return image;
+}
+
+template <typename TImage, typename TLabelImage>
+auto
+AtlasBundle<TImage, TLabelImage>::GetLandmarks(LabelType bone) const -> const LandmarksType &
+{
+  return this->GetBone(bone).landmarks;
+}
+
+template <typename TImage, typename TLabelImage>
+typename TImage::Pointer
+AtlasBundle<TImage, TLabelImage>::GetImage(LabelType bone) const
+{
+  return this->template MakeImage<TImage>(this->GetBone(bone).image);
+}
+
+template <typename TImage, typename TLabelImage>
+typename TLabelImage::Pointer
+AtlasBundle<TImage, TLabelImage>::GetLabels(LabelType bone) const
+{
+  return this->template MakeImage<TLabelImage>(this->GetBone(bone).labels);
+}
+
+template <typename TImage, typename TLabelImage>
+auto
+AtlasBundle<TImage, TLabelImage>::GetPyramid(LabelType bone) const -> PyramidType
+{
+  PyramidType pyramid;
+  for (const EntryType & level : this->GetBone(bone).pyramid)
+  {
+    pyramid.push_back(this->template MakeImage<typename BSplineAtlasRefinement<TImage>::RealImageType>(level));
+  }
+  return pyramid;
+}
+
+template <typename TImage, typename TLabelImage>
+auto
+AtlasBundle<TImage, TLabelImage>::GetDistanceMap(LabelType bone) const -> typename DistanceImageType::Pointer
+{
+  const BoneType & b = this->GetBone(bone);
+  return b.hasDistanceMap ? this->template MakeImage<DistanceImageType>(b.distanceMap) : nullptr;
+}
+
+} // end namespace itk
+
+#endif // itkAtlasBundle_hxx
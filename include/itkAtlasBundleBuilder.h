@@ -0,0 +1,138 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkAtlasBundleBuilder_h
+#define itkAtlasBundleBuilder_h
+
+#include "itkAtlasBundle.h"
+
+#include <ostream>
+
+
+namespace itk
+{
+
+/** \class AtlasBundleBuilder
+ *
+ * \brief Writes an AtlasBundle from an atlas image, its labels and the landmarks of its bones.
+ *
+ * For each bone added by AddBone, the image and labels are cropped to the bounding box
+ * of the bone's label, padded by RegionOfInterestPadding. The Gaussian pyramid of the
+ * cropped image is computed by Refinement, whose NumberOfResolutions must match that of
+ * the refinement which uses the bundle. With ComputeDistanceMaps, the signed distance
+ * map of the bone's label is stored as well.
+ *
+ * Bones are prepared and written one at a time. The bundle is written to a temporary
+ * file which is then renamed, so an interrupted build leaves no partial bundle.
+ *
+ * \ingroup HASI
+ */
+template <typename TImage, typename TLabelImage>
+class AtlasBundleBuilder : public Object
+{
+public:
+  ITK_DISALLOW_COPY_AND_MOVE(AtlasBundleBuilder);
+
+  /** Standard class typedefs. */
+  using Self = AtlasBundleBuilder;
+  using Superclass = Object;
+  using Pointer = SmartPointer<Self>;
+  using ConstPointer = SmartPointer<const Self>;
+
+  /** Run-time type information. */
+  itkOverrideGetNameOfClassMacro(AtlasBundleBuilder);
+
+  /** Standard New macro. */
+  itkNewMacro(Self);
+
+  using BundleType = AtlasBundle<TImage, TLabelImage>;
+  static constexpr unsigned int ImageDimension = TImage::ImageDimension;
+  using LabelType = typename BundleType::LabelType;
+  using LandmarksType = typename BundleType::LandmarksType;
+  using RefinementType = BSplineAtlasRefinement<TImage>;
+
+  /** The atlas image. */
+  itkSetConstObjectMacro(Image, TImage);
+  itkGetConstObjectMacro(Image, TImage);
+
+  /** The atlas labels, on the grid of the image. */
+  itkSetConstObjectMacro(Labels, TLabelImage);
+  itkGetConstObjectMacro(Labels, TLabelImage);
+
+  /** Add a bone, given by its label, with its landmarks. */
+  void
+  AddBone(LabelType bone, const LandmarksType & landmarks)
+  {
+    m_Bones.push_back(bone);
+    m_Landmarks.push_back(landmarks);
+    this->Modified();
+  }
+
+  /** Remove the bones added by AddBone. */
+  void
+  ClearBones()
+  {
+    m_Bones.clear();
+    m_Landmarks.clear();
+    this->Modified();
+  }
+
+  /** Padding of each bone's bounding box, in physical units. Default is 0.5. */
+  itkSetMacro(RegionOfInterestPadding, double);
+  itkGetConstMacro(RegionOfInterestPadding, double);
+
+  /** Whether the signed distance map of each bone is stored. Default is off. */
+  itkSetMacro(ComputeDistanceMaps, bool);
+  itkGetConstMacro(ComputeDistanceMaps, bool);
+  itkBooleanMacro(ComputeDistanceMaps);
+
+  /** The refinement whose pyramid is stored. */
+  itkGetModifiableObjectMacro(Refinement, RefinementType);
+
+  /** Prepare each bone and write the bundle to fileName. Throws if a bone does not occur
+   * in the labels or the file cannot be written. */
+  void
+  Write(const std::string & fileName) const;
+
+protected:
+  AtlasBundleBuilder() { m_Refinement = RefinementType::New(); }
+  ~AtlasBundleBuilder() override = default;
+
+  void
+  PrintSelf(std::ostream & os, Indent indent) const override;
+
+  // pad data to the alignment, then write the image's voxels to data and its entry to table
+  template <typename TEntryImage>
+  static void
+  WriteEntry(std::ostream & data, std::ostream & table, const TEntryImage * image);
+
+private:
+  typename TImage::ConstPointer      m_Image;
+  typename TLabelImage::ConstPointer m_Labels;
+  std::vector<LabelType>             m_Bones;
+  std::vector<LandmarksType>         m_Landmarks;
+  double                             m_RegionOfInterestPadding = 0.5;
+  bool                               m_ComputeDistanceMaps = false;
+  typename RefinementType::Pointer   m_Refinement;
+};
+} // namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#  include "itkAtlasBundleBuilder.hxx"
+#endif
+
+#endif // itkAtlasBundleBuilder_h
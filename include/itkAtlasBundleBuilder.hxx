@@ -0,0 +1,214 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkAtlasBundleBuilder_hxx
+#define itkAtlasBundleBuilder_hxx
+
+
+#include "itkBinaryThresholdImageFilter.h"
+#include "itkExtractImageFilter.h"
+#include "itkLinearLabelResampler.h"
+#include "itkMath.h"
+#include "itkSignedMaurerDistanceMapImageFilter.h"
+#include "itksys/SystemTools.hxx"
+
+#include <fstream>
+#include <sstream>
+
+namespace itk
+{
+template <typename TImage, typename TLabelImage>
+void
+AtlasBundleBuilder<TImage, TLabelImage>::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "Image: " << m_Image.GetPointer() << std::endl;
+  os << indent << "Labels: " << m_Labels.GetPointer() << std::endl;
+  os << indent << "NumberOfBones: " << m_Bones.size() << std::endl;
+  os << indent << "RegionOfInterestPadding: " << m_RegionOfInterestPadding << std::endl;
+  os << indent << "ComputeDistanceMaps: " << (m_ComputeDistanceMaps ? "On" : "Off") << std::endl;
+  os << indent << "Refinement: " << std::endl;
+  m_Refinement->Print(os, indent.GetNextIndent());
+}
+
+template <typename TImage, typename TLabelImage>
+template <typename TEntryImage>
+void
+AtlasBundleBuilder<TImage, TLabelImage>::WriteEntry(std::ostream &      data,
+                                                    std::ostream &      table,
+                                                    const TEntryImage * image)
+{
+  using PixelType = typename TEntryImage::PixelType;
+  auto                offset = static_cast<std::uint64_t>(data.tellp());
+  const std::uint64_t padding = (AtlasBundleDetail::Alignment - offset % AtlasBundleDetail::Alignment) %
+                                AtlasBundleDetail::Alignment;
+  const char          zeros[AtlasBundleDetail::Alignment] = {};
+  data.write(zeros, padding);
+  offset += padding;
+
+  const typename TEntryImage::RegionType region = image->GetBufferedRegion();
+  const std::uint64_t                    numberOfBytes = region.GetNumberOfPixels() * sizeof(PixelType);
+  data.write(reinterpret_cast<const char *>(image->GetBufferPointer()), numberOfBytes);
+
+  AtlasBundleDetail::WriteValue(table, AtlasBundleDetail::PixelTypeId<PixelType>());
+  for (unsigned d = 0; d < ImageDimension; d++)
+  {
+    AtlasBundleDetail::WriteValue<std::int64_t>(table, region.GetIndex(d));
+    AtlasBundleDetail::WriteValue<std::uint64_t>(table, region.GetSize(d));
+    AtlasBundleDetail::WriteValue<double>(table, image->GetSpacing()[d]);
+    AtlasBundleDetail::WriteValue<double>(table, image->GetOrigin()[d]);
+    for (unsigned e = 0; e < ImageDimension; e++)
+    {
+      AtlasBundleDetail::WriteValue<double>(table, image->GetDirection()(d, e));
+    }
+  }
+  AtlasBundleDetail::WriteValue<std::uint64_t>(table, offset);
+  AtlasBundleDetail::WriteValue<std::uint64_t>(table, numberOfBytes);
+}
+
+template <typename TImage, typename TLabelImage>
+void
+AtlasBundleBuilder<TImage, TLabelImage>::Write(const std::string & fileName) const
+{
+  itkAssertOrThrowMacro(m_Image && m_Labels, "Image and Labels must be set");
+  using RegionType = typename TLabelImage::RegionType;
+  using DistanceImageType = typename BundleType::DistanceImageType;
+  using MaskImageType = Image<unsigned char, ImageDimension>;
+
+  // the temporary file is removed when anything fails, including the filters, and renamed once it is complete
+  struct TemporaryFile
+  {
+    std::string   name;
+    std::ofstream out;
+    bool          renamed = false;
+    ~TemporaryFile()
+    {
+      if (!renamed)
+      {
+        out.close();
+        itksys::SystemTools::RemoveFile(name);
+      }
+    }
+  } temporary{ fileName + ".tmp", {} };
+  const std::string & temporaryName = temporary.name;
+  std::ofstream &     out = temporary.out;
+  out.open(temporaryName, std::ios::binary | std::ios::trunc);
+  if (!out)
+  {
+    itkExceptionMacro(<< "Could not open " << temporaryName);
+  }
+
+  // the number of bones and the offset of the table are filled in at the end
+  const auto numberOfPyramidLevels = static_cast<std::uint32_t>(m_Refinement->GetNumberOfResolutions());
+  out.write(AtlasBundleDetail::Magic, sizeof(AtlasBundleDetail::Magic));
+  AtlasBundleDetail::WriteValue(out, AtlasBundleDetail::ByteOrderMark);
+  AtlasBundleDetail::WriteValue(out, static_cast<std::uint32_t>(ImageDimension));
+  AtlasBundleDetail::WriteValue(out, numberOfPyramidLevels);
+  AtlasBundleDetail::WriteValue<std::uint32_t>(out, 0);
+  AtlasBundleDetail::WriteValue<std::uint64_t>(out, 0);
+
+  std::ostringstream table(std::ios::binary);
+  for (SizeValueType b = 0; b < m_Bones.size(); ++b)
+  {
+    const LabelType bone = m_Bones[b];
+    RegionType      roi = LinearLabelResampler<TLabelImage>::ComputeFootprint(m_Labels, bone);
+    if (roi.GetNumberOfPixels() == 0)
+    {
+      itkExceptionMacro(<< "Bone " << static_cast<typename NumericTraits<LabelType>::PrintType>(bone)
+                        << " does not occur in the labels");
+    }
+    typename RegionType::SizeType padding;
+    for (unsigned d = 0; d < ImageDimension; d++)
+    {
+      padding[d] = Math::Ceil<SizeValueType>(m_RegionOfInterestPadding / m_Labels->GetSpacing()[d]);
+    }
+    roi.PadByRadius(padding);
+    roi.Crop(m_Labels->GetLargestPossibleRegion());
+
+    using ImageExtractType = ExtractImageFilter<TImage, TImage>;
+    typename ImageExtractType::Pointer imageExtract = ImageExtractType::New();
+    imageExtract->SetInput(m_Image);
+    imageExtract->SetExtractionRegion(roi);
+    imageExtract->SetDirectionCollapseToSubmatrix();
+    imageExtract->Update();
+
+    using LabelExtractType = ExtractImageFilter<TLabelImage, TLabelImage>;
+    typename LabelExtractType::Pointer labelExtract = LabelExtractType::New();
+    labelExtract->SetInput(m_Labels);
+    labelExtract->SetExtractionRegion(roi);
+    labelExtract->SetDirectionCollapseToSubmatrix();
+    labelExtract->Update();
+
+    AtlasBundleDetail::WriteValue<std::int64_t>(table, bone);
+    AtlasBundleDetail::WriteValue(table, static_cast<std::uint32_t>(m_Landmarks[b].size()));
+    for (const auto & landmark : m_Landmarks[b])
+    {
+      for (unsigned d = 0; d < ImageDimension; d++)
+      {
+        AtlasBundleDetail::WriteValue<double>(table, landmark[d]);
+      }
+    }
+    WriteEntry(out, table, imageExtract->GetOutput());
+    WriteEntry(out, table, labelExtract->GetOutput());
+    for (const auto & level : m_Refinement->ComputePyramid(m_Image, roi))
+    {
+      WriteEntry(out, table, level.GetPointer());
+    }
+
+    AtlasBundleDetail::WriteValue<std::uint32_t>(table, m_ComputeDistanceMaps);
+    if (m_ComputeDistanceMaps)
+    {
+      using ThresholdType = BinaryThresholdImageFilter<TLabelImage, MaskImageType>;
+      typename ThresholdType::Pointer threshold = ThresholdType::New();
+      threshold->SetInput(labelExtract->GetOutput());
+      threshold->SetLowerThreshold(bone == 0 ? 1 : bone);
+      threshold->SetUpperThreshold(bone == 0 ? NumericTraits<LabelType>::max() : bone);
+      threshold->SetInsideValue(1);
+      threshold->SetOutsideValue(0);
+
+      using DistanceType = SignedMaurerDistanceMapImageFilter<MaskImageType, DistanceImageType>;
+      typename DistanceType::Pointer distance = DistanceType::New();
+      distance->SetInput(threshold->GetOutput());
+      distance->SetUseImageSpacing(true);
+      distance->SetSquaredDistance(false);
+      distance->SetInsideIsPositive(false);
+      distance->Update();
+      WriteEntry(out, table, distance->GetOutput());
+    }
+  }
+
+  const auto tableOffset = static_cast<std::uint64_t>(out.tellp());
+  const std::string tableBytes = table.str();
+  out.write(tableBytes.data(), tableBytes.size());
+  out.seekp(AtlasBundleDetail::PreambleSize - sizeof(std::uint32_t) - sizeof(std::uint64_t));
+  AtlasBundleDetail::WriteValue(out, static_cast<std::uint32_t>(m_Bones.size()));
+  AtlasBundleDetail::WriteValue(out, tableOffset);
+  out.close();
+  if (!out)
+  {
+    itkExceptionMacro(<< "Could not write " << temporaryName);
+  }
+  if (!itksys::SystemTools::RenameFile(temporaryName, fileName))
+  {
+    itkExceptionMacro(<< "Could not rename " << temporaryName << " to " << fileName);
+  }
+  temporary.renamed = true;
+}
+
+} // end namespace itk
+
+#endif // itkAtlasBundleBuilder_hxx
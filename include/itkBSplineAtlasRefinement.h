@@ -0,0 +1,152 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkBSplineAtlasRefinement_h
+#define itkBSplineAtlasRefinement_h
+
+#include "itkBSplineTransform.h"
+#include "itkCompositeTransform.h"
+#include "itkImage.h"
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+
+#include <vector>
+
+
+namespace itk
+{
+
+/** \class BSplineAtlasRefinement
+ *
+ * \brief Deformable refinement of an atlas-to-image transform by multi-resolution BSpline registration.
+ *
+ * The atlas image is registered to the image within a region of it, e.g. a bone's,
+ * starting from a transform such as the landmark-based rigid one. The metric is Mattes
+ * mutual information of the images cast to float, sampled at random points within
+ * the optional mask. Each of NumberOfResolutions levels halves the shrink factor and
+ * the spacing of the BSpline control points, down to ControlPointSpacing and full
+ * resolution at the last level. The metric is evaluated by multiple threads.
+ *
+ * Both images enter the registration as Gaussian pyramids, see ComputePyramid. Either
+ * pyramid can be computed once and passed to each call, e.g. the atlas's from an AtlasBundle,
+ * or the image's when several atlases are registered to it.
+ *
+ * The result maps image points to atlas points: the BSpline transform, defined over
+ * the region, followed by the initial transform. Refine can be called repeatedly.
+ *
+ * \ingroup HASI
+ */
+template <typename TImage>
+class BSplineAtlasRefinement : public Object
+{
+public:
+  ITK_DISALLOW_COPY_AND_MOVE(BSplineAtlasRefinement);
+
+  /** Standard class typedefs. */
+  using Self = BSplineAtlasRefinement;
+  using Superclass = Object;
+  using Pointer = SmartPointer<Self>;
+  using ConstPointer = SmartPointer<const Self>;
+
+  /** Run-time type information. */
+  itkOverrideGetNameOfClassMacro(BSplineAtlasRefinement);
+
+  /** Standard New macro. */
+  itkNewMacro(Self);
+
+  static constexpr unsigned int ImageDimension = TImage::ImageDimension;
+  using ImageType = TImage;
+  using RegionType = typename TImage::RegionType;
+  using MaskImageType = Image<unsigned char, ImageDimension>;
+  using TransformType = Transform<double, ImageDimension, ImageDimension>;
+  using BSplineTransformType = BSplineTransform<double, ImageDimension, 3>;
+  using CompositeTransformType = CompositeTransform<double, ImageDimension>;
+  using RealImageType = Image<float, ImageDimension>;
+  using PyramidType = std::vector<typename RealImageType::Pointer>;
+
+  /** Spacing of the BSpline control points at the last level, in physical units. Default is 1.0. */
+  itkSetMacro(ControlPointSpacing, double);
+  itkGetConstMacro(ControlPointSpacing, double);
+
+  /** Number of resolution levels. Default is 4. */
+  itkSetClampMacro(NumberOfResolutions, unsigned int, 1, 8);
+  itkGetConstMacro(NumberOfResolutions, unsigned int);
+
+  /** Maximum number of optimizer iterations at each level. Default is 100. */
+  itkSetMacro(NumberOfIterations, unsigned int);
+  itkGetConstMacro(NumberOfIterations, unsigned int);
+
+  /** Fraction of the voxels of each level which the metric samples. Default is 0.2. */
+  itkSetClampMacro(SamplingPercentage, double, 0.0001, 1.0);
+  itkGetConstMacro(SamplingPercentage, double);
+
+  /** Number of histogram bins of the metric. Default is 32. */
+  itkSetClampMacro(NumberOfHistogramBins, unsigned int, 4, 256);
+  itkGetConstMacro(NumberOfHistogramBins, unsigned int);
+
+  /** The levels of region of image as float, coarsest first. Each level is smoothed with a sigma of
+   * half its shrink factor, in voxels, and then shrunk. The last level is not smoothed. */
+  PyramidType
+  ComputePyramid(const TImage * image, const RegionType & region) const;
+
+  /** Register atlas to region of image, starting from initialTransform, which maps image points
+   * to atlas points. Only voxels where mask is non-zero are sampled, unless it is null.
+   * The mask must be on image's grid and cover region. */
+  typename CompositeTransformType::Pointer
+  Refine(const TImage *        image,
+         const TImage *        atlas,
+         const MaskImageType * mask,
+         const RegionType &    region,
+         TransformType *       initialTransform) const;
+
+  /** As above, with the atlas given by its pyramid, which must have NumberOfResolutions levels. */
+  typename CompositeTransformType::Pointer
+  Refine(const TImage *        image,
+         const PyramidType &   atlasPyramid,
+         const MaskImageType * mask,
+         const RegionType &    region,
+         TransformType *       initialTransform) const;
+
+  /** As above, with region of image also given by its pyramid, so that several atlases
+   * can be registered to it without recomputing it. Both pyramids must have NumberOfResolutions levels. */
+  typename CompositeTransformType::Pointer
+  Refine(const PyramidType &   fixedPyramid,
+         const PyramidType &   atlasPyramid,
+         const MaskImageType * mask,
+         TransformType *       initialTransform) const;
+
+protected:
+  BSplineAtlasRefinement() = default;
+  ~BSplineAtlasRefinement() override = default;
+
+  void
+  PrintSelf(std::ostream & os, Indent indent) const override;
+
+private:
+  double       m_ControlPointSpacing = 1.0;
+  unsigned int m_NumberOfResolutions = 4;
+  unsigned int m_NumberOfIterations = 100;
+  double       m_SamplingPercentage = 0.2;
+  unsigned int m_NumberOfHistogramBins = 32;
+};
+} // namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#  include "itkBSplineAtlasRefinement.hxx"
+#endif
+
+#endif // itkBSplineAtlasRefinement_h
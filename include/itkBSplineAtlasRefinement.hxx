@@ -0,0 +1,243 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkBSplineAtlasRefinement_hxx
+#define itkBSplineAtlasRefinement_hxx
+
+
+#include "itkBSplineTransformInitializer.h"
+#include "itkBSplineTransformParametersAdaptor.h"
+#include "itkCastImageFilter.h"
+#include "itkExtractImageFilter.h"
+#include "itkGradientDescentOptimizerv4.h"
+#include "itkImageMaskSpatialObject.h"
+#include "itkImageRegistrationMethodv4.h"
+#include "itkMath.h"
+#include "itkMattesMutualInformationImageToImageMetricv4.h"
+#include "itkRegistrationParameterScalesFromPhysicalShift.h"
+#include "itkShrinkImageFilter.h"
+#include "itkSmoothingRecursiveGaussianImageFilter.h"
+
+#include <algorithm>
+
+namespace itk
+{
+template <typename TImage>
+void
+BSplineAtlasRefinement<TImage>::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "ControlPointSpacing: " << m_ControlPointSpacing << std::endl;
+  os << indent << "NumberOfResolutions: " << m_NumberOfResolutions << std::endl;
+  os << indent << "NumberOfIterations: " << m_NumberOfIterations << std::endl;
+  os << indent << "SamplingPercentage: " << m_SamplingPercentage << std::endl;
+  os << indent << "NumberOfHistogramBins: " << m_NumberOfHistogramBins << std::endl;
+}
+
+template <typename TImage>
+auto
+BSplineAtlasRefinement<TImage>::ComputePyramid(const TImage * image, const RegionType & region) const -> PyramidType
+{
+  using ExtractFilterType = ExtractImageFilter<TImage, TImage>;
+  typename ExtractFilterType::Pointer extract = ExtractFilterType::New();
+  extract->SetInput(image);
+  extract->SetExtractionRegion(region);
+  extract->SetDirectionCollapseToSubmatrix();
+
+  using CastFilterType = CastImageFilter<TImage, RealImageType>;
+  typename CastFilterType::Pointer cast = CastFilterType::New();
+  cast->SetInput(extract->GetOutput());
+  cast->Update();
+  typename RealImageType::Pointer full = cast->GetOutput();
+  full->DisconnectPipeline();
+
+  const unsigned int levels = m_NumberOfResolutions;
+  PyramidType        pyramid(levels);
+  for (unsigned level = 0; level < levels; ++level)
+  {
+    const unsigned shrink = 1u << (levels - 1 - level);
+    if (shrink == 1)
+    {
+      pyramid[level] = full;
+      continue;
+    }
+
+    using SmoothingFilterType = SmoothingRecursiveGaussianImageFilter<RealImageType, RealImageType>;
+    typename SmoothingFilterType::Pointer        smoother = SmoothingFilterType::New();
+    typename SmoothingFilterType::SigmaArrayType sigmas;
+    for (unsigned d = 0; d < ImageDimension; d++)
+    {
+      sigmas[d] = 0.5 * shrink * full->GetSpacing()[d];
+    }
+    smoother->SetSigmaArray(sigmas);
+    smoother->SetInput(full);
+
+    using ShrinkFilterType = ShrinkImageFilter<RealImageType, RealImageType>;
+    typename ShrinkFilterType::Pointer shrinker = ShrinkFilterType::New();
+    shrinker->SetShrinkFactors(shrink);
+    shrinker->SetInput(smoother->GetOutput());
+    shrinker->Update();
+    pyramid[level] = shrinker->GetOutput();
+    pyramid[level]->DisconnectPipeline();
+  }
+  return pyramid;
+}
+
+template <typename TImage>
+auto
+BSplineAtlasRefinement<TImage>::Refine(const TImage *        image,
+                                       const TImage *        atlas,
+                                       const MaskImageType * mask,
+                                       const RegionType &    region,
+                                       TransformType *       initialTransform) const ->
+  typename CompositeTransformType::Pointer
+{
+  return this->Refine(image, this->ComputePyramid(atlas, atlas->GetBufferedRegion()), mask, region, initialTransform);
+}
+
+template <typename TImage>
+auto
+BSplineAtlasRefinement<TImage>::Refine(const TImage *        image,
+                                       const PyramidType &   atlasPyramid,
+                                       const MaskImageType * mask,
+                                       const RegionType &    region,
+                                       TransformType *       initialTransform) const ->
+  typename CompositeTransformType::Pointer
+{
+  return this->Refine(this->ComputePyramid(image, region), atlasPyramid, mask, initialTransform);
+}
+
+template <typename TImage>
+auto
+BSplineAtlasRefinement<TImage>::Refine(const PyramidType &   fixedPyramid,
+                                       const PyramidType &   atlasPyramid,
+                                       const MaskImageType * mask,
+                                       TransformType *       initialTransform) const ->
+  typename CompositeTransformType::Pointer
+{
+  using MetricType = MattesMutualInformationImageToImageMetricv4<RealImageType, RealImageType>;
+  using OptimizerType = GradientDescentOptimizerv4;
+  using ScalesEstimatorType = RegistrationParameterScalesFromPhysicalShift<MetricType>;
+  using RegistrationType = ImageRegistrationMethodv4<RealImageType, RealImageType, BSplineTransformType>;
+
+  const unsigned int levels = m_NumberOfResolutions;
+  itkAssertOrThrowMacro(fixedPyramid.size() == levels, "The image pyramid must have NumberOfResolutions levels");
+  itkAssertOrThrowMacro(atlasPyramid.size() == levels, "The atlas pyramid must have NumberOfResolutions levels");
+
+  // control points double along each axis from one level to the next
+  const RealImageType *                       full = fixedPyramid.back();
+  typename BSplineTransformType::MeshSizeType coarsestMesh;
+  for (unsigned d = 0; d < ImageDimension; d++)
+  {
+    const double extent = full->GetBufferedRegion().GetSize(d) * full->GetSpacing()[d];
+    const double coarsestSpacing = m_ControlPointSpacing * (1u << (levels - 1));
+    coarsestMesh[d] = std::max<SizeValueType>(1, Math::Ceil<SizeValueType>(extent / coarsestSpacing));
+  }
+
+  typename BSplineTransformType::Pointer bspline = BSplineTransformType::New();
+  using InitializerType = BSplineTransformInitializer<BSplineTransformType, RealImageType>;
+  typename InitializerType::Pointer initializer = InitializerType::New();
+  initializer->SetTransform(bspline);
+  initializer->SetImage(full);
+  initializer->SetTransformDomainMeshSize(coarsestMesh);
+  initializer->InitializeTransform();
+  bspline->SetIdentity();
+
+  using SpatialMaskType = ImageMaskSpatialObject<ImageDimension>;
+  typename SpatialMaskType::Pointer spatialMask;
+  if (mask)
+  {
+    spatialMask = SpatialMaskType::New();
+    spatialMask->SetImage(mask);
+    spatialMask->Update();
+  }
+
+  // the pyramids are already smoothed and shrunk, so each level is a single-level registration
+  for (unsigned level = 0; level < levels; ++level)
+  {
+    if (level > 0)
+    {
+      using AdaptorType = BSplineTransformParametersAdaptor<BSplineTransformType>;
+      typename BSplineTransformType::MeshSizeType mesh;
+      for (unsigned d = 0; d < ImageDimension; d++)
+      {
+        mesh[d] = coarsestMesh[d] << level;
+      }
+      typename AdaptorType::Pointer adaptor = AdaptorType::New();
+      adaptor->SetTransform(bspline);
+      adaptor->SetRequiredTransformDomainOrigin(bspline->GetTransformDomainOrigin());
+      adaptor->SetRequiredTransformDomainDirection(bspline->GetTransformDomainDirection());
+      adaptor->SetRequiredTransformDomainPhysicalDimensions(bspline->GetTransformDomainPhysicalDimensions());
+      adaptor->SetRequiredTransformDomainMeshSize(mesh);
+      adaptor->AdaptTransformParameters();
+    }
+
+    // image gradients are computed where sampled, instead of over the whole atlas
+    typename MetricType::Pointer metric = MetricType::New();
+    metric->SetNumberOfHistogramBins(m_NumberOfHistogramBins);
+    metric->SetUseFixedImageGradientFilter(false);
+    metric->SetUseMovingImageGradientFilter(false);
+    if (spatialMask)
+    {
+      metric->SetFixedImageMask(spatialMask);
+    }
+
+    typename ScalesEstimatorType::Pointer scalesEstimator = ScalesEstimatorType::New();
+    scalesEstimator->SetMetric(metric);
+    scalesEstimator->SetTransformForward(true);
+
+    typename OptimizerType::Pointer optimizer = OptimizerType::New();
+    optimizer->SetScalesEstimator(scalesEstimator);
+    optimizer->SetNumberOfIterations(m_NumberOfIterations);
+    optimizer->SetDoEstimateLearningRateOnce(false);
+    optimizer->SetDoEstimateLearningRateAtEachIteration(true);
+    optimizer->SetMinimumConvergenceValue(1e-6);
+    optimizer->SetConvergenceWindowSize(10);
+
+    typename RegistrationType::ShrinkFactorsArrayType   shrinkFactors(1);
+    typename RegistrationType::SmoothingSigmasArrayType smoothingSigmas(1);
+    shrinkFactors[0] = 1;
+    smoothingSigmas[0] = 0.0;
+
+    typename RegistrationType::Pointer registration = RegistrationType::New();
+    registration->SetFixedImage(fixedPyramid[level]);
+    registration->SetMovingImage(atlasPyramid[level]);
+    registration->SetMetric(metric);
+    registration->SetOptimizer(optimizer);
+    registration->SetMovingInitialTransform(initialTransform);
+    registration->SetInitialTransform(bspline);
+    registration->InPlaceOn();
+    registration->SetNumberOfLevels(1);
+    registration->SetShrinkFactorsPerLevel(shrinkFactors);
+    registration->SetSmoothingSigmasPerLevel(smoothingSigmas);
+
+    // random samples within the mask, the same ones for each call
+    registration->SetMetricSamplingStrategy(RegistrationType::MetricSamplingStrategyEnum::RANDOM);
+    registration->SetMetricSamplingPercentage(m_SamplingPercentage);
+    registration->MetricSamplingReinitializeSeed(121213 + level);
+    registration->Update();
+  }
+
+  typename CompositeTransformType::Pointer result = CompositeTransformType::New();
+  result->AddTransform(initialTransform);
+  result->AddTransform(bspline); // applied first
+  return result;
+}
+
+} // end namespace itk
+
+#endif // itkBSplineAtlasRefinement_hxx
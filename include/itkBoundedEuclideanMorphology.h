@@ -0,0 +1,168 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkBoundedEuclideanMorphology_h
+#define itkBoundedEuclideanMorphology_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+
+#include <vector>
+
+
+namespace itk
+{
+
+/** \class BoundedEuclideanMorphology
+ *
+ * \brief Binary dilation and erosion by a Euclidean ball, in physical units.
+ *
+ * The results are identical to thresholding the squared output of
+ * SignedMaurerDistanceMapImageFilter (with image spacing):
+ * Dilate(mask, r) keeps voxels whose signed squared distance is at most r*r,
+ * while Erode(mask, r) keeps voxels whose signed squared distance
+ * in the negated mask is at least r*r.
+ * As there, a mask without contour, all foreground or all background, is at the largest
+ * distance everywhere: Dilate clears it and Erode fills it, whatever the radius.
+ * The same separable lower-envelope passes are carried out in the same floating-point arithmetic,
+ * but distances beyond the radius are never propagated and the last pass writes the binary result
+ * directly, without a distance map or intermediate filters.
+ *
+ * The object keeps its distance buffer between calls,
+ * so it should be reused for a sequence of operations on similar regions.
+ * Chains of operations, such as closing and opening, run on a single output image,
+ * each step thresholding in place, so no intermediate images are allocated.
+ * Non-zero pixels of the input are foreground. The output has the input's buffered region.
+ *
+ * \ingroup HASI
+ */
+template <typename TImage>
+class BoundedEuclideanMorphology : public Object
+{
+public:
+  ITK_DISALLOW_COPY_AND_MOVE(BoundedEuclideanMorphology);
+
+  /** Standard class typedefs. */
+  using Self = BoundedEuclideanMorphology;
+  using Superclass = Object;
+  using Pointer = SmartPointer<Self>;
+  using ConstPointer = SmartPointer<const Self>;
+
+  /** Run-time type information. */
+  itkOverrideGetNameOfClassMacro(BoundedEuclideanMorphology);
+
+  /** Standard New macro. */
+  itkNewMacro(Self);
+
+  static constexpr unsigned int ImageDimension = TImage::ImageDimension;
+  using ImageType = TImage;
+  using RegionType = typename TImage::RegionType;
+  using IndexType = typename TImage::IndexType;
+  using DistanceType = float; // the pixel type of the distance map being emulated
+
+  /** One step of a chain: dilation (erode == false) or erosion by radius. */
+  struct Operation
+  {
+    bool   erode;
+    double radius;
+  };
+  using OperationListType = std::vector<Operation>;
+
+  /** Foreground, plus background voxels within radius of foreground. */
+  typename TImage::Pointer
+  Dilate(const TImage * mask, double radius);
+
+  /** Foreground voxels which are at least radius away from background. */
+  typename TImage::Pointer
+  Erode(const TImage * mask, double radius);
+
+  /** Dilation followed by erosion. The radii may differ. */
+  typename TImage::Pointer
+  Close(const TImage * mask, double dilationRadius, double erosionRadius);
+
+  /** Erosion followed by dilation. The radii may differ. */
+  typename TImage::Pointer
+  Open(const TImage * mask, double erosionRadius, double dilationRadius);
+
+  /** Apply the operations in order, into a single new image. */
+  typename TImage::Pointer
+  Apply(const TImage * mask, const OperationListType & operations);
+
+  /** Apply the operations in order, into output, which must have the mask's buffered region. */
+  void
+  Apply(const TImage * mask, const OperationListType & operations, TImage * output);
+
+  /** Apply the operations in order, overwriting mask with the result. */
+  void
+  ApplyInPlace(TImage * mask, const OperationListType & operations);
+
+protected:
+  BoundedEuclideanMorphology() = default;
+  ~BoundedEuclideanMorphology() override = default;
+
+  void
+  PrintSelf(std::ostream & os, Indent indent) const override;
+
+  // squared distances to the contour of foreground (erode=false) or background (erode=true),
+  // thresholded at radius squared into output, which may be the mask itself
+  void
+  Compute(const TImage * mask, bool erode, double radius, TImage * output);
+
+  // one pass of Maurer's Voronoi lower envelope along dimension d, over lines starting in lineStarts
+  // the last pass writes the thresholded result into output, the others update the distances
+  void
+  VoronoiPass(unsigned int       d,
+              const RegionType & lineStarts,
+              const TImage *     mask,
+              bool               erode,
+              DistanceType       threshold,
+              TImage *           output);
+
+  // whether site 2 is hidden by sites 1 and f, as in SignedMaurerDistanceMapImageFilter
+  static bool
+  Remove(DistanceType d1, DistanceType d2, DistanceType df, DistanceType x1, DistanceType x2, DistanceType xf)
+  {
+    const DistanceType a = x2 - x1;
+    const DistanceType b = xf - x2;
+    const DistanceType c = xf - x1;
+    return (c * d2 - b * d1 - a * df - a * b * c) > 0;
+  }
+
+  OffsetValueType
+  ComputeOffset(const IndexType & index) const
+  {
+    OffsetValueType offset = 0;
+    for (unsigned d = 0; d < ImageDimension; d++)
+    {
+      offset += (index[d] - m_Region.GetIndex(d)) * m_Strides[d];
+    }
+    return offset;
+  }
+
+private:
+  std::vector<DistanceType> m_Distance; // squared distances over the mask's buffered region
+  RegionType                m_Region;
+  double                    m_Spacing[ImageDimension];
+  OffsetValueType           m_Strides[ImageDimension];
+};
+} // namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#  include "itkBoundedEuclideanMorphology.hxx"
+#endif
+
+#endif // itkBoundedEuclideanMorphology_h
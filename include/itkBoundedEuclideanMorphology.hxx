@@ -0,0 +1,306 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkBoundedEuclideanMorphology_hxx
+#define itkBoundedEuclideanMorphology_hxx
+
+
+#include "itkImageAlgorithm.h"
+#include "itkImageRegionIndexRange.h"
+#include "itkMultiThreaderBase.h"
+#include "itkNumericTraits.h"
+
+#include <algorithm>
+
+namespace itk
+{
+template <typename TImage>
+void
+BoundedEuclideanMorphology<TImage>::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "Region: " << m_Region << std::endl;
+  os << indent << "DistanceBufferSize: " << m_Distance.size() << std::endl;
+}
+
+template <typename TImage>
+typename TImage::Pointer
+BoundedEuclideanMorphology<TImage>::Dilate(const TImage * mask, double radius)
+{
+  return this->Apply(mask, { { false, radius } });
+}
+
+template <typename TImage>
+typename TImage::Pointer
+BoundedEuclideanMorphology<TImage>::Erode(const TImage * mask, double radius)
+{
+  return this->Apply(mask, { { true, radius } });
+}
+
+template <typename TImage>
+typename TImage::Pointer
+BoundedEuclideanMorphology<TImage>::Close(const TImage * mask, double dilationRadius, double erosionRadius)
+{
+  return this->Apply(mask, { { false, dilationRadius }, { true, erosionRadius } });
+}
+
+template <typename TImage>
+typename TImage::Pointer
+BoundedEuclideanMorphology<TImage>::Open(const TImage * mask, double erosionRadius, double dilationRadius)
+{
+  return this->Apply(mask, { { true, erosionRadius }, { false, dilationRadius } });
+}
+
+template <typename TImage>
+typename TImage::Pointer
+BoundedEuclideanMorphology<TImage>::Apply(const TImage * mask, const OperationListType & operations)
+{
+  typename TImage::Pointer output = TImage::New();
+  output->CopyInformation(mask);
+  output->SetRegions(mask->GetBufferedRegion());
+  output->Allocate();
+  this->Apply(mask, operations, output);
+  return output;
+}
+
+template <typename TImage>
+void
+BoundedEuclideanMorphology<TImage>::Apply(const TImage * mask, const OperationListType & operations, TImage * output)
+{
+  itkAssertOrThrowMacro(output->GetBufferedRegion() == mask->GetBufferedRegion(),
+                        "The output must have the mask's buffered region");
+  if (operations.empty())
+  {
+    ImageAlgorithm::Copy(mask, output, mask->GetBufferedRegion(), mask->GetBufferedRegion());
+    return;
+  }
+
+  // the first step reads the mask, the rest update the output in place
+  this->Compute(mask, operations[0].erode, operations[0].radius, output);
+  this->ApplyInPlace(output, OperationListType(operations.begin() + 1, operations.end()));
+}
+
+template <typename TImage>
+void
+BoundedEuclideanMorphology<TImage>::ApplyInPlace(TImage * mask, const OperationListType & operations)
+{
+  for (const Operation & operation : operations)
+  {
+    this->Compute(mask, operation.erode, operation.radius, mask);
+  }
+}
+
+template <typename TImage>
+void
+BoundedEuclideanMorphology<TImage>::Compute(const TImage * mask, bool erode, double radius, TImage * output)
+{
+  m_Region = mask->GetBufferedRegion();
+  OffsetValueType stride = 1;
+  for (unsigned d = 0; d < ImageDimension; d++)
+  {
+    m_Spacing[d] = mask->GetSpacing()[d];
+    m_Strides[d] = stride;
+    stride *= m_Region.GetSize(d);
+  }
+
+  // the same rounding as thresholding a float distance map at radius squared
+  const DistanceType threshold = static_cast<DistanceType>(radius * radius);
+
+  // a mask which is all foreground or all background has no contour, so SignedMaurerDistanceMapImageFilter
+  // leaves the largest distance, unsigned, everywhere: dilation clears every voxel and erosion sets every voxel
+  const typename TImage::PixelType * maskBuffer = mask->GetBufferPointer();
+  const SizeValueType                numberOfPixels = m_Region.GetNumberOfPixels();
+  if (std::all_of(maskBuffer, maskBuffer + numberOfPixels, [maskBuffer](typename TImage::PixelType value) {
+        return (value != 0) == (maskBuffer[0] != 0);
+      }))
+  {
+    std::fill_n(output->GetBufferPointer(), numberOfPixels, erode ? 1 : 0);
+    return;
+  }
+  if (!erode && radius == 0.0)
+  {
+    // identity, unlike erosion by zero which adds the contour of background
+    if (output != mask)
+    {
+      ImageAlgorithm::Copy(mask, output, m_Region, m_Region);
+    }
+    return;
+  }
+  m_Distance.resize(numberOfPixels);
+
+  // the contour is distance zero, as computed by BinaryContourImageFilter (fully connected),
+  // erosion measures distance from the contour of background
+  std::vector<OffsetValueType> neighborOffsets;
+  std::vector<IndexType>       neighborDeltas;
+
+  unsigned neighborhoodSize = 1;
+  for (unsigned d = 0; d < ImageDimension; d++)
+  {
+    neighborhoodSize *= 3;
+  }
+  for (unsigned k = 0; k < neighborhoodSize; ++k)
+  {
+    IndexType       delta;
+    OffsetValueType offset = 0;
+    unsigned        digits = k;
+    for (unsigned d = 0; d < ImageDimension; d++, digits /= 3)
+    {
+      delta[d] = IndexValueType(digits % 3) - 1;
+      offset += delta[d] * m_Strides[d];
+    }
+    if (offset != 0)
+    {
+      neighborOffsets.push_back(offset);
+      neighborDeltas.push_back(delta);
+    }
+  }
+
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegion<ImageDimension>(
+    m_Region,
+    [this, maskBuffer, erode, &neighborOffsets, &neighborDeltas](const RegionType & region) {
+      const IndexType lower = m_Region.GetIndex();
+      const IndexType upper = m_Region.GetUpperIndex();
+      for (const IndexType & index : ImageRegionIndexRange<ImageDimension>(region))
+      {
+        const OffsetValueType offset = this->ComputeOffset(index);
+        DistanceType          distance = NumericTraits<DistanceType>::max();
+        if ((maskBuffer[offset] != 0) != erode)
+        {
+          for (unsigned k = 0; k < neighborOffsets.size(); ++k)
+          {
+            bool inside = true;
+            for (unsigned d = 0; d < ImageDimension; d++)
+            {
+              IndexValueType n = index[d] + neighborDeltas[k][d];
+              inside = inside && n >= lower[d] && n <= upper[d];
+            }
+            if (inside && (maskBuffer[offset + neighborOffsets[k]] != 0) == erode)
+            {
+              distance = 0;
+              break;
+            }
+          }
+        }
+        m_Distance[offset] = distance;
+      }
+    },
+    nullptr);
+
+  for (unsigned d = 0; d < ImageDimension; d++)
+  {
+    const bool last = d == ImageDimension - 1;
+    mt->ParallelizeImageRegionRestrictDirection<ImageDimension>(
+      d,
+      m_Region,
+      [this, d, threshold, mask, erode, last, output](const RegionType & region) {
+        RegionType lineStarts = region;
+        lineStarts.SetSize(d, 1);
+        this->VoronoiPass(d, lineStarts, mask, erode, threshold, last ? output : nullptr);
+      },
+      nullptr);
+  }
+}
+
+template <typename TImage>
+void
+BoundedEuclideanMorphology<TImage>::VoronoiPass(unsigned int       d,
+                                                const RegionType & lineStarts,
+                                                const TImage *     mask,
+                                                bool               erode,
+                                                DistanceType       threshold,
+                                                TImage *           output)
+{
+  using PixelType = typename TImage::PixelType;
+
+  const SizeValueType   nd = m_Region.GetSize(d);
+  const OffsetValueType stride = m_Strides[d];
+  const DistanceType    spacing = static_cast<DistanceType>(m_Spacing[d]);
+
+  const PixelType * maskBuffer = mask->GetBufferPointer();
+  PixelType *       outBuffer = output ? output->GetBufferPointer() : nullptr;
+
+  // sites of the lower envelope: squared distance and position
+  std::vector<DistanceType> g(nd);
+  std::vector<DistanceType> h(nd);
+
+  for (const IndexType & start : ImageRegionIndexRange<ImageDimension>(lineStarts))
+  {
+    const OffsetValueType lineOffset = this->ComputeOffset(start);
+    DistanceType *        line = m_Distance.data() + lineOffset;
+
+    int l = -1;
+    for (unsigned int i = 0; i < nd; ++i)
+    {
+      const DistanceType di = line[i * stride];
+      if (di <= threshold) // farther sites cannot bring any voxel within the radius
+      {
+        const DistanceType iw = i * spacing;
+        while (l >= 1 && Remove(g[l - 1], g[l], di, h[l - 1], h[l], iw))
+        {
+          --l;
+        }
+        ++l;
+        g[l] = di;
+        h[l] = iw;
+      }
+    }
+
+    if (l == -1 && !output)
+    {
+      continue; // no sites, so all the distances stay beyond the radius
+    }
+
+    const int ns = l;
+    l = 0;
+    for (unsigned int i = 0; i < nd; ++i)
+    {
+      DistanceType d1 = NumericTraits<DistanceType>::max();
+      if (ns >= 0)
+      {
+        const DistanceType iw = i * spacing;
+        d1 = g[l] + (h[l] - iw) * (h[l] - iw);
+        while (l < ns)
+        {
+          const DistanceType d2 = g[l + 1] + (h[l + 1] - iw) * (h[l + 1] - iw);
+          if (d1 <= d2)
+          {
+            break;
+          }
+          ++l;
+          d1 = d2;
+        }
+      }
+
+      const OffsetValueType offset = lineOffset + i * stride;
+      if (!output)
+      {
+        line[i * stride] = d1;
+        continue;
+      }
+
+      // signed distance as in SignedMaurerDistanceMapImageFilter, thresholded
+      const bool         inside = (maskBuffer[offset] != 0) != erode;
+      const DistanceType value = inside ? -d1 : d1;
+      outBuffer[offset] = (erode ? value >= threshold : value <= threshold) ? 1 : 0;
+    }
+  }
+}
+
+} // end namespace itk
+
+#endif // itkBoundedEuclideanMorphology_hxx
@@ -0,0 +1,154 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkImageBufferPool_h
+#define itkImageBufferPool_h
+
+#include "itkImage.h"
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+
+namespace itk
+{
+
+/** \class ImageBufferPool
+ *
+ * \brief Recycles the buffers of short-lived images of varying sizes.
+ *
+ * Acquire returns an image whose pixel container borrows a buffer from the pool.
+ * When the container is destroyed, because the image is released or reallocated,
+ * the buffer goes back to the pool instead of to the allocator, and the next
+ * acquired image of its size class reuses it. Buffers are allocated in size classes
+ * of 4, 5, 6 or 7 times a power of two, so at most a fifth of a buffer is unused
+ * and images of similar sizes share buffers. An image takes a retained buffer of its
+ * own size class or of the next larger one, but never a much larger buffer.
+ *
+ * Zero-initialization only covers the acquired image's pixels, not the whole buffer.
+ * Images can be acquired and released concurrently.
+ *
+ * \ingroup HASI
+ */
+template <unsigned int VImageDimension>
+class ImageBufferPool : public Object
+{
+public:
+  ITK_DISALLOW_COPY_AND_MOVE(ImageBufferPool);
+
+  /** Standard class typedefs. */
+  using Self = ImageBufferPool;
+  using Superclass = Object;
+  using Pointer = SmartPointer<Self>;
+  using ConstPointer = SmartPointer<const Self>;
+
+  /** Run-time type information. */
+  itkOverrideGetNameOfClassMacro(ImageBufferPool);
+
+  /** Standard New macro. */
+  itkNewMacro(Self);
+
+  static constexpr unsigned int ImageDimension = VImageDimension;
+  using RegionType = ImageRegion<ImageDimension>;
+
+  /** Buffers which would make the pool hold more than this many bytes are freed instead of being
+   * retained, zero means no limit. */
+  itkSetMacro(MaximumRetainedBytes, SizeValueType);
+  itkGetConstMacro(MaximumRetainedBytes, SizeValueType);
+
+  /** Bytes of the buffers which are currently retained for reuse. */
+  SizeValueType
+  GetRetainedBytes() const;
+
+  /** A new image with reference's geometry, buffered over region, whose buffer comes from the pool.
+   * The pixels are zeroed if initialize is true, otherwise their values are undefined. */
+  template <typename TImage>
+  typename TImage::Pointer
+  Acquire(const ImageBase<ImageDimension> * reference, const RegionType & region, bool initialize);
+
+protected:
+  ImageBufferPool() = default;
+  ~ImageBufferPool() override = default;
+
+  void
+  PrintSelf(std::ostream & os, Indent indent) const override;
+
+  using BufferType = std::unique_ptr<char[]>;
+
+  // the smallest size class which holds numberOfBytes
+  static SizeValueType
+  GetSizeClass(SizeValueType numberOfBytes);
+
+  // the smallest retained buffer of the size class of numberOfBytes or the next one, or a new one of its size class
+  BufferType
+  Take(SizeValueType numberOfBytes, SizeValueType & capacity);
+
+  // retain the buffer for reuse, or free it if the pool would hold too much
+  void
+  Give(BufferType buffer, SizeValueType capacity);
+
+  // pixel container which gives its buffer back to the pool when it is destroyed
+  template <typename TPixelContainer>
+  class PooledPixelContainer : public TPixelContainer
+  {
+  public:
+    ITK_DISALLOW_COPY_AND_MOVE(PooledPixelContainer);
+
+    using Self = PooledPixelContainer;
+    using Pointer = SmartPointer<Self>;
+    itkNewMacro(Self);
+
+    void
+    SetBuffer(ImageBufferPool * pool, BufferType buffer, SizeValueType capacity)
+    {
+      m_Pool = pool;
+      m_Buffer = std::move(buffer);
+      m_Capacity = capacity;
+    }
+
+  protected:
+    PooledPixelContainer() = default;
+    ~PooledPixelContainer() override
+    {
+      if (m_Pool)
+      {
+        m_Pool->Give(std::move(m_Buffer), m_Capacity);
+      }
+    }
+
+  private:
+    typename ImageBufferPool::Pointer m_Pool;
+    BufferType                        m_Buffer;
+    SizeValueType                     m_Capacity = 0;
+  };
+
+private:
+  std::multimap<SizeValueType, BufferType> m_Buffers; // by capacity
+  SizeValueType                            m_RetainedBytes = 0;
+  SizeValueType                            m_MaximumRetainedBytes = 0;
+  mutable std::mutex                       m_Mutex;
+};
+} // namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#  include "itkImageBufferPool.hxx"
+#endif
+
+#endif // itkImageBufferPool_h
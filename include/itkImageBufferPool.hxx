@@ -0,0 +1,139 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkImageBufferPool_hxx
+#define itkImageBufferPool_hxx
+
+
+#include "itkMultiThreaderBase.h"
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+namespace itk
+{
+template <unsigned int VImageDimension>
+void
+ImageBufferPool<VImageDimension>::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "MaximumRetainedBytes: " << m_MaximumRetainedBytes << std::endl;
+  os << indent << "RetainedBytes: " << this->GetRetainedBytes() << std::endl;
+}
+
+template <unsigned int VImageDimension>
+SizeValueType
+ImageBufferPool<VImageDimension>::GetRetainedBytes() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_RetainedBytes;
+}
+
+template <unsigned int VImageDimension>
+SizeValueType
+ImageBufferPool<VImageDimension>::GetSizeClass(SizeValueType numberOfBytes)
+{
+  // units of a quarter of the largest power of two which is not above numberOfBytes
+  SizeValueType unit = 1;
+  while (unit * 8 <= numberOfBytes)
+  {
+    unit *= 2;
+  }
+  return std::max<SizeValueType>((numberOfBytes + unit - 1) / unit, 4) * unit;
+}
+
+template <unsigned int VImageDimension>
+auto
+ImageBufferPool<VImageDimension>::Take(SizeValueType numberOfBytes, SizeValueType & capacity) -> BufferType
+{
+  {
+    // buffers of the same size class or the next one, so that small images do not hold on to large buffers
+    const SizeValueType         sizeClass = GetSizeClass(numberOfBytes);
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    auto                        retained = m_Buffers.lower_bound(sizeClass);
+    if (retained != m_Buffers.end() && retained->first <= GetSizeClass(sizeClass + 1))
+    {
+      capacity = retained->first;
+      BufferType buffer = std::move(retained->second);
+      m_Buffers.erase(retained);
+      m_RetainedBytes -= capacity;
+      return buffer;
+    }
+  }
+  capacity = GetSizeClass(numberOfBytes);
+  return BufferType(new char[capacity]);
+}
+
+template <unsigned int VImageDimension>
+void
+ImageBufferPool<VImageDimension>::Give(BufferType buffer, SizeValueType capacity)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (m_MaximumRetainedBytes > 0 && m_RetainedBytes + capacity > m_MaximumRetainedBytes)
+  {
+    return; // freed as it goes out of scope
+  }
+  m_Buffers.emplace(capacity, std::move(buffer));
+  m_RetainedBytes += capacity;
+}
+
+template <unsigned int VImageDimension>
+template <typename TImage>
+typename TImage::Pointer
+ImageBufferPool<VImageDimension>::Acquire(const ImageBase<ImageDimension> * reference,
+                                          const RegionType &                region,
+                                          bool                              initialize)
+{
+  using PixelType = typename TImage::PixelType;
+  static_assert(std::is_trivially_copyable<PixelType>::value, "Pooled pixels are not constructed or destroyed");
+
+  const SizeValueType numberOfPixels = region.GetNumberOfPixels();
+  const SizeValueType numberOfBytes = numberOfPixels * sizeof(PixelType);
+  SizeValueType       capacity;
+  BufferType          buffer = this->Take(numberOfBytes, capacity);
+  char *              bytes = buffer.get();
+  if (initialize)
+  {
+    // in 1 MiB blocks, so large images are zeroed by all threads
+    constexpr SizeValueType    blockSize = 1 << 20;
+    MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+    mt->ParallelizeArray(
+      0,
+      (numberOfBytes + blockSize - 1) / blockSize,
+      [&](SizeValueType block) {
+        const SizeValueType begin = block * blockSize;
+        std::memset(bytes + begin, 0, std::min(blockSize, numberOfBytes - begin));
+      },
+      nullptr);
+  }
+
+  using ContainerType = PooledPixelContainer<typename TImage::PixelContainer>;
+  typename ContainerType::Pointer container = ContainerType::New();
+  container->SetImportPointer(reinterpret_cast<PixelType *>(bytes), numberOfPixels, false);
+  container->SetBuffer(this, std::move(buffer), capacity);
+
+  typename TImage::Pointer image = TImage::New();
+  image->CopyInformation(reference);
+  image->SetRegions(region);
+  image->SetPixelContainer(container);
+  return image;
+}
+
+} // end namespace itk
+
+#endif // itkImageBufferPool_hxx
@@ -0,0 +1,116 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkLabelVoteAccumulator_h
+#define itkLabelVoteAccumulator_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+
+#include <mutex>
+#include <vector>
+
+
+namespace itk
+{
+
+/** \class LabelVoteAccumulator
+ *
+ * \brief Per-voxel majority voting of label images, which are added one at a time.
+ *
+ * Each added label image votes for its label in every voxel of the voting region, zero
+ * is background. Only the votes for labels 1 to MaximumLabel are stored, one byte per label
+ * and voxel, the votes for background are what remains of the number of voters. So a label
+ * image can be discarded as soon as it is added, and label images which only cover part of
+ * the voting region, e.g. the part an atlas maps onto, vote for background elsewhere.
+ *
+ * Images can be added from several threads, they are added one at a time.
+ *
+ * \ingroup HASI
+ */
+template <typename TLabelImage>
+class LabelVoteAccumulator : public Object
+{
+public:
+  ITK_DISALLOW_COPY_AND_MOVE(LabelVoteAccumulator);
+
+  /** Standard class typedefs. */
+  using Self = LabelVoteAccumulator;
+  using Superclass = Object;
+  using Pointer = SmartPointer<Self>;
+  using ConstPointer = SmartPointer<const Self>;
+
+  /** Run-time type information. */
+  itkOverrideGetNameOfClassMacro(LabelVoteAccumulator);
+
+  /** Standard New macro. */
+  itkNewMacro(Self);
+
+  static constexpr unsigned int ImageDimension = TLabelImage::ImageDimension;
+  using LabelImageType = TLabelImage;
+  using LabelType = typename TLabelImage::PixelType;
+  using RegionType = typename TLabelImage::RegionType;
+  using IndexType = typename TLabelImage::IndexType;
+  using VoteType = unsigned char;
+
+  /** Largest label found in region of labels, zero if there are none. */
+  static LabelType
+  ComputeMaximumLabel(const TLabelImage * labels, const RegionType & region);
+
+  /** Discard the votes, and prepare to count votes for labels 1 to maximumLabel within region. */
+  void
+  Initialize(const RegionType & region, LabelType maximumLabel);
+
+  /** Add the votes of the buffered region of labels, which can differ from the voting region.
+   * Negative labels, labels above MaximumLabel and, with a real pixel type, fractional labels are an error. */
+  void
+  AddVotes(const TLabelImage * labels);
+
+  /** Write the label with the most votes to each voxel of output's buffered region, zero outside
+   * of the voting region. Ties go to the smaller label, background included. */
+  void
+  Fuse(TLabelImage * output) const;
+
+  itkGetConstReferenceMacro(Region, RegionType);
+  itkGetConstMacro(MaximumLabel, LabelType);
+  itkGetConstMacro(NumberOfVoters, SizeValueType);
+
+protected:
+  LabelVoteAccumulator() = default;
+  ~LabelVoteAccumulator() override = default;
+
+  void
+  PrintSelf(std::ostream & os, Indent indent) const override;
+
+  // index of the first vote of the voxel at index, which must be in the voting region
+  SizeValueType
+  ComputeVoteOffset(const IndexType & index) const;
+
+private:
+  RegionType            m_Region;
+  LabelType             m_MaximumLabel = 0;
+  SizeValueType         m_NumberOfVoters = 0;
+  std::vector<VoteType> m_Votes; // MaximumLabel per voxel of the region, in image order
+  std::mutex            m_Mutex;
+};
+} // namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#  include "itkLabelVoteAccumulator.hxx"
+#endif
+
+#endif // itkLabelVoteAccumulator_h
@@ -0,0 +1,191 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkLabelVoteAccumulator_hxx
+#define itkLabelVoteAccumulator_hxx
+
+
+#include "itkMultiThreaderBase.h"
+#include "itkNumericTraits.h"
+#include "itkScanlineKernels.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace itk
+{
+template <typename TLabelImage>
+void
+LabelVoteAccumulator<TLabelImage>::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "Region: " << m_Region << std::endl;
+  os << indent << "MaximumLabel: " << static_cast<typename NumericTraits<LabelType>::PrintType>(m_MaximumLabel)
+     << std::endl;
+  os << indent << "NumberOfVoters: " << m_NumberOfVoters << std::endl;
+}
+
+template <typename TLabelImage>
+auto
+LabelVoteAccumulator<TLabelImage>::ComputeMaximumLabel(const TLabelImage * labels, const RegionType & region)
+  -> LabelType
+{
+  LabelType  maximum = 0;
+  std::mutex mergeMutex;
+
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegion<ImageDimension>(
+    region,
+    [&](const RegionType & chunk) {
+      LabelType chunkMaximum = 0;
+      ForEachScanline(
+        chunk,
+        [&chunkMaximum](const IndexType &, SizeValueType length, const LabelType * row) {
+          chunkMaximum = std::max(chunkMaximum, *std::max_element(row, row + length));
+        },
+        labels);
+
+      std::lock_guard<std::mutex> lock(mergeMutex);
+      maximum = std::max(maximum, chunkMaximum);
+    },
+    nullptr);
+  return maximum;
+}
+
+template <typename TLabelImage>
+void
+LabelVoteAccumulator<TLabelImage>::Initialize(const RegionType & region, LabelType maximumLabel)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Region = region;
+  m_MaximumLabel = maximumLabel;
+  m_NumberOfVoters = 0;
+  m_Votes.assign(region.GetNumberOfPixels() * static_cast<SizeValueType>(maximumLabel), 0);
+}
+
+template <typename TLabelImage>
+SizeValueType
+LabelVoteAccumulator<TLabelImage>::ComputeVoteOffset(const IndexType & index) const
+{
+  SizeValueType offset = 0;
+  for (int d = ImageDimension - 1; d >= 0; d--)
+  {
+    offset = offset * m_Region.GetSize(d) + static_cast<SizeValueType>(index[d] - m_Region.GetIndex(d));
+  }
+  return offset * static_cast<SizeValueType>(m_MaximumLabel);
+}
+
+template <typename TLabelImage>
+void
+LabelVoteAccumulator<TLabelImage>::AddVotes(const TLabelImage * labels)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  itkAssertOrThrowMacro(m_NumberOfVoters < NumericTraits<VoteType>::max(), "Too many voters");
+  ++m_NumberOfVoters;
+
+  RegionType region = labels->GetBufferedRegion();
+  if (!region.Crop(m_Region))
+  {
+    return; // votes for background everywhere
+  }
+
+  const SizeValueType stride = static_cast<SizeValueType>(m_MaximumLabel);
+  std::atomic<bool>   outOfRange{ false };
+  std::atomic<bool>   nonIntegral{ false };
+
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegion<ImageDimension>(
+    region,
+    [&](const RegionType & chunk) {
+      ForEachScanline(
+        chunk,
+        [&](const IndexType & index, SizeValueType length, const LabelType * row) {
+          VoteType * votes = m_Votes.data() + this->ComputeVoteOffset(index);
+          for (SizeValueType x = 0; x < length; ++x, votes += stride)
+          {
+            const LabelType label = row[x];
+            if (label == 0)
+            {
+              continue;
+            }
+            if (!(label > 0) || label > m_MaximumLabel)
+            {
+              outOfRange = true;
+              continue;
+            }
+            const SizeValueType l = static_cast<SizeValueType>(label); // real pixel types hold labels too
+            if (static_cast<LabelType>(l) != label)
+            {
+              nonIntegral = true;
+              continue;
+            }
+            ++votes[l - 1];
+          }
+        },
+        labels);
+    },
+    nullptr);
+  itkAssertOrThrowMacro(!outOfRange, "Labels below zero or above MaximumLabel cannot be voted for");
+  itkAssertOrThrowMacro(!nonIntegral, "Labels must be integers");
+}
+
+template <typename TLabelImage>
+void
+LabelVoteAccumulator<TLabelImage>::Fuse(TLabelImage * output) const
+{
+  output->FillBuffer(0);
+  RegionType region = output->GetBufferedRegion();
+  if (m_NumberOfVoters == 0 || !region.Crop(m_Region))
+  {
+    return;
+  }
+
+  const SizeValueType stride = static_cast<SizeValueType>(m_MaximumLabel);
+
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegion<ImageDimension>(
+    region,
+    [&](const RegionType & chunk) {
+      ForEachScanline(
+        chunk,
+        [&](const IndexType & index, SizeValueType length, LabelType * row) {
+          const VoteType * votes = m_Votes.data() + this->ComputeVoteOffset(index);
+          for (SizeValueType x = 0; x < length; ++x, votes += stride)
+          {
+            SizeValueType labelVotes = 0;
+            LabelType     best = 0;
+            SizeValueType bestVotes = 0;
+            for (SizeValueType l = 0; l < stride; ++l)
+            {
+              labelVotes += votes[l];
+              if (votes[l] > bestVotes)
+              {
+                best = static_cast<LabelType>(l + 1);
+                bestVotes = votes[l];
+              }
+            }
+            row[x] = bestVotes > m_NumberOfVoters - labelVotes ? best : 0;
+          }
+        },
+        output);
+    },
+    nullptr);
+}
+
+} // end namespace itk
+
+#endif // itkLabelVoteAccumulator_hxx
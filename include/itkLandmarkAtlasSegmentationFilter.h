@@ -18,11 +18,14 @@
 #ifndef itkLandmarkAtlasSegmentationFilter_h
 #define itkLandmarkAtlasSegmentationFilter_h
 
+#include "itkAtlasBundle.h"
 #include "itkImageToImageFilter.h"
 #include "itkVersorRigid3DTransform.h"
 #include "itkAffineTransform.h"
 #include "itkCompositeTransform.h"
 
+#include <vector>
+
 
 namespace itk
 {
@@ -65,10 +68,33 @@ public:
 
   /** Get/Set the input labels.
    * This is basic segmentation into bones,
-   * or cortical, trabecular and marrow. */
+   * or cortical, trabecular and marrow.
+   * If set, they must be on the grid of the input image. They restrict the output only
+   * with CropToInputLabels or MaskByInputLabels. */
   itkSetObjectMacro(InputLabels, TOutputImage);
   itkGetModifiableObjectMacro(InputLabels, TOutputImage);
 
+  /** The label of the bone in InputLabels which the atlases are propagated to.
+   * Zero (default) means all labels. */
+  itkSetMacro(BoneLabel, OutputPixelType);
+  itkGetConstMacro(BoneLabel, OutputPixelType);
+
+  /** Whether the output is cropped to the bounding box of BoneLabel in InputLabels,
+   * padded by RegionOfInterestPadding, with its origin moved to the first voxel of that region.
+   * Default is off, the output covers the input image. */
+  itkSetMacro(CropToInputLabels, bool);
+  itkGetConstMacro(CropToInputLabels, bool);
+  itkBooleanMacro(CropToInputLabels);
+
+  /** Padding of the bone's bounding box in InputLabels, in physical units. Default is 0.5. */
+  itkSetMacro(RegionOfInterestPadding, double);
+  itkGetConstMacro(RegionOfInterestPadding, double);
+
+  /** Whether atlas labels are cleared where InputLabels do not have BoneLabel. Default is off. */
+  itkSetMacro(MaskByInputLabels, bool);
+  itkGetConstMacro(MaskByInputLabels, bool);
+  itkBooleanMacro(MaskByInputLabels);
+
   /** Get/Set the atlas labels. */
   itkSetObjectMacro(AtlasLabels, TOutputImage);
   itkGetModifiableObjectMacro(AtlasLabels, TOutputImage);
@@ -100,11 +126,89 @@ public:
   }
   itkGetConstReferenceMacro(AtlasLandmarks, LandmarksType);
 
+  /** Add an atlas, whose labels are fused with those of the others by per-voxel majority voting,
+   * see LabelVoteAccumulator. The atlas given by AtlasLabels and AtlasLandmarks comes first.
+   * The atlas image is only needed for DeformableRefinement, atlases without one are not refined. */
+  void
+  AddAtlas(TOutputImage * labels, const LandmarksType & landmarks, const TInputImage * image = nullptr)
+  {
+    m_AdditionalAtlases.push_back({ labels, landmarks, image, {} });
+    this->Modified();
+  }
+
+  using AtlasBundleType = AtlasBundle<TInputImage, TOutputImage>;
+
+  /** Add the atlas of bone from a bundle. Its cropped image and labels are views into the bundle's
+   * mapped file, and its pyramid is used by DeformableRefinement if it has the refinement's levels. */
+  void
+  AddAtlas(const AtlasBundleType * bundle, OutputPixelType bone)
+  {
+    m_AdditionalAtlases.push_back(
+      { bundle->GetLabels(bone), bundle->GetLandmarks(bone), bundle->GetImage(bone), bundle->GetPyramid(bone) });
+    this->Modified();
+  }
+
+  /** Remove the atlases added by AddAtlas. */
+  void
+  ClearAtlases()
+  {
+    if (!m_AdditionalAtlases.empty())
+    {
+      m_AdditionalAtlases.clear();
+      this->Modified();
+    }
+  }
+
+  /** The number of atlases, including the one given by AtlasLabels. */
+  SizeValueType
+  GetNumberOfAtlases() const
+  {
+    return (m_AtlasLabels ? 1 : 0) + m_AdditionalAtlases.size();
+  }
+
+  /** How many atlases are resampled at the same time, each into a buffer the size of
+   * the part of the output it maps onto. Default is 2. */
+  itkGetConstMacro(NumberOfConcurrentAtlases, unsigned int);
+  itkSetClampMacro(NumberOfConcurrentAtlases, unsigned int, 1, NumericTraits<unsigned int>::max());
+
+  /** Whether the landmarks transform of each atlas is refined by deformable registration of the
+   * atlas image to the input image within the region of interest, see BSplineAtlasRefinement.
+   * The metric is sampled within BoneLabel of InputLabels, if they are set. Default is off. */
+  itkSetMacro(DeformableRefinement, bool);
+  itkGetConstMacro(DeformableRefinement, bool);
+  itkBooleanMacro(DeformableRefinement);
+
+  using RefinementType = BSplineAtlasRefinement<TInputImage>;
+
+  /** The parameters of the deformable refinement. */
+  itkGetModifiableObjectMacro(Refinement, RefinementType);
+
   using RigidTransformType = itk::VersorRigid3DTransform<double>;
+  using TransformType = Transform<double, Dimension, Dimension>;
 
-  /** Only valid after Update. */
+  /** Only valid after Update. The transform of the first atlas. */
   itkGetConstObjectMacro(LandmarksTransform, RigidTransformType);
 
+  using RegionType = typename TOutputImage::RegionType;
+
+  /** The region of InputLabels which the output covers. Only valid after UpdateOutputInformation. */
+  itkGetConstReferenceMacro(RegionOfInterest, RegionType);
+
+  /** Only valid after Update. The transform of each atlas, in the order of GetNumberOfAtlases. */
+  const RigidTransformType *
+  GetLandmarksTransform(SizeValueType atlas) const
+  {
+    return m_LandmarksTransforms[atlas];
+  }
+
+  /** Only valid after Update. The transform which each atlas was resampled with, its landmarks transform
+   * or, with DeformableRefinement, the refined one. */
+  const TransformType *
+  GetAtlasTransform(SizeValueType atlas) const
+  {
+    return m_AtlasTransforms[atlas];
+  }
+
 
 protected:
   LandmarkAtlasSegmentationFilter()
@@ -112,6 +216,7 @@ protected:
     this->SetNumberOfRequiredInputs(2);
     Self::SetPrimaryInputName("InputImage");
     Self::AddRequiredInputName("AtlasImage", 1);
+    m_Refinement = RefinementType::New();
   }
   ~LandmarkAtlasSegmentationFilter() override = default;
 
@@ -125,21 +230,66 @@ protected:
   {}
 
   using RealImageType = Image<float, Dimension>;
-  using RegionType = typename TOutputImage::RegionType;
   using IndexType = typename TOutputImage::IndexType;
   using SizeType = typename TOutputImage::SizeType;
 
+  // the output covers the region of interest of InputLabels
+  void
+  GenerateOutputInformation() override;
+
+  // only the grid of the inputs is used
+  void
+  GenerateInputRequestedRegion() override;
+
   void
   GenerateData() override;
 
+  // clear the output where InputLabels do not have BoneLabel
+  void
+  MaskOutput();
+
+  // the rigid transform from input points to atlas points, which maps the first landmarks exactly
+  typename RigidTransformType::Pointer
+  ComputeLandmarksTransform(const LandmarksType & atlasLandmarks) const;
+
+  // BoneLabel of InputLabels within the region of interest, on the input's grid
+  typename RefinementType::MaskImageType::Pointer
+  ComputeBoneMask() const;
+
+  // resample the atlases into a running vote, NumberOfConcurrentAtlases at a time
+  void
+  FuseAtlases(const std::vector<const TOutputImage *> & atlasLabels);
+
 private:
+  struct AtlasType
+  {
+    typename TOutputImage::Pointer       labels;
+    LandmarksType                        landmarks;
+    typename TInputImage::ConstPointer   image;
+    typename RefinementType::PyramidType pyramid;
+  };
+
   typename TOutputImage::Pointer m_InputLabels = nullptr;
   typename TOutputImage::Pointer m_AtlasLabels = nullptr;
 
   LandmarksType m_AtlasLandmarks;
   LandmarksType m_InputLandmarks;
 
-  typename RigidTransformType::Pointer m_LandmarksTransform = nullptr;
+  OutputPixelType m_BoneLabel = 0;
+  bool            m_CropToInputLabels = false;
+  double          m_RegionOfInterestPadding = 0.5;
+  bool            m_MaskByInputLabels = false;
+  RegionType      m_RegionOfInterest;
+
+  std::vector<AtlasType> m_AdditionalAtlases;
+  unsigned int           m_NumberOfConcurrentAtlases = 2;
+
+  bool                             m_DeformableRefinement = false;
+  typename RefinementType::Pointer m_Refinement;
+
+  typename RigidTransformType::Pointer              m_LandmarksTransform = nullptr;
+  std::vector<typename RigidTransformType::Pointer> m_LandmarksTransforms;
+  std::vector<typename TransformType::Pointer>      m_AtlasTransforms;
 
 #ifdef ITK_USE_CONCEPT_CHECKING
   itkConceptMacro(InputAndOutputMustHaveSameDimension,
@@ -19,9 +19,17 @@
 #define itkLandmarkAtlasSegmentationFilter_hxx
 
 
+#include "itkLabelVoteAccumulator.h"
 #include "itkLandmarkBasedTransformInitializer.h"
-#include "itkResampleImageFilter.h"
-#include "itkNearestNeighborInterpolateImageFunction.h"
+#include "itkLinearLabelResampler.h"
+#include "itkMath.h"
+#include "itkMultiThreaderBase.h"
+#include "itkScanlineKernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
 
 namespace itk
 {
@@ -30,24 +38,137 @@ void
 LandmarkAtlasSegmentationFilter<TInputImage, TOutputImage>::PrintSelf(std::ostream & os, Indent indent) const
 {
   Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfAtlases: " << this->GetNumberOfAtlases() << std::endl;
+  os << indent << "NumberOfConcurrentAtlases: " << m_NumberOfConcurrentAtlases << std::endl;
+  os << indent << "BoneLabel: " << static_cast<typename NumericTraits<OutputPixelType>::PrintType>(m_BoneLabel)
+     << std::endl;
+  os << indent << "CropToInputLabels: " << (m_CropToInputLabels ? "On" : "Off") << std::endl;
+  os << indent << "RegionOfInterestPadding: " << m_RegionOfInterestPadding << std::endl;
+  os << indent << "MaskByInputLabels: " << (m_MaskByInputLabels ? "On" : "Off") << std::endl;
+  os << indent << "RegionOfInterest: " << m_RegionOfInterest << std::endl;
+  os << indent << "DeformableRefinement: " << (m_DeformableRefinement ? "On" : "Off") << std::endl;
+  os << indent << "Refinement: " << std::endl;
+  m_Refinement->Print(os, indent.GetNextIndent());
 }
 
 template <typename TInputImage, typename TOutputImage>
 void
-LandmarkAtlasSegmentationFilter<TInputImage, TOutputImage>::GenerateData()
+LandmarkAtlasSegmentationFilter<TInputImage, TOutputImage>::GenerateOutputInformation()
 {
-  this->AllocateOutputs();
+  Superclass::GenerateOutputInformation();
 
-  // OutputImageType *      output = this->GetOutput();
   const InputImageType * input = this->GetInput();
-  // const RegionType &     outputRegion = output->GetRequestedRegion();
-  // RegionType             inputRegion = RegionType(outputRegion.GetSize());
+  if (!m_InputLabels || !m_CropToInputLabels)
+  {
+    m_RegionOfInterest = input->GetLargestPossibleRegion();
+    return;
+  }
 
+  m_InputLabels->Update();
+  RegionType roi = LinearLabelResampler<OutputImageType>::ComputeFootprint(m_InputLabels, m_BoneLabel);
+  itkAssertOrThrowMacro(roi.GetNumberOfPixels() > 0, "BoneLabel does not occur in InputLabels");
+  SizeType padding;
+  for (unsigned d = 0; d < Dimension; d++)
+  {
+    padding[d] = Math::Ceil<SizeValueType>(m_RegionOfInterestPadding / m_InputLabels->GetSpacing()[d]);
+  }
+  roi.PadByRadius(padding);
+  roi.Crop(input->GetLargestPossibleRegion());
+  m_RegionOfInterest = roi;
 
-  m_LandmarksTransform = RigidTransformType::New();
+  // the output's index starts at zero, at the physical location of the region of interest
+  OutputImageType *                   output = this->GetOutput();
+  typename OutputImageType::PointType origin;
+  input->TransformIndexToPhysicalPoint(roi.GetIndex(), origin);
+  output->SetOrigin(origin);
+  output->SetLargestPossibleRegion(RegionType(roi.GetSize()));
+}
 
-  itkAssertOrThrowMacro(m_InputLandmarks.size() == 3, "There must be exactly 3 input landmarks");
-  itkAssertOrThrowMacro(m_AtlasLandmarks.size() == 3, "There must be exactly 3 atlas landmarks");
+template <typename TInputImage, typename TOutputImage>
+void
+LandmarkAtlasSegmentationFilter<TInputImage, TOutputImage>::GenerateInputRequestedRegion()
+{
+  // the output region differs from the input regions, and the input pixels are not read
+  for (const auto & input : this->GetInputs())
+  {
+    if (input)
+    {
+      input->SetRequestedRegionToLargestPossibleRegion();
+    }
+  }
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+LandmarkAtlasSegmentationFilter<TInputImage, TOutputImage>::MaskOutput()
+{
+  OutputImageType *       output = this->GetOutput();
+  const OutputImageType * labels = m_InputLabels;
+  const OutputPixelType   boneLabel = m_BoneLabel;
+  const auto              toLabels = m_RegionOfInterest.GetIndex() - output->GetLargestPossibleRegion().GetIndex();
+
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegion<Dimension>(
+    output->GetBufferedRegion(),
+    [&](const RegionType & chunk) {
+      ForEachScanline(
+        chunk,
+        [&](const IndexType & index, SizeValueType length, OutputPixelType * row) {
+          const OutputPixelType * labelRow = labels->GetBufferPointer() + labels->ComputeOffset(index + toLabels);
+          for (SizeValueType x = 0; x < length; ++x)
+          {
+            const bool inBone = boneLabel == 0 ? labelRow[x] != 0 : labelRow[x] == boneLabel;
+            if (!inBone)
+            {
+              row[x] = 0;
+            }
+          }
+        },
+        output);
+    },
+    nullptr);
+}
+
+template <typename TInputImage, typename TOutputImage>
+auto
+LandmarkAtlasSegmentationFilter<TInputImage, TOutputImage>::ComputeBoneMask() const ->
+  typename RefinementType::MaskImageType::Pointer
+{
+  using MaskImageType = typename RefinementType::MaskImageType;
+  using MaskPixelType = typename MaskImageType::PixelType;
+  typename MaskImageType::Pointer mask = MaskImageType::New();
+  mask->CopyInformation(this->GetInput());
+  mask->SetRegions(m_RegionOfInterest);
+  mask->Allocate();
+
+  const OutputPixelType      boneLabel = m_BoneLabel;
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegion<Dimension>(
+    m_RegionOfInterest,
+    [&](const RegionType & chunk) {
+      ForEachScanline(
+        chunk,
+        [boneLabel](const IndexType &, SizeValueType length, MaskPixelType * row, const OutputPixelType * labelRow) {
+          for (SizeValueType x = 0; x < length; ++x)
+          {
+            row[x] = boneLabel == 0 ? labelRow[x] != 0 : labelRow[x] == boneLabel;
+          }
+        },
+        mask.GetPointer(),
+        m_InputLabels.GetPointer());
+    },
+    nullptr);
+  return mask;
+}
+
+template <typename TInputImage, typename TOutputImage>
+auto
+LandmarkAtlasSegmentationFilter<TInputImage, TOutputImage>::ComputeLandmarksTransform(
+  const LandmarksType & atlasLandmarks) const -> typename RigidTransformType::Pointer
+{
+  itkAssertOrThrowMacro(atlasLandmarks.size() == 3, "There must be exactly 3 atlas landmarks");
+
+  typename RigidTransformType::Pointer transform = RigidTransformType::New();
 
   using LandmarkBasedTransformInitializerType =
     itk::LandmarkBasedTransformInitializer<RigidTransformType, InputImageType, InputImageType>;
@@ -55,33 +176,181 @@ LandmarkAtlasSegmentationFilter<TInputImage, TOutputImage>::GenerateData()
     LandmarkBasedTransformInitializerType::New();
 
   landmarkBasedTransformInitializer->SetFixedLandmarks(m_InputLandmarks);
-  landmarkBasedTransformInitializer->SetMovingLandmarks(m_AtlasLandmarks);
+  landmarkBasedTransformInitializer->SetMovingLandmarks(atlasLandmarks);
 
-  m_LandmarksTransform->SetIdentity();
-  landmarkBasedTransformInitializer->SetTransform(m_LandmarksTransform);
+  transform->SetIdentity();
+  landmarkBasedTransformInitializer->SetTransform(transform);
   landmarkBasedTransformInitializer->InitializeTransform();
 
   // force rotation to be around center of femur head
-  m_LandmarksTransform->SetCenter(m_InputLandmarks.front());
+  transform->SetCenter(m_InputLandmarks.front());
   // and make sure that the other corresponding point maps to it perfectly
-  m_LandmarksTransform->SetTranslation(m_AtlasLandmarks.front() - m_InputLandmarks.front());
-
-  using InterpolatorType = itk::NearestNeighborInterpolateImageFunction<OutputImageType, double>;
-  typename InterpolatorType::Pointer interpolator = InterpolatorType::New();
-
-  using ResampleFilterType = itk::ResampleImageFilter<OutputImageType, OutputImageType, double>;
-  typename ResampleFilterType::Pointer resampleFilter = ResampleFilterType::New();
-  resampleFilter->SetInput(m_AtlasLabels);
-  resampleFilter->SetReferenceImage(input);
-  resampleFilter->SetUseReferenceImage(true);
-  resampleFilter->SetDefaultPixelValue(0);
-  resampleFilter->SetTransform(m_LandmarksTransform);
-  resampleFilter->SetInterpolator(interpolator);
-
-  // grafting pattern spares us from allocating an intermediate image
-  resampleFilter->GraftOutput(this->GetOutput());
-  resampleFilter->Update();
-  this->GraftOutput(resampleFilter->GetOutput());
+  transform->SetTranslation(atlasLandmarks.front() - m_InputLandmarks.front());
+  return transform;
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+LandmarkAtlasSegmentationFilter<TInputImage, TOutputImage>::FuseAtlases(
+  const std::vector<const TOutputImage *> & atlasLabels)
+{
+  using ResamplerType = LinearLabelResampler<OutputImageType>;
+  using AccumulatorType = LabelVoteAccumulator<OutputImageType>;
+  OutputImageType *   output = this->GetOutput();
+  const SizeValueType numberOfAtlases = atlasLabels.size();
+
+  // votes are only kept for the part of the output which some atlas maps onto
+  std::vector<RegionType> footprints(numberOfAtlases);
+  std::vector<RegionType> mapped(numberOfAtlases);
+  IndexType               lower = IndexType::Filled(NumericTraits<IndexValueType>::max());
+  IndexType               upper = IndexType::Filled(NumericTraits<IndexValueType>::NonpositiveMin());
+  OutputPixelType         maximumLabel = 0;
+  for (SizeValueType i = 0; i < numberOfAtlases; ++i)
+  {
+    footprints[i] = ResamplerType::ComputeFootprint(atlasLabels[i]);
+    mapped[i] = ResamplerType::MapFootprint(atlasLabels[i], footprints[i], m_AtlasTransforms[i], output);
+    if (mapped[i].GetNumberOfPixels() == 0)
+    {
+      continue;
+    }
+    maximumLabel = std::max(maximumLabel, AccumulatorType::ComputeMaximumLabel(atlasLabels[i], footprints[i]));
+    for (unsigned d = 0; d < Dimension; d++)
+    {
+      lower[d] = std::min(lower[d], mapped[i].GetIndex(d));
+      upper[d] = std::max(upper[d], mapped[i].GetIndex(d) + static_cast<IndexValueType>(mapped[i].GetSize(d)));
+    }
+  }
+  RegionType votingRegion;
+  if (lower[0] < upper[0])
+  {
+    votingRegion.SetIndex(lower);
+    for (unsigned d = 0; d < Dimension; d++)
+    {
+      votingRegion.SetSize(d, static_cast<SizeValueType>(upper[d] - lower[d]));
+    }
+  }
+
+  typename AccumulatorType::Pointer accumulator = AccumulatorType::New();
+  accumulator->Initialize(votingRegion, maximumLabel);
+
+  // each worker resamples one atlas at a time, and votes with it before taking the next
+  const SizeValueType numberOfWorkers = std::min<SizeValueType>(m_NumberOfConcurrentAtlases, numberOfAtlases);
+  std::atomic<SizeValueType>      nextAtlas{ 0 };
+  std::vector<std::exception_ptr> exceptions(numberOfWorkers);
+  std::vector<std::thread>        workers;
+  workers.reserve(numberOfWorkers);
+  for (SizeValueType w = 0; w < numberOfWorkers; ++w)
+  {
+    workers.emplace_back([&, w]() {
+      try
+      {
+        typename ResamplerType::Pointer resampler = ResamplerType::New();
+        for (SizeValueType i = nextAtlas++; i < numberOfAtlases; i = nextAtlas++)
+        {
+          typename OutputImageType::Pointer resampled = OutputImageType::New();
+          resampled->CopyInformation(output);
+          resampled->SetRegions(mapped[i]);
+          if (mapped[i].GetNumberOfPixels() > 0)
+          {
+            resampled->Allocate();
+            resampler->Resample(atlasLabels[i], footprints[i], m_AtlasTransforms[i], resampled);
+          }
+          accumulator->AddVotes(resampled); // an atlas which maps nowhere votes for background
+        }
+      }
+      catch (...)
+      {
+        exceptions[w] = std::current_exception();
+        nextAtlas = numberOfAtlases;
+      }
+    });
+  }
+  for (std::thread & worker : workers)
+  {
+    worker.join();
+  }
+  for (const std::exception_ptr & exception : exceptions)
+  {
+    if (exception)
+    {
+      std::rethrow_exception(exception);
+    }
+  }
+
+  accumulator->Fuse(output);
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+LandmarkAtlasSegmentationFilter<TInputImage, TOutputImage>::GenerateData()
+{
+  this->AllocateOutputs();
+
+  itkAssertOrThrowMacro(m_InputLandmarks.size() == 3, "There must be exactly 3 input landmarks");
+  itkAssertOrThrowMacro(this->GetNumberOfAtlases() > 0, "There must be at least one atlas");
+
+  std::vector<const TOutputImage *>                         atlasLabels;
+  std::vector<const TInputImage *>                          atlasImages;
+  std::vector<const typename RefinementType::PyramidType *> atlasPyramids;
+  m_LandmarksTransforms.clear();
+  if (m_AtlasLabels)
+  {
+    atlasLabels.push_back(m_AtlasLabels);
+    atlasImages.push_back(this->GetInput(1));
+    atlasPyramids.push_back(nullptr);
+    m_LandmarksTransforms.push_back(this->ComputeLandmarksTransform(m_AtlasLandmarks));
+  }
+  for (const AtlasType & atlas : m_AdditionalAtlases)
+  {
+    atlasLabels.push_back(atlas.labels);
+    atlasImages.push_back(atlas.image);
+    atlasPyramids.push_back(&atlas.pyramid);
+    m_LandmarksTransforms.push_back(this->ComputeLandmarksTransform(atlas.landmarks));
+  }
+  m_LandmarksTransform = m_LandmarksTransforms.front();
+
+  // one atlas after another, each registration is multi-threaded
+  m_AtlasTransforms.assign(m_LandmarksTransforms.begin(), m_LandmarksTransforms.end());
+  if (m_DeformableRefinement)
+  {
+    typename RefinementType::MaskImageType::Pointer mask = m_InputLabels ? this->ComputeBoneMask() : nullptr;
+
+    // the input's pyramid is shared by all the atlases, and only computed if one of them is refined
+    typename RefinementType::PyramidType inputPyramid;
+    for (SizeValueType i = 0; i < atlasImages.size(); ++i)
+    {
+      const bool hasPyramid = atlasPyramids[i] && atlasPyramids[i]->size() == m_Refinement->GetNumberOfResolutions();
+      if (!hasPyramid && !atlasImages[i])
+      {
+        continue;
+      }
+      if (inputPyramid.empty())
+      {
+        inputPyramid = m_Refinement->ComputePyramid(this->GetInput(), m_RegionOfInterest);
+      }
+      const TInputImage *                        atlasImage = atlasImages[i];
+      const typename RefinementType::PyramidType atlasPyramid =
+        hasPyramid ? *atlasPyramids[i] : m_Refinement->ComputePyramid(atlasImage, atlasImage->GetBufferedRegion());
+      m_AtlasTransforms[i] = m_Refinement->Refine(inputPyramid, atlasPyramid, mask, m_LandmarksTransforms[i]);
+    }
+  }
+
+  if (atlasLabels.size() == 1)
+  {
+    // only the part of the output which the atlas labels map onto is resampled, the rest is zero
+    using ResamplerType = LinearLabelResampler<OutputImageType>;
+    typename ResamplerType::Pointer resampler = ResamplerType::New();
+    resampler->Resample(atlasLabels.front(), m_AtlasTransforms.front(), this->GetOutput());
+  }
+  else
+  {
+    this->FuseAtlases(atlasLabels);
+  }
+
+  if (m_InputLabels && m_MaskByInputLabels)
+  {
+    this->MaskOutput();
+  }
 }
 
 } // end namespace itk
@@ -0,0 +1,113 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkLinearLabelResampler_h
+#define itkLinearLabelResampler_h
+
+#include "itkContinuousIndex.h"
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+#include "itkTransform.h"
+
+
+namespace itk
+{
+
+/** \class LinearLabelResampler
+ *
+ * \brief Nearest neighbor resampling of a label image through a transform, restricted to its labels.
+ *
+ * Gives the same labels as ResampleImageFilter with a NearestNeighborInterpolateImageFunction
+ * and a default pixel value of zero, for transforms which map output points to label points,
+ * up to continuous indices which fall on the boundary between two voxels within rounding error.
+ *
+ * Only the output voxels which can map into the footprint of the labels, the bounding box
+ * of their non-zero voxels, are visited, the others are zero. Within that part of the output,
+ * each row takes two point transforms, and the continuous index of its voxels is stepped
+ * along the row, as linear transforms allow. Other transforms, e.g. deformable ones, take a point
+ * transform per voxel over all of the output, as the footprint's corners do not bound where they map it.
+ *
+ * \ingroup HASI
+ */
+template <typename TLabelImage>
+class LinearLabelResampler : public Object
+{
+public:
+  ITK_DISALLOW_COPY_AND_MOVE(LinearLabelResampler);
+
+  /** Standard class typedefs. */
+  using Self = LinearLabelResampler;
+  using Superclass = Object;
+  using Pointer = SmartPointer<Self>;
+  using ConstPointer = SmartPointer<const Self>;
+
+  /** Run-time type information. */
+  itkOverrideGetNameOfClassMacro(LinearLabelResampler);
+
+  /** Standard New macro. */
+  itkNewMacro(Self);
+
+  static constexpr unsigned int ImageDimension = TLabelImage::ImageDimension;
+  using LabelImageType = TLabelImage;
+  using LabelType = typename TLabelImage::PixelType;
+  using RegionType = typename TLabelImage::RegionType;
+  using IndexType = typename TLabelImage::IndexType;
+  using PointType = typename TLabelImage::PointType;
+  using ContinuousIndexType = ContinuousIndex<double, ImageDimension>;
+  using TransformType = Transform<double, ImageDimension, ImageDimension>;
+
+  /** Bounding box of the voxels with label in the buffered region of labels, of all non-zero voxels
+   * if label is zero. The region is empty if there are none. */
+  static RegionType
+  ComputeFootprint(const TLabelImage * labels, LabelType label = 0);
+
+  /** The part of output's buffered region whose voxels can map into footprint, a region of labels.
+   * All of the buffered region if the transform is not linear or not invertible. */
+  static RegionType
+  MapFootprint(const TLabelImage *   labels,
+               const RegionType &    footprint,
+               const TransformType * transform,
+               const TLabelImage *   output);
+
+  /** Resample labels into the buffered region of output, which must be allocated, on output's grid.
+   * The footprint of labels is computed first, unless it is given. */
+  void
+  Resample(const TLabelImage * labels, const TransformType * transform, TLabelImage * output) const;
+  void
+  Resample(const TLabelImage *   labels,
+           const RegionType &    footprint,
+           const TransformType * transform,
+           TLabelImage *         output) const;
+
+protected:
+  LinearLabelResampler() = default;
+  ~LinearLabelResampler() override = default;
+
+  // labels' continuous index of an output voxel
+  static ContinuousIndexType
+  MapIndex(const TLabelImage *   labels,
+           const TransformType * transform,
+           const TLabelImage *   output,
+           const IndexType &     index);
+};
+} // namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#  include "itkLinearLabelResampler.hxx"
+#endif
+
+#endif // itkLinearLabelResampler_h
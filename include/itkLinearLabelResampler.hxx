@@ -0,0 +1,276 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkLinearLabelResampler_hxx
+#define itkLinearLabelResampler_hxx
+
+
+#include "itkMath.h"
+#include "itkMultiThreaderBase.h"
+#include "itkNumericTraits.h"
+#include "itkScanlineKernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+namespace itk
+{
+template <typename TLabelImage>
+auto
+LinearLabelResampler<TLabelImage>::ComputeFootprint(const TLabelImage * labels, LabelType label) -> RegionType
+{
+  auto matches = [label](LabelType value) { return label == 0 ? value != 0 : value == label; };
+
+  IndexType  minIndex = IndexType::Filled(NumericTraits<IndexValueType>::max());
+  IndexType  maxIndex = IndexType::Filled(NumericTraits<IndexValueType>::NonpositiveMin());
+  std::mutex mergeMutex;
+
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegion<ImageDimension>(
+    labels->GetBufferedRegion(),
+    [&](const RegionType & chunk) {
+      IndexType chunkMin = IndexType::Filled(NumericTraits<IndexValueType>::max());
+      IndexType chunkMax = IndexType::Filled(NumericTraits<IndexValueType>::NonpositiveMin());
+      ForEachScanline(
+        chunk,
+        [&chunkMin, &chunkMax, &matches](const IndexType & index, SizeValueType length, const LabelType * row) {
+          SizeValueType first = 0;
+          while (first < length && !matches(row[first]))
+          {
+            ++first;
+          }
+          if (first == length)
+          {
+            return;
+          }
+          SizeValueType last = length - 1;
+          while (!matches(row[last]))
+          {
+            --last;
+          }
+          for (unsigned d = 1; d < ImageDimension; d++)
+          {
+            chunkMin[d] = std::min(chunkMin[d], index[d]);
+            chunkMax[d] = std::max(chunkMax[d], index[d]);
+          }
+          chunkMin[0] = std::min(chunkMin[0], index[0] + static_cast<IndexValueType>(first));
+          chunkMax[0] = std::max(chunkMax[0], index[0] + static_cast<IndexValueType>(last));
+        },
+        labels);
+
+      std::lock_guard<std::mutex> lock(mergeMutex);
+      for (unsigned d = 0; d < ImageDimension; d++)
+      {
+        minIndex[d] = std::min(minIndex[d], chunkMin[d]);
+        maxIndex[d] = std::max(maxIndex[d], chunkMax[d]);
+      }
+    },
+    nullptr);
+
+  RegionType footprint;
+  if (minIndex[0] > maxIndex[0]) // no matching voxels
+  {
+    return footprint;
+  }
+  footprint.SetIndex(minIndex);
+  for (unsigned d = 0; d < ImageDimension; d++)
+  {
+    footprint.SetSize(d, maxIndex[d] - minIndex[d] + 1);
+  }
+  return footprint;
+}
+
+template <typename TLabelImage>
+auto
+LinearLabelResampler<TLabelImage>::MapFootprint(const TLabelImage *   labels,
+                                                const RegionType &    footprint,
+                                                const TransformType * transform,
+                                                const TLabelImage *   output) -> RegionType
+{
+  const RegionType outputRegion = output->GetBufferedRegion();
+  if (footprint.GetNumberOfPixels() == 0)
+  {
+    return RegionType();
+  }
+  // the box around the mapped corners only bounds the footprint's preimage under a linear transform
+  if (!transform->IsLinear())
+  {
+    return outputRegion;
+  }
+  typename TransformType::InverseTransformBasePointer inverse = transform->GetInverseTransform();
+  if (!inverse)
+  {
+    return outputRegion;
+  }
+
+  // the corners of the footprint's voxels, mapped into output's continuous indices
+  ContinuousIndexType lower;
+  ContinuousIndexType upper;
+  lower.Fill(NumericTraits<double>::max());
+  upper.Fill(NumericTraits<double>::NonpositiveMin());
+  for (unsigned corner = 0; corner < (1u << ImageDimension); ++corner)
+  {
+    ContinuousIndexType labelIndex;
+    for (unsigned d = 0; d < ImageDimension; d++)
+    {
+      const bool high = (corner >> d) & 1u;
+      labelIndex[d] = footprint.GetIndex(d) - 0.5 + (high ? footprint.GetSize(d) : 0);
+    }
+    PointType labelPoint;
+    labels->TransformContinuousIndexToPhysicalPoint(labelIndex, labelPoint);
+    const ContinuousIndexType outputIndex =
+      output->template TransformPhysicalPointToContinuousIndex<double>(inverse->TransformPoint(labelPoint));
+    for (unsigned d = 0; d < ImageDimension; d++)
+    {
+      lower[d] = std::min(lower[d], outputIndex[d]);
+      upper[d] = std::max(upper[d], outputIndex[d]);
+    }
+  }
+
+  // a voxel of margin against rounding, each voxel is tested exactly when it is resampled
+  RegionType mapped;
+  for (unsigned d = 0; d < ImageDimension; d++)
+  {
+    const IndexValueType first = Math::Floor<IndexValueType>(lower[d]) - 1;
+    const IndexValueType last = Math::Ceil<IndexValueType>(upper[d]) + 1;
+    mapped.SetIndex(d, first);
+    mapped.SetSize(d, static_cast<SizeValueType>(last - first + 1));
+  }
+  if (!mapped.Crop(outputRegion))
+  {
+    return RegionType();
+  }
+  return mapped;
+}
+
+template <typename TLabelImage>
+auto
+LinearLabelResampler<TLabelImage>::MapIndex(const TLabelImage *   labels,
+                                            const TransformType * transform,
+                                            const TLabelImage *   output,
+                                            const IndexType &     index) -> ContinuousIndexType
+{
+  PointType outputPoint;
+  output->TransformIndexToPhysicalPoint(index, outputPoint);
+  return labels->template TransformPhysicalPointToContinuousIndex<double>(transform->TransformPoint(outputPoint));
+}
+
+template <typename TLabelImage>
+void
+LinearLabelResampler<TLabelImage>::Resample(const TLabelImage *   labels,
+                                            const TransformType * transform,
+                                            TLabelImage *         output) const
+{
+  this->Resample(labels, ComputeFootprint(labels), transform, output);
+}
+
+template <typename TLabelImage>
+void
+LinearLabelResampler<TLabelImage>::Resample(const TLabelImage *   labels,
+                                            const RegionType &    footprint,
+                                            const TransformType * transform,
+                                            TLabelImage *         output) const
+{
+  const RegionType outputRegion = output->GetBufferedRegion();
+  output->FillBuffer(0);
+  const RegionType mapped = MapFootprint(labels, footprint, transform, output);
+  if (mapped.GetNumberOfPixels() == 0)
+  {
+    return;
+  }
+
+  // voxels outside of the footprint are zero, so the footprint stands in for the labels' buffer
+  // in NearestNeighborInterpolateImageFunction's test of continuous indices
+  ContinuousIndexType lower;
+  ContinuousIndexType upper;
+  for (unsigned d = 0; d < ImageDimension; d++)
+  {
+    lower[d] = footprint.GetIndex(d) - 0.5;
+    upper[d] = footprint.GetIndex(d) + static_cast<double>(footprint.GetSize(d)) - 0.5;
+  }
+  const LabelType *       buffer = labels->GetBufferPointer();
+  const IndexType         bufferStart = labels->GetBufferedRegion().GetIndex();
+  const OffsetValueType * offsetTable = labels->GetOffsetTable();
+  const bool              linear = transform->IsLinear();
+
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegion<ImageDimension>(
+    mapped,
+    [&](const RegionType & chunk) {
+      ForEachScanline(
+        chunk,
+        [&](const IndexType & index, SizeValueType length, LabelType * row) {
+          // the continuous index of the output row's first voxel, plus a multiple of the step to the next voxel.
+          // Unlike accumulating the step, this does not depend on where the chunks of the region start.
+          ContinuousIndexType start;
+          ContinuousIndexType step;
+          if (linear)
+          {
+            IndexType rowStart = index;
+            rowStart[0] = outputRegion.GetIndex(0);
+            start = MapIndex(labels, transform, output, rowStart);
+            ++rowStart[0];
+            const ContinuousIndexType next = MapIndex(labels, transform, output, rowStart);
+            for (unsigned d = 0; d < ImageDimension; d++)
+            {
+              step[d] = next[d] - start[d];
+            }
+          }
+
+          const IndexValueType skipped = index[0] - outputRegion.GetIndex(0);
+          IndexType            voxel = index;
+          for (SizeValueType x = 0; x < length; ++x, ++voxel[0])
+          {
+            ContinuousIndexType c;
+            if (linear)
+            {
+              for (unsigned d = 0; d < ImageDimension; d++)
+              {
+                c[d] = start[d] + step[d] * static_cast<double>(skipped + static_cast<IndexValueType>(x));
+              }
+            }
+            else // e.g. deformable, each voxel takes a point transform
+            {
+              c = MapIndex(labels, transform, output, voxel);
+            }
+
+            OffsetValueType offset = 0;
+            bool            inside = true;
+            for (unsigned d = 0; d < ImageDimension && inside; d++)
+            {
+              inside = c[d] >= lower[d] && c[d] < upper[d]; // also false for NaN
+              if (inside)
+              {
+                const IndexValueType nearest = Math::RoundHalfIntegerUp<IndexValueType>(c[d]);
+                offset += (nearest - bufferStart[d]) * (d > 0 ? offsetTable[d] : 1);
+              }
+            }
+            if (inside)
+            {
+              row[x] = buffer[offset];
+            }
+          }
+        },
+        output);
+    },
+    nullptr);
+}
+
+} // end namespace itk
+
+#endif // itkLinearLabelResampler_hxx
@@ -0,0 +1,317 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkPackedBinaryImage_h
+#define itkPackedBinaryImage_h
+
+#include "itkImageBase.h"
+
+#include <cstdint>
+#include <vector>
+
+
+namespace itk
+{
+
+/** \class PackedBinaryImage
+ *
+ * \brief Binary image which stores 64 pixels in one machine word.
+ *
+ * Each row along the first axis starts at a new word,
+ * so images with the same buffered region can be combined
+ * one word (64 pixels) at a time via TransformWords.
+ * Bits past the end of a row are always zero.
+ *
+ * Setting a pixel is a read-modify-write of its word,
+ * so concurrent writers must not share rows, e.g. use
+ * MultiThreaderBase::ParallelizeImageRegionRestrictDirection(0, ...).
+ *
+ * \ingroup HASI
+ */
+template <unsigned int VImageDimension>
+class PackedBinaryImage : public ImageBase<VImageDimension>
+{
+public:
+  ITK_DISALLOW_COPY_AND_MOVE(PackedBinaryImage);
+
+  /** Standard class typedefs. */
+  using Self = PackedBinaryImage;
+  using Superclass = ImageBase<VImageDimension>;
+  using Pointer = SmartPointer<Self>;
+  using ConstPointer = SmartPointer<const Self>;
+
+  /** Run-time type information. */
+  itkOverrideGetNameOfClassMacro(PackedBinaryImage);
+
+  /** Standard New macro. */
+  itkNewMacro(Self);
+
+  static constexpr unsigned int ImageDimension = VImageDimension;
+  using PixelType = bool;
+  using WordType = std::uint64_t;
+  static constexpr unsigned int BitsPerWord = 64;
+
+  using typename Superclass::IndexType;
+  using typename Superclass::SizeType;
+  using typename Superclass::RegionType;
+
+  /** Allocate the buffer for the buffered region. Pixels are always initialized to zero. */
+  void
+  Allocate(bool initialize = false) override;
+
+  /** Release the buffer. */
+  void
+  Initialize() override;
+
+  /** Set all the pixels of the buffered region. */
+  void
+  FillBuffer(bool value);
+
+  bool
+  GetPixel(const IndexType & index) const
+  {
+    SizeValueType row, bit;
+    this->ComputeRowAndBit(index, row, bit);
+    return (m_Buffer[row * m_WordsPerRow + bit / BitsPerWord] >> (bit % BitsPerWord)) & 1u;
+  }
+
+  void
+  SetPixel(const IndexType & index, bool value)
+  {
+    SizeValueType row, bit;
+    this->ComputeRowAndBit(index, row, bit);
+    WordType &     word = m_Buffer[row * m_WordsPerRow + bit / BitsPerWord];
+    const WordType mask = WordType{ 1 } << (bit % BitsPerWord);
+    word = value ? (word | mask) : (word & ~mask);
+  }
+
+  /** Number of words per row along the first axis. */
+  SizeValueType
+  GetWordsPerRow() const
+  {
+    return m_WordsPerRow;
+  }
+
+  /** Number of rows along the first axis in the buffered region. */
+  SizeValueType
+  GetNumberOfRows() const
+  {
+    const SizeValueType rowLength = this->GetBufferedRegion().GetSize(0);
+    return rowLength > 0 ? this->GetBufferedRegion().GetNumberOfPixels() / rowLength : 0;
+  }
+
+  WordType *
+  GetRow(SizeValueType row)
+  {
+    return m_Buffer.data() + row * m_WordsPerRow;
+  }
+  const WordType *
+  GetRow(SizeValueType row) const
+  {
+    return m_Buffer.data() + row * m_WordsPerRow;
+  }
+
+  /** The 64 pixels of a row which start at bit, as a word. Pixels past the end of the row are zero. */
+  WordType
+  GetBits(SizeValueType row, SizeValueType bit) const
+  {
+    const WordType *   word = this->GetRow(row) + bit / BitsPerWord;
+    const unsigned int shift = bit % BitsPerWord;
+    if (shift == 0 || bit / BitsPerWord + 1 == m_WordsPerRow)
+    {
+      return word[0] >> shift;
+    }
+    return (word[0] >> shift) | (word[1] << (BitsPerWord - shift));
+  }
+
+  /** Row number and bit position within the row of a buffered index. */
+  void
+  ComputeRowAndBit(const IndexType & index, SizeValueType & row, SizeValueType & bit) const
+  {
+    const SizeValueType rowLength = this->GetBufferedRegion().GetSize(0);
+    const SizeValueType offset = this->ComputeOffset(index);
+    row = offset / rowLength;
+    bit = offset % rowLength;
+  }
+
+  /** Set the pixels of the buffered region to image's pixels being non-zero.
+   * The image must buffer at least this image's buffered region. */
+  template <typename TImage>
+  void
+  Pack(const TImage * image);
+
+  /** Set the pixels of image to foreground where this image's pixels are set,
+   * and to zero elsewhere, within this image's buffered region. */
+  template <typename TImage>
+  void
+  Unpack(TImage * image, typename TImage::PixelType foreground) const;
+
+  /** Call operation(thisWord, inputWord...) for each word of the buffered region,
+   * where thisWord is a modifiable reference. The inputs must have the same buffered region.
+   * For example, TransformWords([](WordType & o, WordType a, WordType b) { o = a & b; }, a, b). */
+  template <typename TOperation, typename... TInputs>
+  void
+  TransformWords(TOperation operation, const TInputs *... inputs);
+
+protected:
+  PackedBinaryImage() = default;
+  ~PackedBinaryImage() override = default;
+
+  void
+  PrintSelf(std::ostream & os, Indent indent) const override;
+
+private:
+  std::vector<WordType> m_Buffer;
+  SizeValueType         m_WordsPerRow = 0;
+};
+
+
+/** \class PackedBinaryImageRegionConstIterator
+ *
+ * \brief Iterates over a region of a PackedBinaryImage in the same order as ImageRegionConstIterator.
+ *
+ * \ingroup HASI
+ */
+template <typename TImage>
+class PackedBinaryImageRegionConstIterator
+{
+public:
+  using Self = PackedBinaryImageRegionConstIterator;
+  using ImageType = TImage;
+  using PixelType = bool;
+  using WordType = typename TImage::WordType;
+  using IndexType = typename TImage::IndexType;
+  using RegionType = typename TImage::RegionType;
+
+  PackedBinaryImageRegionConstIterator(const TImage * image, const RegionType & region)
+    : m_Image(const_cast<TImage *>(image))
+    , m_Region(region)
+    , m_UpperIndex(region.GetUpperIndex())
+  {
+    this->GoToBegin();
+  }
+
+  void
+  GoToBegin()
+  {
+    m_Index = m_Region.GetIndex();
+    m_AtEnd = m_Region.GetNumberOfPixels() == 0;
+    if (!m_AtEnd)
+    {
+      this->LocateWord();
+    }
+  }
+
+  bool
+  IsAtEnd() const
+  {
+    return m_AtEnd;
+  }
+
+  const IndexType &
+  GetIndex() const
+  {
+    return m_Index;
+  }
+
+  bool
+  Get() const
+  {
+    return *m_Word & m_Mask;
+  }
+
+  Self &
+  operator++()
+  {
+    ++m_Index[0];
+    if (m_Index[0] <= m_UpperIndex[0])
+    {
+      m_Mask <<= 1;
+      if (m_Mask == 0)
+      {
+        m_Mask = 1;
+        ++m_Word;
+      }
+      return *this;
+    }
+
+    // next row
+    m_Index[0] = m_Region.GetIndex(0);
+    for (unsigned d = 1; d < TImage::ImageDimension; d++)
+    {
+      ++m_Index[d];
+      if (m_Index[d] <= m_UpperIndex[d])
+      {
+        this->LocateWord();
+        return *this;
+      }
+      m_Index[d] = m_Region.GetIndex(d);
+    }
+    m_AtEnd = true;
+    return *this;
+  }
+
+protected:
+  void
+  LocateWord()
+  {
+    SizeValueType row, bit;
+    m_Image->ComputeRowAndBit(m_Index, row, bit);
+    m_Word = m_Image->GetRow(row) + bit / TImage::BitsPerWord;
+    m_Mask = WordType{ 1 } << (bit % TImage::BitsPerWord);
+  }
+
+  TImage *   m_Image;
+  RegionType m_Region;
+  IndexType  m_UpperIndex;
+  IndexType  m_Index;
+  WordType * m_Word = nullptr;
+  WordType   m_Mask = 0;
+  bool       m_AtEnd = true;
+};
+
+
+/** \class PackedBinaryImageRegionIterator
+ *
+ * \brief Modifying iterator over a region of a PackedBinaryImage.
+ *
+ * \ingroup HASI
+ */
+template <typename TImage>
+class PackedBinaryImageRegionIterator : public PackedBinaryImageRegionConstIterator<TImage>
+{
+public:
+  using Superclass = PackedBinaryImageRegionConstIterator<TImage>;
+  using RegionType = typename Superclass::RegionType;
+
+  PackedBinaryImageRegionIterator(TImage * image, const RegionType & region)
+    : Superclass(image, region)
+  {}
+
+  void
+  Set(bool value) const
+  {
+    *this->m_Word = value ? (*this->m_Word | this->m_Mask) : (*this->m_Word & ~this->m_Mask);
+  }
+};
+} // namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#  include "itkPackedBinaryImage.hxx"
+#endif
+
+#endif // itkPackedBinaryImage_h
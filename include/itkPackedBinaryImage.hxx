@@ -0,0 +1,161 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkPackedBinaryImage_hxx
+#define itkPackedBinaryImage_hxx
+
+
+#include "itkImageScanlineIterator.h"
+#include "itkMultiThreaderBase.h"
+
+#include <algorithm>
+
+namespace itk
+{
+template <unsigned int VImageDimension>
+void
+PackedBinaryImage<VImageDimension>::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "WordsPerRow: " << m_WordsPerRow << std::endl;
+  os << indent << "BufferSize: " << m_Buffer.size() << std::endl;
+}
+
+template <unsigned int VImageDimension>
+void
+PackedBinaryImage<VImageDimension>::Allocate(bool itkNotUsed(initialize))
+{
+  const SizeValueType rowLength = this->GetBufferedRegion().GetSize(0);
+  m_WordsPerRow = (rowLength + BitsPerWord - 1) / BitsPerWord;
+
+  // always zero-initialized, as rows must not contain stray bits past their end
+  std::vector<WordType>(this->GetNumberOfRows() * m_WordsPerRow).swap(m_Buffer);
+}
+
+template <unsigned int VImageDimension>
+void
+PackedBinaryImage<VImageDimension>::Initialize()
+{
+  Superclass::Initialize();
+  std::vector<WordType>().swap(m_Buffer);
+  m_WordsPerRow = 0;
+}
+
+template <unsigned int VImageDimension>
+void
+PackedBinaryImage<VImageDimension>::FillBuffer(bool value)
+{
+  if (!value)
+  {
+    std::fill(m_Buffer.begin(), m_Buffer.end(), WordType{ 0 });
+    return;
+  }
+  this->TransformWords([](WordType & word) { word = ~WordType{ 0 }; });
+}
+
+template <unsigned int VImageDimension>
+template <typename TImage>
+void
+PackedBinaryImage<VImageDimension>::Pack(const TImage * image)
+{
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegionRestrictDirection<VImageDimension>(
+    0,
+    this->GetBufferedRegion(),
+    [this, image](const RegionType & region) {
+      ImageScanlineConstIterator<TImage> it(image, region);
+      while (!it.IsAtEnd())
+      {
+        SizeValueType row, bit;
+        this->ComputeRowAndBit(it.GetIndex(), row, bit);
+        WordType * word = this->GetRow(row);
+        WordType   packed = 0;
+        for (SizeValueType i = 0; !it.IsAtEndOfLine(); ++it, ++i)
+        {
+          if (i > 0 && i % BitsPerWord == 0)
+          {
+            *word++ = packed;
+            packed = 0;
+          }
+          packed |= WordType{ it.Get() != 0 } << (i % BitsPerWord);
+        }
+        *word = packed;
+        it.NextLine();
+      }
+    },
+    nullptr);
+}
+
+template <unsigned int VImageDimension>
+template <typename TImage>
+void
+PackedBinaryImage<VImageDimension>::Unpack(TImage * image, typename TImage::PixelType foreground) const
+{
+  using ImagePixelType = typename TImage::PixelType;
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegionRestrictDirection<VImageDimension>(
+    0,
+    this->GetBufferedRegion(),
+    [this, image, foreground](const RegionType & region) {
+      ImageScanlineIterator<TImage> it(image, region);
+      while (!it.IsAtEnd())
+      {
+        SizeValueType row, bit;
+        this->ComputeRowAndBit(it.GetIndex(), row, bit);
+        const WordType * word = this->GetRow(row);
+        for (SizeValueType i = 0; !it.IsAtEndOfLine(); ++it, ++i)
+        {
+          bool value = (word[i / BitsPerWord] >> (i % BitsPerWord)) & 1u;
+          it.Set(value ? foreground : ImagePixelType{});
+        }
+        it.NextLine();
+      }
+    },
+    nullptr);
+}
+
+template <unsigned int VImageDimension>
+template <typename TOperation, typename... TInputs>
+void
+PackedBinaryImage<VImageDimension>::TransformWords(TOperation operation, const TInputs *... inputs)
+{
+  const SizeValueType rowLength = this->GetBufferedRegion().GetSize(0);
+  const SizeValueType wordsPerRow = m_WordsPerRow;
+  const unsigned int  tailBits = rowLength % BitsPerWord;
+  const WordType      tailMask = tailBits ? (WordType{ 1 } << tailBits) - 1 : ~WordType{ 0 };
+
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeArray(
+    0,
+    this->GetNumberOfRows(),
+    [this, &operation, wordsPerRow, tailMask, inputs...](SizeValueType row) {
+      WordType * word = this->GetRow(row);
+      for (SizeValueType w = 0; w < wordsPerRow; ++w)
+      {
+        operation(word[w], inputs->GetRow(row)[w]...);
+      }
+      if (wordsPerRow > 0)
+      {
+        word[wordsPerRow - 1] &= tailMask; // keep the bits past the end of the row zero
+      }
+    },
+    nullptr);
+}
+
+} // end namespace itk
+
+#endif // itkPackedBinaryImage_hxx
@@ -0,0 +1,132 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkParallelConnectedComponentImageFilter_h
+#define itkParallelConnectedComponentImageFilter_h
+
+#include "itkImageToImageFilter.h"
+
+#include <vector>
+
+
+namespace itk
+{
+
+/** \class ParallelConnectedComponentImageFilter
+ *
+ * \brief Labels the connected components of a binary image, sorted by size, without small components.
+ *
+ * Equivalent to ConnectedComponentImageFilter followed by RelabelComponentImageFilter:
+ * non-zero input voxels are foreground, components smaller than MinimumObjectSize are removed,
+ * and the remaining ones are labeled 1, 2, ... in order of decreasing size.
+ * Components of equal size are ordered by their first voxel in image order.
+ *
+ * Rows along the first axis are run-length encoded in parallel, and runs in neighboring rows
+ * are merged by a lock-free union-find. The labels are written directly into the output,
+ * so no intermediate image with one label per component is needed. An exception is thrown
+ * if the output pixel type cannot represent the number of components.
+ * AbortGenerateData is checked between the phases, after their progress events.
+ *
+ * \ingroup HASI
+ */
+template <typename TInputImage, typename TOutputImage>
+class ParallelConnectedComponentImageFilter : public ImageToImageFilter<TInputImage, TOutputImage>
+{
+public:
+  ITK_DISALLOW_COPY_AND_MOVE(ParallelConnectedComponentImageFilter);
+
+  static constexpr unsigned Dimension = TInputImage::ImageDimension;
+
+  using InputImageType = TInputImage;
+  using OutputImageType = TOutputImage;
+  using InputPixelType = typename InputImageType::PixelType;
+  using OutputPixelType = typename OutputImageType::PixelType;
+  using RegionType = typename OutputImageType::RegionType;
+  using IndexType = typename OutputImageType::IndexType;
+
+  /** Standard class typedefs. */
+  using Self = ParallelConnectedComponentImageFilter<InputImageType, OutputImageType>;
+  using Superclass = ImageToImageFilter<InputImageType, OutputImageType>;
+  using Pointer = SmartPointer<Self>;
+  using ConstPointer = SmartPointer<const Self>;
+
+  /** Run-time type information. */
+  itkOverrideGetNameOfClassMacro(ParallelConnectedComponentImageFilter);
+
+  /** Standard New macro. */
+  itkNewMacro(Self);
+
+  /** Whether voxels touching by an edge or a corner are connected, or only those sharing a face. Default is off. */
+  itkSetMacro(FullyConnected, bool);
+  itkGetConstMacro(FullyConnected, bool);
+  itkBooleanMacro(FullyConnected);
+
+  /** Components with fewer voxels are set to background. Default is 0, which keeps all of them. */
+  itkSetMacro(MinimumObjectSize, SizeValueType);
+  itkGetConstMacro(MinimumObjectSize, SizeValueType);
+
+  /** Number of labeled components. Only valid after Update. */
+  itkGetConstMacro(ObjectCount, SizeValueType);
+
+  /** Voxel counts of labels 1 to ObjectCount, at indices 0 to ObjectCount-1. Only valid after Update. */
+  const std::vector<SizeValueType> &
+  GetSizeOfObjectsInPixels() const
+  {
+    return m_SizeOfObjectsInPixels;
+  }
+
+protected:
+  ParallelConnectedComponentImageFilter() = default;
+  ~ParallelConnectedComponentImageFilter() override = default;
+
+  void
+  PrintSelf(std::ostream & os, Indent indent) const override;
+
+  // labels depend on the whole image
+  void
+  GenerateInputRequestedRegion() override;
+
+  void
+  EnlargeOutputRequestedRegion(DataObject * output) override;
+
+  void
+  GenerateData() override;
+
+  // throw ProcessAborted if AbortGenerateData was set, e.g. by a progress observer
+  void
+  CheckAbort() const;
+
+  // consecutive foreground voxels along the first axis, with inclusive bounds
+  struct RunType
+  {
+    IndexValueType first;
+    IndexValueType last;
+  };
+
+private:
+  bool                       m_FullyConnected = false;
+  SizeValueType              m_MinimumObjectSize = 0;
+  SizeValueType              m_ObjectCount = 0;
+  std::vector<SizeValueType> m_SizeOfObjectsInPixels;
+};
+} // namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#  include "itkParallelConnectedComponentImageFilter.hxx"
+#endif
+
+#endif // itkParallelConnectedComponentImageFilter_h
@@ -0,0 +1,320 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkParallelConnectedComponentImageFilter_hxx
+#define itkParallelConnectedComponentImageFilter_hxx
+
+
+#include "itkImageRegionIndexRange.h"
+#include "itkMultiThreaderBase.h"
+#include "itkNumericTraits.h"
+
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+
+namespace itk
+{
+template <typename TInputImage, typename TOutputImage>
+void
+ParallelConnectedComponentImageFilter<TInputImage, TOutputImage>::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "FullyConnected: " << (m_FullyConnected ? "On" : "Off") << std::endl;
+  os << indent << "MinimumObjectSize: " << m_MinimumObjectSize << std::endl;
+  os << indent << "ObjectCount: " << m_ObjectCount << std::endl;
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+ParallelConnectedComponentImageFilter<TInputImage, TOutputImage>::GenerateInputRequestedRegion()
+{
+  Superclass::GenerateInputRequestedRegion();
+  auto * input = const_cast<InputImageType *>(this->GetInput());
+  if (input)
+  {
+    input->SetRequestedRegionToLargestPossibleRegion();
+  }
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+ParallelConnectedComponentImageFilter<TInputImage, TOutputImage>::EnlargeOutputRequestedRegion(DataObject * output)
+{
+  Superclass::EnlargeOutputRequestedRegion(output);
+  output->SetRequestedRegionToLargestPossibleRegion();
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+ParallelConnectedComponentImageFilter<TInputImage, TOutputImage>::GenerateData()
+{
+  const InputImageType * input = this->GetInput();
+  OutputImageType *      output = this->GetOutput();
+  this->AllocateOutputs();
+
+  const RegionType     region = output->GetRequestedRegion();
+  const IndexValueType rowLength = region.GetSize(0);
+
+  // one index per row, so a row's offset in this region is its row number
+  RegionType rowRegion = region;
+  rowRegion.SetSize(0, 1);
+  const SizeValueType numberOfRows = rowRegion.GetNumberOfPixels();
+
+  // earlier rows which can contain neighbors of a row's voxels
+  using OffsetType = Offset<Dimension>;
+  std::vector<OffsetType> neighborRows;
+  SizeValueType           numberOfOffsets = 1;
+  for (unsigned d = 1; d < Dimension; d++)
+  {
+    numberOfOffsets *= 3;
+  }
+  for (SizeValueType code = 0; code < numberOfOffsets; ++code)
+  {
+    OffsetType    offset;
+    SizeValueType remainder = code;
+    unsigned      nonZero = 0;
+    offset[0] = 0;
+    for (unsigned d = 1; d < Dimension; d++)
+    {
+      offset[d] = static_cast<OffsetValueType>(remainder % 3) - 1;
+      remainder /= 3;
+      nonZero += offset[d] != 0;
+    }
+    // the highest non-zero component decides whether the row comes earlier
+    unsigned highest = Dimension - 1;
+    while (highest > 0 && offset[highest] == 0)
+    {
+      --highest;
+    }
+    if (highest > 0 && offset[highest] < 0 && (m_FullyConnected || nonZero == 1))
+    {
+      neighborRows.push_back(offset);
+    }
+  }
+
+  const auto isForeground = [](InputPixelType value) { return value != NumericTraits<InputPixelType>::ZeroValue(); };
+
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+
+  // run-length encoding: count the runs of each row, then fill them in with rows at their prefix sums
+  std::vector<SizeValueType> rowBegin(numberOfRows + 1, 0);
+  mt->ParallelizeImageRegion<Dimension>(
+    rowRegion,
+    [&](const RegionType & chunk) {
+      for (const IndexType & ind : ImageRegionIndexRange<Dimension>(chunk))
+      {
+        const InputPixelType * row = input->GetBufferPointer() + input->ComputeOffset(ind);
+        SizeValueType          count = 0;
+        for (IndexValueType x = 0; x < rowLength; ++x)
+        {
+          count += isForeground(row[x]) && (x == 0 || !isForeground(row[x - 1]));
+        }
+        rowBegin[rowRegion.ComputeOffset(ind) + 1] = count;
+      }
+    },
+    nullptr);
+  std::partial_sum(rowBegin.begin(), rowBegin.end(), rowBegin.begin());
+  const SizeValueType numberOfRuns = rowBegin[numberOfRows];
+
+  // union-find forest over runs, each tree is rooted at its run which comes first in image order
+  std::vector<RunType>                    runs(numberOfRuns);
+  std::vector<std::atomic<SizeValueType>> parent(numberOfRuns);
+  mt->ParallelizeImageRegion<Dimension>(
+    rowRegion,
+    [&](const RegionType & chunk) {
+      for (const IndexType & ind : ImageRegionIndexRange<Dimension>(chunk))
+      {
+        const InputPixelType * row = input->GetBufferPointer() + input->ComputeOffset(ind);
+        SizeValueType          r = rowBegin[rowRegion.ComputeOffset(ind)];
+        for (IndexValueType x = 0; x < rowLength; ++x)
+        {
+          if (isForeground(row[x]))
+          {
+            runs[r].first = x;
+            while (x + 1 < rowLength && isForeground(row[x + 1]))
+            {
+              ++x;
+            }
+            runs[r].last = x;
+            parent[r].store(r);
+            ++r;
+          }
+        }
+      }
+    },
+    nullptr);
+  this->UpdateProgress(0.3f);
+  this->CheckAbort();
+
+  // parents always have smaller indices than their children, so roots only ever get linked to earlier roots
+  const auto find = [&parent](SizeValueType x) {
+    while (true)
+    {
+      SizeValueType p = parent[x].load();
+      if (p == x)
+      {
+        return x;
+      }
+      const SizeValueType grandparent = parent[p].load();
+      if (grandparent != p)
+      {
+        parent[x].compare_exchange_weak(p, grandparent); // path halving, fine to fail
+      }
+      x = grandparent;
+    }
+  };
+  const auto unite = [&parent, &find](SizeValueType a, SizeValueType b) {
+    while (true)
+    {
+      a = find(a);
+      b = find(b);
+      if (a == b)
+      {
+        return;
+      }
+      if (a < b)
+      {
+        std::swap(a, b);
+      }
+      SizeValueType root = a;
+      if (parent[a].compare_exchange_strong(root, b)) // fails if a got linked meanwhile
+      {
+        return;
+      }
+    }
+  };
+
+  // runs in one row are never connected, so only earlier rows need to be compared
+  const IndexValueType gap = m_FullyConnected ? 1 : 0;
+  mt->ParallelizeImageRegion<Dimension>(
+    rowRegion,
+    [&](const RegionType & chunk) {
+      for (const IndexType & ind : ImageRegionIndexRange<Dimension>(chunk))
+      {
+        const SizeValueType row = rowRegion.ComputeOffset(ind);
+        if (rowBegin[row] == rowBegin[row + 1])
+        {
+          continue;
+        }
+        for (const OffsetType & offset : neighborRows)
+        {
+          const IndexType neighbor = ind + offset;
+          if (!rowRegion.IsInside(neighbor))
+          {
+            continue;
+          }
+          const SizeValueType other = rowRegion.ComputeOffset(neighbor);
+          SizeValueType       a = rowBegin[row];
+          SizeValueType       b = rowBegin[other];
+          while (a < rowBegin[row + 1] && b < rowBegin[other + 1])
+          {
+            if (runs[a].first <= runs[b].last + gap && runs[b].first <= runs[a].last + gap)
+            {
+              unite(a, b);
+            }
+            if (runs[a].last < runs[b].last)
+            {
+              ++a;
+            }
+            else
+            {
+              ++b;
+            }
+          }
+        }
+      }
+    },
+    nullptr);
+  this->UpdateProgress(0.6f);
+  this->CheckAbort();
+
+  // replace parents by component numbers, in order of the components' first voxels
+  std::vector<SizeValueType> componentSizes;
+  for (SizeValueType r = 0; r < numberOfRuns; ++r)
+  {
+    const SizeValueType p = parent[r].load();
+    if (p == r)
+    {
+      parent[r].store(componentSizes.size());
+      componentSizes.push_back(0);
+    }
+    else
+    {
+      parent[r].store(parent[p].load()); // p < r was already replaced
+    }
+    componentSizes[parent[r].load()] += runs[r].last - runs[r].first + 1;
+  }
+
+  // large components first, ties keep image order
+  std::vector<SizeValueType> order;
+  for (SizeValueType c = 0; c < componentSizes.size(); ++c)
+  {
+    if (componentSizes[c] >= m_MinimumObjectSize)
+    {
+      order.push_back(c);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(), [&componentSizes](SizeValueType a, SizeValueType b) {
+    return componentSizes[a] > componentSizes[b];
+  });
+  if (order.size() > static_cast<SizeValueType>(NumericTraits<OutputPixelType>::max()))
+  {
+    itkExceptionMacro(<< "There are " << order.size() << " components, but the output pixel type can only hold "
+                                   << static_cast<SizeValueType>(NumericTraits<OutputPixelType>::max())
+                                   << " labels");
+  }
+
+  m_ObjectCount = order.size();
+  m_SizeOfObjectsInPixels.resize(m_ObjectCount);
+  std::vector<OutputPixelType> labels(componentSizes.size(), 0); // small components stay background
+  for (SizeValueType i = 0; i < m_ObjectCount; ++i)
+  {
+    labels[order[i]] = static_cast<OutputPixelType>(i + 1);
+    m_SizeOfObjectsInPixels[i] = componentSizes[order[i]];
+  }
+
+  mt->ParallelizeImageRegion<Dimension>(
+    rowRegion,
+    [&](const RegionType & chunk) {
+      for (const IndexType & ind : ImageRegionIndexRange<Dimension>(chunk))
+      {
+        const SizeValueType row = rowRegion.ComputeOffset(ind);
+        OutputPixelType *   out = output->GetBufferPointer() + output->ComputeOffset(ind);
+        std::fill_n(out, rowLength, OutputPixelType(0));
+        for (SizeValueType r = rowBegin[row]; r < rowBegin[row + 1]; ++r)
+        {
+          std::fill(out + runs[r].first, out + runs[r].last + 1, labels[parent[r].load()]);
+        }
+      }
+    },
+    nullptr);
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+ParallelConnectedComponentImageFilter<TInputImage, TOutputImage>::CheckAbort() const
+{
+  if (this->GetAbortGenerateData())
+  {
+    throw ProcessAborted(__FILE__, __LINE__);
+  }
+}
+
+} // end namespace itk
+
+#endif // itkParallelConnectedComponentImageFilter_hxx
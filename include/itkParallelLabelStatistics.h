@@ -0,0 +1,130 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkParallelLabelStatistics_h
+#define itkParallelLabelStatistics_h
+
+#include "itkContinuousIndex.h"
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+
+#include <vector>
+
+
+namespace itk
+{
+
+/** \class ParallelLabelStatistics
+ *
+ * \brief Per-label bounding boxes, voxel counts, centroids and voxel runs, from one multi-threaded pass.
+ *
+ * Labels are consecutive integers from 1 to the number of labels, zero is background.
+ * Each thread accumulates its rows into private tables, which are merged at the end.
+ *
+ * The voxels of each label are also recorded compactly, as runs of consecutive voxels
+ * along the first axis, sorted in image order. They can be used as seeds for region growing
+ * without rescanning the bounding box.
+ *
+ * \ingroup HASI
+ */
+template <typename TLabelImage>
+class ParallelLabelStatistics : public Object
+{
+public:
+  ITK_DISALLOW_COPY_AND_MOVE(ParallelLabelStatistics);
+
+  /** Standard class typedefs. */
+  using Self = ParallelLabelStatistics;
+  using Superclass = Object;
+  using Pointer = SmartPointer<Self>;
+  using ConstPointer = SmartPointer<const Self>;
+
+  /** Run-time type information. */
+  itkOverrideGetNameOfClassMacro(ParallelLabelStatistics);
+
+  /** Standard New macro. */
+  itkNewMacro(Self);
+
+  static constexpr unsigned int ImageDimension = TLabelImage::ImageDimension;
+  using LabelImageType = TLabelImage;
+  using LabelType = typename TLabelImage::PixelType;
+  using RegionType = typename TLabelImage::RegionType;
+  using IndexType = typename TLabelImage::IndexType;
+  using CentroidType = ContinuousIndex<double, ImageDimension>;
+
+  /** Consecutive voxels of one label along the first axis. */
+  struct RunType
+  {
+    IndexType     index;
+    SizeValueType length;
+  };
+  using RunContainerType = std::vector<RunType>;
+
+  /** Gather the statistics of labels 1 to numberOfLabels within region.
+   * Voxels with larger labels are ignored. */
+  void
+  Compute(const TLabelImage * labelImage, const RegionType & region, IdentifierType numberOfLabels);
+
+  IdentifierType
+  GetNumberOfLabels() const
+  {
+    return m_Counts.empty() ? 0 : m_Counts.size() - 1;
+  }
+
+  /** Number of voxels with this label. */
+  SizeValueType
+  GetCount(IdentifierType label) const
+  {
+    return m_Counts[label];
+  }
+
+  /** Tight bounding box of the label. The region is empty if the label has no voxels. */
+  RegionType
+  GetBoundingBox(IdentifierType label) const;
+
+  /** Mean index of the label's voxels. */
+  CentroidType
+  GetCentroid(IdentifierType label) const;
+
+  /** The label's voxels, as runs along the first axis. */
+  const RunContainerType &
+  GetRuns(IdentifierType label) const
+  {
+    return m_Runs[label];
+  }
+
+protected:
+  ParallelLabelStatistics() = default;
+  ~ParallelLabelStatistics() override = default;
+
+  void
+  PrintSelf(std::ostream & os, Indent indent) const override;
+
+private:
+  std::vector<SizeValueType>    m_Counts;
+  std::vector<IndexType>        m_MinIndices;
+  std::vector<IndexType>        m_MaxIndices;
+  std::vector<CentroidType>     m_IndexSums;
+  std::vector<RunContainerType> m_Runs;
+};
+} // namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#  include "itkParallelLabelStatistics.hxx"
+#endif
+
+#endif // itkParallelLabelStatistics_h
@@ -0,0 +1,164 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkParallelLabelStatistics_hxx
+#define itkParallelLabelStatistics_hxx
+
+
+#include "itkImageScanlineIterator.h"
+#include "itkMultiThreaderBase.h"
+#include "itkNumericTraits.h"
+
+#include <algorithm>
+#include <mutex>
+
+namespace itk
+{
+template <typename TLabelImage>
+void
+ParallelLabelStatistics<TLabelImage>::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfLabels: " << this->GetNumberOfLabels() << std::endl;
+}
+
+template <typename TLabelImage>
+void
+ParallelLabelStatistics<TLabelImage>::Compute(const TLabelImage * labelImage,
+                                              const RegionType &  region,
+                                              IdentifierType      numberOfLabels)
+{
+  const SizeValueType tableSize = numberOfLabels + 1;
+  const IndexType     emptyMin = IndexType::Filled(NumericTraits<IndexValueType>::max());
+  const IndexType     emptyMax = IndexType::Filled(NumericTraits<IndexValueType>::NonpositiveMin());
+  CentroidType        zeroSum;
+  zeroSum.Fill(0.0);
+
+  m_Counts.assign(tableSize, 0);
+  m_MinIndices.assign(tableSize, emptyMin);
+  m_MaxIndices.assign(tableSize, emptyMax);
+  m_IndexSums.assign(tableSize, zeroSum);
+  m_Runs.assign(tableSize, RunContainerType());
+
+  // whole rows per thread, so runs are never split between threads
+  std::mutex                 mergeMutex;
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegionRestrictDirection<ImageDimension>(
+    0,
+    region,
+    [&](const RegionType & chunk) {
+      std::vector<SizeValueType>    counts(tableSize, 0);
+      std::vector<IndexType>        minIndices(tableSize, emptyMin);
+      std::vector<IndexType>        maxIndices(tableSize, emptyMax);
+      std::vector<CentroidType>     indexSums(tableSize, zeroSum);
+      std::vector<RunContainerType> runs(tableSize);
+
+      ImageScanlineConstIterator<TLabelImage> it(labelImage, chunk);
+      while (!it.IsAtEnd())
+      {
+        while (!it.IsAtEndOfLine())
+        {
+          const IdentifierType label = it.Get();
+          if (label == 0 || label > numberOfLabels)
+          {
+            ++it;
+            continue;
+          }
+
+          RunType run{ it.GetIndex(), 0 };
+          for (; !it.IsAtEndOfLine() && static_cast<IdentifierType>(it.Get()) == label; ++it)
+          {
+            ++run.length;
+          }
+
+          // the run's other axes are constant, so only the first axis needs per-voxel sums
+          const IndexValueType last = run.index[0] + static_cast<IndexValueType>(run.length) - 1;
+          counts[label] += run.length;
+          indexSums[label][0] += 0.5 * (run.index[0] + last) * run.length;
+          for (unsigned d = 1; d < ImageDimension; d++)
+          {
+            indexSums[label][d] += static_cast<double>(run.index[d]) * run.length;
+          }
+          for (unsigned d = 0; d < ImageDimension; d++)
+          {
+            minIndices[label][d] = std::min(minIndices[label][d], run.index[d]);
+            maxIndices[label][d] = std::max(maxIndices[label][d], d == 0 ? last : run.index[d]);
+          }
+          runs[label].push_back(run);
+        }
+        it.NextLine();
+      }
+
+      std::lock_guard<std::mutex> lock(mergeMutex);
+      for (SizeValueType label = 1; label < tableSize; ++label)
+      {
+        if (counts[label] == 0)
+        {
+          continue;
+        }
+        m_Counts[label] += counts[label];
+        for (unsigned d = 0; d < ImageDimension; d++)
+        {
+          m_MinIndices[label][d] = std::min(m_MinIndices[label][d], minIndices[label][d]);
+          m_MaxIndices[label][d] = std::max(m_MaxIndices[label][d], maxIndices[label][d]);
+          m_IndexSums[label][d] += indexSums[label][d];
+        }
+        m_Runs[label].insert(m_Runs[label].end(), runs[label].begin(), runs[label].end());
+      }
+    },
+    nullptr);
+
+  // chunks are merged in arbitrary order
+  mt->ParallelizeArray(
+    1,
+    tableSize,
+    [this, &region](SizeValueType label) {
+      std::sort(m_Runs[label].begin(), m_Runs[label].end(), [&region](const RunType & a, const RunType & b) {
+        return region.ComputeOffset(a.index) < region.ComputeOffset(b.index);
+      });
+    },
+    nullptr);
+}
+
+template <typename TLabelImage>
+auto
+ParallelLabelStatistics<TLabelImage>::GetBoundingBox(IdentifierType label) const -> RegionType
+{
+  RegionType box;
+  if (m_Counts[label] > 0)
+  {
+    box.SetIndex(m_MinIndices[label]);
+    box.SetUpperIndex(m_MaxIndices[label]);
+  }
+  return box;
+}
+
+template <typename TLabelImage>
+auto
+ParallelLabelStatistics<TLabelImage>::GetCentroid(IdentifierType label) const -> CentroidType
+{
+  CentroidType centroid = m_IndexSums[label];
+  for (unsigned d = 0; d < ImageDimension; d++)
+  {
+    centroid[d] /= std::max<SizeValueType>(m_Counts[label], 1);
+  }
+  return centroid;
+}
+
+} // end namespace itk
+
+#endif // itkParallelLabelStatistics_hxx
@@ -0,0 +1,148 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkParallelNeighborhoodConnected_h
+#define itkParallelNeighborhoodConnected_h
+
+#include "itkNumericTraits.h"
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+#include "itkPackedBinaryImage.h"
+#include "itkParallelLabelStatistics.h"
+
+#include <vector>
+
+
+namespace itk
+{
+
+/** \class ParallelNeighborhoodConnected
+ *
+ * \brief Multi-threaded region growing with the criterion of NeighborhoodConnectedImageFilter.
+ *
+ * A voxel passes if all the voxels of its box neighborhood are between Lower and Upper.
+ * The result marks the passing voxels which are face-connected to a passing seed,
+ * the same as NeighborhoodConnectedImageFilter with the same seeds.
+ *
+ * Growing is restricted to a region and an optional mask, without building a masked copy of the input:
+ * the result is identical to running NeighborhoodConnectedImageFilter on an image buffered on the output region,
+ * holding the input inside the region and the mask, and a value below Lower everywhere else.
+ * As in ITK's neighborhood functions, neighborhoods are truncated at the boundary of the output region.
+ *
+ * The criterion is evaluated by separable passes over the region. Its rows are then
+ * run-length encoded, and the runs reachable from the seeds are found by a breadth-first
+ * wavefront, whose runs are expanded in parallel.
+ *
+ * \ingroup HASI
+ */
+template <typename TInputImage, typename TLabelImage>
+class ParallelNeighborhoodConnected : public Object
+{
+public:
+  ITK_DISALLOW_COPY_AND_MOVE(ParallelNeighborhoodConnected);
+
+  /** Standard class typedefs. */
+  using Self = ParallelNeighborhoodConnected;
+  using Superclass = Object;
+  using Pointer = SmartPointer<Self>;
+  using ConstPointer = SmartPointer<const Self>;
+
+  /** Run-time type information. */
+  itkOverrideGetNameOfClassMacro(ParallelNeighborhoodConnected);
+
+  /** Standard New macro. */
+  itkNewMacro(Self);
+
+  static constexpr unsigned int ImageDimension = TInputImage::ImageDimension;
+  using InputImageType = TInputImage;
+  using InputPixelType = typename TInputImage::PixelType;
+  using LabelImageType = TLabelImage;
+  using MaskImageType = PackedBinaryImage<ImageDimension>;
+  using RegionType = typename TInputImage::RegionType;
+  using IndexType = typename TInputImage::IndexType;
+  using SizeType = typename TInputImage::SizeType;
+
+  /** Seeds are given as runs of voxels, as gathered by ParallelLabelStatistics. */
+  using SeedContainerType = typename ParallelLabelStatistics<TLabelImage>::RunContainerType;
+
+  /** Lowest passing intensity. Default is the lowest value of the pixel type. */
+  itkSetMacro(Lower, InputPixelType);
+  itkGetConstMacro(Lower, InputPixelType);
+
+  /** Highest passing intensity. Default is the highest value of the pixel type. */
+  itkSetMacro(Upper, InputPixelType);
+  itkGetConstMacro(Upper, InputPixelType);
+
+  /** Radius of the neighborhood. Default is 1 along each axis. */
+  itkSetMacro(Radius, SizeType);
+  itkGetConstReferenceMacro(Radius, SizeType);
+
+  /** Grow from the seeds within region, where mask is set unless it is null.
+   * Returns a binary image buffered on outputRegion, which must contain region.
+   * The input must buffer region, and the mask must buffer at least region. */
+  typename TLabelImage::Pointer
+  Grow(const TInputImage *       input,
+       const MaskImageType *     mask,
+       const RegionType &        region,
+       const SeedContainerType & seeds,
+       const RegionType &        outputRegion) const;
+
+  /** Grow as above, setting the grown voxels of output to one instead of returning a new image.
+   * Output must buffer at least outputRegion, and its other voxels are left unchanged,
+   * so a zeroed image with a margin around outputRegion can be grown into directly. */
+  void
+  Grow(const TInputImage *       input,
+       const MaskImageType *     mask,
+       const RegionType &        region,
+       const SeedContainerType & seeds,
+       const RegionType &        outputRegion,
+       TLabelImage *             output) const;
+
+protected:
+  ParallelNeighborhoodConnected() { m_Radius.Fill(1); }
+  ~ParallelNeighborhoodConnected() override = default;
+
+  void
+  PrintSelf(std::ostream & os, Indent indent) const override;
+
+  // consecutive passing voxels along the first axis, with inclusive bounds relative to the region's start
+  struct RunType
+  {
+    IndexValueType first;
+    IndexValueType last;
+  };
+
+  // erode the passing voxels of region along axis d, failing those whose neighborhood leaves region
+  // on a side where outputRegion extends beyond it
+  void
+  ErodeAlong(unsigned                     d,
+             const RegionType &           region,
+             const RegionType &           outputRegion,
+             std::vector<unsigned char> & passes) const;
+
+private:
+  InputPixelType m_Lower = NumericTraits<InputPixelType>::NonpositiveMin();
+  InputPixelType m_Upper = NumericTraits<InputPixelType>::max();
+  SizeType       m_Radius;
+};
+} // namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#  include "itkParallelNeighborhoodConnected.hxx"
+#endif
+
+#endif // itkParallelNeighborhoodConnected_h
@@ -0,0 +1,328 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkParallelNeighborhoodConnected_hxx
+#define itkParallelNeighborhoodConnected_hxx
+
+
+#include "itkImageRegionIndexRange.h"
+#include "itkMultiThreaderBase.h"
+
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+
+namespace itk
+{
+template <typename TInputImage, typename TLabelImage>
+void
+ParallelNeighborhoodConnected<TInputImage, TLabelImage>::PrintSelf(std::ostream & os, Indent indent) const
+{
+  using PrintType = typename NumericTraits<InputPixelType>::PrintType;
+  Superclass::PrintSelf(os, indent);
+  os << indent << "Lower: " << static_cast<PrintType>(m_Lower) << std::endl;
+  os << indent << "Upper: " << static_cast<PrintType>(m_Upper) << std::endl;
+  os << indent << "Radius: " << m_Radius << std::endl;
+}
+
+template <typename TInputImage, typename TLabelImage>
+void
+ParallelNeighborhoodConnected<TInputImage, TLabelImage>::ErodeAlong(unsigned                     d,
+                                                                    const RegionType &           region,
+                                                                    const RegionType &           outputRegion,
+                                                                    std::vector<unsigned char> & passes) const
+{
+  const IndexValueType radius = m_Radius[d];
+  const IndexValueType length = region.GetSize(d);
+  OffsetValueType      stride = 1;
+  for (unsigned i = 0; i < d; i++)
+  {
+    stride *= region.GetSize(i);
+  }
+
+  // outside of region but within outputRegion, the input counts as failing
+  const bool lowClosed = region.GetIndex(d) > outputRegion.GetIndex(d);
+  const bool highClosed = region.GetUpperIndex()[d] < outputRegion.GetUpperIndex()[d];
+
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegionRestrictDirection<ImageDimension>(
+    d,
+    region,
+    [&](const RegionType & chunk) {
+      RegionType lineStarts = chunk;
+      lineStarts.SetSize(d, 1);
+      std::vector<unsigned char> line(length);
+      for (const IndexType & start : ImageRegionIndexRange<ImageDimension>(lineStarts))
+      {
+        unsigned char * p = passes.data() + region.ComputeOffset(start);
+        for (IndexValueType i = 0; i < length; ++i)
+        {
+          line[i] = p[i * stride];
+        }
+
+        // a voxel passes if the nearest failing voxel on either side is farther than the radius
+        IndexValueType lastFail = lowClosed ? -1 : -radius - 1;
+        for (IndexValueType i = 0; i < length; ++i)
+        {
+          if (!line[i])
+          {
+            lastFail = i;
+          }
+          p[i * stride] = i - lastFail > radius;
+        }
+        IndexValueType nextFail = highClosed ? length : length + radius;
+        for (IndexValueType i = length - 1; i >= 0; --i)
+        {
+          if (!line[i])
+          {
+            nextFail = i;
+          }
+          p[i * stride] = p[i * stride] && nextFail - i > radius;
+        }
+      }
+    },
+    nullptr);
+}
+
+template <typename TInputImage, typename TLabelImage>
+typename TLabelImage::Pointer
+ParallelNeighborhoodConnected<TInputImage, TLabelImage>::Grow(const TInputImage *       input,
+                                                              const MaskImageType *     mask,
+                                                              const RegionType &        region,
+                                                              const SeedContainerType & seeds,
+                                                              const RegionType &        outputRegion) const
+{
+  typename TLabelImage::Pointer output = TLabelImage::New();
+  output->CopyInformation(input);
+  output->SetRegions(outputRegion);
+  output->Allocate(true);
+  this->Grow(input, mask, region, seeds, outputRegion, output);
+  return output;
+}
+
+template <typename TInputImage, typename TLabelImage>
+void
+ParallelNeighborhoodConnected<TInputImage, TLabelImage>::Grow(const TInputImage *       input,
+                                                              const MaskImageType *     mask,
+                                                              const RegionType &        region,
+                                                              const SeedContainerType & seeds,
+                                                              const RegionType &        outputRegion,
+                                                              TLabelImage *             output) const
+{
+  itkAssertOrThrowMacro(output->GetBufferedRegion().IsInside(outputRegion),
+                        "The output must buffer at least the output region");
+  const IndexValueType rowLength = region.GetSize(0);
+
+  // one index per row, so a row's offset in this region is its row number
+  RegionType rowRegion = region;
+  rowRegion.SetSize(0, 1);
+  const SizeValueType numberOfRows = rowRegion.GetNumberOfPixels();
+
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+
+  // the pointwise criterion, then the minimum over each neighborhood, one axis at a time
+  std::vector<unsigned char> passes(region.GetNumberOfPixels());
+  mt->ParallelizeImageRegion<ImageDimension>(
+    rowRegion,
+    [&](const RegionType & chunk) {
+      for (const IndexType & ind : ImageRegionIndexRange<ImageDimension>(chunk))
+      {
+        const InputPixelType * in = input->GetBufferPointer() + input->ComputeOffset(ind);
+        unsigned char *        p = passes.data() + region.ComputeOffset(ind);
+        for (IndexValueType x = 0; x < rowLength; ++x)
+        {
+          p[x] = m_Lower <= in[x] && in[x] <= m_Upper;
+        }
+        if (mask)
+        {
+          using WordType = typename MaskImageType::WordType;
+          constexpr unsigned BitsPerWord = MaskImageType::BitsPerWord;
+          SizeValueType      row, bit;
+          mask->ComputeRowAndBit(ind, row, bit);
+          const WordType * maskRow = mask->GetRow(row);
+          for (IndexValueType x = 0; x < rowLength; ++x, ++bit)
+          {
+            p[x] = p[x] && ((maskRow[bit / BitsPerWord] >> (bit % BitsPerWord)) & 1u);
+          }
+        }
+      }
+    },
+    nullptr);
+  for (unsigned d = 0; d < ImageDimension; d++)
+  {
+    this->ErodeAlong(d, region, outputRegion, passes);
+  }
+
+  // run-length encoding: count the runs of each row, then fill them in with rows at their prefix sums
+  std::vector<SizeValueType> rowBegin(numberOfRows + 1, 0);
+  mt->ParallelizeImageRegion<ImageDimension>(
+    rowRegion,
+    [&](const RegionType & chunk) {
+      for (const IndexType & ind : ImageRegionIndexRange<ImageDimension>(chunk))
+      {
+        const unsigned char * p = passes.data() + region.ComputeOffset(ind);
+        SizeValueType         count = 0;
+        for (IndexValueType x = 0; x < rowLength; ++x)
+        {
+          count += p[x] && (x == 0 || !p[x - 1]);
+        }
+        rowBegin[rowRegion.ComputeOffset(ind) + 1] = count;
+      }
+    },
+    nullptr);
+  std::partial_sum(rowBegin.begin(), rowBegin.end(), rowBegin.begin());
+  const SizeValueType numberOfRuns = rowBegin[numberOfRows];
+
+  std::vector<RunType>           runs(numberOfRuns);
+  std::vector<std::atomic<bool>> reached(numberOfRuns);
+  mt->ParallelizeImageRegion<ImageDimension>(
+    rowRegion,
+    [&](const RegionType & chunk) {
+      for (const IndexType & ind : ImageRegionIndexRange<ImageDimension>(chunk))
+      {
+        const unsigned char * p = passes.data() + region.ComputeOffset(ind);
+        SizeValueType         r = rowBegin[rowRegion.ComputeOffset(ind)];
+        for (IndexValueType x = 0; x < rowLength; ++x)
+        {
+          if (p[x])
+          {
+            runs[r].first = x;
+            while (x + 1 < rowLength && p[x + 1])
+            {
+              ++x;
+            }
+            runs[r].last = x;
+            reached[r].store(false);
+            ++r;
+          }
+        }
+      }
+    },
+    nullptr);
+  passes = std::vector<unsigned char>(); // deallocate it
+
+  // claim the unreached runs of row which overlap [first, last], appending them to frontier
+  const auto claimOverlapping = [&runs, &rowBegin, &reached](SizeValueType                row,
+                                                             IndexValueType               first,
+                                                             IndexValueType               last,
+                                                             std::vector<SizeValueType> & frontier) {
+    auto r = std::lower_bound(runs.begin() + rowBegin[row],
+                              runs.begin() + rowBegin[row + 1],
+                              first,
+                              [](const RunType & run, IndexValueType x) { return run.last < x; });
+    for (; r != runs.begin() + rowBegin[row + 1] && r->first <= last; ++r)
+    {
+      const SizeValueType k = r - runs.begin();
+      if (!reached[k].exchange(true))
+      {
+        frontier.push_back(k);
+      }
+    }
+  };
+
+  // seeds which fail the criterion are ignored, like in NeighborhoodConnectedImageFilter
+  constexpr SizeValueType                 runsPerBlock = 256;
+  std::vector<std::vector<SizeValueType>> blockFrontiers((seeds.size() + runsPerBlock - 1) / runsPerBlock);
+  mt->ParallelizeArray(
+    0,
+    blockFrontiers.size(),
+    [&](SizeValueType block) {
+      const SizeValueType endSeed = std::min<SizeValueType>(seeds.size(), (block + 1) * runsPerBlock);
+      for (SizeValueType s = block * runsPerBlock; s < endSeed; ++s)
+      {
+        IndexType rowIndex = seeds[s].index;
+        rowIndex[0] = region.GetIndex(0);
+        if (!rowRegion.IsInside(rowIndex))
+        {
+          continue;
+        }
+        const IndexValueType first = std::max<IndexValueType>(seeds[s].index[0] - region.GetIndex(0), 0);
+        const IndexValueType last = std::min<IndexValueType>(
+          seeds[s].index[0] - region.GetIndex(0) + static_cast<IndexValueType>(seeds[s].length) - 1, rowLength - 1);
+        claimOverlapping(rowRegion.ComputeOffset(rowIndex), first, last, blockFrontiers[block]);
+      }
+    },
+    nullptr);
+
+  // breadth-first wavefront: the face neighbors of a run are the overlapping runs in adjacent rows
+  std::vector<SizeValueType> rowStrides(ImageDimension, 1);
+  for (unsigned d = 2; d < ImageDimension; d++)
+  {
+    rowStrides[d] = rowStrides[d - 1] * region.GetSize(d - 1);
+  }
+  std::vector<SizeValueType> frontier;
+  while (true)
+  {
+    frontier.clear();
+    for (const std::vector<SizeValueType> & blockFrontier : blockFrontiers)
+    {
+      frontier.insert(frontier.end(), blockFrontier.begin(), blockFrontier.end());
+    }
+    if (frontier.empty())
+    {
+      break;
+    }
+
+    blockFrontiers.assign((frontier.size() + runsPerBlock - 1) / runsPerBlock, std::vector<SizeValueType>());
+    mt->ParallelizeArray(
+      0,
+      blockFrontiers.size(),
+      [&](SizeValueType block) {
+        const SizeValueType endRun = std::min<SizeValueType>(frontier.size(), (block + 1) * runsPerBlock);
+        for (SizeValueType i = block * runsPerBlock; i < endRun; ++i)
+        {
+          const SizeValueType k = frontier[i];
+          const SizeValueType row = std::upper_bound(rowBegin.begin(), rowBegin.end(), k) - rowBegin.begin() - 1;
+          for (unsigned d = 1; d < ImageDimension; d++)
+          {
+            const SizeValueType coordinate = (row / rowStrides[d]) % region.GetSize(d);
+            if (coordinate > 0)
+            {
+              claimOverlapping(row - rowStrides[d], runs[k].first, runs[k].last, blockFrontiers[block]);
+            }
+            if (coordinate + 1 < region.GetSize(d))
+            {
+              claimOverlapping(row + rowStrides[d], runs[k].first, runs[k].last, blockFrontiers[block]);
+            }
+          }
+        }
+      },
+      nullptr);
+  }
+
+  mt->ParallelizeImageRegion<ImageDimension>(
+    rowRegion,
+    [&](const RegionType & chunk) {
+      for (const IndexType & ind : ImageRegionIndexRange<ImageDimension>(chunk))
+      {
+        const SizeValueType               row = rowRegion.ComputeOffset(ind);
+        typename TLabelImage::PixelType * out = output->GetBufferPointer() + output->ComputeOffset(ind);
+        for (SizeValueType r = rowBegin[row]; r < rowBegin[row + 1]; ++r)
+        {
+          if (reached[r].load())
+          {
+            std::fill(out + runs[r].first, out + runs[r].last + 1, 1);
+          }
+        }
+      }
+    },
+    nullptr);
+}
+
+} // end namespace itk
+
+#endif // itkParallelNeighborhoodConnected_hxx
@@ -0,0 +1,388 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkScanlineKernels_h
+#define itkScanlineKernels_h
+
+#include "itkImageRegion.h"
+#include "itkImageRegionIndexRange.h"
+
+#include <cmath>
+#include <type_traits>
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#  include <emmintrin.h>
+#endif
+
+
+namespace itk
+{
+
+/** Call kernel(index, length, rows...) for each row of region along the first axis, where index is the first index
+ * of the row and rows point to its first pixel in each of images. The images must buffer region, null images give
+ * null rows. Offsets are computed once per row, so kernels can run over contiguous pixels. */
+template <unsigned int VImageDimension, typename TKernel, typename... TImages>
+void
+ForEachScanline(const ImageRegion<VImageDimension> & region, TKernel && kernel, TImages *... images)
+{
+  if (region.GetNumberOfPixels() == 0)
+  {
+    return;
+  }
+  ImageRegion<VImageDimension> rowStarts = region;
+  rowStarts.SetSize(0, 1);
+  for (const Index<VImageDimension> & index : ImageRegionIndexRange<VImageDimension>(rowStarts))
+  {
+    kernel(index, region.GetSize(0), (images ? images->GetBufferPointer() + images->ComputeOffset(index) : nullptr)...);
+  }
+}
+
+
+/** Kernels over contiguous rows of pixels, see ForEachScanline.
+ *
+ * Integer pixels of one or two bytes and float distances use SSE2 or AVX2, depending on the instruction set the
+ * module is compiled for. Other pixel types, and the remainder of each row, run a scalar loop which compilers can
+ * vectorize on their own. All versions give the same results.
+ *
+ * \ingroup HASI
+ */
+namespace ScanlineKernels
+{
+namespace Detail
+{
+// pixels with vector kernels are tagged with their size, others with zero
+template <typename TPixel>
+using LaneTag = std::integral_constant<int,
+                                       std::is_integral<TPixel>::value && (sizeof(TPixel) == 1 || sizeof(TPixel) == 2)
+                                         ? static_cast<int>(sizeof(TPixel))
+                                         : 0>;
+using OneByte = std::integral_constant<int, 1>;
+using TwoBytes = std::integral_constant<int, 2>;
+
+#if defined(__AVX2__)
+using VectorType = __m256i;
+using FloatVectorType = __m256;
+
+inline VectorType
+Load(const void * p)
+{
+  return _mm256_loadu_si256(static_cast<const VectorType *>(p));
+}
+inline void
+Store(void * p, VectorType v)
+{
+  _mm256_storeu_si256(static_cast<VectorType *>(p), v);
+}
+inline VectorType
+And(VectorType a, VectorType b)
+{
+  return _mm256_and_si256(a, b);
+}
+inline VectorType
+AndNot(VectorType a, VectorType b) // ~a & b
+{
+  return _mm256_andnot_si256(a, b);
+}
+inline VectorType
+Or(VectorType a, VectorType b)
+{
+  return _mm256_or_si256(a, b);
+}
+inline VectorType
+Broadcast(char v, OneByte)
+{
+  return _mm256_set1_epi8(v);
+}
+inline VectorType
+Broadcast(short v, TwoBytes)
+{
+  return _mm256_set1_epi16(v);
+}
+inline VectorType
+Equal(VectorType a, VectorType b, OneByte)
+{
+  return _mm256_cmpeq_epi8(a, b);
+}
+inline VectorType
+Equal(VectorType a, VectorType b, TwoBytes)
+{
+  return _mm256_cmpeq_epi16(a, b);
+}
+inline VectorType
+Less16(VectorType a, VectorType b)
+{
+  return _mm256_cmpgt_epi16(b, a);
+}
+// the packing instructions work within 128 bit lanes, so the 64 bit quarters are put back in order
+inline VectorType
+Pack16To8(VectorType a, VectorType b)
+{
+  return _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+}
+inline VectorType
+Pack32To16(VectorType a, VectorType b)
+{
+  return _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+}
+inline VectorType
+CloseMask(const float * a, const float * b, float epsilon) // abs(a - b) < epsilon
+{
+  const FloatVectorType signBit = _mm256_set1_ps(-0.0f);
+  const FloatVectorType difference = _mm256_sub_ps(_mm256_loadu_ps(a), _mm256_loadu_ps(b));
+  return _mm256_castps_si256(
+    _mm256_cmp_ps(_mm256_andnot_ps(signBit, difference), _mm256_set1_ps(epsilon), _CMP_LT_OQ));
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+using VectorType = __m128i;
+using FloatVectorType = __m128;
+
+inline VectorType
+Load(const void * p)
+{
+  return _mm_loadu_si128(static_cast<const VectorType *>(p));
+}
+inline void
+Store(void * p, VectorType v)
+{
+  _mm_storeu_si128(static_cast<VectorType *>(p), v);
+}
+inline VectorType
+And(VectorType a, VectorType b)
+{
+  return _mm_and_si128(a, b);
+}
+inline VectorType
+AndNot(VectorType a, VectorType b) // ~a & b
+{
+  return _mm_andnot_si128(a, b);
+}
+inline VectorType
+Or(VectorType a, VectorType b)
+{
+  return _mm_or_si128(a, b);
+}
+inline VectorType
+Broadcast(char v, OneByte)
+{
+  return _mm_set1_epi8(v);
+}
+inline VectorType
+Broadcast(short v, TwoBytes)
+{
+  return _mm_set1_epi16(v);
+}
+inline VectorType
+Equal(VectorType a, VectorType b, OneByte)
+{
+  return _mm_cmpeq_epi8(a, b);
+}
+inline VectorType
+Equal(VectorType a, VectorType b, TwoBytes)
+{
+  return _mm_cmpeq_epi16(a, b);
+}
+inline VectorType
+Less16(VectorType a, VectorType b)
+{
+  return _mm_cmplt_epi16(a, b);
+}
+inline VectorType
+Pack16To8(VectorType a, VectorType b)
+{
+  return _mm_packs_epi16(a, b);
+}
+inline VectorType
+Pack32To16(VectorType a, VectorType b)
+{
+  return _mm_packs_epi32(a, b);
+}
+inline VectorType
+CloseMask(const float * a, const float * b, float epsilon) // abs(a - b) < epsilon
+{
+  const FloatVectorType signBit = _mm_set1_ps(-0.0f);
+  const FloatVectorType difference = _mm_sub_ps(_mm_loadu_ps(a), _mm_loadu_ps(b));
+  return _mm_castps_si128(_mm_cmplt_ps(_mm_andnot_ps(signBit, difference), _mm_set1_ps(epsilon)));
+}
+#endif
+
+// each of these returns how many pixels it processed, the caller finishes the row
+template <typename TPixel, typename TInputPixel, typename TLaneTag>
+SizeValueType
+Threshold(const TInputPixel *, TPixel *, SizeValueType, TInputPixel, TLaneTag)
+{
+  return 0;
+}
+template <typename TPixel, typename TLaneTag>
+SizeValueType
+ExtractLabel(const TPixel *, TPixel *, SizeValueType, TPixel, TLaneTag)
+{
+  return 0;
+}
+template <typename TPixel, typename TLaneTag>
+SizeValueType
+Or(const TPixel *, TPixel *, SizeValueType, TLaneTag)
+{
+  return 0;
+}
+template <typename TRealPixel, typename TPixel, typename TLaneTag>
+SizeValueType
+MarkClose(const TRealPixel *, const TRealPixel *, TPixel *, SizeValueType, TRealPixel, TLaneTag)
+{
+  return 0;
+}
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+constexpr SizeValueType VectorBytes = sizeof(VectorType);
+
+template <typename TPixel, int VBytes, typename = typename std::enable_if<(VBytes > 0)>::type>
+SizeValueType
+Threshold(const short * input, TPixel * output, SizeValueType length, short lower, std::integral_constant<int, VBytes>)
+{
+  constexpr SizeValueType outputLanes = VectorBytes / VBytes;
+  const VectorType        lowerV = Broadcast(lower, TwoBytes());
+  const VectorType        one = Broadcast(1, std::integral_constant<int, VBytes>());
+  SizeValueType           i = 0;
+  for (; i + outputLanes <= length; i += outputLanes)
+  {
+    VectorType below = Less16(Load(input + i), lowerV);
+    if (VBytes == 1)
+    {
+      below = Pack16To8(below, Less16(Load(input + i + outputLanes / 2), lowerV));
+    }
+    Store(output + i, AndNot(below, one));
+  }
+  return i;
+}
+
+template <typename TPixel, int VBytes, typename = typename std::enable_if<(VBytes > 0)>::type>
+SizeValueType
+ExtractLabel(const TPixel *                     labels,
+             TPixel *                           output,
+             SizeValueType                      length,
+             TPixel                             label,
+             std::integral_constant<int, VBytes> lanes)
+{
+  constexpr SizeValueType lanesPerVector = VectorBytes / VBytes;
+  const VectorType        labelV = Broadcast(label, lanes);
+  SizeValueType           i = 0;
+  for (; i + lanesPerVector <= length; i += lanesPerVector)
+  {
+    const VectorType equal = Equal(Load(labels + i), labelV, lanes);
+    Store(output + i, Or(And(equal, labelV), AndNot(equal, Load(output + i))));
+  }
+  return i;
+}
+
+template <typename TPixel, int VBytes, typename = typename std::enable_if<(VBytes > 0)>::type>
+SizeValueType
+Or(const TPixel * input, TPixel * output, SizeValueType length, std::integral_constant<int, VBytes> lanes)
+{
+  constexpr SizeValueType lanesPerVector = VectorBytes / VBytes;
+  const VectorType        zero = Broadcast(0, lanes);
+  const VectorType        one = Broadcast(1, lanes);
+  SizeValueType           i = 0;
+  for (; i + lanesPerVector <= length; i += lanesPerVector)
+  {
+    const VectorType neither = Equal(Or(Load(input + i), Load(output + i)), zero, lanes);
+    Store(output + i, AndNot(neither, one));
+  }
+  return i;
+}
+
+template <typename TPixel, int VBytes, typename = typename std::enable_if<(VBytes > 0)>::type>
+SizeValueType
+MarkClose(const float *                       a,
+          const float *                       b,
+          TPixel *                            output,
+          SizeValueType                       length,
+          float                               epsilon,
+          std::integral_constant<int, VBytes> lanes)
+{
+  constexpr SizeValueType outputLanes = VectorBytes / VBytes;
+  constexpr SizeValueType floatLanes = VectorBytes / sizeof(float);
+  const VectorType        one = Broadcast(1, lanes);
+  SizeValueType           i = 0;
+  for (; i + outputLanes <= length; i += outputLanes)
+  {
+    VectorType close = Pack32To16(CloseMask(a + i, b + i, epsilon),
+                                  CloseMask(a + i + floatLanes, b + i + floatLanes, epsilon));
+    if (VBytes == 1)
+    {
+      close = Pack16To8(close,
+                        Pack32To16(CloseMask(a + i + 2 * floatLanes, b + i + 2 * floatLanes, epsilon),
+                                   CloseMask(a + i + 3 * floatLanes, b + i + 3 * floatLanes, epsilon)));
+    }
+    Store(output + i, Or(And(close, one), AndNot(close, Load(output + i))));
+  }
+  return i;
+}
+#endif
+} // namespace Detail
+
+/** output = input >= lower, as 1 or 0. */
+template <typename TInputPixel, typename TPixel>
+void
+Threshold(const TInputPixel * input, TPixel * output, SizeValueType length, TInputPixel lower)
+{
+  SizeValueType i = Detail::Threshold(input, output, length, lower, Detail::LaneTag<TPixel>());
+  for (; i < length; ++i)
+  {
+    output[i] = input[i] >= lower;
+  }
+}
+
+/** output = label where labels == label, output is kept elsewhere. */
+template <typename TPixel>
+void
+ExtractLabel(const TPixel * labels, TPixel * output, SizeValueType length, TPixel label)
+{
+  SizeValueType i = Detail::ExtractLabel(labels, output, length, label, Detail::LaneTag<TPixel>());
+  for (; i < length; ++i)
+  {
+    output[i] = labels[i] == label ? label : output[i];
+  }
+}
+
+/** output = input || output, as 1 or 0. */
+template <typename TPixel>
+void
+Or(const TPixel * input, TPixel * output, SizeValueType length)
+{
+  SizeValueType i = Detail::Or(input, output, length, Detail::LaneTag<TPixel>());
+  for (; i < length; ++i)
+  {
+    output[i] = input[i] || output[i];
+  }
+}
+
+/** output = 1 where abs(a - b) < epsilon, output is kept elsewhere. */
+template <typename TRealPixel, typename TPixel>
+void
+MarkClose(const TRealPixel * a, const TRealPixel * b, TPixel * output, SizeValueType length, TRealPixel epsilon)
+{
+  SizeValueType i = Detail::MarkClose(a, b, output, length, epsilon, Detail::LaneTag<TPixel>());
+  for (; i < length; ++i)
+  {
+    output[i] = std::abs(a[i] - b[i]) < epsilon ? TPixel{ 1 } : output[i];
+  }
+}
+} // namespace ScanlineKernels
+} // namespace itk
+
+#endif // itkScanlineKernels_h
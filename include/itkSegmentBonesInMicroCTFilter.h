@@ -20,6 +20,19 @@
 
 #include "itkImageToImageFilter.h"
 #include "itkBinaryThresholdImageFilter.h"
+#include "itkSymmetricSecondRankTensor.h"
+#include "itkPackedBinaryImage.h"
+#include "itkBoundedEuclideanMorphology.h"
+#include "itkParallelLabelStatistics.h"
+#include "itkStageCache.h"
+#include "itkImageBufferPool.h"
+#include "itkStageProfile.h"
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 
 namespace itk
@@ -36,6 +49,13 @@ namespace itk
  *
  * Breakdown of each bone into these sub-regions is usually not overly accurate.
  *
+ * The first output has either one or 3 labels per bone, depending on WholeBones.
+ * With BothLabelMaps, the second output has the other kind of labels.
+ *
+ * Setting AbortGenerateData during Update, e.g. from a progress observer or another thread,
+ * is noticed between stages and bones, and forwarded into the internal filters.
+ * Update then throws ProcessAborted. Stages which were cached by then are kept.
+ *
  * \ingroup HASI
  */
 template <typename TInputImage, typename TOutputImage>
@@ -74,8 +94,127 @@ public:
   itkGetConstMacro(WholeBones, bool);
   itkSetMacro(WholeBones, bool);
 
+  /** If true, the second output holds the other label map:
+   * the split labels if WholeBones is true, the whole bone labels otherwise.
+   * Both label maps then come out of a single Update. Default is false,
+   * which leaves the second output empty. */
+  itkGetConstMacro(BothLabelMaps, bool);
+  itkSetMacro(BothLabelMaps, bool);
+  itkBooleanMacro(BothLabelMaps);
+
+  /** The label map with one label per bone.
+   * It is the first output if WholeBones is true, otherwise the second one. */
+  TOutputImage *
+  GetWholeBonesOutput()
+  {
+    return this->GetOutput(m_WholeBones ? 0 : 1);
+  }
+
+  /** The label map with 3 labels per bone.
+   * It is the first output if WholeBones is false, otherwise the second one. */
+  TOutputImage *
+  GetSplitBonesOutput()
+  {
+    return this->GetOutput(m_WholeBones ? 1 : 0);
+  }
+
+  /** Maximum number of bones which are processed at the same time.
+   * Bones are independent after connected component analysis,
+   * so their morphological processing can overlap.
+   * The default of 1 processes one bone after another.
+   * The result does not depend on this setting. */
+  itkGetConstMacro(NumberOfConcurrentBones, unsigned int);
+  itkSetClampMacro(NumberOfConcurrentBones, unsigned int, 1, NumericTraits<unsigned int>::max());
+
+  /** Approximate memory budget (in bytes) for the temporary images
+   * of the bones which are processed at the same time.
+   * At least one bone is always processed.
+   * Zero (default) means no limit besides NumberOfConcurrentBones.
+   * Buffers of finished bones are retained for reuse up to this budget, or without one,
+   * up to the estimated working set of the largest bones processed at the same time. */
+  itkGetConstMacro(ConcurrentBonesMemoryBudget, SizeValueType);
+  itkSetMacro(ConcurrentBonesMemoryBudget, SizeValueType);
+
+  /** Thickness (in voxels along the last axis) of slabs in which the input is processed.
+   * Only a slab plus a halo of the input is requested from upstream at a time,
+   * and the floating-point intermediates are slab-sized instead of image-sized.
+   * Connected components are stitched across slab boundaries.
+   * Zero (default) processes the whole image at once. */
+  itkGetConstMacro(SlabThickness, SizeValueType);
+  itkSetMacro(SlabThickness, SizeValueType);
+
+  /** If true, Hessian eigen-analysis and Descoteaux's sheetness measure are evaluated only at
+   * candidate voxels (those above the bone threshold), where the measure is used.
+   * The measure's normalization is then estimated from a sparse grid of voxels near candidates
+   * instead of from all voxels, so results can differ slightly. Default is false.
+   * In slab mode the measure is always evaluated only where it is needed. */
+  itkGetConstMacro(MaskedSheetness, bool);
+  itkSetMacro(MaskedSheetness, bool);
+  itkBooleanMacro(MaskedSheetness);
+
+  /** Factor by which the input is shrunk for the global stages: Gaussian smoothing,
+   * Hessian and sheetness, connected components and the distance field which separates bones.
+   * Thresholds, region growing and morphology still run at full resolution, within each bone's region.
+   * Blocks of voxels are averaged, so the shrunk spacing should stay below cortical bone thickness.
+   * Larger factors are faster, at the cost of accuracy near bone boundaries
+   * and of merging bones which are closer than a block.
+   * 1 (default) processes everything at full resolution. Ignored in slab mode. */
+  itkGetConstMacro(ShrinkFactor, unsigned int);
+  itkSetClampMacro(ShrinkFactor, unsigned int, 1, 4);
+
+  /** Directory of an on-disk cache of intermediate results, keyed by a hash of the input voxels,
+   * its geometry and the parameters which affect the results. A rerun on the same input loads
+   * the completed stages instead of recomputing them: the cortex mask and connected components,
+   * the distance field which separates bones, and the segmentation of each bone,
+   * so an interrupted run resumes at the next bone.
+   * Empty (default) disables caching. Ignored in slab mode, where the input is never buffered whole. */
+  itkSetStringMacro(CacheDirectory);
+  itkGetStringMacro(CacheDirectory);
+
+  /** If true, Update records the wall time, processor time and memory of each stage,
+   * e.g. the Gaussian and Hessian, connected components, the distance field, and each bone's
+   * basin, hole filling, region growing, morphology and compositing. Off by default. */
+  itkSetMacro(ProfileStages, bool);
+  itkGetConstMacro(ProfileStages, bool);
+  itkBooleanMacro(ProfileStages);
+
+  /** The stages recorded by the last Update or SweepCorticalBoneThickness with ProfileStages on,
+   * null otherwise. Stages of a single bone carry its label as their item.
+   * Use StageProfile::WriteJSON to dump them. */
+  itkGetConstObjectMacro(StageProfile, StageProfile);
+
+  /** Seconds which Update may take, zero (default) for no limit. It is checked like AbortGenerateData,
+   * but running out of it ends Update without an exception: the bones which were finished by then
+   * are in the output, the others are left as background, and TimeBudgetExceeded is set.
+   * The filter is then marked as modified, so the next Update runs it again.
+   * With a CacheDirectory, that rerun loads the finished bones and resumes at the next one. */
+  itkSetMacro(TimeBudget, double);
+  itkGetConstMacro(TimeBudget, double);
+
+  /** Whether the last Update or SweepCorticalBoneThickness ran out of TimeBudget,
+   * so its output lacks some of the bones. */
+  itkGetConstMacro(TimeBudgetExceeded, bool);
+
+  /** Segment the input once per cortical bone thickness, returning the label maps
+   * which the first output would hold with each thickness, in the order of thicknesses.
+   * Thresholding, connected components, the distance field which separates bones
+   * and the bones' basins do not depend on the thickness, so they are computed once and shared by all values.
+   * Values are processed from the smallest up, each continuing the Gaussian scale-space of the previous one,
+   * so only the smallest value's label map matches an Update exactly.
+   * CorticalBoneThickness itself is left unchanged.
+   * In slab and shrink modes, which interleave these stages with the thickness-dependent ones,
+   * the filter is updated once per value instead.
+   * TimeBudget applies to the whole sweep. When it runs out, the label map whose bones were being segmented
+   * is partial, and those of the values which were not reached are null. */
+  std::vector<typename TOutputImage::Pointer>
+  SweepCorticalBoneThickness(const std::vector<float> & thicknesses);
+
+  /** Runs GenerateData, and marks the filter as modified if it ran out of TimeBudget. */
+  void
+  UpdateOutputData(DataObject * output) override;
+
 protected:
-  SegmentBonesInMicroCTFilter() = default;
+  SegmentBonesInMicroCTFilter();
   ~SegmentBonesInMicroCTFilter() override = default;
 
   void
@@ -88,32 +227,324 @@ protected:
   using SizeType = typename TOutputImage::SizeType;
   using FloatThresholdType = BinaryThresholdImageFilter<RealImageType, TOutputImage>;
 
+  using TensorImageType = Image<SymmetricSecondRankTensor<float, Dimension>, Dimension>;
+  using MaskImageType = PackedBinaryImage<Dimension>; // for masks which are not inputs to ITK filters
+  using WordType = typename MaskImageType::WordType;
+  using MorphologyType = BoundedEuclideanMorphology<TOutputImage>; // same results as thresholding SDF
+  using LabelStatisticsType = ParallelLabelStatistics<TOutputImage>;
+  using RunContainerType = typename LabelStatisticsType::RunContainerType;
+  using CacheType = StageCache<Dimension>;
+  using BufferPoolType = ImageBufferPool<Dimension>;
+
+  // the whole outputs are always computed
+  void
+  EnlargeOutputRequestedRegion(DataObject * output) override;
+
+  // the whole input, or only the first slab in slab mode
+  void
+  GenerateInputRequestedRegion() override;
+
+  // extent of morphological operations, in voxels
+  SizeType
+  ComputeOperationSize(const TInputImage * inImage) const;
+
+  // core slab padded by the halo along the last axis, restricted to the image
+  RegionType
+  GetSlabRegion(const RegionType & wholeImage, IndexValueType slabBegin, SizeValueType halo) const;
+
+  // the input restricted to region; in slab mode it is requested from upstream and copied
+  typename TInputImage::ConstPointer
+  GetInputRegion(const RegionType & region);
+
+  // Descoteaux sheetness measure of bright sheets, from Hessian eigenvalues sorted by magnitude
+  // alpha, beta and c follow the defaults of DescoteauxEigenToMeasureParameterEstimationFilter
+  template <typename TEigenValues>
+  static double
+  DescoteauxSheetness(const TEigenValues & eigenValues, double c);
+
+  // eigenvalues of a Hessian, sorted by magnitude
+  static typename TensorImageType::PixelType::EigenValuesArrayType
+  SortedEigenValues(const typename TensorImageType::PixelType & tensor);
+
+  // iterative eigen-solve, for any dimension
+  template <unsigned int VDimension>
+  static typename TensorImageType::PixelType::EigenValuesArrayType
+  SortedEigenValues(const typename TensorImageType::PixelType & tensor,
+                    std::integral_constant<unsigned int, VDimension>);
+
+  // closed-form eigen-solve of a 3x3 symmetric matrix, several times faster than the iterative one
+  static typename TensorImageType::PixelType::EigenValuesArrayType
+  SortedEigenValues(const typename TensorImageType::PixelType & tensor, std::integral_constant<unsigned int, 3>);
+
+  // squared Frobenius norm of a Hessian, which is the sum of its squared eigenvalues
+  static double
+  SquaredFrobeniusNorm(const typename TensorImageType::PixelType & tensor);
+
+  // the input smoothed at sigma, from which a sweep continues the scale-space of a larger thickness
+  struct SmoothedInputData
+  {
+    typename RealImageType::Pointer image; // null before the first value
+    double                          sigma = 0.0;
+  };
+
+  // Gaussian scale-space at sigma of cortical bone thickness: the scale-normalized Hessian of the input,
+  // and unless gaussLabel is null, the smoothed input thresholded into gaussLabel.
+  // Unless smoothed is null, the passes start from its image if it is smoothed at a smaller sigma,
+  // and it receives the smoothed input of this thickness, which needs gaussLabel.
+  typename TensorImageType::Pointer
+  ComputeScaleSpace(const TInputImage * input, MaskImageType * gaussLabel, SmoothedInputData * smoothed = nullptr);
+
+  // thresholded Descoteaux sheetness at candidate voxels, estimating its normalization near candidates
+  typename MaskImageType::Pointer
+  ComputeMaskedSheetness(const TensorImageType * tensors, const TOutputImage * candidates);
+
+  // thresholded Descoteaux sheetness, everywhere or only at candidates depending on MaskedSheetness
+  typename MaskImageType::Pointer
+  ComputeSheetness(const TensorImageType * tensors, const TOutputImage * candidates);
+
+  // cortexLabel from the Gaussian scale-space at cortical bone thickness, restricted to thLabel
+  void
+  ComputeCortex(const TInputImage *  input,
+                const TOutputImage * thLabel,
+                MaskImageType *      cortexLabel,
+                SmoothedInputData *  smoothed = nullptr);
+
+  // thresholded Descoteaux sheetness, at candidate voxels or everywhere if candidates is null.
+  // Eigenvalues and the measure are computed per voxel, only the mask is stored.
+  typename MaskImageType::Pointer
+  ThresholdSheetness(const TensorImageType * tensors, const TOutputImage * candidates, double c) const;
+
+  // compute cortexLabel and the connected components of thresholded input slab by slab,
+  // the components with a zero margin of opSize
+  typename TOutputImage::Pointer
+  ComputeInSlabs(MaskImageType * cortexLabel, const SizeType & opSize, IdentifierType & numberOfLabels);
+
+  // the region of the shrunk image, which starts at zero
+  RegionType
+  GetCoarseRegion(const RegionType & wholeImage) const;
+
+  // number of coarse voxels which cover a full resolution extent
+  SizeType
+  GetCoarseSize(const SizeType & size) const;
+
+  // first full resolution voxel of a coarse voxel's block
+  IndexType
+  CoarseToFine(const IndexType & coarse, const RegionType & wholeImage) const;
+
+  // full resolution region covered by blocks of a coarse region, restricted to the image
+  RegionType
+  CoarseToFine(const RegionType & coarse, const RegionType & wholeImage) const;
+
+  // coarse voxel whose block contains a full resolution voxel
+  IndexType
+  FineToCoarse(const IndexType & fine, const RegionType & wholeImage) const;
+
+  // average of each block of the image, or maximum if maximum is true, with a zero margin of padSize;
+  // the physical position of a coarse voxel is the center of its block
+  template <typename TImage>
+  typename TImage::Pointer
+  Shrink(const TImage * image, bool maximum, const SizeType & padSize = SizeType()) const;
+
+  // compute cortexLabel and the connected components of thresholded input on the shrunk image,
+  // returning the components upsampled to full resolution and restricted to the full resolution threshold;
+  // coarseBones has a margin for operations of opSize at full resolution
+  typename TOutputImage::Pointer
+  ComputeShrunk(MaskImageType *                  cortexLabel,
+                const SizeType &                 opSize,
+                IdentifierType &                 numberOfLabels,
+                typename TOutputImage::Pointer & coarseBones);
+
+  // the input's voxels at or above lower, with a zero margin of padSize around the image,
+  // so the connected components and their distance field need no padded copy
+  typename TOutputImage::Pointer
+  Threshold(const TInputImage * input, InputPixelType lower, const SizeType & padSize) const;
+
   // split the binary mask into components and remove the small islands
   typename TOutputImage::Pointer
-  ConnectedComponentAnalysis(typename TOutputImage::Pointer labelImage, IdentifierType & numberOfLabels);
+  ConnectedComponentAnalysis(typename TOutputImage::Pointer labelImage,
+                             IdentifierType &               numberOfLabels,
+                             SizeValueType                  minimumObjectSize = 1000);
 
   // compute Signed Distance Field of a binary image
   typename RealImageType::Pointer
   SDF(typename TOutputImage::Pointer labelImage);
 
-  // morphological dilation by thresholding the distance field
-  typename TOutputImage::Pointer
-  SDFDilate(typename TOutputImage::Pointer labelImage, double radius);
+  // bit-pack the non-zero pixels of a region of a binary image
+  static typename MaskImageType::Pointer
+  Pack(const TOutputImage * labelImage, const RegionType & region);
 
-  // morphological erosion by thresholding the distance field
-  typename TOutputImage::Pointer
-  SDFErode(typename TOutputImage::Pointer labelImage, double radius);
+  // intermediate state of one bone's processing
+  struct BoneData
+  {
+    OutputPixelType bone = 0;
+    RegionType      boneRegion;         // tight bounding box
+    RegionType      expandedBoneRegion; // bounding box with room for morphological operations
+    RegionType      safeBoneRegion;     // expanded bounding box restricted to image size
 
-  // zero-pad an image
-  typename TOutputImage::Pointer
-  ZeroPad(typename TOutputImage::Pointer labelImage, Size<Dimension> padSize);
+    const RunContainerType * boneRuns = nullptr; // the bone's voxels, used as region growing seeds
+
+    typename MaskImageType::Pointer boneBasin = nullptr;    // voxels closer to this bone than to any other
+    typename MaskImageType::Pointer dilatedBone = nullptr;  // cortical and trabecular bone
+    typename MaskImageType::Pointer erodedMarrow = nullptr; // whole bone including marrow
+
+    bool cached = false;   // the basin and the segmentation were loaded from the cache
+    bool finished = false; // the segmentation is complete, computed or loaded from the cache
+  };
+
+  // the cache of this input and parameters, or null if caching is disabled
+  typename CacheType::Pointer
+  CreateCache(const TInputImage * inImage) const;
+
+  // load cortexLabel and the connected components from the cache, false if some of them are missing
+  bool
+  LoadComponents(const CacheType *                 cache,
+                 typename MaskImageType::Pointer & cortexLabel,
+                 typename TOutputImage::Pointer &  bones,
+                 typename TOutputImage::Pointer &  coarseBones,
+                 IdentifierType &                  numBones) const;
+
+  // load the bone's basin and segmentation from the cache, false if some of them are missing
+  bool
+  LoadBone(const CacheType * cache, BoneData & boneData) const;
+
+  // store the bone's basin and segmentation into the cache
+  void
+  StoreBone(const CacheType * cache, const BoneData & boneData) const;
+
+  // connected components of bones, with what the per-bone processing needs of them
+  struct ComponentsData
+  {
+    IdentifierType                        numBones = 0;
+    typename TOutputImage::Pointer        bones;          // with a zero margin for the distance field
+    typename RealImageType::Pointer       boneDist;       // null in slab mode, where it is computed per bone
+    typename LabelStatisticsType::Pointer boneStatistics; // bounding box and voxels of each bone
+
+    typename TOutputImage::Pointer        coarseBones; // the shrunk components with a margin, only when shrinking
+    typename RealImageType::Pointer       coarseDist;
+    typename LabelStatisticsType::Pointer coarseStatistics;
+    SizeType                              coarseOpSize;
+
+    typename BufferPoolType::Pointer bufferPool; // recycles the buffers of per-bone temporaries
+
+    // in a sweep, the basins of bones by label, computed with the margin of the largest thickness
+    // by the first SegmentBones and reused by the later ones; empty otherwise
+    std::vector<typename MaskImageType::Pointer> boneBasins;
+    SizeType                                     basinPadSize;
+  };
+
+  // compute the distance fields and statistics of components, whose margins are at least padSize
+  void
+  PrepareComponents(ComponentsData &   components,
+                    const RegionType & wholeImage,
+                    const SizeType &   padSize,
+                    const CacheType *  cache);
+
+  // segment the bones in batches, and write their labels into the label maps which are not null
+  void
+  SegmentBones(ComponentsData &      components,
+               const MaskImageType * cortexLabel,
+               const SizeType &      opSize,
+               float                 epsDist,
+               const CacheType *     cache,
+               TOutputImage *        wholeBones,
+               TOutputImage *        splitBones);
+
+  // estimate memory needed for temporary images while processing a bone
+  SizeValueType
+  EstimateBoneMemory(const BoneData & boneData) const;
+
+  // compute the part of the image which is closer to this bone than to any other bone
+  void
+  ComputeBoneBasin(BoneData &            boneData,
+                   const TOutputImage *  bones,
+                   const RealImageType * boneDist,
+                   float                 epsDist,
+                   BufferPoolType *      pool,
+                   float                 beginProgress,
+                   float                 boneProgress);
+
+  // ComputeBoneBasin on the shrunk image, upsampled into the bone's full resolution region
+  void
+  ComputeCoarseBoneBasin(BoneData &                  boneData,
+                         const TOutputImage *        coarseBones,
+                         const RealImageType *       coarseDist,
+                         const LabelStatisticsType * coarseStatistics,
+                         const SizeType &            coarseOpSize,
+                         float                       epsDist,
+                         BufferPoolType *            pool,
+                         float                       beginProgress,
+                         float                       boneProgress);
+
+  // mark other bones fully enclosed by this bone's basin for skipping
+  void
+  MarkIslands(const BoneData & boneData, const TOutputImage * bones, std::vector<OutputPixelType> & replacedBy);
+
+  // region-grow the bone within its basin and compute its trabecular bone and marrow
+  void
+  SegmentBone(BoneData &       boneData,
+              const SizeType & opSize,
+              BufferPoolType * pool,
+              float            beginProgress,
+              float            boneProgress);
+
+  // write the bone's labels into the label maps which are not null, clipping them to the bone basin
+  void
+  CompositeBone(const BoneData &      boneData,
+                const MaskImageType * cortexLabel,
+                TOutputImage *        wholeBones,
+                TOutputImage *        splitBones);
+
+  // update progress from within per-bone processing, unless boneProgress is zero
+  void
+  UpdateBoneProgress(float beginProgress, float boneProgress, float fraction);
+
+  // replace the stage profile with a started one if ProfileStages is on, or with null
+  void
+  StartStageProfile();
+
+  // stop sampling the memory of the stage profile, if any
+  void
+  StopStageProfile();
+
+  // whether TimeBudget has run out since the start of this run
+  bool
+  IsOverTimeBudget() const;
+
+  // throw ProcessAborted if AbortGenerateData is set or TimeBudget has run out
+  void
+  CheckAbort() const;
+
+  // make an internal filter abort from its next progress event on, once this filter should
+  void
+  ForwardAbort(ProcessObject * filter) const;
+
+  // invoke func(i) for i in [0, count) from count threads, rethrowing the first exception
+  template <typename TFunction>
+  static void
+  RunConcurrently(SizeValueType count, TFunction func);
 
   void
   GenerateData() override;
 
 private:
-  float m_CorticalBoneThickness = 0.1;
-  bool  m_WholeBones = true;
+  float         m_CorticalBoneThickness = 0.1;
+  bool          m_WholeBones = true;
+  bool          m_BothLabelMaps = false;
+  unsigned int  m_NumberOfConcurrentBones = 1;
+  SizeValueType m_ConcurrentBonesMemoryBudget = 0;
+  SizeValueType m_SlabThickness = 0;
+  bool          m_MaskedSheetness = false;
+  unsigned int  m_ShrinkFactor = 1;
+  std::string   m_CacheDirectory;
+  bool          m_ProfileStages = false;
+  double        m_TimeBudget = 0.0;
+  bool          m_TimeBudgetExceeded = false;
+
+  std::chrono::steady_clock::time_point m_StartTime; // of the current run, for TimeBudget
+
+  StageProfile::Pointer m_StageProfile; // of the last run, or null
+
+  std::mutex m_InputMutex; // serializes upstream requests in slab mode
 
 #ifdef ITK_USE_CONCEPT_CHECKING
   itkConceptMacro(CTInputPixelIsSigned, (itk::Concept::Signed<typename InputImageType::PixelType>));
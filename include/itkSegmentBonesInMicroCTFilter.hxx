@@ -19,480 +19,2139 @@
 #define itkSegmentBonesInMicroCTFilter_hxx
 
 
-#include "itkArray.h"
 #include "itkMedianImageFilter.h"
-#include "itkConnectedComponentImageFilter.h"
-#include "itkRelabelComponentImageFilter.h"
+#include "itkParallelConnectedComponentImageFilter.h"
 #include "itkSignedMaurerDistanceMapImageFilter.h"
-#include "itkNotImageFilter.h"
-#include "itkSmoothingRecursiveGaussianImageFilter.h"
-#include "itkMultiScaleHessianEnhancementImageFilter.h"
-#include "itkDescoteauxEigenToMeasureImageFilter.h"
-#include "itkDescoteauxEigenToMeasureParameterEstimationFilter.h"
-#include "itkNeighborhoodConnectedImageFilter.h"
-#include "itkConstantPadImageFilter.h"
+#include "itkRecursiveGaussianImageFilter.h"
+#include "itkParallelNeighborhoodConnected.h"
+#include "itkScanlineKernels.h"
 #include "itkBinaryFillholeImageFilter.h"
+#include "itkImageAlgorithm.h"
+#include "itkImageRegionIndexRange.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkImageScanlineConstIterator.h"
+#include "itkMath.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <numeric>
+#include <thread>
 
 namespace itk
 {
+template <typename TInputImage, typename TOutputImage>
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::SegmentBonesInMicroCTFilter()
+{
+  // the other label map, see BothLabelMaps
+  this->SetNumberOfRequiredOutputs(2);
+  this->SetNthOutput(1, this->MakeOutput(1));
+}
+
 template <typename TInputImage, typename TOutputImage>
 void
 SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::PrintSelf(std::ostream & os, Indent indent) const
 {
   Superclass::PrintSelf(os, indent);
   os << indent << "CorticalBoneThickness: " << m_CorticalBoneThickness << std::endl;
+  os << indent << "WholeBones: " << m_WholeBones << std::endl;
+  os << indent << "BothLabelMaps: " << m_BothLabelMaps << std::endl;
+  os << indent << "NumberOfConcurrentBones: " << m_NumberOfConcurrentBones << std::endl;
+  os << indent << "ConcurrentBonesMemoryBudget: " << m_ConcurrentBonesMemoryBudget << std::endl;
+  os << indent << "SlabThickness: " << m_SlabThickness << std::endl;
+  os << indent << "MaskedSheetness: " << m_MaskedSheetness << std::endl;
+  os << indent << "ShrinkFactor: " << m_ShrinkFactor << std::endl;
+  os << indent << "CacheDirectory: " << m_CacheDirectory << std::endl;
+  os << indent << "ProfileStages: " << m_ProfileStages << std::endl;
+  os << indent << "TimeBudget: " << m_TimeBudget << std::endl;
+  os << indent << "TimeBudgetExceeded: " << m_TimeBudgetExceeded << std::endl;
 }
 
 template <typename TInputImage, typename TOutputImage>
-typename TOutputImage::Pointer
-SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::ConnectedComponentAnalysis(
-  typename TOutputImage::Pointer labelImage,
-  IdentifierType &               numberOfLabels)
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::EnlargeOutputRequestedRegion(DataObject * output)
 {
-  using ManyLabelImageType = Image<SizeValueType, TOutputImage::ImageDimension>;
-  using LabelerType = ConnectedComponentImageFilter<TOutputImage, ManyLabelImageType>;
-  typename LabelerType::Pointer labeler = LabelerType::New();
-  labeler->SetInput(labelImage);
+  Superclass::EnlargeOutputRequestedRegion(output);
+  output->SetRequestedRegionToLargestPossibleRegion();
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::GenerateInputRequestedRegion()
+{
+  Superclass::GenerateInputRequestedRegion();
 
-  using RelabelType = RelabelComponentImageFilter<ManyLabelImageType, TOutputImage>;
-  typename RelabelType::Pointer relabeler = RelabelType::New();
-  relabeler->SetInput(labeler->GetOutput());
-  relabeler->SetMinimumObjectSize(1000);
+  TInputImage * inImage = const_cast<TInputImage *>(this->GetInput());
+  if (!inImage)
+  {
+    return;
+  }
 
-  relabeler->Update();
-  numberOfLabels = relabeler->GetNumberOfObjects();
-  return relabeler->GetOutput();
+  RegionType wholeImage = inImage->GetLargestPossibleRegion();
+  if (m_SlabThickness == 0)
+  {
+    inImage->SetRequestedRegion(wholeImage);
+  }
+  else // the remaining slabs are requested during GenerateData
+  {
+    SizeType opSize = this->ComputeOperationSize(inImage);
+    inImage->SetRequestedRegion(
+      this->GetSlabRegion(wholeImage, wholeImage.GetIndex(Dimension - 1), opSize[Dimension - 1]));
+  }
 }
 
 template <typename TInputImage, typename TOutputImage>
-typename SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::RealImageType::Pointer
-SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::SDF(typename TOutputImage::Pointer labelImage)
+auto
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::ComputeOperationSize(const TInputImage * inImage) const
+  -> SizeType
 {
-  using DistanceFieldType = SignedMaurerDistanceMapImageFilter<TOutputImage, RealImageType>;
-  typename DistanceFieldType::Pointer distF = DistanceFieldType::New();
-  distF->SetInput(labelImage);
-  distF->SetSquaredDistance(true);
-  distF->Update();
-  typename RealImageType::Pointer dist = distF->GetOutput();
-  dist->DisconnectPipeline();
-  return dist;
+  const double maxRadius = 8.0 * m_CorticalBoneThickness; // allow some room for imperfect intermediate steps
+  SizeType     opSize;
+  for (unsigned d = 0; d < Dimension; d++)
+  {
+    opSize[d] = std::ceil(maxRadius / inImage->GetSpacing()[d]);
+  }
+  return opSize;
 }
 
 template <typename TInputImage, typename TOutputImage>
-typename TOutputImage::Pointer
-SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::SDFDilate(typename TOutputImage::Pointer labelImage,
-                                                                  double                         radius)
+auto
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::GetSlabRegion(const RegionType & wholeImage,
+                                                                      IndexValueType     slabBegin,
+                                                                      SizeValueType      halo) const -> RegionType
 {
-  typename FloatThresholdType::Pointer sdfTh = FloatThresholdType::New();
-  sdfTh->SetInput(this->SDF(labelImage));
-  sdfTh->SetUpperThreshold(radius * radius);
-  sdfTh->Update();
-  return sdfTh->GetOutput();
+  RegionType slab = wholeImage;
+  slab.SetIndex(Dimension - 1, slabBegin);
+  slab.SetSize(Dimension - 1, m_SlabThickness);
+  SizeType radius;
+  radius.Fill(0);
+  radius[Dimension - 1] = halo;
+  slab.PadByRadius(radius);
+  slab.Crop(wholeImage);
+  return slab;
 }
 
 template <typename TInputImage, typename TOutputImage>
-typename TOutputImage::Pointer
-SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::SDFErode(typename TOutputImage::Pointer labelImage,
-                                                                 double                         radius)
+typename TInputImage::ConstPointer
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::GetInputRegion(const RegionType & region)
 {
-  // we need an inversion filter because Maurer's filter distances are not symmetrical
-  // inside distances start at 0, while outside distances start at single spacing
-  using NotType = NotImageFilter<TOutputImage, TOutputImage>;
-  typename NotType::Pointer negator = NotType::New();
-  negator->SetInput(labelImage);
-  negator->Update();
+  if (m_SlabThickness == 0)
+  {
+    return this->GetInput();
+  }
 
-  typename FloatThresholdType::Pointer sdfTh = FloatThresholdType::New();
-  sdfTh->SetInput(this->SDF(negator->GetOutput()));
-  sdfTh->SetLowerThreshold(radius * radius);
-  sdfTh->Update();
+  // concurrently processed bones share the upstream pipeline
+  std::lock_guard<std::mutex> lock(m_InputMutex);
 
-  return sdfTh->GetOutput();
+  TInputImage * inImage = const_cast<TInputImage *>(this->GetInput());
+  inImage->SetRequestedRegion(region);
+  inImage->PropagateRequestedRegion();
+  inImage->UpdateOutputData();
+
+  // the next request might replace the input's buffer
+  typename TInputImage::Pointer part = TInputImage::New();
+  part->CopyInformation(inImage);
+  part->SetRegions(region);
+  part->Allocate(false);
+  ImageAlgorithm::Copy(inImage, part.GetPointer(), region, region);
+  return part;
 }
 
 template <typename TInputImage, typename TOutputImage>
-typename TOutputImage::Pointer
-SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::ZeroPad(typename TOutputImage::Pointer labelImage,
-                                                                Size<Dimension>                padSize)
+template <typename TEigenValues>
+double
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::DescoteauxSheetness(const TEigenValues & eigenValues,
+                                                                            double               c)
 {
-  using PadType = ConstantPadImageFilter<TOutputImage, TOutputImage>;
-  typename PadType::Pointer padder = PadType::New();
-  padder->SetInput(labelImage);
-  padder->SetPadBound(padSize);
-  padder->Update();
-  return padder->GetOutput();
+  constexpr double alpha = 0.5;
+  constexpr double beta = 0.5;
+
+  const double a3 = eigenValues[Dimension - 1];
+  const double l1 = std::abs(eigenValues[0]);
+  const double l2 = std::abs(eigenValues[1]);
+  const double l3 = std::abs(a3);
+  if (a3 > 0 || l3 < NumericTraits<double>::epsilon() || c <= 0.0) // not a bright sheet
+  {
+    return 0.0;
+  }
+
+  const double rSheet = l2 / l3;
+  const double rBlob = std::abs(2 * l3 - l2 - l1) / l3;
+  const double rNoise2 = l1 * l1 + l2 * l2 + l3 * l3;
+  return std::exp(-rSheet * rSheet / (2 * alpha * alpha)) * (1.0 - std::exp(-rBlob * rBlob / (2 * beta * beta))) *
+         (1.0 - std::exp(-rNoise2 / (2 * c * c)));
 }
 
+template <typename TInputImage, typename TOutputImage>
+auto
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::SortedEigenValues(
+  const typename TensorImageType::PixelType & tensor) -> typename TensorImageType::PixelType::EigenValuesArrayType
+{
+  return SortedEigenValues(tensor, std::integral_constant<unsigned int, Dimension>());
+}
 
 template <typename TInputImage, typename TOutputImage>
-void
-SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::GenerateData()
+template <unsigned int VDimension>
+auto
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::SortedEigenValues(
+  const typename TensorImageType::PixelType & tensor,
+  std::integral_constant<unsigned int, VDimension>) -> typename TensorImageType::PixelType::EigenValuesArrayType
 {
-  this->AllocateOutputs();
+  typename TensorImageType::PixelType::EigenValuesArrayType eigenValues;
+  tensor.ComputeEigenValues(eigenValues);
+  std::sort(eigenValues.begin(), eigenValues.end(), [](double a, double b) { return std::abs(a) < std::abs(b); });
+  return eigenValues;
+}
 
-  typename TInputImage::ConstPointer inImage = this->GetInput();
+template <typename TInputImage, typename TOutputImage>
+auto
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::SortedEigenValues(
+  const typename TensorImageType::PixelType & tensor,
+  std::integral_constant<unsigned int, 3>) -> typename TensorImageType::PixelType::EigenValuesArrayType
+{
+  // trigonometric solution of the characteristic polynomial, after shifting by the mean eigenvalue
+  const double a00 = tensor(0, 0);
+  const double a11 = tensor(1, 1);
+  const double a22 = tensor(2, 2);
+  const double a01 = tensor(0, 1);
+  const double a02 = tensor(0, 2);
+  const double a12 = tensor(1, 2);
 
-  Array<double> sigmaArray(1);
-  sigmaArray[0] = m_CorticalBoneThickness;
-  using BinaryThresholdType = BinaryThresholdImageFilter<TInputImage, TOutputImage>;
+  const double q = (a00 + a11 + a22) / 3.0;
+  const double b00 = a00 - q;
+  const double b11 = a11 - q;
+  const double b22 = a22 - q;
+  const double p2 = (b00 * b00 + b11 * b11 + b22 * b22 + 2.0 * (a01 * a01 + a02 * a02 + a12 * a12)) / 6.0;
 
-  const double maxRadius = 8.0 * m_CorticalBoneThickness; // allow some room for imperfect intermediate steps
-  double       avgSpacing = 1.0;
-  SizeType     opSize; // maximum extent of morphological operations
-  for (unsigned d = 0; d < Dimension; d++)
+  double e[3] = { q, q, q };
+  if (p2 > 0.0)
   {
-    opSize[d] = std::ceil(maxRadius / inImage->GetSpacing()[d]);
-    avgSpacing *= inImage->GetSpacing()[d];
+    const double p = std::sqrt(p2);
+    // half the determinant of (A - qI) / p, which is within [-1, 1] up to rounding
+    const double det = b00 * (b11 * b22 - a12 * a12) - a01 * (a01 * b22 - a12 * a02) + a02 * (a01 * a12 - b11 * a02);
+    const double r = std::max(-1.0, std::min(1.0, det / (2.0 * p2 * p)));
+    const double phi = std::acos(r) / 3.0;
+    e[0] = q + 2.0 * p * std::cos(phi);
+    e[2] = q + 2.0 * p * std::cos(phi + 2.0 * Math::pi / 3.0);
+    e[1] = 3.0 * q - e[0] - e[2];
   }
-  avgSpacing = std::pow(avgSpacing, 1.0 / Dimension); // geometric average preserves voxel volume
-  float epsDist = 0.001 * avgSpacing;                 // epsilon for distance comparisons
 
-  RegionType wholeImage = inImage->GetLargestPossibleRegion();
+  // sort by magnitude with three compare-exchanges
+  auto order = [&e](unsigned i, unsigned j) {
+    if (std::abs(e[j]) < std::abs(e[i]))
+    {
+      std::swap(e[i], e[j]);
+    }
+  };
+  order(0, 1);
+  order(1, 2);
+  order(0, 1);
+
+  typename TensorImageType::PixelType::EigenValuesArrayType eigenValues;
+  for (unsigned d = 0; d < 3; d++)
+  {
+    eigenValues[d] = e[d];
+  }
+  return eigenValues;
+}
+
+template <typename TInputImage, typename TOutputImage>
+double
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::SquaredFrobeniusNorm(
+  const typename TensorImageType::PixelType & tensor)
+{
+  double frobenius2 = 0.0;
+  for (unsigned i = 0; i < Dimension; i++)
+  {
+    for (unsigned j = 0; j < Dimension; j++)
+    {
+      frobenius2 += double(tensor(i, j)) * tensor(i, j);
+    }
+  }
+  return frobenius2;
+}
 
-  // extra padding so morphological operations don't introduce boundary effects
-  RegionType paddedWholeImage = wholeImage;
-  paddedWholeImage.PadByRadius(opSize);
+template <typename TInputImage, typename TOutputImage>
+auto
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::ComputeScaleSpace(const TInputImage * input,
+                                                                          MaskImageType *     gaussLabel,
+                                                                          SmoothedInputData * smoothed)
+  -> typename TensorImageType::Pointer
+{
+  using FirstPassType = RecursiveGaussianImageFilter<TInputImage, RealImageType>;
+  using PassType = RecursiveGaussianImageFilter<RealImageType, RealImageType>;
+  using OrdersType = FixedArray<unsigned int, Dimension>; // derivative order along each axis
+  StageProfile::Scope stage(m_StageProfile, "gaussAndHessian");
 
-  // we will do pixel-wise operation in a multi-threaded manner
+  const RegionType           region = input->GetBufferedRegion();
   MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
 
-  typename TOutputImage::Pointer gaussLabel;
+  typename TensorImageType::Pointer tensors = TensorImageType::New();
+  tensors->CopyInformation(input);
+  tensors->SetRegions(region);
+  tensors->Allocate(false);
+
+  // Gaussians compose by adding variances, so the passes can continue from the input smoothed at a smaller sigma,
+  // with derivatives normalized by this thickness rather than by the sigma of the passes
+  typename RealImageType::Pointer smoothedInput; // held, as smoothed receives this thickness' image during the passes
+  double                          sigma = m_CorticalBoneThickness;
+  float                           hessianScale = 1.0f;
+  if (smoothed && smoothed->image && smoothed->sigma < m_CorticalBoneThickness)
   {
-    using GaussType = SmoothingRecursiveGaussianImageFilter<TInputImage>;
-    typename GaussType::Pointer gaussF = GaussType::New();
-    gaussF->SetInput(inImage);
-    gaussF->SetSigma(m_CorticalBoneThickness);
-    gaussF->Update();
+    smoothedInput = smoothed->image;
+    sigma = std::sqrt(double(m_CorticalBoneThickness) * m_CorticalBoneThickness - smoothed->sigma * smoothed->sigma);
+    hessianScale = m_CorticalBoneThickness * m_CorticalBoneThickness / (sigma * sigma);
+  }
 
-    typename BinaryThresholdType::Pointer binTh2 = BinaryThresholdType::New();
-    binTh2->SetInput(gaussF->GetOutput());
-    binTh2->SetLowerThreshold(2000);
-    binTh2->Update();
-    gaussLabel = binTh2->GetOutput();
+  // the smoothed image needs zeroth order along all axes, a Hessian component second order along one axis
+  // or first order along two. Passes run from the last axis to the first, depth-first over derivative orders,
+  // so a pass shared by several outputs runs once and at most one intermediate per axis is alive.
+  std::vector<OrdersType> leaves;
+  if (gaussLabel)
+  {
+    leaves.push_back(OrdersType::Filled(0));
+  }
+  for (unsigned i = 0; i < Dimension; i++)
+  {
+    for (unsigned j = i; j < Dimension; j++)
+    {
+      OrdersType orders = OrdersType::Filled(0);
+      ++orders[i];
+      ++orders[j];
+      leaves.push_back(orders);
+    }
   }
 
-  // Create a process accumulator for tracking the progress of minipipeline
-  ProgressAccumulator::Pointer progress = ProgressAccumulator::New();
-  progress->SetMiniPipelineFilter(this);
+  auto storeLeaf = [&](const RealImageType * result, const OrdersType & orders) {
+    if (orders == OrdersType::Filled(0))
+    {
+      mt->ParallelizeImageRegionRestrictDirection<Dimension>(
+        0, // rows of packed gaussLabel must not be shared between threads
+        gaussLabel->GetBufferedRegion(),
+        [result, gaussLabel](const RegionType labelRegion) {
+          ImageRegionConstIterator<RealImageType>        rIt(result, labelRegion);
+          PackedBinaryImageRegionIterator<MaskImageType> gIt(gaussLabel, labelRegion);
+          for (; !gIt.IsAtEnd(); ++rIt, ++gIt)
+          {
+            gIt.Set(rIt.Get() >= 2000);
+          }
+        },
+        nullptr);
+      return;
+    }
 
-  typename TOutputImage::Pointer descoLabel;
-  {
-    using MultiScaleHessianFilterType = MultiScaleHessianEnhancementImageFilter<TInputImage, RealImageType>;
-    using EigenValueImageType = typename MultiScaleHessianFilterType::EigenValueImageType;
-    using DescoteauxEigenToScalarImageFilterType =
-      DescoteauxEigenToMeasureImageFilter<EigenValueImageType, RealImageType>;
-    using DescoteauxMeasureEstimationType = DescoteauxEigenToMeasureParameterEstimationFilter<EigenValueImageType>;
+    unsigned i = 0;
+    while (orders[i] == 0)
+    {
+      ++i;
+    }
+    unsigned j = orders[i] == 2 ? i : i + 1;
+    while (orders[j] == 0)
+    {
+      ++j;
+    }
+    mt->ParallelizeImageRegion<Dimension>(
+      region,
+      [result, tensors, i, j, hessianScale](const RegionType tensorRegion) {
+        ImageRegionConstIterator<RealImageType> rIt(result, tensorRegion);
+        ImageRegionIterator<TensorImageType>    tIt(tensors, tensorRegion);
+        for (; !tIt.IsAtEnd(); ++rIt, ++tIt)
+        {
+          tIt.Value()(i, j) = hessianScale * rIt.Get();
+        }
+      },
+      nullptr);
+  };
+
+  // filter the intermediate along axis, for each order needed by leaves which share the orders of later axes
+  std::function<void(const RealImageType *, int, OrdersType)> descend;
+  descend = [&](const RealImageType * intermediate, int axis, OrdersType orders) {
+    std::vector<unsigned int> axisOrders;
+    for (const OrdersType & leaf : leaves)
+    {
+      bool sharesLaterAxes = true;
+      for (int d = axis + 1; d < static_cast<int>(Dimension); d++)
+      {
+        sharesLaterAxes = sharesLaterAxes && leaf[d] == orders[d];
+      }
+      if (sharesLaterAxes && std::find(axisOrders.begin(), axisOrders.end(), leaf[axis]) == axisOrders.end())
+      {
+        axisOrders.push_back(leaf[axis]);
+      }
+    }
 
-    typename MultiScaleHessianFilterType::Pointer multiScaleFilter = MultiScaleHessianFilterType::New();
-    multiScaleFilter->SetInput(inImage);
-    multiScaleFilter->SetSigmaArray(sigmaArray);
-    typename DescoteauxEigenToScalarImageFilterType::Pointer descoFilter =
-      DescoteauxEigenToScalarImageFilterType::New();
-    multiScaleFilter->SetEigenToMeasureImageFilter(descoFilter);
-    typename DescoteauxMeasureEstimationType::Pointer descoEstimator = DescoteauxMeasureEstimationType::New();
-    multiScaleFilter->SetEigenToMeasureParameterEstimationFilter(descoEstimator);
-    progress->RegisterInternalFilter(multiScaleFilter, 0.5f);
-    multiScaleFilter->Update();
+    for (unsigned int order : axisOrders)
+    {
+      orders[axis] = order;
+      typename RealImageType::Pointer result;
+      if (intermediate || smoothedInput)
+      {
+        typename PassType::Pointer pass = PassType::New();
+        this->ForwardAbort(pass);
+        pass->SetInput(intermediate ? intermediate : smoothedInput.GetPointer());
+        pass->SetInPlace(intermediate && order == axisOrders.back()); // the intermediate's last use
+        pass->SetDirection(axis);
+        pass->SetOrder(static_cast<GaussianOrderEnum>(order));
+        pass->SetSigma(sigma);
+        pass->SetNormalizeAcrossScale(true);
+        pass->Update();
+        result = pass->GetOutput();
+      }
+      else // the first pass reads the input
+      {
+        typename FirstPassType::Pointer pass = FirstPassType::New();
+        this->ForwardAbort(pass);
+        pass->SetInput(input);
+        pass->InPlaceOff();
+        pass->SetDirection(axis);
+        pass->SetOrder(static_cast<GaussianOrderEnum>(order));
+        pass->SetSigma(sigma);
+        pass->SetNormalizeAcrossScale(true);
+        pass->Update();
+        result = pass->GetOutput();
+      }
 
-    typename FloatThresholdType::Pointer descoTh = FloatThresholdType::New();
-    descoTh->SetInput(multiScaleFilter->GetOutput());
-    descoTh->SetLowerThreshold(0.1);
-    descoTh->Update();
-    descoLabel = descoTh->GetOutput();
-    this->UpdateProgress(0.51f);
-  }
+      if (axis == 0)
+      {
+        storeLeaf(result, orders);
+        if (smoothed && orders == OrdersType::Filled(0))
+        {
+          smoothed->image = result;
+          smoothed->sigma = m_CorticalBoneThickness;
+        }
+      }
+      else
+      {
+        descend(result, axis - 1, orders);
+      }
+    }
+  };
+  descend(nullptr, Dimension - 1, OrdersType::Filled(0));
 
+  return tensors;
+}
 
-  typename BinaryThresholdType::Pointer binTh = BinaryThresholdType::New();
-  binTh->SetInput(inImage);
-  binTh->SetLowerThreshold(5000); // start from a high threshold, so bones are well separated
-  binTh->Update();
-  typename TOutputImage::Pointer thLabel = binTh->GetOutput();
+template <typename TInputImage, typename TOutputImage>
+auto
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::ComputeMaskedSheetness(const TensorImageType * tensors,
+                                                                               const TOutputImage *    candidates)
+  -> typename MaskImageType::Pointer
+{
+  const RegionType           wholeImage = tensors->GetBufferedRegion();
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
 
-  // create cortexLabel with information from descoLabel, gaussLabel and thLabel
-  typename TOutputImage::Pointer cortexLabel = TOutputImage::New();
-  cortexLabel->CopyInformation(inImage);
-  cortexLabel->SetRegions(paddedWholeImage);
-  cortexLabel->Allocate(true);
+  // Descoteaux's c is half of the largest Frobenius norm. It is attained at bone surfaces, so it is searched for
+  // within a Gaussian's sigma of candidates, on a grid of about half a sigma, where the Hessian is smooth.
+  typename TOutputImage::Pointer nearCandidates = MorphologyType::New()->Dilate(candidates, m_CorticalBoneThickness);
+  SizeType                       step;
+  for (unsigned d = 0; d < Dimension; d++)
+  {
+    step[d] = std::max(1.0, std::floor(0.5 * m_CorticalBoneThickness / tensors->GetSpacing()[d]));
+  }
+  std::mutex maxMutex;
+  double     maxFrobenius2 = 0.0;
   mt->ParallelizeImageRegion<Dimension>(
     wholeImage,
-    [descoLabel, gaussLabel, thLabel, cortexLabel](const RegionType region) {
-      ImageRegionConstIterator<TOutputImage> gIt(gaussLabel, region);
-      ImageRegionConstIterator<TOutputImage> tIt(thLabel, region);
-      ImageRegionConstIterator<TOutputImage> dIt(descoLabel, region);
-      ImageRegionIterator<TOutputImage>      cIt(cortexLabel, region);
-      for (; !cIt.IsAtEnd(); ++gIt, ++tIt, ++dIt, ++cIt)
-      {
-        unsigned char p = dIt.Get() || gIt.Get();
-        p = p && tIt.Get();
-        if (p)
+    [&](const RegionType region) {
+      // the grid points within region
+      IndexType  first;
+      RegionType samples;
+      for (unsigned d = 0; d < Dimension; d++)
+      {
+        const IndexValueType stepD = step[d];
+        const IndexValueType offset = region.GetIndex(d) - wholeImage.GetIndex(d);
+        first[d] = region.GetIndex(d) + (stepD - offset % stepD) % stepD;
+        const IndexValueType end = region.GetIndex(d) + static_cast<IndexValueType>(region.GetSize(d));
+        samples.SetSize(d, first[d] < end ? (end - first[d] + stepD - 1) / stepD : 0);
+      }
+
+      double localMax = 0.0;
+      for (const IndexType & sample : ImageRegionIndexRange<Dimension>(samples))
+      {
+        IndexType ind;
+        for (unsigned d = 0; d < Dimension; d++)
+        {
+          ind[d] = first[d] + sample[d] * static_cast<IndexValueType>(step[d]);
+        }
+        if (nearCandidates->GetPixel(ind))
         {
-          cIt.Set(p);
+          localMax = std::max(localMax, SquaredFrobeniusNorm(tensors->GetPixel(ind)));
         }
       }
+      std::lock_guard<std::mutex> lock(maxMutex);
+      maxFrobenius2 = std::max(maxFrobenius2, localMax);
     },
     nullptr);
-  typename TOutputImage::Pointer cortexEroded = this->SDFErode(cortexLabel, 0.5 * m_CorticalBoneThickness);
-  descoLabel = nullptr; // deallocate it
-  gaussLabel = nullptr; // deallocate it
-  this->UpdateProgress(0.52f);
+  nearCandidates = nullptr; // deallocate it
 
-  typename TOutputImage::Pointer finalBones = this->GetOutput();
+  return this->ThresholdSheetness(tensors, candidates, 0.5 * std::sqrt(maxFrobenius2));
+}
+
+template <typename TInputImage, typename TOutputImage>
+auto
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::ComputeSheetness(const TensorImageType * tensors,
+                                                                         const TOutputImage *    candidates)
+  -> typename MaskImageType::Pointer
+{
+  StageProfile::Scope stage(m_StageProfile, "sheetness");
+  if (m_MaskedSheetness)
+  {
+    return this->ComputeMaskedSheetness(tensors, candidates);
+  }
+
+  // Descoteaux's c is half of the largest Frobenius norm, as in DescoteauxEigenToMeasureParameterEstimationFilter
+  std::mutex                 maxMutex;
+  double                     maxFrobenius2 = 0.0;
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegion<Dimension>(
+    tensors->GetBufferedRegion(),
+    [&](const RegionType region) {
+      double localMax = 0.0;
+      for (ImageRegionConstIterator<TensorImageType> hIt(tensors, region); !hIt.IsAtEnd(); ++hIt)
+      {
+        localMax = std::max(localMax, SquaredFrobeniusNorm(hIt.Get()));
+      }
+      std::lock_guard<std::mutex> lock(maxMutex);
+      maxFrobenius2 = std::max(maxFrobenius2, localMax);
+    },
+    nullptr);
 
-  // do morphological processing per bone, to avoid merging bones which are close to each other
-  IdentifierType numBones = 0;
+  return this->ThresholdSheetness(tensors, nullptr, 0.5 * std::sqrt(maxFrobenius2));
+}
 
-  typename TOutputImage::Pointer bones = this->ConnectedComponentAnalysis(thLabel, numBones);
-  // we might not even get to this point if there are more than 255 bones
-  // we need 3 labels per bone, one each for cortical, trabecular and marrow
-  itkAssertOrThrowMacro(numBones <= 85, "There are too many bones to fit into uchar");
-  this->UpdateProgress(0.55f);
+template <typename TInputImage, typename TOutputImage>
+auto
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::ThresholdSheetness(const TensorImageType * tensors,
+                                                                           const TOutputImage *    candidates,
+                                                                           double                  c) const
+  -> typename MaskImageType::Pointer
+{
+  const RegionType wholeImage = tensors->GetBufferedRegion();
 
-  bones = this->ZeroPad(bones, opSize);
-  this->UpdateProgress(0.56f);
-  typename RealImageType::Pointer boneDist = this->SDF(bones);
-  this->UpdateProgress(0.69f);
+  typename MaskImageType::Pointer descoLabel = MaskImageType::New();
+  descoLabel->CopyInformation(tensors);
+  descoLabel->SetRegions(wholeImage);
+  descoLabel->Allocate();
 
-  // calculate bounding box for each bone
-  std::vector<IndexType> minIndices(numBones + 1, IndexType::Filled(NumericTraits<IndexValueType>::max()));
-  std::vector<IndexType> maxIndices(numBones + 1, IndexType::Filled(NumericTraits<IndexValueType>::NonpositiveMin()));
-  std::vector<unsigned char> replacedBy(numBones + 1, 0);
-  {
-    ImageRegionConstIteratorWithIndex<TOutputImage> bIt(bones, wholeImage);
-    ImageRegionConstIterator<TOutputImage>          cIt(cortexEroded, wholeImage);
-    for (; !bIt.IsAtEnd(); ++bIt, ++cIt)
-    {
-      unsigned char bone = bIt.Get();
-      if (bone > 0)
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegionRestrictDirection<Dimension>(
+    0, // rows of packed descoLabel must not be shared between threads
+    wholeImage,
+    [candidates, tensors, descoLabel, c](const RegionType region) {
+      ImageScanlineConstIterator<TensorImageType>    hIt(tensors, region);
+      PackedBinaryImageRegionIterator<MaskImageType> dIt(descoLabel, region);
+      while (!hIt.IsAtEnd())
       {
-        // for determining bone's bounding box
-        IndexType ind = bIt.GetIndex();
-        for (unsigned d = 0; d < Dimension; d++)
+        const typename TOutputImage::PixelType * candidateRow =
+          candidates ? candidates->GetBufferPointer() + candidates->ComputeOffset(hIt.GetIndex()) : nullptr;
+        for (SizeValueType i = 0; !hIt.IsAtEndOfLine(); ++hIt, ++dIt, ++i)
         {
-          if (ind[d] < minIndices[bone][d])
-          {
-            minIndices[bone][d] = ind[d];
-          }
-          if (ind[d] > maxIndices[bone][d])
+          if ((!candidateRow || candidateRow[i]) &&
+              static_cast<float>(DescoteauxSheetness(SortedEigenValues(hIt.Get()), c)) >= 0.1f)
           {
-            maxIndices[bone][d] = ind[d];
+            dIt.Set(true);
           }
         }
+        hIt.NextLine();
       }
-    }
-  }
-  this->UpdateProgress(0.7f);
+    },
+    nullptr);
+  return descoLabel;
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::ComputeCortex(const TInputImage *  input,
+                                                                      const TOutputImage * thLabel,
+                                                                      MaskImageType *      cortexLabel,
+                                                                      SmoothedInputData *  smoothed)
+{
+  const RegionType wholeImage = input->GetLargestPossibleRegion();
+
+  // the smoothed image is only needed thresholded, and shares its Gaussian passes with the Hessian
+  typename MaskImageType::Pointer gaussLabel = MaskImageType::New();
+  gaussLabel->CopyInformation(input);
+  gaussLabel->SetRegions(wholeImage);
+  gaussLabel->Allocate();
+  typename TensorImageType::Pointer tensors = this->ComputeScaleSpace(input, gaussLabel, smoothed);
+  this->UpdateProgress(0.3f);
+  this->CheckAbort();
+
+  typename MaskImageType::Pointer descoLabel = this->ComputeSheetness(tensors, thLabel);
+  tensors = nullptr; // deallocate it
+  this->UpdateProgress(0.51f);
+
+  // 64 pixels at a time
+  StageProfile::Scope stage(m_StageProfile, "cortex");
+  cortexLabel->TransformWords([](WordType & c, WordType d, WordType g, WordType t) { c = (d | g) & t; },
+                              descoLabel.GetPointer(),
+                              gaussLabel.GetPointer(),
+                              Pack(thLabel, wholeImage).GetPointer());
+}
+
+template <typename TInputImage, typename TOutputImage>
+typename TOutputImage::Pointer
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::ComputeInSlabs(MaskImageType *  cortexLabel,
+                                                                       const SizeType & opSize,
+                                                                       IdentifierType & numberOfLabels)
+{
+  StageProfile::Scope stage(m_StageProfile, "slabs");
+  using SlabLabelImageType = Image<std::uint32_t, Dimension>; // provisional labels of one slab
+  using LabelerType = ParallelConnectedComponentImageFilter<TOutputImage, SlabLabelImageType>;
+
+  const RegionType     wholeImage = this->GetInput()->GetLargestPossibleRegion();
+  const IndexValueType zBegin = wholeImage.GetIndex(Dimension - 1);
+  const SizeValueType  halo = opSize[Dimension - 1]; // more than enough for the Gaussian's support
+  const SizeValueType  slabCount = (wholeImage.GetSize(Dimension - 1) + m_SlabThickness - 1) / m_SlabThickness;
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+
+  // high threshold within the slab's core, so bones are well separated
+  auto coreComponents = [this](const TInputImage * slabInput, const RegionType & core) {
+    typename TOutputImage::Pointer thLabel = TOutputImage::New();
+    thLabel->CopyInformation(slabInput);
+    thLabel->SetRegions(core);
+    thLabel->Allocate();
+    ForEachScanline(
+      core,
+      [](const IndexType &, SizeValueType length, const InputPixelType * input, OutputPixelType * output) {
+        ScanlineKernels::Threshold(input, output, length, static_cast<InputPixelType>(5000));
+      },
+      slabInput,
+      thLabel.GetPointer());
+
+    // all components are kept, as small ones can be parts of large ones in other slabs
+    typename LabelerType::Pointer labeler = LabelerType::New();
+    this->ForwardAbort(labeler);
+    labeler->SetInput(thLabel);
+    labeler->SetMinimumObjectSize(0);
+    labeler->Update();
+    return labeler;
+  };
 
+  // union-find over provisional labels of all slabs, the root is the smallest label
+  std::vector<SizeValueType> parent(1, 0); // label 0 is background
+  std::vector<SizeValueType> sizes(1, 0);
+  std::vector<SizeValueType> firstVoxels(1, 0); // position of the first voxel in raster order of the image
+  SizeValueType              position = 0;      // of the current voxel, as cores are visited in raster order
+  auto                       find = [&parent](SizeValueType label) {
+    while (parent[label] != label)
+    {
+      parent[label] = parent[parent[label]];
+      label = parent[label];
+    }
+    return label;
+  };
 
-  // per-bone processing
-  for (typename TOutputImage::PixelType bone = 1; bone <= numBones; bone++)
+  // first pass: stitch connected components and find maximum Frobenius norm for Descoteaux's C
+  std::vector<SizeValueType> slabFirstLabel(slabCount);
+  std::vector<SizeValueType> lastPlane; // provisional labels in the last plane of the previous slab
+  double                     maxFrobenius2 = 0.0;
+  for (SizeValueType slab = 0; slab < slabCount; ++slab)
   {
-    float boneProgress = 0.3f / numBones;
-    float beginProgress = 0.7 + boneProgress * (bone - 1);
-    this->UpdateProgress(beginProgress + boneProgress * 0.0f);
+    this->CheckAbort();
+    const IndexValueType slabBegin = zBegin + static_cast<IndexValueType>(slab * m_SlabThickness);
+    const RegionType     core = this->GetSlabRegion(wholeImage, slabBegin, 0);
+    typename TInputImage::ConstPointer slabInput =
+      this->GetInputRegion(this->GetSlabRegion(wholeImage, slabBegin, halo));
 
-    if (replacedBy[bone] > 0)
     {
-      std::cout << "Bone " << bone << " was an island inside bone " << unsigned(replacedBy[bone]) << std::endl;
-      continue; // next bone
+      typename TensorImageType::Pointer         tensors = this->ComputeScaleSpace(slabInput, nullptr);
+      ImageRegionConstIterator<TensorImageType> hIt(tensors, core);
+      for (; !hIt.IsAtEnd(); ++hIt)
+      {
+        maxFrobenius2 = std::max(maxFrobenius2, SquaredFrobeniusNorm(hIt.Get()));
+      }
     }
 
-    // calculate expanded bounding box, so the subsequent operations don't need to process the whole image
-    RegionType boneRegion;         // tight bounding box
-    RegionType expandedBoneRegion; // bounding box with room for morphological operations
-    for (unsigned d = 0; d < Dimension; d++)
+    typename LabelerType::Pointer labeler = coreComponents(slabInput, core);
+    const SizeValueType           firstLabel = parent.size() - 1;
+    slabFirstLabel[slab] = firstLabel;
+    for (SizeValueType i = 1; i <= labeler->GetObjectCount(); ++i)
     {
-      boneRegion.SetIndex(d, minIndices[bone][d]);
-      boneRegion.SetSize(d, maxIndices[bone][d] - minIndices[bone][d] + 1);
+      parent.push_back(firstLabel + i);
+      sizes.push_back(labeler->GetSizeOfObjectsInPixels()[i - 1]);
+      firstVoxels.push_back(NumericTraits<SizeValueType>::max());
+    }
 
-      IndexValueType opSizeD = opSize[d]; // a signed value
-      expandedBoneRegion.SetIndex(d, minIndices[bone][d] - opSizeD);
-      expandedBoneRegion.SetSize(d, maxIndices[bone][d] - minIndices[bone][d] + 1 + 2 * opSizeD);
+    // the labeler orders components by size, ties are broken by their first voxel in the whole image
+    const SlabLabelImageType *                   labels = labeler->GetOutput();
+    ImageRegionConstIterator<SlabLabelImageType> lIt(labels, core);
+    for (; !lIt.IsAtEnd(); ++lIt, ++position)
+    {
+      if (lIt.Get() > 0)
+      {
+        SizeValueType & first = firstVoxels[firstLabel + lIt.Get()];
+        first = std::min(first, position);
+      }
     }
-    RegionType safeBoneRegion = expandedBoneRegion;
-    safeBoneRegion.Crop(wholeImage); // restrict to image size
 
-    typename TOutputImage::Pointer thisBone = TOutputImage::New();
-    thisBone->CopyInformation(inImage);
-    thisBone->SetRegions(expandedBoneRegion);
-    thisBone->Allocate(true);
-    mt->ParallelizeImageRegion<Dimension>(
-      boneRegion,
-      [thisBone, bones, bone](const RegionType region) {
-        ImageRegionConstIterator<TOutputImage> bIt(bones, region);
-        ImageRegionIterator<TOutputImage>      oIt(thisBone, region);
-        for (; !oIt.IsAtEnd(); ++bIt, ++oIt)
-        {
-          if (bIt.Get() == bone)
-          {
-            oIt.Set(bone);
-          }
-        }
-      },
-      nullptr);
-    typename RealImageType::Pointer thisDist = this->SDF(thisBone);
-    thisBone = nullptr; // deallocate it
-    this->UpdateProgress(beginProgress + boneProgress * 0.05f);
-
-    typename TOutputImage::Pointer boneBasin = TOutputImage::New();
-    boneBasin->CopyInformation(inImage);
-    boneBasin->SetRegions(safeBoneRegion);
-    boneBasin->Allocate(true);
-    mt->ParallelizeImageRegion<Dimension>(
-      boneRegion,
-      [boneBasin, thisDist, boneDist, epsDist](const RegionType region) {
-        ImageRegionConstIterator<RealImageType> tIt(thisDist, region);
-        ImageRegionConstIterator<RealImageType> gIt(boneDist, region);
-        ImageRegionIterator<TOutputImage>       oIt(boneBasin, region);
-        for (; !oIt.IsAtEnd(); ++tIt, ++gIt, ++oIt)
-        {
-          if (std::abs(tIt.Get() - gIt.Get()) < epsDist)
-          {
-            oIt.Set(1);
-          }
-        }
-      },
-      nullptr);
-    thisDist = nullptr; // deallocate it
-    this->UpdateProgress(beginProgress + boneProgress * 0.10f);
-
-    using FillHolesType = BinaryFillholeImageFilter<TOutputImage>;
-    typename FillHolesType::Pointer fillHoles = FillHolesType::New();
-    fillHoles->SetInput(boneBasin);
-    fillHoles->SetForegroundValue(1);
-    fillHoles->Update();
-    boneBasin = fillHoles->GetOutput();
-    boneBasin->DisconnectPipeline();
-    this->UpdateProgress(beginProgress + boneProgress * 0.20f);
-
-    constexpr typename TInputImage::PixelType background = -4096;
-
-    typename TInputImage::Pointer partialInput = TInputImage::New();
-    partialInput->CopyInformation(inImage);
-    partialInput->SetRegions(safeBoneRegion);
-    partialInput->Allocate(false);
-    partialInput->FillBuffer(background);
-    mt->ParallelizeImageRegion<Dimension>(
-      boneRegion,
-      [partialInput, inImage, boneBasin](const RegionType region) {
-        ImageRegionConstIterator<TOutputImage> tIt(boneBasin, region);
-        ImageRegionConstIterator<TInputImage>  iIt(inImage, region);
-        ImageRegionIterator<TInputImage>       oIt(partialInput, region);
-        for (; !oIt.IsAtEnd(); ++iIt, ++tIt, ++oIt)
+    RegionType plane = core;
+    plane.SetSize(Dimension - 1, 1);
+    if (!lastPlane.empty()) // join components touching across the slab boundary
+    {
+      ImageRegionConstIterator<SlabLabelImageType> pIt(labels, plane);
+      for (SizeValueType i = 0; !pIt.IsAtEnd(); ++pIt, ++i)
+      {
+        if (pIt.Get() > 0 && lastPlane[i] > 0)
         {
-          if (tIt.Get())
-          {
-            oIt.Set(iIt.Get());
-          }
+          SizeValueType a = find(firstLabel + pIt.Get());
+          SizeValueType b = find(lastPlane[i]);
+          parent[std::max(a, b)] = std::min(a, b);
         }
-      },
-      nullptr);
-    this->UpdateProgress(beginProgress + boneProgress * 0.25f);
+      }
+    }
 
-    using ConnectedFilterType = NeighborhoodConnectedImageFilter<TInputImage, TOutputImage>;
-    typename ConnectedFilterType::Pointer neighborhoodConnected = ConnectedFilterType::New();
-    neighborhoodConnected->SetInput(partialInput);
-    neighborhoodConnected->SetLower(1500); // use a lower threshold here, so we capture more of trabecular bone
-    ImageRegionConstIteratorWithIndex<TOutputImage> bIt(bones, boneRegion);
-    ImageRegionConstIterator<TOutputImage>          bbIt(boneBasin, boneRegion);
-    for (; !bIt.IsAtEnd(); ++bIt, ++bbIt)
+    plane.SetIndex(Dimension - 1, core.GetIndex(Dimension - 1) + core.GetSize(Dimension - 1) - 1);
+    lastPlane.assign(plane.GetNumberOfPixels(), 0);
+    ImageRegionConstIterator<SlabLabelImageType> pIt(labels, plane);
+    for (SizeValueType i = 0; !pIt.IsAtEnd(); ++pIt, ++i)
     {
-      unsigned char b = bIt.Get();
-      if (b > 0)
+      if (pIt.Get() > 0)
       {
-        if (b == bone)
-        {
-          neighborhoodConnected->AddSeed(bIt.GetIndex());
-        }
-        else // b != bone
-        {
-          if (bbIt.Get()) // this was a hole inside this bone basin
-          {
-            replacedBy[b] = bone; // mark it for skipping
-          }
-        }
+        lastPlane[i] = firstLabel + pIt.Get();
       }
     }
-    neighborhoodConnected->Update();
-    typename TOutputImage::Pointer thBone = neighborhoodConnected->GetOutput();
-    partialInput = nullptr; // deallocate it
-    this->UpdateProgress(beginProgress + boneProgress * 0.35f);
+    this->UpdateProgress(0.25f * (slab + 1) / slabCount);
+  }
+
+  // same ordering and size filter as ConnectedComponentAnalysis:
+  // by size descending, ties broken by raster order of the first voxel
+  std::vector<SizeValueType> roots;
+  for (SizeValueType label = 1; label < parent.size(); ++label)
+  {
+    SizeValueType root = find(label);
+    if (root != label)
+    {
+      sizes[root] += sizes[label];
+      firstVoxels[root] = std::min(firstVoxels[root], firstVoxels[label]);
+    }
+    else
+    {
+      roots.push_back(label);
+    }
+  }
+  std::sort(roots.begin(), roots.end(), [&sizes, &firstVoxels](SizeValueType a, SizeValueType b) {
+    return sizes[a] != sizes[b] ? sizes[a] > sizes[b] : firstVoxels[a] < firstVoxels[b];
+  });
+  std::vector<SizeValueType> finalLabel(parent.size(), 0);
+  numberOfLabels = 0;
+  for (SizeValueType root : roots)
+  {
+    if (sizes[root] >= 1000)
+    {
+      finalLabel[root] = ++numberOfLabels;
+    }
+  }
+  for (SizeValueType label = 1; label < parent.size(); ++label)
+  {
+    finalLabel[label] = finalLabel[find(label)];
+  }
 
-    thBone = this->ZeroPad(thBone, opSize);
-    this->UpdateProgress(beginProgress + boneProgress * 0.40f);
-    typename TOutputImage::Pointer dilatedBone = this->SDFDilate(thBone, 3.0 * m_CorticalBoneThickness);
-    this->UpdateProgress(beginProgress + boneProgress * 0.50f);
-    typename TOutputImage::Pointer erodedBone = this->SDFErode(dilatedBone, 4.0 * m_CorticalBoneThickness);
-    this->UpdateProgress(beginProgress + boneProgress * 0.60f);
-    dilatedBone = this->SDFDilate(erodedBone, 1.0 * m_CorticalBoneThickness);
-    this->UpdateProgress(beginProgress + boneProgress * 0.70f);
+  RegionType paddedImage = wholeImage;
+  paddedImage.PadByRadius(opSize); // room for distance fields of bones near the image's boundary
+  typename TOutputImage::Pointer bones = TOutputImage::New();
+  bones->CopyInformation(this->GetInput());
+  bones->SetRegions(paddedImage);
+  bones->Allocate(true);
 
-    // now do the same for marrow, seeding from cortical and trabecular bone
-    mt->ParallelizeImageRegion<Dimension>(
-      boneRegion,
-      [thBone, erodedBone](const RegionType region) {
-        ImageRegionConstIterator<TOutputImage> bIt(erodedBone, region);
-        ImageRegionIterator<TOutputImage>      oIt(thBone, region);
-        for (; !oIt.IsAtEnd(); ++bIt, ++oIt)
-        {
-          oIt.Set(bIt.Get() || oIt.Get());
-        }
-      },
-      nullptr);
-    erodedBone = nullptr; // deallocate it
-    this->UpdateProgress(beginProgress + boneProgress * 0.75f);
-    typename TOutputImage::Pointer dilatedMarrow = this->SDFDilate(thBone, 5.0 * m_CorticalBoneThickness);
-    thBone = nullptr; // deallocate it
-    this->UpdateProgress(beginProgress + boneProgress * 0.85f);
-    typename TOutputImage::Pointer erodedMarrow = this->SDFErode(dilatedMarrow, 6.0 * m_CorticalBoneThickness);
-    dilatedMarrow = nullptr; // deallocate it
-    this->UpdateProgress(beginProgress + boneProgress * 0.95f);
+  // second pass: cortexLabel from Gaussian, Descoteaux and threshold labels, and final bone labels
+  const double c = 0.5 * std::sqrt(maxFrobenius2);
+  for (SizeValueType slab = 0; slab < slabCount; ++slab)
+  {
+    this->CheckAbort();
+    const IndexValueType slabBegin = zBegin + static_cast<IndexValueType>(slab * m_SlabThickness);
+    const RegionType     core = this->GetSlabRegion(wholeImage, slabBegin, 0);
+    typename TInputImage::ConstPointer slabInput =
+      this->GetInputRegion(this->GetSlabRegion(wholeImage, slabBegin, halo));
 
+    typename MaskImageType::Pointer gaussLabel = MaskImageType::New();
+    gaussLabel->CopyInformation(slabInput);
+    gaussLabel->SetRegions(core);
+    gaussLabel->Allocate();
+    typename TensorImageType::Pointer tensors = this->ComputeScaleSpace(slabInput, gaussLabel);
 
-    // now combine them, clipping them to the boneBasin
-    mt->ParallelizeImageRegion<Dimension>(
-      safeBoneRegion,
-      [finalBones, erodedMarrow, dilatedBone, cortexLabel, boneBasin, bone, this](const RegionType region) {
-        ImageRegionConstIterator<TOutputImage> mIt(erodedMarrow, region);
-        ImageRegionConstIterator<TOutputImage> bIt(dilatedBone, region);
-        ImageRegionConstIterator<TOutputImage> cIt(cortexLabel, region);
-        ImageRegionConstIterator<TOutputImage> iIt(boneBasin, region);
-        ImageRegionIterator<TOutputImage>      oIt(finalBones, region);
-        for (; !oIt.IsAtEnd(); ++mIt, ++bIt, ++cIt, ++iIt, ++oIt)
+    mt->ParallelizeImageRegionRestrictDirection<Dimension>(
+      0, // rows of packed cortexLabel must not be shared between threads
+      core,
+      [slabInput, gaussLabel, tensors, cortexLabel, c](const RegionType region) {
+        ImageRegionConstIterator<TInputImage>               iIt(slabInput, region);
+        PackedBinaryImageRegionConstIterator<MaskImageType> gIt(gaussLabel, region);
+        ImageRegionConstIterator<TensorImageType>           hIt(tensors, region);
+        PackedBinaryImageRegionIterator<MaskImageType>      cIt(cortexLabel, region);
+        for (; !cIt.IsAtEnd(); ++iIt, ++gIt, ++hIt, ++cIt)
         {
-          if (iIt.Get())
+          if (iIt.Get() >= 5000 &&
+              (gIt.Get() || static_cast<float>(DescoteauxSheetness(SortedEigenValues(hIt.Get()), c)) >= 0.1f))
           {
-            if (this->m_WholeBones)
-            {
-              if (cIt.Get() || bIt.Get() || mIt.Get())
-              {
-                oIt.Set(bone);
-              }
-            }
-            else // split bones
-            {
-              if (cIt.Get())
-              {
-                oIt.Set(3 * bone - 2);
-              }
-              else if (bIt.Get())
-              {
-                oIt.Set(3 * bone - 1);
-              }
-              else if (mIt.Get())
-              {
-                oIt.Set(3 * bone);
-              }
-            }
+            cIt.Set(true);
           }
-          // else this is background
         }
       },
       nullptr);
-  }
+    gaussLabel = nullptr; // deallocate it
+    tensors = nullptr;
+
+    typename LabelerType::Pointer labeler = coreComponents(slabInput, core);
+    const SizeValueType           firstLabel = slabFirstLabel[slab];
+    ImageRegionConstIterator<SlabLabelImageType> lIt(labeler->GetOutput(), core);
+    ImageRegionIterator<TOutputImage>            bIt(bones, core);
+    for (; !lIt.IsAtEnd(); ++lIt, ++bIt)
+    {
+      if (lIt.Get() > 0)
+      {
+        bIt.Set(finalLabel[firstLabel + lIt.Get()]);
+      }
+    }
+    this->UpdateProgress(0.25f + 0.26f * (slab + 1) / slabCount);
+  }
+
+  return bones;
+}
+
+template <typename TInputImage, typename TOutputImage>
+auto
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::GetCoarseRegion(const RegionType & wholeImage) const
+  -> RegionType
+{
+  RegionType coarse;
+  for (unsigned d = 0; d < Dimension; d++)
+  {
+    coarse.SetSize(d, (wholeImage.GetSize(d) + m_ShrinkFactor - 1) / m_ShrinkFactor);
+  }
+  return coarse;
+}
+
+template <typename TInputImage, typename TOutputImage>
+auto
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::GetCoarseSize(const SizeType & size) const -> SizeType
+{
+  SizeType coarse;
+  for (unsigned d = 0; d < Dimension; d++)
+  {
+    coarse[d] = (size[d] + m_ShrinkFactor - 1) / m_ShrinkFactor;
+  }
+  return coarse;
+}
+
+template <typename TInputImage, typename TOutputImage>
+auto
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::CoarseToFine(const IndexType &  coarse,
+                                                                     const RegionType & wholeImage) const
+  -> IndexType
+{
+  IndexType fine;
+  for (unsigned d = 0; d < Dimension; d++)
+  {
+    fine[d] = wholeImage.GetIndex(d) + coarse[d] * static_cast<IndexValueType>(m_ShrinkFactor);
+  }
+  return fine;
+}
+
+template <typename TInputImage, typename TOutputImage>
+auto
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::CoarseToFine(const RegionType & coarse,
+                                                                     const RegionType & wholeImage) const
+  -> RegionType
+{
+  RegionType fine;
+  fine.SetIndex(this->CoarseToFine(coarse.GetIndex(), wholeImage));
+  for (unsigned d = 0; d < Dimension; d++)
+  {
+    fine.SetSize(d, coarse.GetSize(d) * m_ShrinkFactor);
+  }
+  fine.Crop(wholeImage);
+  return fine;
+}
+
+template <typename TInputImage, typename TOutputImage>
+auto
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::FineToCoarse(const IndexType &  fine,
+                                                                     const RegionType & wholeImage) const
+  -> IndexType
+{
+  IndexType coarse;
+  for (unsigned d = 0; d < Dimension; d++)
+  {
+    coarse[d] = (fine[d] - wholeImage.GetIndex(d)) / static_cast<IndexValueType>(m_ShrinkFactor);
+  }
+  return coarse;
+}
+
+template <typename TInputImage, typename TOutputImage>
+template <typename TImage>
+typename TImage::Pointer
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::Shrink(const TImage *   image,
+                                                               bool             maximum,
+                                                               const SizeType & padSize) const
+{
+  using PixelType = typename TImage::PixelType;
+  const RegionType wholeImage = image->GetLargestPossibleRegion();
+
+  ContinuousIndex<double, Dimension> firstCenter;
+  for (unsigned d = 0; d < Dimension; d++)
+  {
+    firstCenter[d] = wholeImage.GetIndex(d) + 0.5 * (m_ShrinkFactor - 1.0);
+  }
+  typename TImage::PointType origin;
+  image->TransformContinuousIndexToPhysicalPoint(firstCenter, origin);
+
+  typename TImage::Pointer coarse = TImage::New();
+  coarse->SetOrigin(origin);
+  coarse->SetSpacing(image->GetSpacing() * static_cast<double>(m_ShrinkFactor));
+  coarse->SetDirection(image->GetDirection());
+  const RegionType coarseRegion = this->GetCoarseRegion(wholeImage);
+  RegionType       paddedRegion = coarseRegion;
+  paddedRegion.PadByRadius(padSize);
+  coarse->SetRegions(paddedRegion);
+  coarse->Allocate(paddedRegion != coarseRegion); // only the margin needs zeroing
+
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegion<Dimension>(
+    coarseRegion,
+    [this, image, coarse, &wholeImage, maximum](const RegionType region) {
+      for (ImageRegionIteratorWithIndex<TImage> cIt(coarse, region); !cIt.IsAtEnd(); ++cIt)
+      {
+        // the blocks of the last row, column and slice can be partial
+        RegionType block(this->CoarseToFine(cIt.GetIndex(), wholeImage), SizeType::Filled(m_ShrinkFactor));
+        block.Crop(wholeImage);
+        double    sum = 0.0;
+        PixelType maxValue = NumericTraits<PixelType>::NonpositiveMin();
+        for (ImageRegionConstIterator<TImage> it(image, block); !it.IsAtEnd(); ++it)
+        {
+          sum += it.Get();
+          maxValue = std::max(maxValue, it.Get());
+        }
+        cIt.Set(maximum ? maxValue : Math::Round<PixelType>(sum / block.GetNumberOfPixels()));
+      }
+    },
+    nullptr);
+  return coarse;
+}
+
+template <typename TInputImage, typename TOutputImage>
+typename TOutputImage::Pointer
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::ComputeShrunk(MaskImageType *  cortexLabel,
+                                                                      const SizeType & opSize,
+                                                                      IdentifierType & numberOfLabels,
+                                                                      typename TOutputImage::Pointer & coarseBones)
+{
+  StageProfile::Scope stage(m_StageProfile, "shrink");
+  using BinaryThresholdType = BinaryThresholdImageFilter<TInputImage, TOutputImage>;
+
+  const TInputImage *        inImage = this->GetInput();
+  const RegionType           wholeImage = inImage->GetLargestPossibleRegion();
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+
+  // the high threshold is applied at full resolution, and a block is a candidate if any of its voxels is,
+  // so thin cortical bone is not averaged away
+  typename BinaryThresholdType::Pointer binTh = BinaryThresholdType::New();
+  this->ForwardAbort(binTh);
+  binTh->SetInput(inImage);
+  binTh->SetLowerThreshold(5000);
+  binTh->Update();
+  typename TOutputImage::Pointer thLabel = binTh->GetOutput();
+  typename TOutputImage::Pointer coarseThLabel = this->Shrink(thLabel.GetPointer(), true, this->GetCoarseSize(opSize));
+  this->UpdateProgress(0.05f);
+
+  typename TInputImage::Pointer   coarseInput = this->Shrink(inImage, false);
+  typename MaskImageType::Pointer coarseLabel = MaskImageType::New(); // Gaussian, then also Descoteaux label
+  coarseLabel->CopyInformation(coarseInput);
+  coarseLabel->SetRegions(coarseInput->GetBufferedRegion());
+  coarseLabel->Allocate();
+  typename TensorImageType::Pointer tensors = this->ComputeScaleSpace(coarseInput, coarseLabel);
+  coarseInput = nullptr; // deallocate it
+  this->UpdateProgress(0.2f);
+  this->CheckAbort();
+
+  coarseLabel->TransformWords([](WordType & g, WordType d) { g |= d; },
+                              this->ComputeSheetness(tensors, coarseThLabel).GetPointer());
+  tensors = nullptr; // deallocate it
+  this->UpdateProgress(0.3f);
+  this->CheckAbort();
+
+  // cortical bone must pass the full resolution threshold
+  mt->ParallelizeImageRegionRestrictDirection<Dimension>(
+    0, // rows of packed cortexLabel must not be shared between threads
+    wholeImage,
+    [this, cortexLabel, coarseLabel, thLabel, &wholeImage](const RegionType region) {
+      ImageRegionConstIterator<TOutputImage>         tIt(thLabel, region);
+      PackedBinaryImageRegionIterator<MaskImageType> cIt(cortexLabel, region);
+      for (; !cIt.IsAtEnd(); ++tIt, ++cIt)
+      {
+        if (tIt.Get() && coarseLabel->GetPixel(this->FineToCoarse(cIt.GetIndex(), wholeImage)))
+        {
+          cIt.Set(true);
+        }
+      }
+    },
+    nullptr);
+  coarseLabel = nullptr; // deallocate it
+
+  SizeValueType blockSize = 1;
+  for (unsigned d = 0; d < Dimension; d++)
+  {
+    blockSize *= m_ShrinkFactor;
+  }
+  const SizeValueType minimumSize = std::max<SizeValueType>(1000 / blockSize, 1); // same volume as at full resolution
+  coarseBones = this->ConnectedComponentAnalysis(coarseThLabel, numberOfLabels, minimumSize);
+  coarseThLabel = nullptr; // deallocate it
+  this->UpdateProgress(0.4f);
+  this->CheckAbort();
+
+  // full resolution bones are the thresholded voxels, labeled by their blocks
+  mt->ParallelizeImageRegion<Dimension>(
+    wholeImage,
+    [this, thLabel, coarseBones, &wholeImage](const RegionType region) {
+      for (ImageRegionIteratorWithIndex<TOutputImage> tIt(thLabel, region); !tIt.IsAtEnd(); ++tIt)
+      {
+        if (tIt.Get())
+        {
+          tIt.Set(coarseBones->GetPixel(this->FineToCoarse(tIt.GetIndex(), wholeImage)));
+        }
+      }
+    },
+    nullptr);
+  return thLabel;
+}
+
+template <typename TInputImage, typename TOutputImage>
+typename TOutputImage::Pointer
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::Threshold(const TInputImage * input,
+                                                                  InputPixelType      lower,
+                                                                  const SizeType &    padSize) const
+{
+  StageProfile::Scope stage(m_StageProfile, "threshold");
+  const RegionType wholeImage = input->GetLargestPossibleRegion();
+  RegionType       paddedImage = wholeImage;
+  paddedImage.PadByRadius(padSize);
+
+  typename TOutputImage::Pointer thLabel = TOutputImage::New();
+  thLabel->CopyInformation(input);
+  thLabel->SetRegions(paddedImage);
+  thLabel->Allocate(true);
+
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegion<Dimension>(
+    wholeImage,
+    [input, thLabel, lower](const RegionType region) {
+      ForEachScanline(
+        region,
+        [lower](const IndexType &, SizeValueType length, const InputPixelType * i, OutputPixelType * t) {
+          ScanlineKernels::Threshold(i, t, length, lower);
+        },
+        input,
+        thLabel.GetPointer());
+    },
+    nullptr);
+  return thLabel;
+}
+
+template <typename TInputImage, typename TOutputImage>
+typename TOutputImage::Pointer
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::ConnectedComponentAnalysis(
+  typename TOutputImage::Pointer labelImage,
+  IdentifierType &               numberOfLabels,
+  SizeValueType                  minimumObjectSize)
+{
+  StageProfile::Scope stage(m_StageProfile, "ccl");
+  using LabelerType = ParallelConnectedComponentImageFilter<TOutputImage, TOutputImage>;
+  typename LabelerType::Pointer labeler = LabelerType::New();
+  this->ForwardAbort(labeler);
+  labeler->SetInput(labelImage);
+  labeler->SetMinimumObjectSize(minimumObjectSize);
+
+  labeler->Update();
+  numberOfLabels = labeler->GetObjectCount();
+  return labeler->GetOutput();
+}
+
+template <typename TInputImage, typename TOutputImage>
+typename SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::RealImageType::Pointer
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::SDF(typename TOutputImage::Pointer labelImage)
+{
+  using DistanceFieldType = SignedMaurerDistanceMapImageFilter<TOutputImage, RealImageType>;
+  typename DistanceFieldType::Pointer distF = DistanceFieldType::New();
+  this->ForwardAbort(distF);
+  distF->SetInput(labelImage);
+  distF->SetSquaredDistance(true);
+  distF->Update();
+  typename RealImageType::Pointer dist = distF->GetOutput();
+  dist->DisconnectPipeline();
+  return dist;
+}
+
+template <typename TInputImage, typename TOutputImage>
+auto
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::Pack(const TOutputImage * labelImage,
+                                                             const RegionType &   region) ->
+  typename MaskImageType::Pointer
+{
+  typename MaskImageType::Pointer mask = MaskImageType::New();
+  mask->CopyInformation(labelImage);
+  mask->SetRegions(region);
+  mask->Allocate();
+  mask->Pack(labelImage);
+  return mask;
+}
+
+
+template <typename TInputImage, typename TOutputImage>
+SizeValueType
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::EstimateBoneMemory(const BoneData & boneData) const
+{
+  // two float distance fields, the region grower's byte per voxel, and a few masks live at the same time
+  // the bone's resulting masks are bit-packed, so they add up to less than a byte
+  constexpr SizeValueType bytesPerPixel =
+    2 * sizeof(typename RealImageType::PixelType) + sizeof(unsigned char) + 4 * sizeof(OutputPixelType) + 1;
+  return boneData.expandedBoneRegion.GetNumberOfPixels() * bytesPerPixel;
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::UpdateBoneProgress(float beginProgress,
+                                                                           float boneProgress,
+                                                                           float fraction)
+{
+  if (boneProgress > 0.0f)
+  {
+    this->UpdateProgress(beginProgress + boneProgress * fraction);
+  }
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::StartStageProfile()
+{
+  m_StageProfile = m_ProfileStages ? StageProfile::New() : nullptr;
+  if (m_StageProfile)
+  {
+    m_StageProfile->Start();
+  }
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::StopStageProfile()
+{
+  if (m_StageProfile)
+  {
+    m_StageProfile->Stop();
+  }
+}
+
+template <typename TInputImage, typename TOutputImage>
+bool
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::IsOverTimeBudget() const
+{
+  return m_TimeBudget > 0.0 &&
+         std::chrono::duration<double>(std::chrono::steady_clock::now() - m_StartTime).count() > m_TimeBudget;
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::CheckAbort() const
+{
+  if (this->GetAbortGenerateData() || this->IsOverTimeBudget())
+  {
+    throw ProcessAborted(__FILE__, __LINE__);
+  }
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::ForwardAbort(ProcessObject * filter) const
+{
+  // filters which report progress check their AbortGenerateData right after it
+  filter->AddObserver(ProgressEvent(), [this, filter](const EventObject &) {
+    if (this->GetAbortGenerateData() || this->IsOverTimeBudget())
+    {
+      filter->AbortGenerateDataOn();
+    }
+  });
+}
+
+template <typename TInputImage, typename TOutputImage>
+template <typename TFunction>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::RunConcurrently(SizeValueType count, TFunction func)
+{
+  if (count == 1) // no need for an extra thread
+  {
+    func(0);
+    return;
+  }
+
+  std::vector<std::exception_ptr> exceptions(count);
+  std::vector<std::thread>        threads;
+  threads.reserve(count);
+  for (SizeValueType i = 0; i < count; ++i)
+  {
+    threads.emplace_back([&func, &exceptions, i]() {
+      try
+      {
+        func(i);
+      }
+      catch (...)
+      {
+        exceptions[i] = std::current_exception();
+      }
+    });
+  }
+  for (std::thread & thread : threads)
+  {
+    thread.join();
+  }
+  for (const std::exception_ptr & exception : exceptions)
+  {
+    if (exception)
+    {
+      std::rethrow_exception(exception);
+    }
+  }
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::ComputeBoneBasin(BoneData &            boneData,
+                                                                         const TOutputImage *  bones,
+                                                                         const RealImageType * boneDist,
+                                                                         float                 epsDist,
+                                                                         BufferPoolType *      pool,
+                                                                         float                 beginProgress,
+                                                                         float                 boneProgress)
+{
+  const OutputPixelType bone = boneData.bone;
+  const RegionType &    boneRegion = boneData.boneRegion;
+  StageProfile::Scope   stage(m_StageProfile, "basin", bone);
+
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+
+  typename TOutputImage::Pointer thisBone =
+    pool->template Acquire<TOutputImage>(bones, boneData.expandedBoneRegion, true);
+  mt->ParallelizeImageRegion<Dimension>(
+    boneRegion,
+    [thisBone, bones, bone](const RegionType region) {
+      ForEachScanline(
+        region,
+        [bone](const IndexType &, SizeValueType length, const OutputPixelType * b, OutputPixelType * o) {
+          ScanlineKernels::ExtractLabel(b, o, length, bone);
+        },
+        bones,
+        thisBone.GetPointer());
+    },
+    nullptr);
+  typename RealImageType::Pointer thisDist = this->SDF(thisBone);
+  thisBone = nullptr; // deallocate it
+  this->CheckAbort();
+
+  typename RealImageType::ConstPointer allDist = boneDist;
+  if (allDist == nullptr) // slab mode, compute distance field of all bones only around this bone
+  {
+    // the nearest voxel of any bone is not farther away than the nearest voxel of this bone
+    float                                   maxDist = 0.0f;
+    ImageRegionConstIterator<RealImageType> tIt(thisDist, boneRegion);
+    for (; !tIt.IsAtEnd(); ++tIt)
+    {
+      maxDist = std::max(maxDist, std::abs(tIt.Get()));
+    }
+
+    RegionType distRegion = boneRegion;
+    SizeType   radius;
+    for (unsigned d = 0; d < Dimension; d++)
+    {
+      radius[d] = std::ceil(std::sqrt(maxDist) / bones->GetSpacing()[d]) + 1;
+    }
+    distRegion.PadByRadius(radius);
+    distRegion.Crop(bones->GetBufferedRegion());
+
+    typename TOutputImage::Pointer nearbyBones = pool->template Acquire<TOutputImage>(bones, distRegion, false);
+    ImageAlgorithm::Copy(bones, nearbyBones.GetPointer(), distRegion, distRegion);
+    allDist = this->SDF(nearbyBones);
+  }
+  this->UpdateBoneProgress(beginProgress, boneProgress, 0.05f);
+
+  typename TOutputImage::Pointer boneBasin = pool->template Acquire<TOutputImage>(bones, boneData.safeBoneRegion, true);
+  mt->ParallelizeImageRegion<Dimension>(
+    boneRegion,
+    [boneBasin, thisDist, allDist, epsDist](const RegionType region) {
+      ForEachScanline(
+        region,
+        [epsDist](const IndexType &, SizeValueType length, const float * t, const float * g, OutputPixelType * o) {
+          ScanlineKernels::MarkClose(t, g, o, length, epsDist);
+        },
+        thisDist.GetPointer(),
+        allDist.GetPointer(),
+        boneBasin.GetPointer());
+    },
+    nullptr);
+  thisDist = nullptr; // deallocate it
+  allDist = nullptr;
+  this->UpdateBoneProgress(beginProgress, boneProgress, 0.10f);
+  this->CheckAbort();
+
+  StageProfile::Scope fillStage(m_StageProfile, "fillHoles", bone);
+  using FillHolesType = BinaryFillholeImageFilter<TOutputImage>;
+  typename FillHolesType::Pointer fillHoles = FillHolesType::New();
+  this->ForwardAbort(fillHoles);
+  fillHoles->SetInput(boneBasin);
+  fillHoles->SetForegroundValue(1);
+  fillHoles->Update();
+  boneData.boneBasin = Pack(fillHoles->GetOutput(), boneData.safeBoneRegion);
+  this->UpdateBoneProgress(beginProgress, boneProgress, 0.20f);
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::ComputeCoarseBoneBasin(
+  BoneData &                  boneData,
+  const TOutputImage *        coarseBones,
+  const RealImageType *       coarseDist,
+  const LabelStatisticsType * coarseStatistics,
+  const SizeType &            coarseOpSize,
+  float                       epsDist,
+  BufferPoolType *            pool,
+  float                       beginProgress,
+  float                       boneProgress)
+{
+  const RegionType wholeImage = this->GetInput()->GetLargestPossibleRegion();
+
+  BoneData coarseData;
+  coarseData.bone = boneData.bone;
+  coarseData.boneRegion = coarseStatistics->GetBoundingBox(boneData.bone);
+  coarseData.expandedBoneRegion = coarseData.boneRegion;
+  coarseData.expandedBoneRegion.PadByRadius(coarseOpSize);
+  coarseData.safeBoneRegion = coarseData.expandedBoneRegion;
+  coarseData.safeBoneRegion.Crop(this->GetCoarseRegion(wholeImage));
+  this->ComputeBoneBasin(coarseData, coarseBones, coarseDist, epsDist, pool, beginProgress, boneProgress);
+  StageProfile::Scope stage(m_StageProfile, "upsampleBasin", boneData.bone);
+
+  // the basin lies within the bounding box, whose blocks make up the full resolution bounding box
+  typename MaskImageType::Pointer basin = MaskImageType::New();
+  basin->CopyInformation(this->GetInput());
+  basin->SetRegions(boneData.safeBoneRegion);
+  basin->Allocate();
+  const MaskImageType *      coarseBasin = coarseData.boneBasin;
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegionRestrictDirection<Dimension>(
+    0, // rows of the packed basin must not be shared between threads
+    boneData.boneRegion,
+    [this, basin, coarseBasin, &wholeImage](const RegionType region) {
+      for (PackedBinaryImageRegionIterator<MaskImageType> bIt(basin, region); !bIt.IsAtEnd(); ++bIt)
+      {
+        if (coarseBasin->GetPixel(this->FineToCoarse(bIt.GetIndex(), wholeImage)))
+        {
+          bIt.Set(true);
+        }
+      }
+    },
+    nullptr);
+  boneData.boneBasin = basin;
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::MarkIslands(const BoneData &               boneData,
+                                                                    const TOutputImage *           bones,
+                                                                    std::vector<OutputPixelType> & replacedBy)
+{
+  std::mutex                 replacedMutex;
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegionRestrictDirection<Dimension>(
+    0, // rows of the packed basin must not be shared
+    boneData.boneRegion,
+    [&](const RegionType region) {
+      std::vector<bool>                                   enclosed(replacedBy.size(), false);
+      ImageRegionConstIterator<TOutputImage>              bIt(bones, region);
+      PackedBinaryImageRegionConstIterator<MaskImageType> bbIt(boneData.boneBasin, region);
+      for (; !bIt.IsAtEnd(); ++bIt, ++bbIt)
+      {
+        const OutputPixelType b = bIt.Get();
+        if (b > 0 && b != boneData.bone && bbIt.Get()) // this was a hole inside this bone basin
+        {
+          enclosed[b] = true;
+        }
+      }
+
+      std::lock_guard<std::mutex> lock(replacedMutex);
+      for (SizeValueType b = 1; b < enclosed.size(); ++b)
+      {
+        if (enclosed[b])
+        {
+          replacedBy[b] = boneData.bone; // mark it for skipping
+        }
+      }
+    },
+    nullptr);
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::SegmentBone(BoneData &       boneData,
+                                                                    const SizeType & opSize,
+                                                                    BufferPoolType * pool,
+                                                                    float            beginProgress,
+                                                                    float            boneProgress)
+{
+  const RegionType &                 boneRegion = boneData.boneRegion;
+  typename MaskImageType::Pointer    boneBasin = boneData.boneBasin;
+  typename TInputImage::ConstPointer inImage = this->GetInputRegion(boneRegion);
+  MultiThreaderBase::Pointer         mt = MultiThreaderBase::New();
+
+  // grows within the basin directly, as if the input were -4096 elsewhere in the bone's safe region
+  using GrowingType = ParallelNeighborhoodConnected<TInputImage, TOutputImage>;
+  typename GrowingType::Pointer growing = GrowingType::New();
+  growing->SetLower(1500); // use a lower threshold here, so we capture more of trabecular bone
+  RegionType paddedRegion = boneData.safeBoneRegion;
+  paddedRegion.PadByRadius(opSize); // room for morphological operations, grown into without a copy
+  typename TOutputImage::Pointer thBone = pool->template Acquire<TOutputImage>(inImage, paddedRegion, true);
+  {
+    StageProfile::Scope stage(m_StageProfile, "grow", boneData.bone);
+    growing->Grow(inImage, boneBasin, boneRegion, *boneData.boneRuns, boneData.safeBoneRegion, thBone);
+  }
+  this->UpdateBoneProgress(beginProgress, boneProgress, 0.40f);
+  this->CheckAbort();
+
+  StageProfile::Scope              stage(m_StageProfile, "morphology", boneData.bone);
+  typename MorphologyType::Pointer morphology = MorphologyType::New();
+  typename TOutputImage::Pointer   erodedBone = pool->template Acquire<TOutputImage>(thBone, paddedRegion, false);
+  morphology->Apply(
+    thBone, { { false, 3.0 * m_CorticalBoneThickness }, { true, 4.0 * m_CorticalBoneThickness } }, erodedBone);
+  this->UpdateBoneProgress(beginProgress, boneProgress, 0.60f);
+  this->CheckAbort();
+  typename TOutputImage::Pointer dilatedBone = pool->template Acquire<TOutputImage>(thBone, paddedRegion, false);
+  morphology->Apply(erodedBone, { { false, 1.0 * m_CorticalBoneThickness } }, dilatedBone);
+  this->UpdateBoneProgress(beginProgress, boneProgress, 0.70f);
+  this->CheckAbort();
+
+  // now do the same for marrow, seeding from cortical and trabecular bone
+  mt->ParallelizeImageRegion<Dimension>(
+    boneRegion,
+    [thBone, erodedBone](const RegionType region) {
+      ForEachScanline(
+        region,
+        [](const IndexType &, SizeValueType length, const OutputPixelType * b, OutputPixelType * o) {
+          ScanlineKernels::Or(b, o, length);
+        },
+        erodedBone.GetPointer(),
+        thBone.GetPointer());
+    },
+    nullptr);
+  erodedBone = nullptr; // deallocate it
+  this->UpdateBoneProgress(beginProgress, boneProgress, 0.75f);
+  this->CheckAbort();
+  morphology->ApplyInPlace(thBone,
+                           { { false, 5.0 * m_CorticalBoneThickness }, { true, 6.0 * m_CorticalBoneThickness } });
+  this->UpdateBoneProgress(beginProgress, boneProgress, 0.90f);
+  boneData.erodedMarrow = Pack(thBone, boneData.safeBoneRegion);
+  thBone = nullptr; // deallocate it
+  boneData.dilatedBone = Pack(dilatedBone, boneData.safeBoneRegion);
+  this->UpdateBoneProgress(beginProgress, boneProgress, 0.95f);
+}
+
+template <typename TInputImage, typename TOutputImage>
+auto
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::CreateCache(const TInputImage * inImage) const ->
+  typename CacheType::Pointer
+{
+  if (m_CacheDirectory.empty() || m_SlabThickness > 0)
+  {
+    return nullptr;
+  }
+
+  typename CacheType::Pointer cache = CacheType::New();
+  cache->SetDirectory(m_CacheDirectory);
+  cache->HashImage(inImage);
+
+  // only the parameters which affect cached results, plus a version to bump when they are computed differently
+  const std::string version = "SegmentBonesInMicroCTFilter 2";
+  cache->Hash(version.data(), version.size());
+  cache->Hash(m_CorticalBoneThickness);
+  cache->Hash(m_MaskedSheetness);
+  cache->Hash(m_ShrinkFactor);
+  return cache;
+}
+
+template <typename TInputImage, typename TOutputImage>
+bool
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::LoadComponents(const CacheType *                 cache,
+                                                                       typename MaskImageType::Pointer & cortexLabel,
+                                                                       typename TOutputImage::Pointer &  bones,
+                                                                       typename TOutputImage::Pointer &  coarseBones,
+                                                                       IdentifierType &                  numBones) const
+{
+  StageProfile::Scope stage(m_StageProfile, "loadComponents");
+  std::vector<std::string> names{ "cortex", "bones" };
+  if (m_ShrinkFactor > 1)
+  {
+    names.push_back("coarseBones");
+  }
+  if (!cache->Contains(names))
+  {
+    return false;
+  }
+
+  typename MaskImageType::Pointer cachedCortex = cache->template Load<MaskImageType>("cortex");
+  typename TOutputImage::Pointer  cachedBones = cache->template Load<TOutputImage>("bones");
+  typename TOutputImage::Pointer  cachedCoarseBones;
+  if (m_ShrinkFactor > 1)
+  {
+    cachedCoarseBones = cache->template Load<TOutputImage>("coarseBones");
+  }
+  const TOutputImage * components = m_ShrinkFactor > 1 ? cachedCoarseBones.GetPointer() : cachedBones.GetPointer();
+  if (!cachedCortex || !cachedBones || !components)
+  {
+    return false;
+  }
+
+  // components are labeled consecutively, so their number is the largest label
+  const OutputPixelType * labels = components->GetBufferPointer();
+  numBones = *std::max_element(labels, labels + components->GetBufferedRegion().GetNumberOfPixels());
+  cortexLabel = cachedCortex;
+  bones = cachedBones;
+  coarseBones = cachedCoarseBones;
+  return true;
+}
+
+template <typename TInputImage, typename TOutputImage>
+bool
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::LoadBone(const CacheType * cache, BoneData & boneData) const
+{
+  StageProfile::Scope stage(m_StageProfile, "loadBone", boneData.bone);
+  const std::string prefix = "bone" + std::to_string(static_cast<SizeValueType>(boneData.bone));
+  if (!cache->Contains({ prefix + "-basin", prefix + "-dilatedBone", prefix + "-erodedMarrow" }))
+  {
+    return false;
+  }
+
+  typename MaskImageType::Pointer boneBasin = cache->template Load<MaskImageType>(prefix + "-basin");
+  typename MaskImageType::Pointer dilatedBone = cache->template Load<MaskImageType>(prefix + "-dilatedBone");
+  typename MaskImageType::Pointer erodedMarrow = cache->template Load<MaskImageType>(prefix + "-erodedMarrow");
+  for (const MaskImageType * mask : { boneBasin.GetPointer(), dilatedBone.GetPointer(), erodedMarrow.GetPointer() })
+  {
+    if (!mask || mask->GetBufferedRegion() != boneData.safeBoneRegion)
+    {
+      return false;
+    }
+  }
+
+  boneData.boneBasin = boneBasin;
+  boneData.dilatedBone = dilatedBone;
+  boneData.erodedMarrow = erodedMarrow;
+  boneData.cached = true;
+  boneData.finished = true;
+  return true;
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::StoreBone(const CacheType * cache,
+                                                                  const BoneData &  boneData) const
+{
+  const std::string prefix = "bone" + std::to_string(static_cast<SizeValueType>(boneData.bone));
+  cache->Store(prefix + "-dilatedBone", boneData.dilatedBone.GetPointer());
+  cache->Store(prefix + "-erodedMarrow", boneData.erodedMarrow.GetPointer());
+  cache->Store(prefix + "-basin", boneData.boneBasin.GetPointer());
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::CompositeBone(const BoneData &      boneData,
+                                                                      const MaskImageType * cortexLabel,
+                                                                      TOutputImage *        wholeBones,
+                                                                      TOutputImage *        splitBones)
+{
+  const OutputPixelType          bone = boneData.bone;
+  typename MaskImageType::Pointer erodedMarrow = boneData.erodedMarrow;
+  typename MaskImageType::Pointer dilatedBone = boneData.dilatedBone;
+  typename MaskImageType::Pointer boneBasin = boneData.boneBasin;
+  StageProfile::Scope             stage(m_StageProfile, "composite", bone);
+
+  // now combine them, clipping them to the boneBasin
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeImageRegion<Dimension>(
+    boneData.safeBoneRegion,
+    [wholeBones, splitBones, erodedMarrow, dilatedBone, cortexLabel, boneBasin, bone](const RegionType region) {
+      // 64 voxels at a time, skipping those which get no label
+      auto compositeRow = [&](const IndexType & index,
+                              SizeValueType     length,
+                              OutputPixelType * wholeRow,
+                              OutputPixelType * splitRow) {
+        SizeValueType mRow, mBit, bRow, bBit, cRow, cBit, iRow, iBit;
+        erodedMarrow->ComputeRowAndBit(index, mRow, mBit);
+        dilatedBone->ComputeRowAndBit(index, bRow, bBit);
+        cortexLabel->ComputeRowAndBit(index, cRow, cBit);
+        boneBasin->ComputeRowAndBit(index, iRow, iBit);
+        for (SizeValueType begin = 0; begin < length; begin += MaskImageType::BitsPerWord)
+        {
+          const WordType      inBasin = boneBasin->GetBits(iRow, iBit + begin);
+          const WordType      cortex = inBasin & cortexLabel->GetBits(cRow, cBit + begin);
+          const WordType      cortexOrBone = cortex | (inBasin & dilatedBone->GetBits(bRow, bBit + begin));
+          const WordType      labeled = cortexOrBone | (inBasin & erodedMarrow->GetBits(mRow, mBit + begin));
+          const SizeValueType count = std::min(static_cast<SizeValueType>(MaskImageType::BitsPerWord), length - begin);
+          for (SizeValueType i = 0; labeled != 0 && i < count; ++i)
+          {
+            if ((labeled >> i) & 1u)
+            {
+              if (wholeRow)
+              {
+                wholeRow[begin + i] = bone;
+              }
+              if (splitRow)
+              {
+                splitRow[begin + i] =
+                  ((cortex >> i) & 1u) ? 3 * bone - 2 : ((cortexOrBone >> i) & 1u) ? 3 * bone - 1 : 3 * bone;
+              }
+            }
+          }
+        }
+      };
+      ForEachScanline(region, compositeRow, wholeBones, splitBones);
+    },
+    nullptr);
+}
+
+
+template <typename TInputImage, typename TOutputImage>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::PrepareComponents(ComponentsData &   components,
+                                                                          const RegionType & wholeImage,
+                                                                          const SizeType &   padSize,
+                                                                          const CacheType *  cache)
+{
+  // the components were labeled with room for the distance field
+  const TOutputImage * margined = components.coarseBones ? components.coarseBones : components.bones;
+  RegionType           paddedImage = components.coarseBones ? this->GetCoarseRegion(wholeImage) : wholeImage;
+  paddedImage.PadByRadius(components.coarseBones ? this->GetCoarseSize(padSize) : padSize);
+  itkAssertOrThrowMacro(margined->GetBufferedRegion().IsInside(paddedImage),
+                        "The connected components must have a margin for the distance field");
+  this->UpdateProgress(0.56f);
+  this->CheckAbort();
+  if (m_SlabThickness == 0 && !components.coarseBones) // when streaming, it is computed per bone instead
+  {
+    StageProfile::Scope stage(m_StageProfile, "boneDistance");
+    components.boneDist = cache ? cache->template Load<RealImageType>("distance") : nullptr;
+    if (!components.boneDist)
+    {
+      components.boneDist = this->SDF(components.bones);
+      if (cache)
+      {
+        cache->Store("distance", components.boneDist.GetPointer());
+      }
+    }
+  }
+
+  // when shrinking, bone basins are computed on the shrunk image
+  if (components.coarseBones)
+  {
+    StageProfile::Scope stage(m_StageProfile, "coarseDistance");
+    components.coarseOpSize = this->GetCoarseSize(padSize);
+    components.coarseStatistics = LabelStatisticsType::New();
+    components.coarseStatistics->Compute(
+      components.coarseBones, this->GetCoarseRegion(wholeImage), components.numBones);
+    components.coarseDist = cache ? cache->template Load<RealImageType>("coarseDistance") : nullptr;
+    if (!components.coarseDist)
+    {
+      components.coarseDist = this->SDF(components.coarseBones);
+      if (cache)
+      {
+        cache->Store("coarseDistance", components.coarseDist.GetPointer());
+      }
+    }
+  }
+  this->UpdateProgress(0.69f);
+
+  // bounding box and voxels of each bone
+  {
+    StageProfile::Scope stage(m_StageProfile, "boneStatistics");
+    components.boneStatistics = LabelStatisticsType::New();
+    components.boneStatistics->Compute(components.bones, wholeImage, components.numBones);
+  }
+
+  // per-bone temporaries are recycled, holding on to no more memory than the bones may use at once:
+  // the budget, or else the working sets of as many of the largest bones as are processed concurrently
+  SizeValueType maximumRetainedBytes = m_ConcurrentBonesMemoryBudget;
+  if (maximumRetainedBytes == 0)
+  {
+    SizeValueType largestBoneMemory = 0;
+    for (IdentifierType bone = 1; bone <= components.numBones; ++bone)
+    {
+      BoneData boneData;
+      boneData.boneRegion = components.boneStatistics->GetBoundingBox(bone);
+      if (components.coarseBones)
+      {
+        boneData.boneRegion = this->CoarseToFine(components.coarseStatistics->GetBoundingBox(bone), wholeImage);
+      }
+      boneData.expandedBoneRegion = boneData.boneRegion;
+      boneData.expandedBoneRegion.PadByRadius(padSize);
+      largestBoneMemory = std::max(largestBoneMemory, this->EstimateBoneMemory(boneData));
+    }
+    maximumRetainedBytes = std::max<SizeValueType>(largestBoneMemory * m_NumberOfConcurrentBones, 1);
+  }
+  components.bufferPool = BufferPoolType::New();
+  components.bufferPool->SetMaximumRetainedBytes(maximumRetainedBytes);
+  this->UpdateProgress(0.7f);
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::SegmentBones(ComponentsData &      components,
+                                                                     const MaskImageType * cortexLabel,
+                                                                     const SizeType &      opSize,
+                                                                     float                 epsDist,
+                                                                     const CacheType *     cache,
+                                                                     TOutputImage *        wholeBones,
+                                                                     TOutputImage *        splitBones)
+{
+  const RegionType wholeImage = this->GetInput()->GetLargestPossibleRegion();
+
+  // per-bone processing, in batches of consecutive bones which are processed concurrently
+  std::vector<OutputPixelType> replacedBy(components.numBones + 1, 0);
+  const float                  boneProgress = 0.3f / components.numBones;
+  for (IdentifierType firstBone = 1; firstBone <= components.numBones;)
+  {
+    this->CheckAbort();
+    // bones which are already known to be islands are not candidates
+    std::vector<BoneData> batch;
+    SizeValueType         batchMemory = 0;
+    IdentifierType        endBone = firstBone;
+    for (; endBone <= components.numBones && batch.size() < m_NumberOfConcurrentBones; ++endBone)
+    {
+      if (replacedBy[endBone] > 0)
+      {
+        continue;
+      }
+
+      // calculate expanded bounding box, so the subsequent operations don't need to process the whole image
+      BoneData boneData;
+      boneData.bone = static_cast<OutputPixelType>(endBone);
+      boneData.boneRuns = &components.boneStatistics->GetRuns(endBone);
+      boneData.boneRegion = components.boneStatistics->GetBoundingBox(endBone);
+      if (components.coarseBones) // the coarse basin can extend to the whole blocks of the bone
+      {
+        boneData.boneRegion = this->CoarseToFine(components.coarseStatistics->GetBoundingBox(endBone), wholeImage);
+      }
+      boneData.expandedBoneRegion = boneData.boneRegion;
+      boneData.expandedBoneRegion.PadByRadius(opSize);
+      boneData.safeBoneRegion = boneData.expandedBoneRegion;
+      boneData.safeBoneRegion.Crop(wholeImage); // restrict to image size
+
+      SizeValueType boneMemory = this->EstimateBoneMemory(boneData);
+      if (!batch.empty() && m_ConcurrentBonesMemoryBudget > 0 &&
+          batchMemory + boneMemory > m_ConcurrentBonesMemoryBudget)
+      {
+        break;
+      }
+      batchMemory += boneMemory;
+      batch.push_back(boneData);
+    }
+
+    // progress events are only invoked from this thread
+    const float stepProgress = batch.size() == 1 ? boneProgress : 0.0f;
+    const float beginProgress = 0.7f + boneProgress * (firstBone - 1);
+    this->UpdateProgress(beginProgress);
+
+    // after a stop, the bones of the batch which were finished are still composited before it is rethrown
+    std::exception_ptr aborted;
+    try
+    {
+      RunConcurrently(batch.size(), [&](SizeValueType i) {
+        this->CheckAbort();
+        if (cache && this->LoadBone(cache, batch[i]))
+        {
+          return; // already segmented
+        }
+        if (components.coarseBones)
+        {
+          const float coarseEpsDist = epsDist * m_ShrinkFactor;
+          this->ComputeCoarseBoneBasin(batch[i],
+                                       components.coarseBones,
+                                       components.coarseDist,
+                                       components.coarseStatistics,
+                                       components.coarseOpSize,
+                                       coarseEpsDist,
+                                       components.bufferPool,
+                                       beginProgress,
+                                       stepProgress);
+        }
+        else if (!components.boneBasins.empty())
+        {
+          // the basin lies within the bounding box, and filling its holes does not depend on the margin
+          typename MaskImageType::Pointer & boneBasin = components.boneBasins[batch[i].bone];
+          if (!boneBasin)
+          {
+            BoneData basinData = batch[i];
+            basinData.expandedBoneRegion = basinData.boneRegion;
+            basinData.expandedBoneRegion.PadByRadius(components.basinPadSize);
+            basinData.safeBoneRegion = basinData.expandedBoneRegion;
+            basinData.safeBoneRegion.Crop(wholeImage);
+            this->ComputeBoneBasin(basinData,
+                                   components.bones,
+                                   components.boneDist,
+                                   epsDist,
+                                   components.bufferPool,
+                                   beginProgress,
+                                   stepProgress);
+            boneBasin = basinData.boneBasin;
+          }
+          batch[i].boneBasin = boneBasin;
+        }
+        else
+        {
+          this->ComputeBoneBasin(batch[i],
+                                 components.bones,
+                                 components.boneDist,
+                                 epsDist,
+                                 components.bufferPool,
+                                 beginProgress,
+                                 stepProgress);
+        }
+      });
+    }
+    catch (ProcessAborted &)
+    {
+      aborted = std::current_exception();
+    }
+
+    // islands are resolved in the order of bones, so the result is the same as with sequential processing
+    std::vector<BoneData *> survivors;
+    auto                    candidate = batch.begin();
+    for (IdentifierType bone = firstBone; bone < endBone; ++bone)
+    {
+      bool isCandidate = candidate != batch.end() && static_cast<IdentifierType>(candidate->bone) == bone;
+      if (replacedBy[bone] > 0)
+      {
+        std::cout << "Bone " << bone << " was an island inside bone " << static_cast<SizeValueType>(replacedBy[bone])
+                  << std::endl;
+        if (isCandidate)
+        {
+          candidate->boneBasin = nullptr; // deallocate it
+          ++candidate;
+        }
+        continue; // next bone
+      }
+      if (!candidate->boneBasin) // stopped before its basin was computed, so later bones could be islands in it
+      {
+        break;
+      }
+      this->MarkIslands(*candidate, components.bones, replacedBy);
+      survivors.push_back(&*candidate);
+      ++candidate;
+    }
+
+    if (!aborted)
+    {
+      try
+      {
+        RunConcurrently(survivors.size(), [&](SizeValueType i) {
+          if (survivors[i]->cached)
+          {
+            return;
+          }
+          this->CheckAbort();
+          this->SegmentBone(*survivors[i], opSize, components.bufferPool, beginProgress, stepProgress);
+          if (cache)
+          {
+            this->StoreBone(cache, *survivors[i]);
+          }
+          survivors[i]->finished = true;
+        });
+      }
+      catch (ProcessAborted &)
+      {
+        aborted = std::current_exception();
+      }
+    }
+
+    // bounding boxes of neighboring bones overlap, so later bones need to overwrite earlier ones
+    for (BoneData * boneData : survivors)
+    {
+      if (boneData->finished)
+      {
+        this->CompositeBone(*boneData, cortexLabel, wholeBones, splitBones);
+        this->UpdateProgress(0.7f + boneProgress * boneData->bone);
+      }
+    }
+    if (aborted)
+    {
+      std::rethrow_exception(aborted);
+    }
+
+    firstBone = endBone;
+  }
+}
+
+template <typename TInputImage, typename TOutputImage>
+auto
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::SweepCorticalBoneThickness(
+  const std::vector<float> & thicknesses) -> std::vector<typename TOutputImage::Pointer>
+{
+  const float                                 corticalBoneThickness = m_CorticalBoneThickness;
+  std::vector<typename TOutputImage::Pointer> results(thicknesses.size());
+  if (m_SlabThickness > 0 || m_ShrinkFactor > 1)
+  {
+    // each update gets what is left of the budget
+    const double                                timeBudget = m_TimeBudget;
+    const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    try
+    {
+      for (SizeValueType i = 0; i < thicknesses.size(); ++i)
+      {
+        if (timeBudget > 0.0)
+        {
+          const double remaining =
+            timeBudget - std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+          if (remaining <= 0.0)
+          {
+            m_TimeBudgetExceeded = true;
+            break;
+          }
+          this->SetTimeBudget(remaining);
+        }
+        this->SetCorticalBoneThickness(thicknesses[i]);
+        this->Update();
+        results[i] = this->GetOutput();
+        results[i]->DisconnectPipeline();
+        if (m_TimeBudgetExceeded)
+        {
+          break;
+        }
+      }
+    }
+    catch (ProcessAborted &)
+    {
+      this->SetTimeBudget(timeBudget);
+      this->SetCorticalBoneThickness(corticalBoneThickness);
+      throw;
+    }
+    this->SetTimeBudget(timeBudget);
+    this->SetCorticalBoneThickness(corticalBoneThickness);
+    return results;
+  }
+
+  TInputImage * input = const_cast<TInputImage *>(this->GetInput());
+  itkAssertOrThrowMacro(input, "The input is not set");
+  input->UpdateOutputInformation();
+  input->SetRequestedRegionToLargestPossibleRegion();
+  input->Update();
+  const RegionType wholeImage = input->GetLargestPossibleRegion();
+  this->StartStageProfile();
+  this->SetAbortGenerateData(false); // as Update does
+  m_StartTime = std::chrono::steady_clock::now();
+  m_TimeBudgetExceeded = false;
+
+  // the largest extent of morphological operations leaves room for all of them
+  std::vector<SizeType> opSizes;
+  SizeType              padSize;
+  padSize.Fill(0);
+  for (float thickness : thicknesses)
+  {
+    m_CorticalBoneThickness = thickness;
+    opSizes.push_back(this->ComputeOperationSize(input));
+    for (unsigned d = 0; d < Dimension; d++)
+    {
+      padSize[d] = std::max(padSize[d], opSizes.back()[d]);
+    }
+  }
+
+  // from the smallest value up, so the scale-space of each continues from the previous one
+  std::vector<SizeValueType> order(thicknesses.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&thicknesses](SizeValueType a, SizeValueType b) {
+    return thicknesses[a] < thicknesses[b];
+  });
+
+  double avgSpacing = 1.0;
+  for (unsigned d = 0; d < Dimension; d++)
+  {
+    avgSpacing *= input->GetSpacing()[d];
+  }
+  avgSpacing = std::pow(avgSpacing, 1.0 / Dimension);
+  const float epsDist = 0.001 * avgSpacing;
+
+  try
+  {
+    // shared stages, which do not depend on cortical bone thickness
+    typename TOutputImage::Pointer thLabel = this->Threshold(input, 5000, padSize);
+
+    ComponentsData components;
+    components.bones = this->ConnectedComponentAnalysis(thLabel, components.numBones);
+    const SizeValueType labelsPerBone = m_WholeBones ? 1 : 3;
+    itkAssertOrThrowMacro(components.numBones * labelsPerBone <=
+                            static_cast<SizeValueType>(NumericTraits<OutputPixelType>::max()),
+                          "There are too many bones to fit into the output pixel type, use a 16-bit output image");
+    this->PrepareComponents(components, wholeImage, padSize, nullptr);
+    components.boneBasins.resize(components.numBones + 1);
+    components.basinPadSize = padSize;
+
+    SmoothedInputData smoothed;
+    for (SizeValueType i : order)
+    {
+      m_CorticalBoneThickness = thicknesses[i];
+
+      typename MaskImageType::Pointer cortexLabel = MaskImageType::New();
+      cortexLabel->CopyInformation(input);
+      cortexLabel->SetRegions(wholeImage);
+      cortexLabel->Allocate(true);
+      this->ComputeCortex(input, thLabel, cortexLabel, &smoothed);
+
+      results[i] = TOutputImage::New(); // partial if TimeBudget runs out during its bones
+      results[i]->CopyInformation(input);
+      results[i]->SetRegions(wholeImage);
+      results[i]->Allocate(true);
+      this->SegmentBones(components,
+                         cortexLabel,
+                         opSizes[i],
+                         epsDist,
+                         nullptr,
+                         m_WholeBones ? results[i].GetPointer() : nullptr,
+                         m_WholeBones ? nullptr : results[i].GetPointer());
+    }
+  }
+  catch (ProcessAborted &)
+  {
+    m_CorticalBoneThickness = corticalBoneThickness;
+    if (this->GetAbortGenerateData() || !this->IsOverTimeBudget())
+    {
+      this->StopStageProfile();
+      throw;
+    }
+    m_TimeBudgetExceeded = true;
+  }
+  this->UpdateProgress(1.0f);
+  m_CorticalBoneThickness = corticalBoneThickness;
+  this->StopStageProfile();
+  return results;
+}
+
+template <typename TInputImage, typename TOutputImage>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::GenerateData()
+{
+  // background is zero, and the second output is only allocated if it is computed
+  for (unsigned i = 0; i < 2; i++)
+  {
+    TOutputImage * output = this->GetOutput(i);
+    if (i == 0 || m_BothLabelMaps)
+    {
+      output->SetBufferedRegion(output->GetRequestedRegion());
+      output->Allocate(true);
+    }
+    else
+    {
+      output->ReleaseData();
+    }
+  }
+  this->StartStageProfile();
+  m_StartTime = std::chrono::steady_clock::now();
+  m_TimeBudgetExceeded = false;
+
+  try
+  {
+    typename TInputImage::ConstPointer inImage = this->GetInput();
+
+    SizeType opSize = this->ComputeOperationSize(inImage); // maximum extent of morphological operations
+    double   avgSpacing = 1.0;
+    for (unsigned d = 0; d < Dimension; d++)
+    {
+      avgSpacing *= inImage->GetSpacing()[d];
+    }
+    avgSpacing = std::pow(avgSpacing, 1.0 / Dimension); // geometric average preserves voxel volume
+    float epsDist = 0.001 * avgSpacing;                 // epsilon for distance comparisons
+
+    RegionType wholeImage = inImage->GetLargestPossibleRegion();
+
+    // we will do pixel-wise operation in a multi-threaded manner
+    MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+
+    // intermediate results of earlier runs, null if caching is disabled
+    typename CacheType::Pointer cache = this->CreateCache(inImage);
+
+    // cortexLabel combines information from descoLabel, gaussLabel and thLabel
+    typename MaskImageType::Pointer cortexLabel = MaskImageType::New();
+    cortexLabel->CopyInformation(inImage);
+    cortexLabel->SetRegions(wholeImage);
+    cortexLabel->Allocate(true);
+
+    // do morphological processing per bone, to avoid merging bones which are close to each other
+    ComponentsData                   components;
+    IdentifierType &                 numBones = components.numBones;
+    typename TOutputImage::Pointer & bones = components.bones;
+    typename TOutputImage::Pointer & coarseBones = components.coarseBones; // only when shrinking
+
+    const bool componentsCached = cache && this->LoadComponents(cache, cortexLabel, bones, coarseBones, numBones);
+    if (componentsCached)
+    {
+      this->UpdateProgress(0.52f);
+    }
+    else if (m_SlabThickness > 0)
+    {
+      bones = this->ComputeInSlabs(cortexLabel, opSize, numBones);
+    }
+    else if (m_ShrinkFactor > 1)
+    {
+      bones = this->ComputeShrunk(cortexLabel, opSize, numBones, coarseBones);
+    }
+    else
+    {
+      // start from a high threshold, so bones are well separated
+      typename TOutputImage::Pointer thLabel = this->Threshold(inImage, 5000, opSize);
+
+      this->ComputeCortex(inImage, thLabel, cortexLabel);
+      this->UpdateProgress(0.52f);
+
+      bones = this->ConnectedComponentAnalysis(thLabel, numBones);
+    }
+    if (cache && !componentsCached)
+    {
+      cache->Store("cortex", cortexLabel.GetPointer());
+      cache->Store("bones", bones.GetPointer());
+      if (coarseBones)
+      {
+        cache->Store("coarseBones", coarseBones.GetPointer());
+      }
+    }
+    // we might not even get to this point if there are more bones than labels
+    // we need 3 labels per bone, one each for cortical, trabecular and marrow
+    const SizeValueType labelsPerBone = m_WholeBones && !m_BothLabelMaps ? 1 : 3;
+    itkAssertOrThrowMacro(numBones * labelsPerBone <= static_cast<SizeValueType>(NumericTraits<OutputPixelType>::max()),
+                          "There are too many bones to fit into the output pixel type, use a 16-bit output image");
+    this->UpdateProgress(0.55f);
+
+    TOutputImage * wholeBones = m_WholeBones || m_BothLabelMaps ? this->GetWholeBonesOutput() : nullptr;
+    TOutputImage * splitBones = !m_WholeBones || m_BothLabelMaps ? this->GetSplitBonesOutput() : nullptr;
+
+    this->PrepareComponents(components, wholeImage, opSize, cache);
+
+    this->SegmentBones(components, cortexLabel, opSize, epsDist, cache, wholeBones, splitBones);
+  }
+  catch (ProcessAborted &)
+  {
+    if (this->GetAbortGenerateData() || !this->IsOverTimeBudget())
+    {
+      this->StopStageProfile();
+      throw;
+    }
+    m_TimeBudgetExceeded = true; // the outputs keep the bones which were finished
+  }
+  this->StopStageProfile();
   this->UpdateProgress(1.0f);
 }
 
+template <typename TInputImage, typename TOutputImage>
+void
+SegmentBonesInMicroCTFilter<TInputImage, TOutputImage>::UpdateOutputData(DataObject * output)
+{
+  Superclass::UpdateOutputData(output);
+
+  // the outputs were marked as up to date, but lack some bones
+  if (m_TimeBudgetExceeded)
+  {
+    this->Modified();
+  }
+}
+
 } // end namespace itk
 
 #endif // itkSegmentBonesInMicroCTFilter_hxx
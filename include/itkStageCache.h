@@ -0,0 +1,154 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkStageCache_h
+#define itkStageCache_h
+
+#include "itkImage.h"
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+#include "itkPackedBinaryImage.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace itk
+{
+
+/** \class StageCache
+ *
+ * \brief On-disk cache of the intermediate images of a multi-stage computation.
+ *
+ * Entries are addressed by a key, which is a hash of everything the stages depend on:
+ * typically the input's voxels and geometry, and the parameters which affect the results.
+ * The key is accumulated via Hash and HashImage, and entries live in a subdirectory
+ * of Directory named after the key. Changing any of the hashed data therefore
+ * leads to a different set of entries, and stale entries are never read.
+ *
+ * Each entry holds one image, either an Image or a PackedBinaryImage, with its
+ * buffered region, geometry and pixel type. Entries are written to a temporary file
+ * which is then renamed, so an interrupted computation leaves either a complete entry or none.
+ * An entry whose size or pixel type does not match is treated as missing.
+ *
+ * Entries with different names can be stored and loaded concurrently. Every writer has its own
+ * temporary file, so processes sharing a Directory can also store the same entry concurrently.
+ *
+ * \ingroup HASI
+ */
+template <unsigned int VImageDimension>
+class StageCache : public Object
+{
+public:
+  ITK_DISALLOW_COPY_AND_MOVE(StageCache);
+
+  /** Standard class typedefs. */
+  using Self = StageCache;
+  using Superclass = Object;
+  using Pointer = SmartPointer<Self>;
+  using ConstPointer = SmartPointer<const Self>;
+
+  /** Run-time type information. */
+  itkOverrideGetNameOfClassMacro(StageCache);
+
+  /** Standard New macro. */
+  itkNewMacro(Self);
+
+  static constexpr unsigned int ImageDimension = VImageDimension;
+  using MaskImageType = PackedBinaryImage<ImageDimension>;
+  using RegionType = ImageRegion<ImageDimension>;
+  using HashValueType = std::uint64_t;
+
+  /** Directory which holds the entries of all keys. It is created if needed. */
+  itkSetStringMacro(Directory);
+  itkGetStringMacro(Directory);
+
+  /** Mix raw bytes into the key. */
+  void
+  Hash(const void * data, SizeValueType numberOfBytes);
+
+  /** Mix a parameter value into the key. */
+  template <typename TValue>
+  void
+  Hash(const TValue & value)
+  {
+    this->Hash(&value, sizeof(TValue));
+  }
+
+  /** Mix an image's buffered voxels, regions and geometry into the key.
+   * Voxels are hashed in parallel blocks, and the result does not depend on the number of threads. */
+  template <typename TPixel>
+  void
+  HashImage(const Image<TPixel, ImageDimension> * image);
+
+  /** The key, as hexadecimal digits. */
+  std::string
+  GetKey() const;
+
+  /** Whether all of the named entries exist for the current key. */
+  bool
+  Contains(const std::vector<std::string> & names) const;
+
+  /** Write an Image or a PackedBinaryImage into the named entry, replacing any previous one.
+   * Failing to write only issues a warning, as the entry can be recomputed. */
+  template <typename TImage>
+  void
+  Store(const std::string & name, const TImage * image) const;
+
+  /** Read the named entry into a new image, which is null if the entry is missing or does not match. */
+  template <typename TImage>
+  typename TImage::Pointer
+  Load(const std::string & name) const;
+
+protected:
+  StageCache() = default;
+  ~StageCache() override = default;
+
+  void
+  PrintSelf(std::ostream & os, Indent indent) const override;
+
+  // file of the named entry under the current key
+  std::string
+  GetFileName(const std::string & name) const;
+
+  // buffer of an allocated image
+  template <typename TPixel>
+  static void *
+  GetBuffer(Image<TPixel, ImageDimension> * image);
+  static void *
+  GetBuffer(MaskImageType * image);
+
+  // size in bytes of an image's buffer over a region, and an id of its pixel type which is zero for packed bits;
+  // the image only selects the overload, so it can be null
+  template <typename TPixel>
+  static SizeValueType
+  GetNumberOfBytes(const Image<TPixel, ImageDimension> * image, const RegionType & region, std::uint32_t & pixelType);
+  static SizeValueType
+  GetNumberOfBytes(const MaskImageType * image, const RegionType & region, std::uint32_t & pixelType);
+
+private:
+  std::string   m_Directory;
+  HashValueType m_Key = 14695981039346656037ull; // FNV-1a offset basis
+};
+} // namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#  include "itkStageCache.hxx"
+#endif
+
+#endif // itkStageCache_h
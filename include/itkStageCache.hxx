@@ -0,0 +1,331 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkStageCache_hxx
+#define itkStageCache_hxx
+
+
+#include "itkMultiThreaderBase.h"
+#include "itksys/SystemInformation.hxx"
+#include "itksys/SystemTools.hxx"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+
+namespace itk
+{
+namespace StageCacheDetail
+{
+constexpr std::uint64_t FNVPrime = 1099511628211ull;
+constexpr char          Magic[8] = { 'H', 'A', 'S', 'I', 'S', 'T', 'C', '2' };
+
+// the pixel's size and whether it is floating point or signed, so that e.g. float and int32 entries differ
+template <typename TPixel>
+constexpr std::uint32_t
+PixelTypeId()
+{
+  return static_cast<std::uint32_t>(sizeof(TPixel)) | (std::is_floating_point<TPixel>::value ? 1u << 8 : 0u) |
+         (std::is_signed<TPixel>::value ? 1u << 9 : 0u);
+}
+
+template <typename T>
+void
+WriteValue(std::ostream & out, const T & value)
+{
+  out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+T
+ReadValue(std::istream & in)
+{
+  T value{};
+  in.read(reinterpret_cast<char *>(&value), sizeof(T));
+  return value;
+}
+} // namespace StageCacheDetail
+
+template <unsigned int VImageDimension>
+void
+StageCache<VImageDimension>::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "Directory: " << m_Directory << std::endl;
+  os << indent << "Key: " << this->GetKey() << std::endl;
+}
+
+template <unsigned int VImageDimension>
+void
+StageCache<VImageDimension>::Hash(const void * data, SizeValueType numberOfBytes)
+{
+  const auto * bytes = static_cast<const unsigned char *>(data);
+  for (SizeValueType i = 0; i < numberOfBytes; ++i)
+  {
+    m_Key = (m_Key ^ bytes[i]) * StageCacheDetail::FNVPrime;
+  }
+}
+
+template <unsigned int VImageDimension>
+template <typename TPixel>
+void
+StageCache<VImageDimension>::HashImage(const Image<TPixel, ImageDimension> * image)
+{
+  const RegionType region = image->GetBufferedRegion();
+  for (unsigned d = 0; d < ImageDimension; d++)
+  {
+    this->Hash(image->GetLargestPossibleRegion().GetIndex(d));
+    this->Hash(image->GetLargestPossibleRegion().GetSize(d));
+    this->Hash(region.GetIndex(d));
+    this->Hash(region.GetSize(d));
+    this->Hash(image->GetSpacing()[d]);
+    this->Hash(image->GetOrigin()[d]);
+    for (unsigned e = 0; e < ImageDimension; e++)
+    {
+      this->Hash(image->GetDirection()(d, e));
+    }
+  }
+
+  // 64-bit words within 1 MiB blocks, then the blocks' hashes in order
+  constexpr SizeValueType    blockSize = 1 << 20;
+  const auto *               bytes = reinterpret_cast<const unsigned char *>(image->GetBufferPointer());
+  const SizeValueType        numberOfBytes = region.GetNumberOfPixels() * sizeof(TPixel);
+  std::vector<HashValueType> blockHashes((numberOfBytes + blockSize - 1) / blockSize);
+  MultiThreaderBase::Pointer mt = MultiThreaderBase::New();
+  mt->ParallelizeArray(
+    0,
+    blockHashes.size(),
+    [&](SizeValueType block) {
+      const unsigned char * begin = bytes + block * blockSize;
+      const SizeValueType   length = std::min(blockSize, numberOfBytes - block * blockSize);
+      HashValueType         hash = 14695981039346656037ull;
+      SizeValueType         i = 0;
+      for (; i + sizeof(HashValueType) <= length; i += sizeof(HashValueType))
+      {
+        HashValueType word;
+        std::memcpy(&word, begin + i, sizeof(HashValueType));
+        hash = (hash ^ word) * StageCacheDetail::FNVPrime;
+      }
+      for (; i < length; ++i)
+      {
+        hash = (hash ^ begin[i]) * StageCacheDetail::FNVPrime;
+      }
+      blockHashes[block] = hash;
+    },
+    nullptr);
+  this->Hash(blockHashes.data(), blockHashes.size() * sizeof(HashValueType));
+}
+
+template <unsigned int VImageDimension>
+std::string
+StageCache<VImageDimension>::GetKey() const
+{
+  std::ostringstream key;
+  key << std::hex << std::setw(16) << std::setfill('0') << m_Key;
+  return key.str();
+}
+
+template <unsigned int VImageDimension>
+std::string
+StageCache<VImageDimension>::GetFileName(const std::string & name) const
+{
+  return m_Directory + "/" + this->GetKey() + "/" + name + ".bin";
+}
+
+template <unsigned int VImageDimension>
+bool
+StageCache<VImageDimension>::Contains(const std::vector<std::string> & names) const
+{
+  for (const std::string & name : names)
+  {
+    if (!itksys::SystemTools::FileExists(this->GetFileName(name), true))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <unsigned int VImageDimension>
+template <typename TPixel>
+void *
+StageCache<VImageDimension>::GetBuffer(Image<TPixel, ImageDimension> * image)
+{
+  return image->GetBufferPointer();
+}
+
+template <unsigned int VImageDimension>
+void *
+StageCache<VImageDimension>::GetBuffer(MaskImageType * image)
+{
+  return image->GetRow(0);
+}
+
+template <unsigned int VImageDimension>
+template <typename TPixel>
+SizeValueType
+StageCache<VImageDimension>::GetNumberOfBytes(const Image<TPixel, ImageDimension> * itkNotUsed(image),
+                                              const RegionType &                    region,
+                                              std::uint32_t &                       pixelType)
+{
+  pixelType = StageCacheDetail::PixelTypeId<TPixel>();
+  return region.GetNumberOfPixels() * sizeof(TPixel);
+}
+
+template <unsigned int VImageDimension>
+SizeValueType
+StageCache<VImageDimension>::GetNumberOfBytes(const MaskImageType * itkNotUsed(image),
+                                              const RegionType &    region,
+                                              std::uint32_t &       pixelType)
+{
+  pixelType = 0;
+  const SizeValueType rowLength = region.GetSize(0);
+  const SizeValueType numberOfRows = rowLength > 0 ? region.GetNumberOfPixels() / rowLength : 0;
+  const SizeValueType wordsPerRow = (rowLength + MaskImageType::BitsPerWord - 1) / MaskImageType::BitsPerWord;
+  return numberOfRows * wordsPerRow * sizeof(typename MaskImageType::WordType);
+}
+
+template <unsigned int VImageDimension>
+template <typename TImage>
+void
+StageCache<VImageDimension>::Store(const std::string & name, const TImage * image) const
+{
+  const RegionType    region = image->GetBufferedRegion();
+  std::uint32_t       pixelType;
+  const SizeValueType numberOfBytes = GetNumberOfBytes(image, region, pixelType);
+  const void *        buffer = GetBuffer(const_cast<TImage *>(image));
+
+  // unique per process and thread, so that concurrent writers of an entry do not share a temporary file
+  std::ostringstream temporarySuffix;
+  temporarySuffix << '.' << itksys::SystemInformation::GetProcessId() << '.' << std::hex
+                  << std::hash<std::thread::id>()(std::this_thread::get_id()) << ".tmp";
+  const std::string directory = m_Directory + "/" + this->GetKey();
+  const std::string fileName = this->GetFileName(name);
+  const std::string temporaryName = fileName + temporarySuffix.str();
+  if (!itksys::SystemTools::MakeDirectory(directory))
+  {
+    itkWarningMacro(<< "Could not create cache directory " << directory);
+    return;
+  }
+
+  {
+    std::ofstream out(temporaryName, std::ios::binary | std::ios::trunc);
+    out.write(StageCacheDetail::Magic, sizeof(StageCacheDetail::Magic));
+    StageCacheDetail::WriteValue(out, static_cast<std::uint32_t>(ImageDimension));
+    StageCacheDetail::WriteValue<std::uint32_t>(out, pixelType);
+    for (unsigned d = 0; d < ImageDimension; d++)
+    {
+      StageCacheDetail::WriteValue<std::int64_t>(out, region.GetIndex(d));
+      StageCacheDetail::WriteValue<std::uint64_t>(out, region.GetSize(d));
+      StageCacheDetail::WriteValue<double>(out, image->GetSpacing()[d]);
+      StageCacheDetail::WriteValue<double>(out, image->GetOrigin()[d]);
+      for (unsigned e = 0; e < ImageDimension; e++)
+      {
+        StageCacheDetail::WriteValue<double>(out, image->GetDirection()(d, e));
+      }
+    }
+    StageCacheDetail::WriteValue<std::uint64_t>(out, numberOfBytes);
+    out.write(static_cast<const char *>(buffer), numberOfBytes);
+    if (!out)
+    {
+      itkWarningMacro(<< "Could not write cache entry " << temporaryName);
+      out.close();
+      itksys::SystemTools::RemoveFile(temporaryName);
+      return;
+    }
+  }
+  if (!itksys::SystemTools::RenameFile(temporaryName, fileName))
+  {
+    itkWarningMacro(<< "Could not rename cache entry " << temporaryName << " to " << fileName);
+    itksys::SystemTools::RemoveFile(temporaryName);
+  }
+}
+
+template <unsigned int VImageDimension>
+template <typename TImage>
+typename TImage::Pointer
+StageCache<VImageDimension>::Load(const std::string & name) const
+{
+  std::ifstream in(this->GetFileName(name), std::ios::binary);
+  if (!in)
+  {
+    return nullptr;
+  }
+  char magic[sizeof(StageCacheDetail::Magic)];
+  in.read(magic, sizeof(magic));
+  if (!in || std::memcmp(magic, StageCacheDetail::Magic, sizeof(magic)) != 0 ||
+      StageCacheDetail::ReadValue<std::uint32_t>(in) != ImageDimension)
+  {
+    return nullptr;
+  }
+  const std::uint32_t pixelType = StageCacheDetail::ReadValue<std::uint32_t>(in);
+
+  RegionType                     region;
+  typename TImage::SpacingType   spacing;
+  typename TImage::PointType     origin;
+  typename TImage::DirectionType direction;
+  for (unsigned d = 0; d < ImageDimension; d++)
+  {
+    region.SetIndex(d, StageCacheDetail::ReadValue<std::int64_t>(in));
+    region.SetSize(d, StageCacheDetail::ReadValue<std::uint64_t>(in));
+    spacing[d] = StageCacheDetail::ReadValue<double>(in);
+    origin[d] = StageCacheDetail::ReadValue<double>(in);
+    for (unsigned e = 0; e < ImageDimension; e++)
+    {
+      direction(d, e) = StageCacheDetail::ReadValue<double>(in);
+    }
+  }
+  const std::uint64_t numberOfBytes = StageCacheDetail::ReadValue<std::uint64_t>(in);
+
+  // checked before allocating, so that a corrupt header cannot request a huge buffer
+  std::uint32_t       expectedPixelType;
+  const SizeValueType expectedBytes = GetNumberOfBytes(static_cast<const TImage *>(nullptr), region, expectedPixelType);
+  if (!in || pixelType != expectedPixelType || numberOfBytes != expectedBytes)
+  {
+    return nullptr;
+  }
+  const std::streamoff dataStart = in.tellg();
+  in.seekg(0, std::ios::end);
+  const std::streamoff fileEnd = in.tellg();
+  if (!in || fileEnd - dataStart != static_cast<std::streamoff>(numberOfBytes))
+  {
+    return nullptr;
+  }
+  in.seekg(dataStart);
+
+  typename TImage::Pointer image = TImage::New();
+  image->SetRegions(region);
+  image->SetSpacing(spacing);
+  image->SetOrigin(origin);
+  image->SetDirection(direction);
+  image->Allocate();
+  in.read(static_cast<char *>(GetBuffer(image.GetPointer())), numberOfBytes);
+  if (!in)
+  {
+    return nullptr;
+  }
+  return image;
+}
+
+} // end namespace itk
+
+#endif // itkStageCache_hxx
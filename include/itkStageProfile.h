@@ -0,0 +1,402 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkStageProfile_h
+#define itkStageProfile_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#  include "itkWindows.h"
+#  include "itksys/SystemInformation.hxx"
+#elif defined(__APPLE__)
+#  include <mach/mach.h>
+#  include <sys/resource.h>
+#else
+#  include <fstream>
+#  include <sys/resource.h>
+#  include <unistd.h>
+#endif
+
+namespace itk
+{
+
+/** \class StageProfile
+ *
+ * \brief Wall time, processor time and memory of the named stages of a computation.
+ *
+ * A stage is measured by a Scope object, from its construction to its destruction.
+ * Stages can nest, and can run concurrently, e.g. one per bone. Stages of a single
+ * item, such as a bone, carry its number, stages of the whole computation have zero.
+ *
+ * Processor time and memory are those of the whole process: processor time adds up
+ * all threads, and memory is the resident set size. So concurrent stages include each
+ * other's work. Between Start and Stop, a background thread samples the memory every
+ * SamplingInterval seconds, so each stage's peak includes the highest sample taken
+ * while it ran, not just the memory at its beginning and end.
+ *
+ * \ingroup HASI
+ */
+class StageProfile : public Object
+{
+public:
+  ITK_DISALLOW_COPY_AND_MOVE(StageProfile);
+
+  /** Standard class typedefs. */
+  using Self = StageProfile;
+  using Superclass = Object;
+  using Pointer = SmartPointer<Self>;
+  using ConstPointer = SmartPointer<const Self>;
+
+  /** Run-time type information. */
+  itkOverrideGetNameOfClassMacro(StageProfile);
+
+  /** Standard New macro. */
+  itkNewMacro(Self);
+
+  /** One measured stage. Times are in seconds, memory in bytes. */
+  struct Record
+  {
+    std::string     name;
+    SizeValueType   item = 0;         // e.g. the bone, zero for stages of the whole computation
+    double          start = 0.0;      // since Start
+    double          wallTime = 0.0;
+    double          cpuTime = 0.0;    // of all threads of the process
+    OffsetValueType memoryChange = 0; // at the end minus at the beginning
+    SizeValueType   peakMemory = 0;   // highest memory seen while the stage ran
+  };
+
+  /** Seconds between memory samples of the background thread, zero disables it. Default is 0.01. */
+  itkSetMacro(SamplingInterval, double);
+  itkGetConstMacro(SamplingInterval, double);
+
+  /** Clear the records, and sample memory in the background until Stop. */
+  void
+  Start();
+
+  /** Stop sampling memory. Also called on destruction. */
+  void
+  Stop();
+
+  /** The finished stages, ordered by their start. */
+  std::vector<Record>
+  GetRecords() const;
+
+  /** Highest memory seen since Start, in bytes. */
+  SizeValueType
+  GetPeakMemory() const;
+
+  /** Write the records and the peak memory as a JSON object. */
+  void
+  WriteJSON(std::ostream & os) const;
+
+  /** Measures a stage during its lifetime. Does nothing if profile is null, so stages can be
+   * marked unconditionally and only measured when a profile is requested. */
+  class Scope
+  {
+  public:
+    ITK_DISALLOW_COPY_AND_MOVE(Scope);
+
+    Scope(StageProfile * profile, std::string name, SizeValueType item = 0)
+      : m_Profile(profile)
+    {
+      if (m_Profile)
+      {
+        m_Id = m_Profile->Begin(std::move(name), item);
+      }
+    }
+    ~Scope()
+    {
+      if (m_Profile)
+      {
+        m_Profile->End(m_Id);
+      }
+    }
+
+  private:
+    StageProfile * m_Profile;
+    SizeValueType  m_Id = 0;
+  };
+
+protected:
+  StageProfile() = default;
+  ~StageProfile() override { this->Stop(); }
+
+  void
+  PrintSelf(std::ostream & os, Indent indent) const override;
+
+  // open a stage, returning its id
+  SizeValueType
+  Begin(std::string name, SizeValueType item);
+
+  // close the stage and record it
+  void
+  End(SizeValueType id);
+
+  // raise the peaks of the whole profile and of the open stages to memory
+  void
+  RaisePeaks(SizeValueType memory);
+
+  // the resident set size of this process in bytes, zero if it is unknown
+  static SizeValueType
+  GetProcessMemory();
+
+  // processor time of all threads of this process, in seconds
+  static double
+  GetProcessorTime();
+
+  double
+  GetSecondsSinceStart() const;
+
+private:
+  struct OpenStage
+  {
+    Record        record;
+    double        cpuStart = 0.0;
+    SizeValueType memoryStart = 0;
+  };
+
+  std::map<SizeValueType, OpenStage>    m_OpenStages; // by id
+  std::vector<Record>                   m_Records;
+  SizeValueType                         m_NextId = 0;
+  SizeValueType                         m_PeakMemory = 0;
+  double                                m_SamplingInterval = 0.01;
+  std::chrono::steady_clock::time_point m_StartTime = std::chrono::steady_clock::now();
+
+  std::thread             m_Sampler;
+  bool                    m_Sampling = false;
+  std::condition_variable m_StopSampling;
+  mutable std::mutex      m_Mutex;
+};
+
+
+inline void
+StageProfile::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "SamplingInterval: " << m_SamplingInterval << std::endl;
+  os << indent << "Records: " << this->GetRecords().size() << std::endl;
+  os << indent << "PeakMemory: " << this->GetPeakMemory() << std::endl;
+}
+
+inline void
+StageProfile::Start()
+{
+  this->Stop();
+  const SizeValueType memory = GetProcessMemory();
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Records.clear();
+    m_PeakMemory = memory;
+    m_StartTime = std::chrono::steady_clock::now();
+    m_Sampling = m_SamplingInterval > 0.0;
+  }
+  if (m_SamplingInterval > 0.0)
+  {
+    m_Sampler = std::thread([this]() {
+      const auto interval = std::chrono::duration<double>(m_SamplingInterval);
+      std::unique_lock<std::mutex> lock(m_Mutex);
+      while (!m_StopSampling.wait_for(lock, interval, [this]() { return !m_Sampling; }))
+      {
+        lock.unlock();
+        const SizeValueType memory = GetProcessMemory();
+        lock.lock();
+        this->RaisePeaks(memory);
+      }
+    });
+  }
+}
+
+inline void
+StageProfile::Stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Sampling = false;
+  }
+  m_StopSampling.notify_all();
+  if (m_Sampler.joinable())
+  {
+    m_Sampler.join();
+  }
+}
+
+inline auto
+StageProfile::GetRecords() const -> std::vector<Record>
+{
+  std::vector<Record> records;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    records = m_Records;
+  }
+  std::stable_sort(
+    records.begin(), records.end(), [](const Record & a, const Record & b) { return a.start < b.start; });
+  return records;
+}
+
+inline SizeValueType
+StageProfile::GetPeakMemory() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_PeakMemory;
+}
+
+inline void
+StageProfile::WriteJSON(std::ostream & os) const
+{
+  auto quoted = [](const std::string & text) {
+    std::string result = "\"";
+    for (char c : text)
+    {
+      if (c == '"' || c == '\\')
+      {
+        result += '\\';
+      }
+      result += c;
+    }
+    return result + "\"";
+  };
+
+  const std::vector<Record> records = this->GetRecords();
+  os << "{\n  \"peakMemory\": " << this->GetPeakMemory() << ",\n  \"stages\": [";
+  for (SizeValueType i = 0; i < records.size(); ++i)
+  {
+    const Record & r = records[i];
+    os << (i > 0 ? ",\n" : "\n") << "    { \"name\": " << quoted(r.name) << ", \"item\": " << r.item
+       << ", \"start\": " << r.start << ", \"wallTime\": " << r.wallTime << ", \"cpuTime\": " << r.cpuTime
+       << ", \"memoryChange\": " << r.memoryChange << ", \"peakMemory\": " << r.peakMemory << " }";
+  }
+  os << "\n  ]\n}" << std::endl;
+}
+
+inline SizeValueType
+StageProfile::Begin(std::string name, SizeValueType item)
+{
+  OpenStage stage;
+  stage.record.name = std::move(name);
+  stage.record.item = item;
+  stage.memoryStart = GetProcessMemory();
+  stage.record.peakMemory = stage.memoryStart;
+  stage.cpuStart = GetProcessorTime();
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  stage.record.start = this->GetSecondsSinceStart();
+  m_PeakMemory = std::max(m_PeakMemory, stage.memoryStart);
+  const SizeValueType id = m_NextId++;
+  m_OpenStages.emplace(id, std::move(stage));
+  return id;
+}
+
+inline void
+StageProfile::End(SizeValueType id)
+{
+  const SizeValueType memory = GetProcessMemory();
+  const double        cpuTime = GetProcessorTime();
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  this->RaisePeaks(memory);
+  auto      open = m_OpenStages.find(id);
+  Record    record = std::move(open->second.record);
+  record.wallTime = this->GetSecondsSinceStart() - record.start;
+  record.cpuTime = cpuTime - open->second.cpuStart;
+  record.memoryChange = static_cast<OffsetValueType>(memory) - static_cast<OffsetValueType>(open->second.memoryStart);
+  m_OpenStages.erase(open);
+  m_Records.push_back(std::move(record));
+}
+
+inline void
+StageProfile::RaisePeaks(SizeValueType memory)
+{
+  m_PeakMemory = std::max(m_PeakMemory, memory);
+  for (auto & open : m_OpenStages)
+  {
+    open.second.record.peakMemory = std::max(open.second.record.peakMemory, memory);
+  }
+}
+
+inline SizeValueType
+StageProfile::GetProcessMemory()
+{
+  // queried directly where that is cheap, as it is sampled every SamplingInterval
+#if defined(_WIN32)
+  itksys::SystemInformation information; // the working set, from the process memory counters
+  const long long           kibibytes = information.GetProcMemoryUsed();
+  return kibibytes > 0 ? static_cast<SizeValueType>(kibibytes) * 1024 : 0;
+#elif defined(__APPLE__)
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t      count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS)
+  {
+    return 0;
+  }
+  return static_cast<SizeValueType>(info.resident_size);
+#else
+  std::ifstream statm("/proc/self/statm"); // total and resident pages
+  SizeValueType pages = 0;
+  SizeValueType residentPages = 0;
+  if (!(statm >> pages >> residentPages))
+  {
+    return 0;
+  }
+  return residentPages * static_cast<SizeValueType>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+inline double
+StageProfile::GetProcessorTime()
+{
+  // user and system time of all threads; std::clock is wall time on Windows
+#if defined(_WIN32)
+  FILETIME creationTime, exitTime, kernelTime, userTime;
+  if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+  {
+    return 0.0;
+  }
+  auto seconds = [](const FILETIME & time) {
+    return 1e-7 * static_cast<double>((static_cast<ULONGLONG>(time.dwHighDateTime) << 32) | time.dwLowDateTime);
+  };
+  return seconds(kernelTime) + seconds(userTime);
+#else
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+  {
+    return 0.0;
+  }
+  return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+         1e-6 * static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+#endif
+}
+
+inline double
+StageProfile::GetSecondsSinceStart() const
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_StartTime).count();
+}
+} // namespace itk
+
+#endif // itkStageProfile_h
@@ -14,8 +14,12 @@ itk_module(HASI
     ITKImageGrid
     ITKLabelMap
     ITKRegistrationCommon
+    ITKRegistrationMethodsv4
+    ITKMetricsv4
+    ITKOptimizersv4
     ITKSpatialObjects
     ITKTransform
+    ITKImageFeatures
     BoneEnhancement
   COMPILE_DEPENDS
     ITKImageSources
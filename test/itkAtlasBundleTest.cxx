@@ -0,0 +1,201 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "itkAtlasBundleBuilder.h"
+
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkTestingMacros.h"
+#include "itksys/SystemTools.hxx"
+
+#include <fstream>
+#include <iterator>
+#include <random>
+
+int
+itkAtlasBundleTest(int argc, char * argv[])
+{
+  if (argc < 2)
+  {
+    std::cerr << "Missing parameters." << std::endl;
+    std::cerr << "Usage: " << itkNameOfTestExecutableMacro(argv) << " <bundleFile>" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  constexpr unsigned int Dimension = 3;
+  using ImageType = itk::Image<short, Dimension>;
+  using LabelImageType = itk::Image<unsigned char, Dimension>;
+  using BuilderType = itk::AtlasBundleBuilder<ImageType, LabelImageType>;
+  using BundleType = itk::AtlasBundle<ImageType, LabelImageType>;
+
+  ImageType::RegionType region;
+  region.SetSize({ { 40, 24, 20 } });
+  ImageType::SpacingType spacing;
+  spacing[0] = 0.5;
+  spacing[1] = 0.5;
+  spacing[2] = 1.0;
+  ImageType::PointType origin;
+  origin[0] = -3.0;
+  origin[1] = 1.5;
+  origin[2] = 7.0;
+
+  ImageType::Pointer image = ImageType::New();
+  image->SetRegions(region);
+  image->SetSpacing(spacing);
+  image->SetOrigin(origin);
+  image->Allocate();
+  std::mt19937                       rng(3);
+  std::uniform_int_distribution<int> values(-1000, 5000);
+  for (itk::ImageRegionIteratorWithIndex<ImageType> it(image, region); !it.IsAtEnd(); ++it)
+  {
+    it.Set(values(rng));
+  }
+
+  // two boxes, bone 2 touching the border of the image
+  ImageType::RegionType boxes[2];
+  boxes[0].SetIndex({ { 4, 3, 2 } });
+  boxes[0].SetSize({ { 9, 8, 7 } });
+  boxes[1].SetIndex({ { 30, 10, 5 } });
+  boxes[1].SetSize({ { 10, 9, 11 } });
+  LabelImageType::Pointer labels = LabelImageType::New();
+  labels->CopyInformation(image);
+  labels->SetRegions(region);
+  labels->Allocate(true);
+  for (unsigned b = 0; b < 2; ++b)
+  {
+    for (itk::ImageRegionIteratorWithIndex<LabelImageType> it(labels, boxes[b]); !it.IsAtEnd(); ++it)
+    {
+      it.Set(b + 1);
+    }
+  }
+
+  BundleType::LandmarksType landmarks[2];
+  for (unsigned b = 0; b < 2; ++b)
+  {
+    for (unsigned l = 0; l < 3; ++l)
+    {
+      BundleType::PointType point;
+      image->TransformIndexToPhysicalPoint(boxes[b].GetIndex(), point);
+      point[l] += 1.25 * (b + 1);
+      landmarks[b].push_back(point);
+    }
+  }
+
+  BuilderType::Pointer builder = BuilderType::New();
+
+  ITK_EXERCISE_BASIC_OBJECT_METHODS(builder, AtlasBundleBuilder, Object);
+
+  builder->SetImage(image);
+  builder->SetLabels(labels);
+  builder->AddBone(1, landmarks[0]);
+  builder->AddBone(2, landmarks[1]);
+  builder->SetRegionOfInterestPadding(0.5);
+  ITK_TEST_SET_GET_VALUE(0.5, builder->GetRegionOfInterestPadding());
+  ITK_TEST_SET_GET_BOOLEAN(builder, ComputeDistanceMaps, true);
+  builder->GetModifiableRefinement()->SetNumberOfResolutions(3);
+  ITK_TRY_EXPECT_NO_EXCEPTION(builder->Write(argv[1]));
+
+  BundleType::Pointer bundle = BundleType::New();
+
+  ITK_EXERCISE_BASIC_OBJECT_METHODS(bundle, AtlasBundle, Object);
+
+  ITK_TRY_EXPECT_EXCEPTION(bundle->Read(std::string(argv[1]) + ".missing"));
+  ITK_TRY_EXPECT_NO_EXCEPTION(bundle->Read(argv[1]));
+  ITK_TEST_EXPECT_EQUAL(bundle->GetFileName(), std::string(argv[1]));
+  ITK_TEST_EXPECT_EQUAL(bundle->GetNumberOfPyramidLevels(), 3);
+  ITK_TEST_EXPECT_TRUE(bundle->GetBones() == std::vector<unsigned char>({ 1, 2 }));
+  ITK_TEST_EXPECT_TRUE(bundle->HasBone(2));
+  ITK_TEST_EXPECT_TRUE(!bundle->HasBone(3));
+  ITK_TRY_EXPECT_EXCEPTION(bundle->GetImage(3));
+
+  for (unsigned b = 0; b < 2; ++b)
+  {
+    const unsigned char bone = b + 1;
+    ITK_TEST_EXPECT_TRUE(bundle->GetLandmarks(bone) == landmarks[b]);
+
+    // the bone's box, padded by one voxel in each direction and cropped to the image
+    ImageType::RegionType roi = boxes[b];
+    roi.PadByRadius(1);
+    roi.Crop(region);
+
+    ImageType::Pointer      boneImage = bundle->GetImage(bone);
+    LabelImageType::Pointer boneLabels = bundle->GetLabels(bone);
+    ITK_TEST_EXPECT_EQUAL(boneImage->GetBufferedRegion(), roi);
+    ITK_TEST_EXPECT_EQUAL(boneLabels->GetBufferedRegion(), roi);
+    ITK_TEST_EXPECT_EQUAL(boneImage->GetSpacing(), spacing);
+    ITK_TEST_EXPECT_EQUAL(boneLabels->GetOrigin(), origin);
+    itk::SizeValueType differences = 0;
+    for (itk::ImageRegionConstIteratorWithIndex<ImageType> it(boneImage, roi); !it.IsAtEnd(); ++it)
+    {
+      differences += it.Get() != image->GetPixel(it.GetIndex());
+      differences += boneLabels->GetPixel(it.GetIndex()) != labels->GetPixel(it.GetIndex());
+    }
+    ITK_TEST_EXPECT_EQUAL(differences, 0);
+
+    // coarsest level first, the finest level is the cropped image
+    BundleType::PyramidType pyramid = bundle->GetPyramid(bone);
+    ITK_TEST_EXPECT_EQUAL(pyramid.size(), 3);
+    ITK_TEST_EXPECT_EQUAL(pyramid[0]->GetSpacing()[0], 4 * spacing[0]);
+    ITK_TEST_EXPECT_EQUAL(pyramid[2]->GetBufferedRegion(), roi);
+    ITK_TEST_EXPECT_EQUAL(pyramid[2]->GetPixel(roi.GetIndex()), image->GetPixel(roi.GetIndex()));
+
+    BundleType::DistanceImageType::Pointer distance = bundle->GetDistanceMap(bone);
+    ITK_TEST_EXPECT_TRUE(distance.IsNotNull());
+    ITK_TEST_EXPECT_EQUAL(distance->GetBufferedRegion(), roi);
+    ImageType::IndexType center = boxes[b].GetIndex();
+    for (unsigned d = 0; d < Dimension; d++)
+    {
+      center[d] += boxes[b].GetSize(d) / 2;
+    }
+    ITK_TEST_EXPECT_TRUE(distance->GetPixel(center) < 0.0f);
+    ITK_TEST_EXPECT_TRUE(distance->GetPixel(roi.GetIndex()) > 0.0f);
+  }
+
+  // writing to an image leaves the file and the other views unchanged
+  ImageType::Pointer   written = bundle->GetImage(1);
+  ImageType::IndexType corner = written->GetBufferedRegion().GetIndex();
+  written->SetPixel(corner, image->GetPixel(corner) + 1);
+  ITK_TEST_EXPECT_EQUAL(bundle->GetImage(1)->GetPixel(corner), image->GetPixel(corner));
+
+  // images outlive the bundle
+  LabelImageType::Pointer kept = bundle->GetLabels(2);
+  bundle = nullptr;
+  ITK_TEST_EXPECT_EQUAL(kept->GetPixel(boxes[1].GetIndex()), 2);
+
+  // a truncated bundle is refused
+  const std::string truncatedName = std::string(argv[1]) + ".truncated";
+  {
+    std::ifstream     in(argv[1], std::ios::binary);
+    const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::ofstream     out(truncatedName, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size() / 2);
+  }
+  BundleType::Pointer truncated = BundleType::New();
+  ITK_TRY_EXPECT_EXCEPTION(truncated->Read(truncatedName));
+
+  // bones without voxels are refused
+  builder->AddBone(7, {});
+  ITK_TRY_EXPECT_EXCEPTION(builder->Write(argv[1]));
+  ITK_TEST_EXPECT_TRUE(!itksys::SystemTools::FileExists(std::string(argv[1]) + ".tmp"));
+  BundleType::Pointer reread = BundleType::New();
+  ITK_TRY_EXPECT_NO_EXCEPTION(reread->Read(argv[1]));
+  ITK_TEST_EXPECT_EQUAL(reread->GetBones().size(), 2);
+
+  std::cout << "Test finished successfully." << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,151 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "itkBSplineAtlasRefinement.h"
+
+#include "itkAffineTransform.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkLinearLabelResampler.h"
+#include "itkTestingMacros.h"
+
+#include <cmath>
+
+namespace
+{
+constexpr unsigned int Dimension = 3;
+using ImageType = itk::Image<short, Dimension>;
+using LabelImageType = itk::Image<unsigned char, Dimension>;
+
+// a ball of radius, with a smooth edge, in a cube
+template <typename TImage>
+typename TImage::Pointer
+MakeBall(double radius, bool labels)
+{
+  typename TImage::Pointer image = TImage::New();
+  image->SetRegions(typename TImage::SizeType{ { 32, 32, 32 } });
+  image->SetSpacing(0.5);
+  image->Allocate();
+  for (itk::ImageRegionIteratorWithIndex<TImage> it(image, image->GetBufferedRegion()); !it.IsAtEnd(); ++it)
+  {
+    typename TImage::PointType point;
+    image->TransformIndexToPhysicalPoint(it.GetIndex(), point);
+    double distance = 0.0;
+    for (unsigned d = 0; d < Dimension; d++)
+    {
+      distance += (point[d] - 7.75) * (point[d] - 7.75);
+    }
+    distance = std::sqrt(distance) - radius;
+    if (labels)
+    {
+      it.Set(distance < 0.0);
+    }
+    else
+    {
+      it.Set(static_cast<typename TImage::PixelType>(100.0 / (1.0 + std::exp(distance / 0.5))));
+    }
+  }
+  return image;
+}
+
+itk::SizeValueType
+CountMismatches(const LabelImageType * expected, const LabelImageType * actual)
+{
+  itk::SizeValueType mismatches = 0;
+  for (itk::ImageRegionConstIteratorWithIndex<LabelImageType> it(expected, expected->GetBufferedRegion());
+       !it.IsAtEnd();
+       ++it)
+  {
+    mismatches += it.Get() != actual->GetPixel(it.GetIndex());
+  }
+  return mismatches;
+}
+} // namespace
+
+int
+itkBSplineAtlasRefinementTest(int, char *[])
+{
+  using RefinementType = itk::BSplineAtlasRefinement<ImageType>;
+  using ResamplerType = itk::LinearLabelResampler<LabelImageType>;
+
+  // the atlas bone is thicker than the image's
+  ImageType::Pointer      image = MakeBall<ImageType>(4.0, false);
+  ImageType::Pointer      atlas = MakeBall<ImageType>(5.0, false);
+  LabelImageType::Pointer imageLabels = MakeBall<LabelImageType>(4.0, true);
+  LabelImageType::Pointer atlasLabels = MakeBall<LabelImageType>(5.0, true);
+
+  RefinementType::Pointer refinement = RefinementType::New();
+
+  ITK_EXERCISE_BASIC_OBJECT_METHODS(refinement, BSplineAtlasRefinement, Object);
+
+  refinement->SetControlPointSpacing(2.0);
+  ITK_TEST_SET_GET_VALUE(2.0, refinement->GetControlPointSpacing());
+  refinement->SetNumberOfResolutions(2);
+  ITK_TEST_SET_GET_VALUE(2, refinement->GetNumberOfResolutions());
+  refinement->SetNumberOfIterations(50);
+  ITK_TEST_SET_GET_VALUE(50, refinement->GetNumberOfIterations());
+  refinement->SetSamplingPercentage(0.5);
+  ITK_TEST_SET_GET_VALUE(0.5, refinement->GetSamplingPercentage());
+  ITK_TEST_SET_GET_VALUE(32, refinement->GetNumberOfHistogramBins());
+
+  // a generous mask around the image's bone
+  RefinementType::MaskImageType::Pointer mask = MakeBall<RefinementType::MaskImageType>(6.0, true);
+  ImageType::RegionType                  region = image->GetLargestPossibleRegion();
+  region.ShrinkByRadius(2);
+
+  using AffineType = itk::AffineTransform<double, Dimension>;
+  AffineType::Pointer identity = AffineType::New();
+
+  RefinementType::CompositeTransformType::Pointer refined;
+  ITK_TRY_EXPECT_NO_EXCEPTION(refined = refinement->Refine(image, atlas, mask, region, identity));
+  ITK_TEST_EXPECT_EQUAL(refined->GetNumberOfTransforms(), 2);
+
+  // the refined atlas labels match the image's better than the initial ones
+  ResamplerType::Pointer  resampler = ResamplerType::New();
+  LabelImageType::Pointer initial = LabelImageType::New();
+  initial->CopyInformation(imageLabels);
+  initial->SetRegions(imageLabels->GetLargestPossibleRegion());
+  initial->Allocate();
+  resampler->Resample(atlasLabels, identity, initial);
+  LabelImageType::Pointer deformed = LabelImageType::New();
+  deformed->CopyInformation(imageLabels);
+  deformed->SetRegions(imageLabels->GetLargestPossibleRegion());
+  deformed->Allocate();
+  resampler->Resample(atlasLabels, refined, deformed);
+
+  const itk::SizeValueType initialMismatches = CountMismatches(imageLabels, initial);
+  const itk::SizeValueType refinedMismatches = CountMismatches(imageLabels, deformed);
+  std::cout << "Mismatches: " << initialMismatches << " initially, " << refinedMismatches << " refined" << std::endl;
+  ITK_TEST_EXPECT_TRUE(refinedMismatches < initialMismatches);
+
+  // another call starts over, and samples the same points, also with both pyramids computed beforehand
+  const RefinementType::PyramidType imagePyramid = refinement->ComputePyramid(image, region);
+  const RefinementType::PyramidType atlasPyramid = refinement->ComputePyramid(atlas, atlas->GetBufferedRegion());
+  ITK_TEST_EXPECT_EQUAL(imagePyramid.size(), refinement->GetNumberOfResolutions());
+  RefinementType::CompositeTransformType::Pointer again =
+    refinement->Refine(imagePyramid, atlasPyramid, mask, identity);
+  const auto & parameters = refined->GetNthTransform(1)->GetParameters();
+  const auto & againParameters = again->GetNthTransform(1)->GetParameters();
+  ITK_TEST_EXPECT_EQUAL(againParameters.Size(), parameters.Size());
+  for (unsigned i = 0; i < parameters.Size(); ++i)
+  {
+    ITK_TEST_EXPECT_TRUE(std::abs(againParameters[i] - parameters[i]) < 1e-6);
+  }
+
+  std::cout << "Test finished successfully." << std::endl;
+  return EXIT_SUCCESS;
+}
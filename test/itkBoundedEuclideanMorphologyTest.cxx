@@ -0,0 +1,200 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "itkBoundedEuclideanMorphology.h"
+
+#include "itkImage.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkSignedMaurerDistanceMapImageFilter.h"
+#include "itkTestingMacros.h"
+
+#include <array>
+#include <random>
+
+namespace
+{
+using ImageType = itk::Image<unsigned char, 3>;
+using RealImageType = itk::Image<float, 3>;
+
+RealImageType::Pointer
+SquaredSignedDistance(const ImageType * mask, bool negate)
+{
+  ImageType::Pointer input = ImageType::New();
+  input->CopyInformation(mask);
+  input->SetRegions(mask->GetBufferedRegion());
+  input->Allocate();
+  itk::ImageRegionConstIteratorWithIndex<ImageType> mIt(mask, mask->GetBufferedRegion());
+  itk::ImageRegionIteratorWithIndex<ImageType>      iIt(input, mask->GetBufferedRegion());
+  for (; !iIt.IsAtEnd(); ++iIt, ++mIt)
+  {
+    iIt.Set((mIt.Get() != 0) != negate ? 1 : 0);
+  }
+
+  using DistanceType = itk::SignedMaurerDistanceMapImageFilter<ImageType, RealImageType>;
+  DistanceType::Pointer distance = DistanceType::New();
+  distance->SetInput(input);
+  distance->SetSquaredDistance(true);
+  distance->SetUseImageSpacing(true);
+  distance->SetInsideIsPositive(false);
+  distance->Update();
+  return distance->GetOutput();
+}
+
+itk::SizeValueType
+CountMismatches(const ImageType * result, const RealImageType * distance, float threshold, bool erode)
+{
+  itk::SizeValueType                                mismatches = 0;
+  itk::ImageRegionConstIteratorWithIndex<ImageType> rIt(result, result->GetBufferedRegion());
+  for (; !rIt.IsAtEnd(); ++rIt)
+  {
+    const float value = distance->GetPixel(rIt.GetIndex());
+    const bool  expected = erode ? value >= threshold : value <= threshold;
+    mismatches += expected != (rIt.Get() != 0);
+  }
+  return mismatches;
+}
+
+itk::SizeValueType
+CountDifferences(const ImageType * a, const ImageType * b)
+{
+  itk::SizeValueType                                differences = 0;
+  itk::ImageRegionConstIteratorWithIndex<ImageType> aIt(a, a->GetBufferedRegion());
+  for (; !aIt.IsAtEnd(); ++aIt)
+  {
+    differences += (aIt.Get() != 0) != (b->GetPixel(aIt.GetIndex()) != 0);
+  }
+  return differences;
+}
+} // namespace
+
+int
+itkBoundedEuclideanMorphologyTest(int, char *[])
+{
+  using MorphologyType = itk::BoundedEuclideanMorphology<ImageType>;
+
+  // anisotropic spacing and a buffered region which does not start at zero
+  ImageType::RegionType region;
+  region.SetIndex({ { -5, 3, 7 } });
+  region.SetSize({ { 47, 38, 29 } });
+  ImageType::SpacingType spacing;
+  spacing[0] = 0.06;
+  spacing[1] = 0.09;
+  spacing[2] = 0.13;
+
+  ImageType::Pointer mask = ImageType::New();
+  mask->SetRegions(region);
+  mask->SetSpacing(spacing);
+  mask->Allocate();
+
+  // a few overlapping balls, plus salt and pepper noise to create thin structures and holes
+  std::mt19937                           rng(42);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::vector<std::array<double, 4>>     balls;
+  for (unsigned b = 0; b < 6; b++)
+  {
+    std::array<double, 4> ball;
+    for (unsigned d = 0; d < 3; d++)
+    {
+      ball[d] = region.GetIndex(d) + uniform(rng) * region.GetSize(d);
+    }
+    ball[3] = 2.0 + 8.0 * uniform(rng);
+    balls.push_back(ball);
+  }
+  for (itk::ImageRegionIteratorWithIndex<ImageType> it(mask, region); !it.IsAtEnd(); ++it)
+  {
+    bool inside = false;
+    for (const auto & ball : balls)
+    {
+      double dist2 = 0.0;
+      for (unsigned d = 0; d < 3; d++)
+      {
+        dist2 += (it.GetIndex()[d] - ball[d]) * (it.GetIndex()[d] - ball[d]);
+      }
+      inside = inside || dist2 < ball[3] * ball[3];
+    }
+    if (uniform(rng) < 0.02)
+    {
+      inside = !inside;
+    }
+    it.Set(inside ? 255 : 0);
+  }
+
+  MorphologyType::Pointer morphology = MorphologyType::New();
+
+  ITK_EXERCISE_BASIC_OBJECT_METHODS(morphology, BoundedEuclideanMorphology, Object);
+
+  RealImageType::Pointer dilationDistance = SquaredSignedDistance(mask, false);
+  RealImageType::Pointer erosionDistance = SquaredSignedDistance(mask, true);
+
+  for (double radius : { 0.0, 0.05, 0.1, 0.25, 0.4, 0.75, 1.5 })
+  {
+    const auto threshold = static_cast<float>(radius * radius);
+
+    ImageType::Pointer dilated = morphology->Dilate(mask, radius);
+    ITK_TEST_EXPECT_EQUAL(dilated->GetBufferedRegion(), region);
+    ITK_TEST_EXPECT_EQUAL(CountMismatches(dilated, dilationDistance, threshold, false), 0);
+
+    ImageType::Pointer eroded = morphology->Erode(mask, radius);
+    ITK_TEST_EXPECT_EQUAL(eroded->GetBufferedRegion(), region);
+    ITK_TEST_EXPECT_EQUAL(CountMismatches(eroded, erosionDistance, threshold, true), 0);
+  }
+
+  // masks without contour are at the largest, unsigned distance, so dilation clears them and erosion fills them
+  for (unsigned char value : { 0, 255 })
+  {
+    ImageType::Pointer uniform = ImageType::New();
+    uniform->CopyInformation(mask);
+    uniform->SetRegions(region);
+    uniform->Allocate();
+    uniform->FillBuffer(value);
+    RealImageType::Pointer uniformDilationDistance = SquaredSignedDistance(uniform, false);
+    RealImageType::Pointer uniformErosionDistance = SquaredSignedDistance(uniform, true);
+    for (double radius : { 0.0, 0.25 })
+    {
+      const auto         threshold = static_cast<float>(radius * radius);
+      ImageType::Pointer dilated = morphology->Dilate(uniform, radius);
+      ITK_TEST_EXPECT_EQUAL(CountMismatches(dilated, uniformDilationDistance, threshold, false), 0);
+      ITK_TEST_EXPECT_EQUAL(dilated->GetPixel(region.GetIndex()), 0);
+      ImageType::Pointer eroded = morphology->Erode(uniform, radius);
+      ITK_TEST_EXPECT_EQUAL(CountMismatches(eroded, uniformErosionDistance, threshold, true), 0);
+      ITK_TEST_EXPECT_EQUAL(eroded->GetPixel(region.GetIndex()), 1);
+    }
+  }
+
+  // chains must give the same results as separate operations
+  const double       thickness = 0.1;
+  ImageType::Pointer closed = morphology->Close(mask, 3.0 * thickness, 4.0 * thickness);
+  ImageType::Pointer expected = morphology->Erode(morphology->Dilate(mask, 3.0 * thickness), 4.0 * thickness);
+  ITK_TEST_EXPECT_EQUAL(CountDifferences(closed, expected), 0);
+
+  ImageType::Pointer opened = morphology->Open(mask, 2.0 * thickness, 1.0 * thickness);
+  expected = morphology->Dilate(morphology->Erode(mask, 2.0 * thickness), 1.0 * thickness);
+  ITK_TEST_EXPECT_EQUAL(CountDifferences(opened, expected), 0);
+
+  MorphologyType::OperationListType chain{ { false, 0.0 }, { true, 0.0 }, { false, 1.5 * thickness } };
+  ImageType::Pointer                inPlace = morphology->Apply(mask, {});
+  ITK_TEST_EXPECT_EQUAL(CountDifferences(inPlace, mask), 0);
+  morphology->ApplyInPlace(inPlace, chain);
+  expected = morphology->Dilate(morphology->Erode(morphology->Dilate(mask, 0.0), 0.0), 1.5 * thickness);
+  ITK_TEST_EXPECT_EQUAL(CountDifferences(inPlace, expected), 0);
+  ITK_TEST_EXPECT_EQUAL(CountDifferences(morphology->Apply(mask, chain), expected), 0);
+
+  std::cout << "Test finished successfully." << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,104 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "itkImageBufferPool.h"
+
+#include "itkImageRegionConstIterator.h"
+#include "itkTestingMacros.h"
+
+int
+itkImageBufferPoolTest(int, char *[])
+{
+  constexpr unsigned int Dimension = 3;
+  using ImageType = itk::Image<short, Dimension>;
+  using FloatImageType = itk::Image<float, Dimension>;
+  using PoolType = itk::ImageBufferPool<Dimension>;
+
+  ImageType::RegionType region;
+  region.SetIndex({ { -3, 2, 5 } });
+  region.SetSize({ { 31, 17, 9 } });
+
+  ImageType::Pointer reference = ImageType::New();
+  reference->SetRegions(region);
+  ImageType::SpacingType spacing;
+  spacing[0] = 0.5;
+  spacing[1] = 0.25;
+  spacing[2] = 2.0;
+  reference->SetSpacing(spacing);
+
+  PoolType::Pointer pool = PoolType::New();
+
+  ITK_EXERCISE_BASIC_OBJECT_METHODS(pool, ImageBufferPool, Object);
+
+  ITK_TEST_SET_GET_VALUE(0, pool->GetMaximumRetainedBytes());
+  ITK_TEST_EXPECT_EQUAL(pool->GetRetainedBytes(), 0);
+
+  // a released buffer is retained, and reused by a smaller image of another pixel type
+  ImageType::Pointer image = pool->Acquire<ImageType>(reference, region, false);
+  ITK_TEST_EXPECT_EQUAL(image->GetBufferedRegion(), region);
+  ITK_TEST_EXPECT_EQUAL(image->GetSpacing(), spacing);
+  image->FillBuffer(7);
+  const void * buffer = image->GetBufferPointer();
+  image = nullptr;
+  const itk::SizeValueType retained = pool->GetRetainedBytes();
+  ITK_TEST_EXPECT_TRUE(retained >= region.GetNumberOfPixels() * sizeof(short));
+  ITK_TEST_EXPECT_TRUE(retained <= region.GetNumberOfPixels() * sizeof(short) * 5 / 4);
+
+  // a much smaller image does not take the large buffer
+  ImageType::RegionType tinyRegion = region;
+  tinyRegion.SetSize({ { 4, 4, 4 } });
+  ImageType::Pointer tiny = pool->Acquire<ImageType>(reference, tinyRegion, false);
+  ITK_TEST_EXPECT_TRUE(static_cast<const void *>(tiny->GetBufferPointer()) != buffer);
+  ITK_TEST_EXPECT_EQUAL(pool->GetRetainedBytes(), retained);
+
+  ImageType::RegionType smallRegion = region;
+  smallRegion.SetSize(2, 4);
+  FloatImageType::Pointer zeroed = pool->Acquire<FloatImageType>(reference, smallRegion, true);
+  ITK_TEST_EXPECT_EQUAL(static_cast<const void *>(zeroed->GetBufferPointer()), buffer);
+  ITK_TEST_EXPECT_EQUAL(pool->GetRetainedBytes(), 0);
+  itk::SizeValueType nonZero = 0;
+  for (itk::ImageRegionConstIterator<FloatImageType> it(zeroed, smallRegion); !it.IsAtEnd(); ++it)
+  {
+    nonZero += it.Get() != 0.0f;
+  }
+  ITK_TEST_EXPECT_EQUAL(nonZero, 0);
+
+  // a larger image needs a new buffer
+  ImageType::RegionType largeRegion = region;
+  largeRegion.SetSize(2, 40);
+  ImageType::Pointer large = pool->Acquire<ImageType>(reference, largeRegion, false);
+  ITK_TEST_EXPECT_TRUE(static_cast<const void *>(large->GetBufferPointer()) != buffer);
+
+  // buffers beyond the limit are freed
+  pool->SetMaximumRetainedBytes(retained);
+  zeroed = nullptr;
+  ITK_TEST_EXPECT_EQUAL(pool->GetRetainedBytes(), retained);
+  large = nullptr;
+  ITK_TEST_EXPECT_EQUAL(pool->GetRetainedBytes(), retained);
+  tiny = nullptr;
+  ITK_TEST_EXPECT_EQUAL(pool->GetRetainedBytes(), retained);
+
+  // images keep the pool alive
+  image = pool->Acquire<ImageType>(reference, region, true);
+  pool = nullptr;
+  image->FillBuffer(3);
+  image = nullptr;
+
+  std::cout << "Test finished successfully." << std::endl;
+  return EXIT_SUCCESS;
+}
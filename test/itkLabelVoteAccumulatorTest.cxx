@@ -0,0 +1,148 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "itkLabelVoteAccumulator.h"
+
+#include "itkImage.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkTestingMacros.h"
+
+#include <thread>
+#include <vector>
+
+int
+itkLabelVoteAccumulatorTest(int, char *[])
+{
+  constexpr unsigned int Dimension = 3;
+  using LabelImageType = itk::Image<unsigned char, Dimension>;
+  using AccumulatorType = itk::LabelVoteAccumulator<LabelImageType>;
+  using RegionType = LabelImageType::RegionType;
+
+  RegionType outputRegion;
+  outputRegion.SetIndex({ { -2, 1, 0 } });
+  outputRegion.SetSize({ { 30, 20, 10 } });
+
+  // voters cover overlapping parts of the output, and one of them reaches past it
+  constexpr unsigned numberOfVoters = 5;
+  std::vector<LabelImageType::Pointer> voters;
+  for (unsigned v = 0; v < numberOfVoters; ++v)
+  {
+    RegionType region;
+    region.SetIndex({ { -4 + 3 * static_cast<int>(v), 2 + static_cast<int>(v), 1 } });
+    region.SetSize({ { 20, 12 + (v == 4 ? 10u : 0u), 7 } });
+    LabelImageType::Pointer voter = LabelImageType::New();
+    voter->SetRegions(region);
+    voter->Allocate();
+    for (itk::ImageRegionIteratorWithIndex<LabelImageType> it(voter, region); !it.IsAtEnd(); ++it)
+    {
+      const LabelImageType::IndexType & ind = it.GetIndex();
+      it.Set((ind[0] + 4 + ind[1] + ind[2] * v) % 4);
+    }
+    voters.push_back(voter);
+  }
+
+  AccumulatorType::Pointer accumulator = AccumulatorType::New();
+
+  ITK_EXERCISE_BASIC_OBJECT_METHODS(accumulator, LabelVoteAccumulator, Object);
+
+  RegionType votingRegion = outputRegion;
+  votingRegion.ShrinkByRadius(1);
+  ITK_TEST_EXPECT_EQUAL(AccumulatorType::ComputeMaximumLabel(voters[0], voters[0]->GetBufferedRegion()), 3);
+  accumulator->Initialize(votingRegion, 3);
+  ITK_TEST_EXPECT_EQUAL(accumulator->GetMaximumLabel(), 3);
+
+  // concurrent voters are added one at a time
+  std::vector<std::thread> threads;
+  for (unsigned v = 0; v < numberOfVoters; ++v)
+  {
+    threads.emplace_back([&accumulator, &voters, v]() { accumulator->AddVotes(voters[v]); });
+  }
+  for (std::thread & thread : threads)
+  {
+    thread.join();
+  }
+  ITK_TEST_EXPECT_EQUAL(accumulator->GetNumberOfVoters(), numberOfVoters);
+
+  LabelImageType::Pointer output = LabelImageType::New();
+  output->SetRegions(outputRegion);
+  output->Allocate();
+  output->FillBuffer(255);
+  accumulator->Fuse(output);
+
+  itk::SizeValueType labeled = 0;
+  for (itk::ImageRegionIteratorWithIndex<LabelImageType> it(output, outputRegion); !it.IsAtEnd(); ++it)
+  {
+    unsigned votes[4] = { 0, 0, 0, 0 };
+    for (const LabelImageType::Pointer & voter : voters)
+    {
+      const bool inside = voter->GetBufferedRegion().IsInside(it.GetIndex());
+      ++votes[inside ? voter->GetPixel(it.GetIndex()) : 0];
+    }
+    unsigned char expected = 0;
+    for (unsigned char l = 1; l < 4; ++l)
+    {
+      if (votes[l] > votes[expected])
+      {
+        expected = l;
+      }
+    }
+    if (!votingRegion.IsInside(it.GetIndex()))
+    {
+      expected = 0;
+    }
+    ITK_TEST_EXPECT_EQUAL(static_cast<int>(it.Get()), static_cast<int>(expected));
+    labeled += expected != 0;
+  }
+  ITK_TEST_EXPECT_TRUE(labeled > 0);
+
+  // labels above the maximum are refused
+  accumulator->Initialize(votingRegion, 2);
+  ITK_TRY_EXPECT_EXCEPTION(accumulator->AddVotes(voters[0]));
+
+  // real pixel types hold integral labels, fractional ones are refused
+  using RealLabelImageType = itk::Image<float, Dimension>;
+  using RealAccumulatorType = itk::LabelVoteAccumulator<RealLabelImageType>;
+  RealLabelImageType::Pointer realVoter = RealLabelImageType::New();
+  realVoter->SetRegions(votingRegion);
+  realVoter->Allocate();
+  realVoter->FillBuffer(2.0f);
+  RealAccumulatorType::Pointer realAccumulator = RealAccumulatorType::New();
+  realAccumulator->Initialize(votingRegion, 2.0f);
+  ITK_TRY_EXPECT_NO_EXCEPTION(realAccumulator->AddVotes(realVoter));
+  RealLabelImageType::Pointer realOutput = RealLabelImageType::New();
+  realOutput->SetRegions(votingRegion);
+  realOutput->Allocate();
+  realAccumulator->Fuse(realOutput);
+  ITK_TEST_EXPECT_EQUAL(realOutput->GetPixel(votingRegion.GetIndex()), 2.0f);
+  realVoter->FillBuffer(1.5f);
+  ITK_TRY_EXPECT_EXCEPTION(realAccumulator->AddVotes(realVoter));
+  realVoter->FillBuffer(-1.0f);
+  ITK_TRY_EXPECT_EXCEPTION(realAccumulator->AddVotes(realVoter));
+
+  // without voters, everything is background
+  accumulator->Initialize(votingRegion, 3);
+  output->FillBuffer(255);
+  accumulator->Fuse(output);
+  for (itk::ImageRegionIteratorWithIndex<LabelImageType> it(output, outputRegion); !it.IsAtEnd(); ++it)
+  {
+    ITK_TEST_EXPECT_EQUAL(it.Get(), 0);
+  }
+
+  std::cout << "Test finished successfully." << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -21,6 +21,8 @@
 #include "itkCommand.h"
 #include "itkImageFileReader.h"
 #include "itkImageFileWriter.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
 #include "itkTestingMacros.h"
 #include "itkTransformFileWriter.h"
 
@@ -181,6 +183,67 @@ itkLandmarkAtlasSegmentationFilterTest(int argc, char * argv[])
   ITK_TRY_EXPECT_NO_EXCEPTION(WriteTransform(filter->GetLandmarksTransform(), outputBase + "LandmarksTransform.h5"));
   ITK_TRY_EXPECT_NO_EXCEPTION(itk::WriteImage(filter->GetOutput(), outputBase + "LandmarksTransformed.nrrd", true));
 
+  // identical atlases vote unanimously, so their fusion is the single atlas result
+  FilterType::Pointer multiFilter = FilterType::New();
+  multiFilter->SetInput(inputImage);
+  multiFilter->SetInput(1, atlasImage);
+  multiFilter->SetInputLabels(inputBones);
+  multiFilter->SetAtlasLabels(atlasLabels);
+  multiFilter->SetInputLandmarks(inputLandmarks);
+  multiFilter->SetAtlasLandmarks(atlasLandmarks);
+  multiFilter->AddAtlas(atlasLabels, atlasLandmarks);
+  multiFilter->AddAtlas(atlasLabels, atlasLandmarks);
+  ITK_TEST_EXPECT_EQUAL(multiFilter->GetNumberOfAtlases(), 3);
+  multiFilter->SetNumberOfConcurrentAtlases(3);
+  ITK_TEST_SET_GET_VALUE(3, multiFilter->GetNumberOfConcurrentAtlases());
+  ITK_TRY_EXPECT_NO_EXCEPTION(multiFilter->Update());
+
+  itk::ImageRegionConstIterator<LabelImageType> sIt(filter->GetOutput(), filter->GetOutput()->GetBufferedRegion());
+  itk::ImageRegionConstIterator<LabelImageType> mIt(multiFilter->GetOutput(), filter->GetOutput()->GetBufferedRegion());
+  for (; !sIt.IsAtEnd(); ++sIt, ++mIt)
+  {
+    ITK_TEST_EXPECT_EQUAL(static_cast<int>(mIt.Get()), static_cast<int>(sIt.Get()));
+  }
+
+  // with the input bones, the output is cropped to them and masked by them
+  FilterType::Pointer roiFilter = FilterType::New();
+  roiFilter->SetInput(inputImage);
+  roiFilter->SetInput(1, atlasImage);
+  roiFilter->SetInputLabels(inputBones);
+  roiFilter->SetAtlasLabels(atlasLabels);
+  roiFilter->SetInputLandmarks(inputLandmarks);
+  roiFilter->SetAtlasLandmarks(atlasLandmarks);
+  ITK_TEST_SET_GET_VALUE(0, roiFilter->GetBoneLabel());
+  ITK_TEST_SET_GET_BOOLEAN(roiFilter, CropToInputLabels, true);
+  ITK_TEST_SET_GET_BOOLEAN(roiFilter, MaskByInputLabels, true);
+  ITK_TEST_SET_GET_BOOLEAN(roiFilter, DeformableRefinement, false);
+  roiFilter->SetRegionOfInterestPadding(0.2);
+  ITK_TEST_SET_GET_VALUE(0.2, roiFilter->GetRegionOfInterestPadding());
+  ITK_TRY_EXPECT_NO_EXCEPTION(roiFilter->Update());
+  ITK_TRY_EXPECT_NO_EXCEPTION(
+    itk::WriteImage(roiFilter->GetOutput(), outputBase + "LandmarksTransformedROI.nrrd", true));
+
+  // without deformable refinement, the atlas is resampled with its landmarks transform
+  ITK_TEST_EXPECT_EQUAL(roiFilter->GetAtlasTransform(0),
+                        static_cast<const FilterType::TransformType *>(roiFilter->GetLandmarksTransform(0)));
+
+  const LabelImageType::RegionType roi = roiFilter->GetRegionOfInterest();
+  ITK_TEST_EXPECT_TRUE(roi.GetNumberOfPixels() <= inputImage->GetLargestPossibleRegion().GetNumberOfPixels());
+  ITK_TEST_EXPECT_EQUAL(roiFilter->GetOutput()->GetLargestPossibleRegion().GetSize(), roi.GetSize());
+  const LabelImageType::PointType roiOrigin = inputImage->TransformIndexToPhysicalPoint(roi.GetIndex());
+  ITK_TEST_EXPECT_TRUE(roiFilter->GetOutput()->GetOrigin().EuclideanDistanceTo(roiOrigin) < 1e-9);
+  const LabelImageType::OffsetType toInput =
+    roi.GetIndex() - roiFilter->GetOutput()->GetLargestPossibleRegion().GetIndex();
+  for (itk::ImageRegionConstIteratorWithIndex<LabelImageType> rIt(roiFilter->GetOutput(),
+                                                                 roiFilter->GetOutput()->GetBufferedRegion());
+       !rIt.IsAtEnd();
+       ++rIt)
+  {
+    const LabelImageType::IndexType inputIndex = rIt.GetIndex() + toInput;
+    const int expected = inputBones->GetPixel(inputIndex) ? filter->GetOutput()->GetPixel(inputIndex) : 0;
+    ITK_TEST_EXPECT_EQUAL(static_cast<int>(rIt.Get()), expected);
+  }
+
   std::cout << "Test finished successfully." << std::endl;
   return EXIT_SUCCESS;
 }
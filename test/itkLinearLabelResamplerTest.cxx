@@ -0,0 +1,128 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "itkLinearLabelResampler.h"
+
+#include "itkAffineTransform.h"
+#include "itkImage.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkNearestNeighborInterpolateImageFunction.h"
+#include "itkResampleImageFilter.h"
+#include "itkTestingMacros.h"
+
+int
+itkLinearLabelResamplerTest(int, char *[])
+{
+  constexpr unsigned int Dimension = 3;
+  using LabelImageType = itk::Image<unsigned char, Dimension>;
+  using ResamplerType = itk::LinearLabelResampler<LabelImageType>;
+  using TransformType = itk::AffineTransform<double, Dimension>;
+
+  // atlas labels in a block of a larger image
+  LabelImageType::RegionType atlasRegion;
+  atlasRegion.SetIndex({ { -4, 3, 0 } });
+  atlasRegion.SetSize({ { 48, 40, 36 } });
+  LabelImageType::Pointer atlas = LabelImageType::New();
+  atlas->SetRegions(atlasRegion);
+  atlas->SetSpacing(itk::MakeVector(0.5, 0.5, 0.6));
+  atlas->SetOrigin(itk::MakePoint(-3.1, 2.2, 1.3));
+  atlas->Allocate();
+
+  LabelImageType::RegionType labelsRegion;
+  labelsRegion.SetIndex({ { 10, 12, 8 } });
+  labelsRegion.SetSize({ { 21, 17, 13 } });
+  for (itk::ImageRegionIteratorWithIndex<LabelImageType> it(atlas, atlasRegion); !it.IsAtEnd(); ++it)
+  {
+    const LabelImageType::IndexType & ind = it.GetIndex();
+    it.Set(labelsRegion.IsInside(ind) ? 1 + (ind[0] + 2 * ind[1] + 3 * ind[2]) % 7 : 0);
+  }
+
+  ResamplerType::Pointer resampler = ResamplerType::New();
+
+  ITK_EXERCISE_BASIC_OBJECT_METHODS(resampler, LinearLabelResampler, Object);
+
+  const LabelImageType::RegionType footprint = ResamplerType::ComputeFootprint(atlas);
+  ITK_TEST_EXPECT_EQUAL(footprint, labelsRegion);
+
+  // the output grid differs from the atlas grid
+  LabelImageType::RegionType outputRegion;
+  outputRegion.SetIndex({ { 2, -5, 1 } });
+  outputRegion.SetSize({ { 50, 45, 40 } });
+  LabelImageType::Pointer reference = LabelImageType::New();
+  reference->SetRegions(outputRegion);
+  reference->SetSpacing(itk::MakeVector(0.45, 0.55, 0.5));
+  reference->SetOrigin(itk::MakePoint(-4.7, 3.9, 0.8));
+  reference->Allocate();
+
+  TransformType::Pointer transform = TransformType::New();
+  TransformType::OutputVectorType axis;
+  axis[0] = 0.3;
+  axis[1] = -0.5;
+  axis[2] = 0.8;
+  transform->Rotate3D(axis, 0.37);
+  transform->Scale(1.07);
+  TransformType::OutputVectorType translation;
+  translation[0] = 1.3;
+  translation[1] = 0.7;
+  translation[2] = 2.9;
+  transform->Translate(translation);
+
+  using ResampleFilterType = itk::ResampleImageFilter<LabelImageType, LabelImageType, double>;
+  ResampleFilterType::Pointer resampleFilter = ResampleFilterType::New();
+  resampleFilter->SetInput(atlas);
+  resampleFilter->SetReferenceImage(reference);
+  resampleFilter->SetUseReferenceImage(true);
+  resampleFilter->SetDefaultPixelValue(0);
+  resampleFilter->SetTransform(transform);
+  resampleFilter->SetInterpolator(itk::NearestNeighborInterpolateImageFunction<LabelImageType, double>::New());
+  ITK_TRY_EXPECT_NO_EXCEPTION(resampleFilter->Update());
+
+  // only part of the output is visited
+  const LabelImageType::RegionType mapped = ResamplerType::MapFootprint(atlas, footprint, transform, reference);
+  ITK_TEST_EXPECT_TRUE(mapped.GetNumberOfPixels() > 0);
+  ITK_TEST_EXPECT_TRUE(mapped.GetNumberOfPixels() < outputRegion.GetNumberOfPixels() / 2);
+
+  LabelImageType::Pointer output = reference;
+  output->FillBuffer(255);
+  resampler->Resample(atlas, transform, output);
+  itk::SizeValueType labeled = 0;
+  itk::SizeValueType mismatches = 0;
+  itk::ImageRegionConstIterator<LabelImageType> eIt(resampleFilter->GetOutput(), outputRegion);
+  itk::ImageRegionConstIterator<LabelImageType> oIt(output, outputRegion);
+  for (; !eIt.IsAtEnd(); ++eIt, ++oIt)
+  {
+    labeled += eIt.Get() != 0;
+    mismatches += eIt.Get() != oIt.Get();
+  }
+  std::cout << labeled << " labeled voxels, " << mismatches << " mismatches" << std::endl;
+  ITK_TEST_EXPECT_TRUE(labeled > 0);
+  ITK_TEST_EXPECT_EQUAL(mismatches, 0);
+
+  // no labels, no footprint, and a zero output
+  atlas->FillBuffer(0);
+  ITK_TEST_EXPECT_EQUAL(ResamplerType::ComputeFootprint(atlas).GetNumberOfPixels(), 0);
+  resampler->Resample(atlas, transform, output);
+  for (oIt.GoToBegin(); !oIt.IsAtEnd(); ++oIt)
+  {
+    ITK_TEST_EXPECT_EQUAL(oIt.Get(), 0);
+  }
+
+  std::cout << "Test finished successfully." << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "itkPackedBinaryImage.h"
+
+#include "itkImage.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkTestingMacros.h"
+
+int
+itkPackedBinaryImageTest(int, char *[])
+{
+  constexpr unsigned int Dimension = 3;
+  using ImageType = itk::Image<unsigned char, Dimension>;
+  using MaskType = itk::PackedBinaryImage<Dimension>;
+  using WordType = MaskType::WordType;
+
+  // rows span several words and end in a partial word
+  ImageType::RegionType region;
+  region.SetIndex({ { -3, 2, 5 } });
+  region.SetSize({ { 130, 4, 3 } });
+
+  ImageType::Pointer image = ImageType::New();
+  image->SetRegions(region);
+  image->Allocate();
+  for (itk::ImageRegionIteratorWithIndex<ImageType> it(image, region); !it.IsAtEnd(); ++it)
+  {
+    const ImageType::IndexType & ind = it.GetIndex();
+    it.Set((ind[0] * 7 + ind[1] * 3 + ind[2]) % 5 == 0 ? 255 : 0);
+  }
+
+  MaskType::Pointer mask = MaskType::New();
+
+  ITK_EXERCISE_BASIC_OBJECT_METHODS(mask, PackedBinaryImage, ImageBase);
+
+  mask->SetRegions(region);
+  mask->Allocate();
+  ITK_TEST_EXPECT_EQUAL(mask->GetWordsPerRow(), 3);
+  ITK_TEST_EXPECT_EQUAL(mask->GetNumberOfRows(), 12);
+  mask->Pack(image.GetPointer());
+
+  for (itk::ImageRegionIteratorWithIndex<ImageType> it(image, region); !it.IsAtEnd(); ++it)
+  {
+    ITK_TEST_EXPECT_EQUAL(mask->GetPixel(it.GetIndex()), it.Get() != 0);
+  }
+
+  // iterator over a sub-region which starts and ends within words
+  ImageType::RegionType subRegion;
+  subRegion.SetIndex({ { 60, 3, 5 } });
+  subRegion.SetSize({ { 63, 2, 2 } });
+  itk::PackedBinaryImageRegionConstIterator<MaskType> mIt(mask, subRegion);
+  itk::ImageRegionIteratorWithIndex<ImageType>        iIt(image, subRegion);
+  for (; !iIt.IsAtEnd(); ++iIt, ++mIt)
+  {
+    ITK_TEST_EXPECT_TRUE(!mIt.IsAtEnd());
+    ITK_TEST_EXPECT_EQUAL(mIt.GetIndex(), iIt.GetIndex());
+    ITK_TEST_EXPECT_EQUAL(mIt.Get(), iIt.Get() != 0);
+  }
+  ITK_TEST_EXPECT_TRUE(mIt.IsAtEnd());
+
+  // word-wise negation must not set bits past the end of rows
+  mask->TransformWords([](WordType & word) { word = ~word; });
+  for (itk::PackedBinaryImageRegionIterator<MaskType> it(mask, subRegion); !it.IsAtEnd(); ++it)
+  {
+    it.Set(!it.Get());
+  }
+  for (itk::ImageRegionIteratorWithIndex<ImageType> it(image, region); !it.IsAtEnd(); ++it)
+  {
+    bool expected = (it.Get() == 0) != subRegion.IsInside(it.GetIndex());
+    ITK_TEST_EXPECT_EQUAL(mask->GetPixel(it.GetIndex()), expected);
+  }
+  const WordType tailMask = (WordType{ 1 } << (130 % 64)) - 1;
+  for (itk::SizeValueType row = 0; row < mask->GetNumberOfRows(); ++row)
+  {
+    ITK_TEST_EXPECT_EQUAL(mask->GetRow(row)[2] & ~tailMask, WordType{ 0 });
+  }
+
+  mask->Unpack(image.GetPointer(), 1);
+  for (itk::ImageRegionIteratorWithIndex<ImageType> it(image, region); !it.IsAtEnd(); ++it)
+  {
+    ITK_TEST_EXPECT_EQUAL(it.Get(), mask->GetPixel(it.GetIndex()) ? 1 : 0);
+  }
+
+  // 64 pixels from any bit of a row, zero past its end
+  for (itk::SizeValueType bit = 0; bit < 130; bit += 13)
+  {
+    const WordType word = mask->GetBits(5, bit);
+    for (itk::SizeValueType i = 0; i < 64; ++i)
+    {
+      const bool inRow = bit + i < 130;
+      const bool expected = inRow && ((mask->GetRow(5)[(bit + i) / 64] >> ((bit + i) % 64)) & 1u);
+      ITK_TEST_EXPECT_EQUAL(((word >> i) & 1u) != 0, expected);
+    }
+  }
+
+  mask->FillBuffer(true);
+  itk::SizeValueType count = 0;
+  for (itk::PackedBinaryImageRegionConstIterator<MaskType> it(mask, region); !it.IsAtEnd(); ++it)
+  {
+    count += it.Get();
+  }
+  ITK_TEST_EXPECT_EQUAL(count, region.GetNumberOfPixels());
+  ITK_TEST_EXPECT_EQUAL(mask->GetRow(0)[2], tailMask);
+
+  std::cout << "Test finished successfully." << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,116 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "itkParallelConnectedComponentImageFilter.h"
+
+#include "itkConnectedComponentImageFilter.h"
+#include "itkImage.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkRelabelComponentImageFilter.h"
+#include "itkTestingMacros.h"
+
+#include <random>
+
+int
+itkParallelConnectedComponentImageFilterTest(int, char *[])
+{
+  constexpr unsigned int Dimension = 3;
+  using MaskImageType = itk::Image<unsigned char, Dimension>;
+  using LabelImageType = itk::Image<unsigned short, Dimension>;
+  using ManyLabelImageType = itk::Image<itk::SizeValueType, Dimension>;
+  using LabelerType = itk::ParallelConnectedComponentImageFilter<MaskImageType, LabelImageType>;
+
+  MaskImageType::RegionType region;
+  region.SetIndex({ { -3, 5, 2 } });
+  region.SetSize({ { 43, 31, 19 } });
+
+  MaskImageType::Pointer mask = MaskImageType::New();
+  mask->SetRegions(region);
+  mask->Allocate();
+
+  // near the percolation threshold, there are components of all sizes and shapes
+  std::mt19937                           rng(7);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  for (itk::ImageRegionIteratorWithIndex<MaskImageType> it(mask, region); !it.IsAtEnd(); ++it)
+  {
+    const double density = it.GetIndex()[2] < 10 ? 0.3 : 0.15;
+    it.Set(uniform(rng) < density ? 1 + (it.GetIndex()[0] & 3) : 0); // any non-zero value is foreground
+  }
+
+  LabelerType::Pointer labeler = LabelerType::New();
+
+  ITK_EXERCISE_BASIC_OBJECT_METHODS(labeler, ParallelConnectedComponentImageFilter, ImageToImageFilter);
+
+  ITK_TEST_SET_GET_BOOLEAN(labeler, FullyConnected, false);
+  ITK_TEST_SET_GET_VALUE(0, labeler->GetMinimumObjectSize());
+
+  labeler->SetInput(mask);
+  for (bool fullyConnected : { false, true })
+  {
+    for (itk::SizeValueType minimumSize : { 0, 3, 20 })
+    {
+      labeler->SetFullyConnected(fullyConnected);
+      labeler->SetMinimumObjectSize(minimumSize);
+      ITK_TRY_EXPECT_NO_EXCEPTION(labeler->Update());
+
+      // the same as ConnectedComponentImageFilter followed by RelabelComponentImageFilter
+      using ReferenceLabelerType = itk::ConnectedComponentImageFilter<MaskImageType, ManyLabelImageType>;
+      ReferenceLabelerType::Pointer reference = ReferenceLabelerType::New();
+      reference->SetInput(mask);
+      reference->SetFullyConnected(fullyConnected);
+      using RelabelType = itk::RelabelComponentImageFilter<ManyLabelImageType, LabelImageType>;
+      RelabelType::Pointer relabeler = RelabelType::New();
+      relabeler->SetInput(reference->GetOutput());
+      relabeler->SetMinimumObjectSize(minimumSize);
+      ITK_TRY_EXPECT_NO_EXCEPTION(relabeler->Update());
+
+      std::cout << "FullyConnected " << fullyConnected << " MinimumObjectSize " << minimumSize << ": "
+                << labeler->GetObjectCount() << " components" << std::endl;
+      ITK_TEST_EXPECT_EQUAL(labeler->GetObjectCount(), relabeler->GetNumberOfObjects());
+      ITK_TEST_EXPECT_EQUAL(labeler->GetOutput()->GetBufferedRegion(), region);
+      for (itk::SizeValueType i = 0; i < labeler->GetObjectCount(); ++i)
+      {
+        ITK_TEST_EXPECT_EQUAL(labeler->GetSizeOfObjectsInPixels()[i], relabeler->GetSizeOfObjectsInPixels()[i]);
+      }
+
+      itk::SizeValueType                            differences = 0;
+      itk::ImageRegionConstIterator<LabelImageType> lIt(labeler->GetOutput(), region);
+      itk::ImageRegionConstIterator<LabelImageType> rIt(relabeler->GetOutput(), region);
+      for (; !lIt.IsAtEnd(); ++lIt, ++rIt)
+      {
+        differences += lIt.Get() != rIt.Get();
+      }
+      ITK_TEST_EXPECT_EQUAL(differences, 0);
+    }
+  }
+
+  // too many components for 8-bit labels
+  using SmallLabelerType = itk::ParallelConnectedComponentImageFilter<MaskImageType, MaskImageType>;
+  SmallLabelerType::Pointer smallLabeler = SmallLabelerType::New();
+  smallLabeler->SetInput(mask);
+  ITK_TRY_EXPECT_EXCEPTION(smallLabeler->Update());
+
+  // but enough room when small components are discarded
+  smallLabeler->SetMinimumObjectSize(20);
+  ITK_TRY_EXPECT_NO_EXCEPTION(smallLabeler->Update());
+  ITK_TEST_EXPECT_TRUE(smallLabeler->GetObjectCount() <= 255);
+
+  std::cout << "Test finished successfully." << std::endl;
+  return EXIT_SUCCESS;
+}
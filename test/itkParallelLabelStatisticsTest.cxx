@@ -0,0 +1,123 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "itkParallelLabelStatistics.h"
+
+#include "itkImage.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkTestingMacros.h"
+
+#include <algorithm>
+#include <cmath>
+
+int
+itkParallelLabelStatisticsTest(int, char *[])
+{
+  constexpr unsigned int Dimension = 3;
+  using ImageType = itk::Image<unsigned char, Dimension>;
+  using StatisticsType = itk::ParallelLabelStatistics<ImageType>;
+  using IndexType = ImageType::IndexType;
+
+  ImageType::RegionType region;
+  region.SetIndex({ { -4, 2, 1 } });
+  region.SetSize({ { 40, 25, 17 } });
+
+  ImageType::Pointer image = ImageType::New();
+  image->SetRegions(region);
+  image->Allocate();
+
+  // stripes of labels 1 to 5, with background and an out-of-range label mixed in
+  constexpr itk::IdentifierType numberOfLabels = 5;
+  for (itk::ImageRegionIteratorWithIndex<ImageType> it(image, region); !it.IsAtEnd(); ++it)
+  {
+    const IndexType & ind = it.GetIndex();
+    unsigned          label = ((ind[0] + 8) / 3 + ind[1] * 2 + ind[2]) % 8; // 6 and 7 are ignored
+    if (ind[2] > 10 && label == 5)
+    {
+      label = 0; // label 5 only occupies the lower slices
+    }
+    it.Set(label);
+  }
+
+  StatisticsType::Pointer statistics = StatisticsType::New();
+
+  ITK_EXERCISE_BASIC_OBJECT_METHODS(statistics, ParallelLabelStatistics, Object);
+
+  statistics->Compute(image, region, numberOfLabels);
+  ITK_TEST_EXPECT_EQUAL(statistics->GetNumberOfLabels(), numberOfLabels);
+
+  for (itk::IdentifierType label = 1; label <= numberOfLabels; ++label)
+  {
+    constexpr itk::IndexValueType maxValue = itk::NumericTraits<itk::IndexValueType>::max();
+    constexpr itk::IndexValueType minValue = itk::NumericTraits<itk::IndexValueType>::NonpositiveMin();
+    itk::SizeValueType            count = 0;
+    IndexType                     minIndex = IndexType::Filled(maxValue);
+    IndexType                     maxIndex = IndexType::Filled(minValue);
+    StatisticsType::CentroidType  centroid;
+    centroid.Fill(0.0);
+    std::vector<IndexType> voxels;
+    for (itk::ImageRegionIteratorWithIndex<ImageType> it(image, region); !it.IsAtEnd(); ++it)
+    {
+      if (it.Get() != label)
+      {
+        continue;
+      }
+      ++count;
+      voxels.push_back(it.GetIndex());
+      for (unsigned d = 0; d < Dimension; d++)
+      {
+        minIndex[d] = std::min(minIndex[d], it.GetIndex()[d]);
+        maxIndex[d] = std::max(maxIndex[d], it.GetIndex()[d]);
+        centroid[d] += it.GetIndex()[d];
+      }
+    }
+
+    ITK_TEST_EXPECT_EQUAL(statistics->GetCount(label), count);
+    ITK_TEST_EXPECT_EQUAL(statistics->GetBoundingBox(label).GetIndex(), minIndex);
+    ITK_TEST_EXPECT_EQUAL(statistics->GetBoundingBox(label).GetUpperIndex(), maxIndex);
+    for (unsigned d = 0; d < Dimension; d++)
+    {
+      ITK_TEST_EXPECT_TRUE(std::abs(statistics->GetCentroid(label)[d] - centroid[d] / count) < 1e-9);
+    }
+
+    // the runs enumerate the label's voxels in image order
+    std::vector<IndexType> runVoxels;
+    for (const StatisticsType::RunType & run : statistics->GetRuns(label))
+    {
+      IndexType ind = run.index;
+      for (itk::SizeValueType i = 0; i < run.length; ++i, ++ind[0])
+      {
+        runVoxels.push_back(ind);
+      }
+    }
+    ITK_TEST_EXPECT_TRUE(runVoxels == voxels);
+  }
+
+  // a sub-region, in which label 5 does not occur
+  ImageType::RegionType upper = region;
+  upper.SetIndex(2, 11);
+  upper.SetSize(2, 6);
+  statistics->Compute(image, upper, numberOfLabels);
+  ITK_TEST_EXPECT_EQUAL(statistics->GetCount(5), 0);
+  ITK_TEST_EXPECT_EQUAL(statistics->GetBoundingBox(5).GetNumberOfPixels(), 0);
+  ITK_TEST_EXPECT_TRUE(statistics->GetRuns(5).empty());
+  ITK_TEST_EXPECT_TRUE(upper.IsInside(statistics->GetBoundingBox(1)));
+
+  std::cout << "Test finished successfully." << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "itkParallelNeighborhoodConnected.h"
+
+#include "itkImage.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkNeighborhoodConnectedImageFilter.h"
+#include "itkTestingMacros.h"
+
+#include <array>
+#include <random>
+
+int
+itkParallelNeighborhoodConnectedTest(int, char *[])
+{
+  constexpr unsigned int Dimension = 3;
+  using ImageType = itk::Image<short, Dimension>;
+  using LabelImageType = itk::Image<unsigned char, Dimension>;
+  using GrowingType = itk::ParallelNeighborhoodConnected<ImageType, LabelImageType>;
+  using MaskImageType = GrowingType::MaskImageType;
+  using RegionType = ImageType::RegionType;
+
+  RegionType wholeImage;
+  wholeImage.SetIndex({ { -2, 3, 1 } });
+  wholeImage.SetSize({ { 45, 37, 29 } });
+
+  ImageType::Pointer image = ImageType::New();
+  image->SetRegions(wholeImage);
+  image->Allocate();
+
+  // bright balls with dim speckles, so some voxels fail only because of their neighbors
+  std::mt19937                           rng(3);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::vector<std::array<double, 4>>     balls;
+  for (unsigned b = 0; b < 8; b++)
+  {
+    std::array<double, 4> ball;
+    for (unsigned d = 0; d < Dimension; d++)
+    {
+      ball[d] = wholeImage.GetIndex(d) + uniform(rng) * wholeImage.GetSize(d);
+    }
+    ball[3] = 3.0 + 7.0 * uniform(rng);
+    balls.push_back(ball);
+  }
+  for (itk::ImageRegionIteratorWithIndex<ImageType> it(image, wholeImage); !it.IsAtEnd(); ++it)
+  {
+    bool inside = false;
+    for (const auto & ball : balls)
+    {
+      double dist2 = 0.0;
+      for (unsigned d = 0; d < Dimension; d++)
+      {
+        dist2 += (it.GetIndex()[d] - ball[d]) * (it.GetIndex()[d] - ball[d]);
+      }
+      inside = inside || dist2 < ball[3] * ball[3];
+    }
+    it.Set(inside && uniform(rng) > 0.01 ? 2000 + 100 * uniform(rng) : 1000 * uniform(rng));
+  }
+
+  // the output region shares the image's lower boundary, the growing region also its upper boundary along x
+  RegionType outputRegion = wholeImage;
+  outputRegion.SetSize({ { 40, 30, 25 } });
+  RegionType region;
+  region.SetIndex({ { 3, 3, 4 } });
+  region.SetUpperIndex(outputRegion.GetUpperIndex());
+  region.SetSize(2, region.GetSize(2) - 2);
+
+  MaskImageType::Pointer mask = MaskImageType::New();
+  mask->CopyInformation(image);
+  mask->SetRegions(outputRegion);
+  mask->Allocate(true);
+  for (itk::ImageRegionConstIteratorWithIndex<ImageType> it(image, outputRegion); !it.IsAtEnd(); ++it)
+  {
+    mask->SetPixel(it.GetIndex(), it.GetIndex()[0] + it.GetIndex()[1] < 45);
+  }
+
+  // short runs of seeds, some of them in failing voxels
+  GrowingType::SeedContainerType seeds;
+  for (unsigned s = 0; s < 300; s++)
+  {
+    ImageType::IndexType index;
+    for (unsigned d = 0; d < Dimension; d++)
+    {
+      index[d] = region.GetIndex(d) + static_cast<itk::IndexValueType>(uniform(rng) * region.GetSize(d));
+    }
+    const itk::SizeValueType length = 1 + static_cast<itk::SizeValueType>(uniform(rng) * 4);
+    seeds.push_back({ index, std::min<itk::SizeValueType>(length, region.GetUpperIndex()[0] - index[0] + 1) });
+  }
+
+  GrowingType::Pointer growing = GrowingType::New();
+
+  ITK_EXERCISE_BASIC_OBJECT_METHODS(growing, ParallelNeighborhoodConnected, Object);
+
+  growing->SetLower(1500);
+  ITK_TEST_SET_GET_VALUE(1500, growing->GetLower());
+
+  const MaskImageType * restrictions[] = { mask, nullptr };
+  for (const MaskImageType * restriction : restrictions)
+  {
+    for (itk::SizeValueType radiusX : { 1, 2 })
+    {
+      GrowingType::SizeType radius;
+      radius.Fill(1);
+      radius[0] = radiusX;
+      growing->SetRadius(radius);
+      LabelImageType::Pointer grown = growing->Grow(image, restriction, region, seeds, outputRegion);
+      ITK_TEST_EXPECT_EQUAL(grown->GetBufferedRegion(), outputRegion);
+
+      // NeighborhoodConnectedImageFilter on a masked copy of the input
+      ImageType::Pointer partialInput = ImageType::New();
+      partialInput->CopyInformation(image);
+      partialInput->SetRegions(outputRegion);
+      partialInput->Allocate();
+      partialInput->FillBuffer(-4096);
+      for (itk::ImageRegionConstIteratorWithIndex<ImageType> it(image, region); !it.IsAtEnd(); ++it)
+      {
+        if (!restriction || restriction->GetPixel(it.GetIndex()))
+        {
+          partialInput->SetPixel(it.GetIndex(), it.Get());
+        }
+      }
+      using ConnectedFilterType = itk::NeighborhoodConnectedImageFilter<ImageType, LabelImageType>;
+      ConnectedFilterType::Pointer neighborhoodConnected = ConnectedFilterType::New();
+      neighborhoodConnected->SetInput(partialInput);
+      neighborhoodConnected->SetLower(1500);
+      neighborhoodConnected->SetRadius(radius);
+      for (const auto & seed : seeds)
+      {
+        ImageType::IndexType index = seed.index;
+        for (itk::SizeValueType i = 0; i < seed.length; ++i, ++index[0])
+        {
+          neighborhoodConnected->AddSeed(index);
+        }
+      }
+      ITK_TRY_EXPECT_NO_EXCEPTION(neighborhoodConnected->Update());
+
+      itk::SizeValueType                                     count = 0;
+      itk::SizeValueType                                     differences = 0;
+      itk::ImageRegionConstIteratorWithIndex<LabelImageType> gIt(grown, outputRegion);
+      for (; !gIt.IsAtEnd(); ++gIt)
+      {
+        count += gIt.Get() != 0;
+        differences += gIt.Get() != neighborhoodConnected->GetOutput()->GetPixel(gIt.GetIndex());
+      }
+      std::cout << "Mask " << (restriction != nullptr) << " radius " << radius << ": " << count << " voxels"
+                << std::endl;
+      ITK_TEST_EXPECT_TRUE(count > 0);
+      ITK_TEST_EXPECT_EQUAL(differences, 0);
+    }
+  }
+
+  // growing into a zeroed image with a margin marks the same voxels, and leaves the margin alone
+  RegionType paddedRegion = outputRegion;
+  paddedRegion.PadByRadius(2);
+  LabelImageType::Pointer padded = LabelImageType::New();
+  padded->CopyInformation(image);
+  padded->SetRegions(paddedRegion);
+  padded->Allocate(true);
+  growing->Grow(image, mask, region, seeds, outputRegion, padded);
+  LabelImageType::Pointer grown = growing->Grow(image, mask, region, seeds, outputRegion);
+  itk::SizeValueType      differences = 0;
+  for (itk::ImageRegionConstIteratorWithIndex<LabelImageType> it(padded, paddedRegion); !it.IsAtEnd(); ++it)
+  {
+    const bool inside = outputRegion.IsInside(it.GetIndex());
+    differences += it.Get() != (inside ? grown->GetPixel(it.GetIndex()) : 0);
+  }
+  ITK_TEST_EXPECT_EQUAL(differences, 0);
+
+  // no seeds, nothing grown
+  LabelImageType::Pointer empty = growing->Grow(image, mask, region, {}, outputRegion);
+  for (itk::ImageRegionConstIteratorWithIndex<LabelImageType> it(empty, outputRegion); !it.IsAtEnd(); ++it)
+  {
+    ITK_TEST_EXPECT_EQUAL(it.Get(), 0);
+  }
+
+  std::cout << "Test finished successfully." << std::endl;
+  return EXIT_SUCCESS;
+}
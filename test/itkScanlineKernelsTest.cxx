@@ -0,0 +1,271 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "itkScanlineKernels.h"
+
+#include "itkImage.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
+#include "itkTestingMacros.h"
+#include "itkTimeProbe.h"
+
+#include <algorithm>
+#include <random>
+
+namespace
+{
+constexpr unsigned int Dimension = 3;
+using RegionType = itk::ImageRegion<Dimension>;
+
+template <typename TPixel>
+typename itk::Image<TPixel, Dimension>::Pointer
+RandomImage(const RegionType & bufferedRegion, std::mt19937 & rng, double lower, double upper)
+{
+  using ImageType = itk::Image<TPixel, Dimension>;
+  typename ImageType::Pointer image = ImageType::New();
+  image->SetRegions(bufferedRegion);
+  image->Allocate();
+  std::uniform_real_distribution<double> uniform(lower, upper);
+  for (itk::ImageRegionIterator<ImageType> it(image, bufferedRegion); !it.IsAtEnd(); ++it)
+  {
+    it.Set(static_cast<TPixel>(std::is_integral<TPixel>::value ? std::floor(uniform(rng)) : uniform(rng)));
+  }
+  return image;
+}
+
+// runs the iterator loop and the scanline kernel on copies of output, prints their times,
+// and returns whether the copies are identical, also outside of region
+template <typename TImage, typename TIteratorLoop, typename TScanlineLoop>
+bool
+CompareAndTime(const char *       name,
+               const TImage *     output,
+               const RegionType & region,
+               TIteratorLoop      iteratorLoop,
+               TScanlineLoop      scanlineLoop)
+{
+  const RegionType             bufferedRegion = output->GetBufferedRegion();
+  const itk::SizeValueType     numberOfPixels = bufferedRegion.GetNumberOfPixels();
+  typename TImage::Pointer     expected = TImage::New();
+  typename TImage::Pointer     actual = TImage::New();
+  const typename TImage::Pointer copies[] = { expected, actual };
+  for (const auto & copy : copies)
+  {
+    copy->SetRegions(bufferedRegion);
+    copy->Allocate();
+    std::copy(output->GetBufferPointer(), output->GetBufferPointer() + numberOfPixels, copy->GetBufferPointer());
+  }
+
+  itk::TimeProbe iteratorProbe;
+  itk::TimeProbe scanlineProbe;
+  for (unsigned repetition = 0; repetition < 5; ++repetition)
+  {
+    iteratorProbe.Start();
+    iteratorLoop(expected.GetPointer());
+    iteratorProbe.Stop();
+    scanlineProbe.Start();
+    scanlineLoop(actual.GetPointer());
+    scanlineProbe.Stop();
+  }
+  std::cout << name << ": " << iteratorProbe.GetMean() << " " << iteratorProbe.GetUnit() << " with iterators, "
+            << scanlineProbe.GetMean() << " " << scanlineProbe.GetUnit() << " with scanlines, speedup "
+            << iteratorProbe.GetMean() / std::max(scanlineProbe.GetMean(), 1e-9) << std::endl;
+
+  return std::equal(
+    expected->GetBufferPointer(), expected->GetBufferPointer() + numberOfPixels, actual->GetBufferPointer());
+}
+
+template <typename TPixel>
+bool
+TestThreshold(const char * name, const itk::Image<short, Dimension> * input, const RegionType & region)
+{
+  using ImageType = itk::Image<TPixel, Dimension>;
+  using InputImageType = itk::Image<short, Dimension>;
+  std::mt19937                rng(1);
+  typename ImageType::Pointer output = RandomImage<TPixel>(input->GetBufferedRegion(), rng, 0, 3);
+  const short                 lower = 5000;
+  return CompareAndTime(
+    name,
+    output.GetPointer(),
+    region,
+    [&](ImageType * o) {
+      itk::ImageRegionConstIterator<InputImageType> iIt(input, region);
+      itk::ImageRegionIterator<ImageType>           oIt(o, region);
+      for (; !oIt.IsAtEnd(); ++iIt, ++oIt)
+      {
+        oIt.Set(iIt.Get() >= lower);
+      }
+    },
+    [&](ImageType * o) {
+      itk::ForEachScanline(
+        region,
+        [lower](const itk::Index<Dimension> &, itk::SizeValueType length, const short * i, TPixel * out) {
+          itk::ScanlineKernels::Threshold(i, out, length, lower);
+        },
+        input,
+        o);
+    });
+}
+
+template <typename TPixel>
+bool
+TestExtractLabel(const char * name, const RegionType & bufferedRegion, const RegionType & region)
+{
+  using ImageType = itk::Image<TPixel, Dimension>;
+  std::mt19937                rng(2);
+  typename ImageType::Pointer labels = RandomImage<TPixel>(bufferedRegion, rng, 0, 5);
+  typename ImageType::Pointer output = RandomImage<TPixel>(bufferedRegion, rng, 0, 2);
+  const TPixel                label = 3;
+  return CompareAndTime(
+    name,
+    output.GetPointer(),
+    region,
+    [&](ImageType * o) {
+      itk::ImageRegionConstIterator<ImageType> lIt(labels, region);
+      itk::ImageRegionIterator<ImageType>      oIt(o, region);
+      for (; !oIt.IsAtEnd(); ++lIt, ++oIt)
+      {
+        if (lIt.Get() == label)
+        {
+          oIt.Set(label);
+        }
+      }
+    },
+    [&](ImageType * o) {
+      itk::ForEachScanline(
+        region,
+        [label](const itk::Index<Dimension> &, itk::SizeValueType length, const TPixel * l, TPixel * out) {
+          itk::ScanlineKernels::ExtractLabel(l, out, length, label);
+        },
+        labels.GetPointer(),
+        o);
+    });
+}
+
+template <typename TPixel>
+bool
+TestOr(const char * name, const RegionType & bufferedRegion, const RegionType & region)
+{
+  using ImageType = itk::Image<TPixel, Dimension>;
+  std::mt19937                rng(3);
+  typename ImageType::Pointer input = RandomImage<TPixel>(bufferedRegion, rng, 0, 2);
+  typename ImageType::Pointer output = RandomImage<TPixel>(bufferedRegion, rng, 0, 3);
+  return CompareAndTime(
+    name,
+    output.GetPointer(),
+    region,
+    [&](ImageType * o) {
+      itk::ImageRegionConstIterator<ImageType> iIt(input, region);
+      itk::ImageRegionIterator<ImageType>      oIt(o, region);
+      for (; !oIt.IsAtEnd(); ++iIt, ++oIt)
+      {
+        oIt.Set(iIt.Get() || oIt.Get());
+      }
+    },
+    [&](ImageType * o) {
+      itk::ForEachScanline(
+        region,
+        [](const itk::Index<Dimension> &, itk::SizeValueType length, const TPixel * i, TPixel * out) {
+          itk::ScanlineKernels::Or(i, out, length);
+        },
+        input.GetPointer(),
+        o);
+    });
+}
+
+template <typename TRealPixel, typename TPixel>
+bool
+TestMarkClose(const char * name, const RegionType & bufferedRegion, const RegionType & region)
+{
+  using RealImageType = itk::Image<TRealPixel, Dimension>;
+  using ImageType = itk::Image<TPixel, Dimension>;
+  std::mt19937                    rng(4);
+  typename RealImageType::Pointer a = RandomImage<TRealPixel>(bufferedRegion, rng, -5.0, 5.0);
+  typename RealImageType::Pointer b = RandomImage<TRealPixel>(bufferedRegion, rng, -5.0, 5.0);
+  typename ImageType::Pointer     output = RandomImage<TPixel>(bufferedRegion, rng, 0, 3);
+  const TRealPixel                epsilon = 2.0;
+  return CompareAndTime(
+    name,
+    output.GetPointer(),
+    region,
+    [&](ImageType * o) {
+      itk::ImageRegionConstIterator<RealImageType> aIt(a, region);
+      itk::ImageRegionConstIterator<RealImageType> bIt(b, region);
+      itk::ImageRegionIterator<ImageType>          oIt(o, region);
+      for (; !oIt.IsAtEnd(); ++aIt, ++bIt, ++oIt)
+      {
+        if (std::abs(aIt.Get() - bIt.Get()) < epsilon)
+        {
+          oIt.Set(1);
+        }
+      }
+    },
+    [&](ImageType * o) {
+      itk::ForEachScanline(
+        region,
+        [epsilon](const itk::Index<Dimension> &,
+                  itk::SizeValueType length,
+                  const TRealPixel * aRow,
+                  const TRealPixel * bRow,
+                  TPixel *           out) { itk::ScanlineKernels::MarkClose(aRow, bRow, out, length, epsilon); },
+        a.GetPointer(),
+        b.GetPointer(),
+        o);
+    });
+}
+} // namespace
+
+int
+itkScanlineKernelsTest(int, char *[])
+{
+  // rows whose lengths are not multiples of the vector width, in images which buffer more than them
+  RegionType bufferedRegion;
+  bufferedRegion.SetIndex({ { -7, 2, 3 } });
+  bufferedRegion.SetSize({ { 269, 131, 67 } });
+  RegionType region;
+  region.SetIndex({ { -4, 3, 5 } });
+  region.SetSize({ { 251, 127, 61 } });
+
+  std::mt19937                                   rng(0);
+  itk::Image<short, Dimension>::Pointer input = RandomImage<short>(bufferedRegion, rng, -2000, 10000);
+
+  unsigned failures = 0;
+  failures += !TestThreshold<unsigned char>("Threshold short to unsigned char", input, region);
+  failures += !TestThreshold<short>("Threshold short to short", input, region);
+  failures += !TestThreshold<float>("Threshold short to float", input, region);
+  failures += !TestExtractLabel<unsigned char>("ExtractLabel unsigned char", bufferedRegion, region);
+  failures += !TestExtractLabel<short>("ExtractLabel short", bufferedRegion, region);
+  failures += !TestExtractLabel<unsigned int>("ExtractLabel unsigned int", bufferedRegion, region);
+  failures += !TestOr<unsigned char>("Or unsigned char", bufferedRegion, region);
+  failures += !TestOr<unsigned short>("Or unsigned short", bufferedRegion, region);
+  failures += !TestOr<int>("Or int", bufferedRegion, region);
+  failures += !TestMarkClose<float, unsigned char>("MarkClose float to unsigned char", bufferedRegion, region);
+  failures += !TestMarkClose<float, short>("MarkClose float to short", bufferedRegion, region);
+  failures += !TestMarkClose<double, unsigned char>("MarkClose double to unsigned char", bufferedRegion, region);
+  ITK_TEST_EXPECT_EQUAL(failures, 0);
+
+  // an empty region visits no rows
+  RegionType empty = region;
+  empty.SetSize(1, 0);
+  unsigned rows = 0;
+  itk::ForEachScanline(
+    empty, [&rows](const itk::Index<Dimension> &, itk::SizeValueType, const short *) { ++rows; }, input.GetPointer());
+  ITK_TEST_EXPECT_EQUAL(rows, 0);
+
+  std::cout << "Test finished successfully." << std::endl;
+  return EXIT_SUCCESS;
+}
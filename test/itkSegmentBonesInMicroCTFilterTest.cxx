@@ -19,6 +19,7 @@
 #include "itkSegmentBonesInMicroCTFilter.h"
 
 #include "itkCommand.h"
+#include "itkImageRegionConstIterator.h"
 #include "itkImageFileReader.h"
 #include "itkImageFileWriter.h"
 #include "itkTestingMacros.h"
@@ -51,6 +52,38 @@ public:
     std::cout << " " << processObject->GetProgress();
   }
 };
+
+// Dice coefficient of two label maps, counting voxels where both have the same non-zero label
+template <typename TImage>
+double
+LabelDice(const TImage * a, const TImage * b)
+{
+  itk::SizeValueType                    same = 0;
+  itk::SizeValueType                    total = 0;
+  itk::ImageRegionConstIterator<TImage> aIt(a, a->GetLargestPossibleRegion());
+  itk::ImageRegionConstIterator<TImage> bIt(b, a->GetLargestPossibleRegion());
+  for (; !aIt.IsAtEnd(); ++aIt, ++bIt)
+  {
+    same += aIt.Get() != 0 && aIt.Get() == bIt.Get();
+    total += (aIt.Get() != 0) + (bIt.Get() != 0);
+  }
+  return total > 0 ? 2.0 * same / total : 1.0;
+}
+
+// number of voxels where a whole bone label differs from the bone of a split label
+template <typename TImage>
+itk::SizeValueType
+CountInconsistentLabels(const TImage * wholeBones, const TImage * splitBones)
+{
+  itk::SizeValueType                    count = 0;
+  itk::ImageRegionConstIterator<TImage> wIt(wholeBones, wholeBones->GetLargestPossibleRegion());
+  itk::ImageRegionConstIterator<TImage> sIt(splitBones, wholeBones->GetLargestPossibleRegion());
+  for (; !wIt.IsAtEnd(); ++wIt, ++sIt)
+  {
+    count += wIt.Get() != (sIt.Get() + 2) / 3;
+  }
+  return count;
+}
 } // namespace
 
 int
@@ -60,7 +93,8 @@ itkSegmentBonesInMicroCTFilterTest(int argc, char * argv[])
   {
     std::cerr << "Missing parameters." << std::endl;
     std::cerr << "Usage: " << itkNameOfTestExecutableMacro(argv);
-    std::cerr << " <inputImage> <outputImage> [corticalThickness] [wholeBones]";
+    std::cerr << " <inputImage> <outputImage> [corticalThickness] [wholeBones] [concurrentBones] [slabThickness]";
+    std::cerr << " [maskedSheetness] [shrinkFactor] [baselineImage minimumDice] [otherLabelMap] [sweptThickness]";
     std::cerr << std::endl;
     return EXIT_FAILURE;
   }
@@ -79,6 +113,30 @@ itkSegmentBonesInMicroCTFilterTest(int argc, char * argv[])
     wholeBones = std::stoi(argv[4]);
   }
 
+  unsigned concurrentBones = 1;
+  if (argc > 5)
+  {
+    concurrentBones = std::stoul(argv[5]);
+  }
+
+  itk::SizeValueType slabThickness = 0;
+  if (argc > 6)
+  {
+    slabThickness = std::stoul(argv[6]);
+  }
+
+  bool maskedSheetness = false;
+  if (argc > 7)
+  {
+    maskedSheetness = std::stoi(argv[7]);
+  }
+
+  unsigned shrinkFactor = 1;
+  if (argc > 8)
+  {
+    shrinkFactor = std::stoul(argv[8]);
+  }
+
   constexpr unsigned int Dimension = 3;
   using PixelType = short;
   using ImageType = itk::Image<PixelType, Dimension>;
@@ -98,11 +156,75 @@ itkSegmentBonesInMicroCTFilterTest(int argc, char * argv[])
   filter->SetInput(image);
   filter->SetCorticalBoneThickness(corticalThickness);
   filter->SetWholeBones(wholeBones);
+  filter->SetNumberOfConcurrentBones(concurrentBones);
+  filter->SetSlabThickness(slabThickness);
+  filter->SetMaskedSheetness(maskedSheetness);
+  filter->SetShrinkFactor(shrinkFactor);
+  filter->SetBothLabelMaps(argc > 11);
+  ITK_TEST_SET_GET_BOOLEAN(filter, ProfileStages, true);
   ITK_TRY_EXPECT_NO_EXCEPTION(filter->Update());
+  ITK_TEST_EXPECT_TRUE(!filter->GetTimeBudgetExceeded());
+
+  const itk::StageProfile * profile = filter->GetStageProfile();
+  ITK_TEST_EXPECT_TRUE(profile != nullptr);
+  ITK_TEST_EXPECT_TRUE(!profile->GetRecords().empty());
+  std::cout << "Stage profile: ";
+  profile->WriteJSON(std::cout);
 
   std::cout << "Writing label map: " << outputImageFileName << std::endl;
   ITK_TRY_EXPECT_NO_EXCEPTION(itk::WriteImage(filter->GetOutput(), outputImageFileName, true));
 
+  if (argc > 10) // approximate modes are compared with the full resolution baseline
+  {
+    ImageType::Pointer baseline;
+    ITK_TRY_EXPECT_NO_EXCEPTION(baseline = itk::ReadImage<ImageType>(argv[9]));
+    const double dice = LabelDice<ImageType>(baseline, filter->GetOutput());
+    const double minimumDice = std::stod(argv[10]);
+    std::cout << "Dice coefficient with baseline: " << dice << std::endl;
+    if (dice < minimumDice)
+    {
+      std::cerr << "Dice coefficient " << dice << " is below " << minimumDice << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (argc > 11) // both label maps from the same run must agree
+  {
+    std::cout << "Writing the other label map: " << argv[11] << std::endl;
+    ITK_TRY_EXPECT_NO_EXCEPTION(itk::WriteImage(filter->GetOutput(1), argv[11], true));
+    const itk::SizeValueType inconsistent =
+      CountInconsistentLabels<ImageType>(filter->GetWholeBonesOutput(), filter->GetSplitBonesOutput());
+    ITK_TEST_EXPECT_EQUAL(inconsistent, 0);
+  }
+
+  if (argc > 12) // the label map of a sweep's smallest thickness, which starts its scale-space, must be reproduced
+  {
+    const std::vector<float> thicknesses{ std::stof(argv[12]), corticalThickness };
+    FilterType::Pointer      sweepFilter = FilterType::New();
+    sweepFilter->SetInput(image);
+    sweepFilter->SetCorticalBoneThickness(corticalThickness);
+    sweepFilter->SetWholeBones(wholeBones);
+    sweepFilter->SetNumberOfConcurrentBones(concurrentBones);
+    sweepFilter->SetSlabThickness(slabThickness);
+    sweepFilter->SetMaskedSheetness(maskedSheetness);
+    sweepFilter->SetShrinkFactor(shrinkFactor);
+    std::vector<ImageType::Pointer> sweep;
+    ITK_TRY_EXPECT_NO_EXCEPTION(sweep = sweepFilter->SweepCorticalBoneThickness(thicknesses));
+    ITK_TEST_EXPECT_EQUAL(sweep.size(), thicknesses.size());
+    ITK_TEST_EXPECT_TRUE(sweep.front() != nullptr);
+    ITK_TEST_EXPECT_EQUAL(sweepFilter->GetCorticalBoneThickness(), corticalThickness);
+    const double dice = LabelDice<ImageType>(filter->GetOutput(), sweep.back());
+    std::cout << "Dice coefficient of the sweep with the single run: " << dice << std::endl;
+    ITK_TEST_EXPECT_EQUAL(dice, 1.0);
+
+    // larger thicknesses continue the smoothing of the smaller ones, so they closely match their own run
+    sweepFilter->SetCorticalBoneThickness(thicknesses.front());
+    ITK_TRY_EXPECT_NO_EXCEPTION(sweepFilter->Update());
+    const double sweptDice = LabelDice<ImageType>(sweepFilter->GetOutput(), sweep.front());
+    std::cout << "Dice coefficient of the swept thickness with its single run: " << sweptDice << std::endl;
+    ITK_TEST_EXPECT_TRUE(sweptDice >= 0.99);
+  }
+
   std::cout << "Test finished successfully." << std::endl;
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,163 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "itkSegmentBonesInMicroCTFilter.h"
+
+#include "itkImageRegionConstIterator.h"
+#include "itkImageFileReader.h"
+#include "itkTestingMacros.h"
+#include "itksys/SystemTools.hxx"
+
+#include <algorithm>
+#include <set>
+
+namespace
+{
+template <typename TImage>
+itk::SizeValueType
+CountLabeled(const TImage * image)
+{
+  itk::SizeValueType labeled = 0;
+  for (itk::ImageRegionConstIterator<TImage> it(image, image->GetLargestPossibleRegion()); !it.IsAtEnd(); ++it)
+  {
+    labeled += it.Get() != 0;
+  }
+  return labeled;
+}
+
+// number of voxels where a partial label map differs from the complete one, ignoring the labels it lacks,
+// which can also cover parts of the labels it has
+template <typename TImage>
+itk::SizeValueType
+CountPartialDifferences(const TImage * partial, const TImage * complete)
+{
+  std::set<typename TImage::PixelType>  present;
+  itk::ImageRegionConstIterator<TImage> pIt(partial, partial->GetLargestPossibleRegion());
+  for (; !pIt.IsAtEnd(); ++pIt)
+  {
+    present.insert(pIt.Get());
+  }
+
+  itk::SizeValueType                    count = 0;
+  itk::ImageRegionConstIterator<TImage> cIt(complete, partial->GetLargestPossibleRegion());
+  for (pIt.GoToBegin(); !pIt.IsAtEnd(); ++pIt, ++cIt)
+  {
+    count += pIt.Get() != cIt.Get() && (cIt.Get() == 0 || present.count(cIt.Get()) > 0);
+  }
+  return count;
+}
+} // namespace
+
+int
+itkSegmentBonesInMicroCTFilterTimeBudgetTest(int argc, char * argv[])
+{
+  if (argc < 4)
+  {
+    std::cerr << "Missing parameters." << std::endl;
+    std::cerr << "Usage: " << itkNameOfTestExecutableMacro(argv);
+    std::cerr << " <inputImage> <baselineImage> <cacheDirectory>" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  constexpr unsigned int Dimension = 3;
+  using PixelType = short;
+  using ImageType = itk::Image<PixelType, Dimension>;
+  using FilterType = itk::SegmentBonesInMicroCTFilter<ImageType, ImageType>;
+
+  ImageType::Pointer image;
+  ITK_TRY_EXPECT_NO_EXCEPTION(image = itk::ReadImage<ImageType>(argv[1]));
+  ImageType::Pointer baseline;
+  ITK_TRY_EXPECT_NO_EXCEPTION(baseline = itk::ReadImage<ImageType>(argv[2]));
+  itksys::SystemTools::RemoveADirectory(argv[3]); // entries of earlier runs would be loaded instead of computed
+
+  // a time budget which runs out at once ends the update cleanly, before any bone is finished
+  FilterType::Pointer budgetFilter = FilterType::New();
+  budgetFilter->SetInput(image);
+  ITK_TEST_EXPECT_TRUE(!budgetFilter->GetTimeBudgetExceeded());
+  budgetFilter->SetTimeBudget(1e-6);
+  ITK_TEST_SET_GET_VALUE(1e-6, budgetFilter->GetTimeBudget());
+  ITK_TRY_EXPECT_NO_EXCEPTION(budgetFilter->Update());
+  ITK_TEST_EXPECT_TRUE(budgetFilter->GetTimeBudgetExceeded());
+  ITK_TEST_EXPECT_EQUAL(CountLabeled<ImageType>(budgetFilter->GetOutput()), 0);
+
+  // aborting from a progress observer throws ProcessAborted
+  FilterType::Pointer abortFilter = FilterType::New();
+  abortFilter->SetInput(image);
+  itk::ProcessObject * abortable = abortFilter;
+  abortFilter->AddObserver(itk::ProgressEvent(), [abortable](const itk::EventObject &) {
+    if (abortable->GetProgress() > 0.0f)
+    {
+      abortable->AbortGenerateDataOn();
+    }
+  });
+  ITK_TRY_EXPECT_EXCEPTION(abortFilter->Update());
+
+  // the budget runs out once the stage profile has the first composited bone, so the bones of its batch are kept;
+  // it is lifted again when the update ends, so that only running out of it makes the output out of date
+  FilterType::Pointer partialFilter = FilterType::New();
+  partialFilter->SetInput(image);
+  partialFilter->SetNumberOfConcurrentBones(2);
+  partialFilter->SetCacheDirectory(argv[3]);
+  partialFilter->ProfileStagesOn();
+  FilterType * stoppable = partialFilter;
+  bool         stopped = false;
+  partialFilter->AddObserver(itk::ProgressEvent(), [stoppable, &stopped](const itk::EventObject &) {
+    if (stoppable->GetProgress() >= 1.0f)
+    {
+      stoppable->SetTimeBudget(0.0);
+      return;
+    }
+    const itk::StageProfile * profile = stoppable->GetStageProfile();
+    if (stopped || !profile)
+    {
+      return; // the profile is started with GenerateData
+    }
+    const std::vector<itk::StageProfile::Record> records = profile->GetRecords();
+    const bool                                   composited = std::any_of(
+      records.begin(), records.end(), [](const itk::StageProfile::Record & r) { return r.name == "composite"; });
+    if (composited)
+    {
+      stopped = true;
+      stoppable->SetTimeBudget(1e-9);
+    }
+  });
+  ITK_TRY_EXPECT_NO_EXCEPTION(partialFilter->Update());
+  ITK_TEST_EXPECT_TRUE(stopped);
+  ITK_TEST_EXPECT_TRUE(partialFilter->GetTimeBudgetExceeded());
+  const itk::SizeValueType partialLabeled = CountLabeled<ImageType>(partialFilter->GetOutput());
+  const itk::SizeValueType baselineLabeled = CountLabeled<ImageType>(baseline);
+  std::cout << partialLabeled << " of " << baselineLabeled << " voxels labeled before running out of time" << std::endl;
+  ITK_TEST_EXPECT_TRUE(partialLabeled > 0);
+  ITK_TEST_EXPECT_TRUE(partialLabeled < baselineLabeled);
+  ITK_TEST_EXPECT_EQUAL(CountPartialDifferences<ImageType>(partialFilter->GetOutput(), baseline), 0);
+
+  // without any change, the next update resumes from the cache and finishes the other bones
+  ITK_TRY_EXPECT_NO_EXCEPTION(partialFilter->Update());
+  ITK_TEST_EXPECT_TRUE(!partialFilter->GetTimeBudgetExceeded());
+  itk::SizeValueType                       differences = 0;
+  itk::ImageRegionConstIterator<ImageType> bIt(baseline, baseline->GetLargestPossibleRegion());
+  itk::ImageRegionConstIterator<ImageType> oIt(partialFilter->GetOutput(), baseline->GetLargestPossibleRegion());
+  for (; !bIt.IsAtEnd(); ++bIt, ++oIt)
+  {
+    differences += bIt.Get() != oIt.Get();
+  }
+  ITK_TEST_EXPECT_EQUAL(differences, 0);
+
+  std::cout << "Test finished successfully." << std::endl;
+  return EXIT_SUCCESS;
+}
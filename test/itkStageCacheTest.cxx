@@ -0,0 +1,158 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "itkStageCache.h"
+
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkTestingMacros.h"
+
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <random>
+
+int
+itkStageCacheTest(int argc, char * argv[])
+{
+  if (argc < 2)
+  {
+    std::cerr << "Missing parameters." << std::endl;
+    std::cerr << "Usage: " << itkNameOfTestExecutableMacro(argv) << " <cacheDirectory>" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  constexpr unsigned int Dimension = 3;
+  using ImageType = itk::Image<short, Dimension>;
+  using CacheType = itk::StageCache<Dimension>;
+  using MaskImageType = CacheType::MaskImageType;
+
+  ImageType::RegionType region;
+  region.SetIndex({ { -3, 2, 5 } });
+  region.SetSize({ { 71, 13, 9 } }); // rows which do not fill whole words
+
+  ImageType::Pointer image = ImageType::New();
+  image->SetRegions(region);
+  ImageType::SpacingType spacing;
+  spacing[0] = 0.5;
+  spacing[1] = 0.25;
+  spacing[2] = 2.0;
+  image->SetSpacing(spacing);
+  image->Allocate();
+  std::mt19937                       rng(5);
+  std::uniform_int_distribution<int> values(-1000, 5000);
+  for (itk::ImageRegionIteratorWithIndex<ImageType> it(image, region); !it.IsAtEnd(); ++it)
+  {
+    it.Set(values(rng));
+  }
+
+  MaskImageType::Pointer mask = MaskImageType::New();
+  mask->CopyInformation(image);
+  mask->SetRegions(region);
+  mask->Allocate(true);
+  for (itk::ImageRegionConstIteratorWithIndex<ImageType> it(image, region); !it.IsAtEnd(); ++it)
+  {
+    mask->SetPixel(it.GetIndex(), it.Get() > 2000);
+  }
+
+  CacheType::Pointer cache = CacheType::New();
+
+  ITK_EXERCISE_BASIC_OBJECT_METHODS(cache, StageCache, Object);
+
+  cache->SetDirectory(argv[1]);
+  ITK_TEST_SET_GET_VALUE(std::string(argv[1]), std::string(cache->GetDirectory()));
+
+  cache->HashImage(image.GetPointer());
+  cache->Hash(0.1f);
+  const std::string key = cache->GetKey();
+  std::cout << "Key: " << key << std::endl;
+
+  // the same data gives the same key
+  CacheType::Pointer sameCache = CacheType::New();
+  sameCache->SetDirectory(argv[1]);
+  sameCache->HashImage(image.GetPointer());
+  sameCache->Hash(0.1f);
+  ITK_TEST_EXPECT_EQUAL(sameCache->GetKey(), key);
+
+  // a different voxel or parameter gives a different key
+  CacheType::Pointer otherCache = CacheType::New();
+  otherCache->SetDirectory(argv[1]);
+  image->SetPixel(region.GetUpperIndex(), image->GetPixel(region.GetUpperIndex()) + 1);
+  otherCache->HashImage(image.GetPointer());
+  otherCache->Hash(0.1f);
+  ITK_TEST_EXPECT_TRUE(otherCache->GetKey() != key);
+  image->SetPixel(region.GetUpperIndex(), image->GetPixel(region.GetUpperIndex()) - 1);
+  otherCache = CacheType::New();
+  otherCache->SetDirectory(argv[1]);
+  otherCache->HashImage(image.GetPointer());
+  otherCache->Hash(0.2f);
+  ITK_TEST_EXPECT_TRUE(otherCache->GetKey() != key);
+
+  // round trips
+  ITK_TEST_EXPECT_TRUE(!cache->Contains({ "image", "mask" }));
+  ITK_TEST_EXPECT_TRUE(cache->Load<ImageType>("image").IsNull());
+  cache->Store("image", image.GetPointer());
+  ITK_TEST_EXPECT_TRUE(cache->Contains({ "image" }));
+  ITK_TEST_EXPECT_TRUE(!cache->Contains({ "image", "mask" }));
+  cache->Store("mask", mask.GetPointer());
+  ITK_TEST_EXPECT_TRUE(sameCache->Contains({ "image", "mask" }));
+  ITK_TEST_EXPECT_TRUE(!otherCache->Contains({ "image" }));
+
+  ImageType::Pointer loadedImage = sameCache->Load<ImageType>("image");
+  ITK_TEST_EXPECT_TRUE(loadedImage.IsNotNull());
+  ITK_TEST_EXPECT_EQUAL(loadedImage->GetBufferedRegion(), region);
+  ITK_TEST_EXPECT_EQUAL(loadedImage->GetSpacing(), spacing);
+  MaskImageType::Pointer loadedMask = sameCache->Load<MaskImageType>("mask");
+  ITK_TEST_EXPECT_TRUE(loadedMask.IsNotNull());
+  ITK_TEST_EXPECT_EQUAL(loadedMask->GetBufferedRegion(), region);
+  itk::SizeValueType differences = 0;
+  for (itk::ImageRegionConstIteratorWithIndex<ImageType> it(image, region); !it.IsAtEnd(); ++it)
+  {
+    differences += it.Get() != loadedImage->GetPixel(it.GetIndex());
+    differences += mask->GetPixel(it.GetIndex()) != loadedMask->GetPixel(it.GetIndex());
+  }
+  ITK_TEST_EXPECT_EQUAL(differences, 0);
+
+  // a different pixel type does not match
+  using FloatImageType = itk::Image<float, Dimension>;
+  using IntImageType = itk::Image<std::int32_t, Dimension>;
+  using UnsignedImageType = itk::Image<unsigned short, Dimension>;
+  ITK_TEST_EXPECT_TRUE(cache->Load<FloatImageType>("image").IsNull());
+  ITK_TEST_EXPECT_TRUE(cache->Load<MaskImageType>("image").IsNull());
+  ITK_TEST_EXPECT_TRUE(cache->Load<UnsignedImageType>("image").IsNull());
+  FloatImageType::Pointer floatImage = FloatImageType::New();
+  floatImage->SetRegions(region);
+  floatImage->Allocate(true);
+  cache->Store("float", floatImage.GetPointer());
+  ITK_TEST_EXPECT_TRUE(cache->Load<FloatImageType>("float").IsNotNull());
+  ITK_TEST_EXPECT_TRUE(cache->Load<IntImageType>("float").IsNull());
+
+  // a truncated entry is missing
+  const std::string entryName = std::string(argv[1]) + "/" + key + "/image.bin";
+  {
+    std::ifstream     in(entryName, std::ios::binary);
+    const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    std::ofstream out(entryName, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size() - 1);
+  }
+  ITK_TEST_EXPECT_TRUE(cache->Load<ImageType>("image").IsNull());
+
+  std::cout << "Test finished successfully." << std::endl;
+  return EXIT_SUCCESS;
+}
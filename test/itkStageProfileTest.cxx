@@ -0,0 +1,117 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "itkStageProfile.h"
+
+#include "itkTestingMacros.h"
+
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+int
+itkStageProfileTest(int, char *[])
+{
+  itk::StageProfile::Pointer profile = itk::StageProfile::New();
+
+  ITK_EXERCISE_BASIC_OBJECT_METHODS(profile, StageProfile, Object);
+
+  ITK_TEST_SET_GET_VALUE(0.01, profile->GetSamplingInterval());
+  profile->SetSamplingInterval(0.001);
+  profile->Start();
+  {
+    itk::StageProfile::Scope outer(profile, "outer");
+    {
+      itk::StageProfile::Scope idle(profile, "idle");
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    // a stage which holds on to 64 MiB
+    {
+      itk::StageProfile::Scope allocating(profile, "allocating");
+      std::vector<char>        buffer(64 << 20);
+      std::memset(buffer.data(), 1, buffer.size());
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    // concurrent stages of several items
+    std::vector<std::thread> threads;
+    for (itk::SizeValueType item = 1; item <= 3; ++item)
+    {
+      threads.emplace_back([&profile, item]() {
+        itk::StageProfile::Scope perItem(profile, "perItem", item);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      });
+    }
+    for (std::thread & thread : threads)
+    {
+      thread.join();
+    }
+  }
+  profile->Stop();
+
+  // a null profile measures nothing
+  {
+    itk::StageProfile::Scope unmeasured(nullptr, "unmeasured");
+  }
+
+  const std::vector<itk::StageProfile::Record> records = profile->GetRecords();
+  ITK_TEST_EXPECT_EQUAL(records.size(), 6);
+  ITK_TEST_EXPECT_EQUAL(records[0].name, "outer");
+  ITK_TEST_EXPECT_EQUAL(records[1].name, "idle");
+  ITK_TEST_EXPECT_EQUAL(records[2].name, "allocating");
+  itk::SizeValueType itemSum = 0;
+  for (const itk::StageProfile::Record & record : records)
+  {
+    ITK_TEST_EXPECT_TRUE(record.wallTime >= 0.0);
+    ITK_TEST_EXPECT_TRUE(record.peakMemory <= profile->GetPeakMemory());
+    if (record.name == "perItem")
+    {
+      itemSum += record.item;
+    }
+    else
+    {
+      ITK_TEST_EXPECT_EQUAL(record.item, 0);
+    }
+  }
+  ITK_TEST_EXPECT_EQUAL(itemSum, 6);
+  ITK_TEST_EXPECT_TRUE(records[0].wallTime >= records[1].wallTime + records[2].wallTime);
+  ITK_TEST_EXPECT_TRUE(records[1].wallTime >= 0.015);
+
+  // memory is only checked where the platform reports it
+  if (profile->GetPeakMemory() > 0)
+  {
+    const bool allocationSeen = records[2].peakMemory >= records[1].peakMemory + (32 << 20);
+    ITK_TEST_EXPECT_TRUE(allocationSeen);
+  }
+
+  std::ostringstream json;
+  profile->WriteJSON(json);
+  std::cout << json.str();
+  ITK_TEST_EXPECT_TRUE(json.str().find("\"peakMemory\"") != std::string::npos);
+  ITK_TEST_EXPECT_TRUE(json.str().find("\"name\": \"allocating\"") != std::string::npos);
+
+  // restarting clears the records
+  profile->Start();
+  profile->Stop();
+  ITK_TEST_EXPECT_TRUE(profile->GetRecords().empty());
+
+  std::cout << "Test finished successfully." << std::endl;
+  return EXIT_SUCCESS;
+}